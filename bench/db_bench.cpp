@@ -1,17 +1,57 @@
+#include "util/arena.hpp"
 #include "util/time.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
 
 #include "skrillex/skrillex.hpp"
 #include "skrillex/testing/populator.hpp"
+#include "sqlite3/sqlite3.h"
+#include "store/store.hpp"
+#include "mutator.hpp"
 
 using namespace std;
 using namespace skrillex;
 using namespace skrillex::internal;
 using namespace skrillex::testing;
 
+// Every allocation made through operator new, and their total
+// size, for benchmarks that count them.
+atomic<uint64_t> allocations(0);
+atomic<uint64_t> allocated(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    allocated += size;
+
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
 void checkStatus(Status status) {
     if (status != Status::OK()) {
         cerr << status.message() << endl;
@@ -141,6 +181,1129 @@ void benchVoteSong() {
     }
 }
 
+void benchRecoverQueue() {
+    {
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_recover.db", Options::TestOptions()));
+        shared_ptr<DB> db(raw);
+
+        checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+        vector<int> songIds;
+        for (int i = 1; i <= 10000; i++) {
+            songIds.push_back(i);
+        }
+
+        checkStatus(db->setQueue(songIds));
+    }
+
+    // Time the open() of a database with 10k queued items,
+    // which includes rebuilding the queue from disk.
+    for (int i = 0; i < 100; i++) {
+        DB* raw = 0;
+
+        auto start = now();
+        checkStatus(open(raw, "bench_recover.db", Options()));
+        auto end = now();
+
+        shared_ptr<DB> db(raw);
+        cout << (end - start).count() << endl;
+    }
+}
+
+void benchRestoreSession() {
+    Options options = Options::TestOptions();
+    int64_t session_id = 0;
+
+    {
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_restore.db", options));
+        shared_ptr<DB> db(raw);
+
+        checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+        Song song;
+        for (int i = 0; i < 50000; i++) {
+            song.id = (i * 7919) % 10000 + 1;
+            checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+        }
+
+        checkStatus(StoreMutator::getStore(raw)->getSession(session_id));
+    }
+
+    ReadOptions readOptions;
+    readOptions.result_limit = 100;
+    readOptions.inactivity_threshold = 0;
+
+    Options restore;
+    restore.session_id = session_id;
+
+    // Time from open() to the first ranking being available.
+    for (int i = 0; i < 100; i++) {
+        DB* raw = 0;
+        ResultSet<Song> songs;
+
+        auto start = now();
+        checkStatus(open(raw, "bench_restore.db", restore));
+        checkStatus(raw->getSongs(songs, readOptions));
+        auto end = now();
+
+        delete raw;
+        cout << (end - start).count() << endl;
+    }
+}
+
+void benchRooms() {
+    const int votes_per_room = 5000;
+
+    for (int rooms : { 1, 2, 4, 8, 16 }) {
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_rooms.db", Options::TestOptions()));
+        shared_ptr<DB> db(raw);
+        checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+        vector<WriteOptions> options(rooms);
+        for (int i = 1; i < rooms; i++) {
+            int64_t session_id = 0;
+            checkStatus(db->createSession(session_id));
+            options[i].session_id = session_id;
+        }
+
+        // One thread per room, each voting and reading its own session.
+        auto start = now();
+
+        vector<thread> threads;
+        for (int r = 0; r < rooms; r++) {
+            threads.emplace_back([&, r]() {
+                ReadOptions readOptions;
+                readOptions.session_id = options[r].session_id;
+                readOptions.result_limit = 10;
+                readOptions.inactivity_threshold = 0;
+
+                Song song;
+                ResultSet<Song> songs;
+                for (int i = 0; i < votes_per_room; i++) {
+                    song.id = (i * 7919) % 10000 + 1;
+                    checkStatus(db->voteSong("u" + to_string(i % 100), song, 1, options[r]));
+
+                    if (i % 100 == 0) {
+                        checkStatus(db->getSongs(songs, readOptions));
+                    }
+                }
+            });
+        }
+
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        auto end = now();
+        cout << rooms << " " << (end - start).count() / (rooms * votes_per_room) << endl;
+    }
+}
+
+void benchPartitionedSessions() {
+    for (bool partitioned : { false, true }) {
+        Options options = Options::TestOptions();
+        options.partition_sessions = partitioned;
+
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_partitioned.db", options));
+        shared_ptr<DB> db(raw);
+        checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+        // Build up some history, leaving a small current session.
+        Song song;
+        for (int session = 0; session < 10; session++) {
+            int votes = session < 9 ? 5000 : 500;
+            for (int i = 0; i < votes; i++) {
+                song.id = (i * 7919) % 10000 + 1;
+                checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+            }
+
+            if (session < 9) {
+                checkStatus(StoreMutator::getStore(raw)->createSession());
+            }
+        }
+
+        ReadOptions current;
+        current.result_limit = 100;
+
+        ReadOptions history = current;
+        history.session_id = -1;
+
+        for (auto& readOptions : { current, history }) {
+            ResultSet<Song> songs;
+
+            auto start = now();
+            for (int i = 0; i < 20; i++) {
+                checkStatus(db->getSongs(songs, readOptions));
+            }
+            auto end = now();
+
+            cout << partitioned << " " << readOptions.session_id << " " << (end - start).count() / 20 << endl;
+        }
+    }
+}
+
+void benchHistoryRollups() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_rollups.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+    Song song;
+    for (int session = 0; session < 10; session++) {
+        for (int i = 0; i < 5000; i++) {
+            song.id = (i * 7919 + session) % 10000 + 1;
+            checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+        }
+
+        checkStatus(StoreMutator::getStore(raw)->createSession());
+    }
+
+    // The same answer, aggregated from the vote tables, and
+    // then from the rollups.
+    ReadOptions aggregated;
+    aggregated.session_id = -1;
+    aggregated.result_limit = 100;
+    aggregated.inactivity_threshold = 2000000000;
+
+    ReadOptions rolled = aggregated;
+    rolled.inactivity_threshold = 0;
+
+    for (auto& readOptions : { aggregated, rolled }) {
+        ResultSet<Song> songs;
+
+        auto start = now();
+        for (int i = 0; i < 20; i++) {
+            checkStatus(db->getSongs(songs, readOptions));
+        }
+        auto end = now();
+
+        cout << readOptions.inactivity_threshold << " " << (end - start).count() / 20 << endl;
+    }
+}
+
+void benchSubscriptions() {
+    const int clients = 64;
+
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_subscriptions.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+    ReadOptions top;
+    top.result_limit = 10;
+    top.inactivity_threshold = 0;
+
+    atomic<int> notifications(0);
+    for (int i = 0; i < clients; i++) {
+        int id = 0;
+        checkStatus(db->subscribeSongs(top, [&](const RankingDelta<Song>&) {
+            notifications++;
+        }, id));
+    }
+
+    // Votes trickle in at about one per millisecond, for two seconds.
+    Song song;
+    auto start = now();
+    for (int i = 0; i < 2000; i++) {
+        song.id = (i * 7919) % 10000 + 1;
+        checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+        this_thread::sleep_for(chrono::microseconds(1000));
+    }
+    auto end = now();
+
+    // Clients polling every 100ms would have read this many times.
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+    cout << "polled " << clients * elapsed / 100 << endl;
+    cout << "notified " << notifications << endl;
+}
+
+void benchDeltaReads() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_delta.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+    ReadOptions full;
+    full.inactivity_threshold = 0;
+
+    ReadOptions delta = full;
+    delta.delta = true;
+
+    // A few votes between each read of the whole catalog.
+    string pass;
+    for (auto& readOptions : { full, delta }) {
+        pass += "p";
+
+        ResultSet<Song> songs;
+        checkStatus(db->getSongs(songs, readOptions));
+
+        Song song;
+        chrono::high_resolution_clock::duration elapsed(0);
+        for (int i = 0; i < 100; i++) {
+            for (int j = 0; j < 10; j++) {
+                song.id = ((i * 10 + j) * 7919) % 10000 + 1;
+                checkStatus(db->voteSong(pass + to_string(j), song, 1));
+            }
+
+            auto start = now();
+            checkStatus(db->getSongs(songs, readOptions));
+            elapsed += now() - start;
+        }
+
+        cout << readOptions.delta << " " << elapsed.count() / 100 << endl;
+    }
+}
+
+void benchScoredSorts() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_scores.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+    Song song;
+    for (int i = 0; i < 5000; i++) {
+        song.id = (i * 7919) % 10000 + 1;
+        checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+    }
+
+    // Scores are kept on each vote, so reads cost about the same
+    // whichever way they are sorted.
+    ReadOptions readOptions;
+    readOptions.result_limit = 100;
+    readOptions.inactivity_threshold = 0;
+
+    for (auto sort : { SortType::Counts, SortType::Decayed, SortType::Trending }) {
+        readOptions.sort = sort;
+
+        ResultSet<Song> songs;
+        auto start = now();
+        for (int i = 0; i < 20; i++) {
+            checkStatus(db->getSongs(songs, readOptions));
+        }
+        auto end = now();
+
+        cout << sort << " " << (end - start).count() / 20 << endl;
+    }
+}
+
+void benchCompositeSort() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_composite.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+    Song song;
+    Artist artist;
+    Genre genre;
+    for (int i = 0; i < 5000; i++) {
+        song.id   = (i * 7919) % 10000 + 1;
+        artist.id = (i * 31) % 1000 + 1;
+        genre.id  = i % 100 + 1;
+        checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+        checkStatus(db->voteArtist("u" + to_string(i % 500), artist, 1));
+        checkStatus(db->voteGenre("u" + to_string(i % 500), genre, 1));
+    }
+
+    ReadOptions readOptions;
+    readOptions.inactivity_threshold = 0;
+    readOptions.sort = SortType::Votes;
+
+    // Three reads, joined by the caller.
+    auto start = now();
+    for (int i = 0; i < 20; i++) {
+        ResultSet<Song>   songs;
+        ResultSet<Artist> artists;
+        ResultSet<Genre>  genres;
+        checkStatus(db->getSongs(songs, readOptions));
+        checkStatus(db->getArtists(artists, readOptions));
+        checkStatus(db->getGenres(genres, readOptions));
+
+        map<int, int> artistVotes, genreVotes;
+        for (auto& a : artists) {
+            artistVotes[a.id] = a.votes;
+        }
+        for (auto& g : genres) {
+            genreVotes[g.id] = g.votes;
+        }
+
+        vector<pair<double, int>> scores;
+        for (auto& s : songs) {
+            scores.push_back(make_pair(-(s.votes + 0.5 * artistVotes[s.artist.id] + 0.25 * genreVotes[s.genre.id]), s.id));
+        }
+        partial_sort(scores.begin(), scores.begin() + 10, scores.end());
+    }
+    auto end = now();
+
+    cout << "joined " << (end - start).count() / 20 << endl;
+
+    readOptions.sort = SortType::Composite;
+    readOptions.result_limit = 10;
+
+    start = now();
+    for (int i = 0; i < 20; i++) {
+        ResultSet<Song> songs;
+        checkStatus(db->getSongs(songs, readOptions));
+    }
+    end = now();
+
+    cout << "composite " << (end - start).count() / 20 << endl;
+}
+
+void benchAutofill() {
+    Options options = Options::TestOptions();
+
+    for (bool autofill : { false, true }) {
+        options.autofill = autofill;
+
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_autofill.db", options));
+        shared_ptr<DB> db(raw);
+        checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+        Song song;
+        for (int i = 0; i < 5000; i++) {
+            song.id = (i * 7919) % 10000 + 1;
+            checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+        }
+
+        // Without autofill, the player picks the next song itself.
+        ReadOptions readOptions;
+        readOptions.result_limit = 1;
+        readOptions.inactivity_threshold = 0;
+
+        auto start = now();
+        for (int i = 0; i < 200; i++) {
+            if (!autofill) {
+                ResultSet<Song> songs;
+                checkStatus(db->getSongs(songs, readOptions));
+                checkStatus(db->queueSong(songs.begin()->id));
+            }
+
+            checkStatus(db->bufferNext());
+            checkStatus(db->songFinished());
+        }
+        auto end = now();
+
+        cout << autofill << " " << (end - start).count() / 200 << endl;
+    }
+}
+
+void benchFilters() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_filters.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+    Song song;
+    for (int i = 0; i < 5000; i++) {
+        song.id = (i * 7919) % 10000 + 1;
+        checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+    }
+
+    // Play and buffer a few hundred songs, and lose a few more.
+    for (int i = 0; i < 500; i++) {
+        checkStatus(db->queueSong(i * 13 % 5000 + 1));
+        checkStatus(db->bufferNext());
+        if (i < 400) {
+            checkStatus(db->songFinished());
+        }
+        checkStatus(db->markUnplayable(i * 17 % 5000 + 5001));
+    }
+
+    ReadOptions readOptions;
+    readOptions.inactivity_threshold = 0;
+
+    for (bool filter : { false, true }) {
+        readOptions.filter_buffered   = filter;
+        readOptions.filter_unplayable = filter;
+        readOptions.filter_played     = filter;
+
+        auto start = now();
+        for (int i = 0; i < 20; i++) {
+            ResultSet<Song> songs;
+            checkStatus(db->getSongs(songs, readOptions));
+        }
+        auto end = now();
+
+        cout << filter << " " << (end - start).count() / 20 << endl;
+    }
+}
+
+void benchPredicates() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_predicates.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 10000, 1000, 100));
+
+    Song song;
+    for (int i = 0; i < 5000; i++) {
+        song.id = (i * 7919) % 10000 + 1;
+        checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+    }
+
+    // The top ten songs of a single genre.
+    ReadOptions readOptions;
+    readOptions.sort = SortType::Votes;
+
+    for (int threshold : { 1800000, 0 }) {
+        readOptions.inactivity_threshold = threshold;
+        readOptions.result_limit = 0;
+        readOptions.genre_ids.clear();
+
+        auto start = now();
+        for (int i = 0; i < 20; i++) {
+            ResultSet<Song> songs;
+            checkStatus(db->getSongs(songs, readOptions));
+
+            int found = 0;
+            for (auto& s : songs) {
+                if (s.genre.id == 1 && ++found == 10) {
+                    break;
+                }
+            }
+        }
+        auto end = now();
+
+        cout << threshold << " client " << (end - start).count() / 20 << endl;
+
+        readOptions.result_limit = 10;
+        readOptions.genre_ids = { 1 };
+
+        start = now();
+        for (int i = 0; i < 20; i++) {
+            ResultSet<Song> songs;
+            checkStatus(db->getSongs(songs, readOptions));
+        }
+        end = now();
+
+        cout << threshold << " predicate " << (end - start).count() / 20 << endl;
+    }
+}
+
+void benchFields() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_fields.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    checkStatus(populate_empty(raw, 100000, 1000, 100));
+
+    Song song;
+    for (int i = 0; i < 20000; i++) {
+        song.id = (i * 7919) % 100000 + 1;
+        checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+    }
+
+    // Every song's votes, as a client updating its rankings would.
+    ReadOptions readOptions;
+    readOptions.sort = SortType::Votes;
+
+    for (int threshold : { 1800000, 0 }) {
+        readOptions.inactivity_threshold = threshold;
+
+        for (int fields : { (int) FieldAll, (int) FieldCounts }) {
+            readOptions.fields = fields;
+
+            auto start = now();
+            for (int i = 0; i < 5; i++) {
+                ResultSet<Song> songs;
+                checkStatus(db->getSongs(songs, readOptions));
+            }
+            auto end = now();
+
+            cout << threshold << " " << fields << " " << (end - start).count() / 5 << endl;
+        }
+    }
+}
+
+void benchSearch() {
+    // Created, then filled directly in a single transaction, as
+    // adding a million songs one by one takes far too long.
+    {
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_search.db", Options::TestOptions()));
+        delete raw;
+    }
+
+    // Names of two or three words, from a few thousand made up ones.
+    const vector<string> syllables = { "ka", "lo", "mi", "ra", "ten", "su", "vo", "ne", "bri", "dar", "el", "fu", "gon", "hy", "ix", "jo" };
+    auto word = [&syllables](uint64_t seed) {
+        string w;
+        for (int i = 0; i < 3; i++, seed /= 16) {
+            w += syllables[seed % 16];
+        }
+        return w;
+    };
+
+    {
+        sqlite3* sqlite = 0;
+        sqlite3_open("bench_search.db", &sqlite);
+        sqlite3_exec(sqlite, "BEGIN", 0, 0, 0);
+
+        sqlite3_stmt* statement = 0;
+        sqlite3_prepare_v2(sqlite, "INSERT INTO Artists (Name) VALUES (?)", -1, &statement, 0);
+        for (int i = 0; i < 10000; i++) {
+            string name = word(i * 31ull % 4096) + " " + word(i * 17ull % 4093);
+            sqlite3_bind_text(statement, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_step(statement);
+            sqlite3_reset(statement);
+        }
+        sqlite3_finalize(statement);
+
+        sqlite3_prepare_v2(sqlite, "INSERT INTO Songs (ArtistID, GenreID, Name) VALUES (?, 0, ?)", -1, &statement, 0);
+        for (int i = 0; i < 1000000; i++) {
+            string name = word(i * 7919ull % 4096) + " " + word(i * 104729ull % 4091);
+            if (i % 3 == 0) {
+                name += " " + word(i % 4093);
+            }
+
+            sqlite3_bind_int(statement, 1, i % 10000 + 1);
+            sqlite3_bind_text(statement, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_step(statement);
+            sqlite3_reset(statement);
+        }
+        sqlite3_finalize(statement);
+
+        sqlite3_exec(sqlite, "COMMIT", 0, 0, 0);
+        sqlite3_close(sqlite);
+    }
+
+    Options options;
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_search.db", options));
+    shared_ptr<DB> db(raw);
+
+    Song song;
+    for (int i = 0; i < 50000; i++) {
+        song.id = (i * 7919) % 1000000 + 1;
+        checkStatus(db->voteSong("u" + to_string(i % 500), song, 1));
+    }
+
+    ReadOptions readOptions;
+    readOptions.sort = SortType::Votes;
+    readOptions.result_limit = 10;
+
+    // Every prefix of a query, as it is typed.
+    vector<int64_t> times;
+    for (int i = 0; i < 200; i++) {
+        string query = word(i * 2654435761ull % 4096) + " " + word(i);
+        for (size_t length = 1; length <= query.size(); length++) {
+            ResultSet<Song> songs;
+
+            auto start = now();
+            checkStatus(db->searchSongs(query.substr(0, length), songs, readOptions));
+            auto end = now();
+
+            times.push_back((end - start).count());
+        }
+    }
+
+    sort(times.begin(), times.end());
+    cout << "p50 " << times[times.size() / 2] << endl;
+    cout << "p99 " << times[times.size() * 99 / 100] << endl;
+    cout << "max " << times.back() << endl;
+}
+
+void benchUserKeys() {
+    {
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_users.db", Options::TestOptions()));
+        shared_ptr<DB> db(raw);
+        checkStatus(populate_empty(raw, 10000, 100, 10));
+
+        // Device ids look like UUIDs.
+        vector<string> users;
+        for (uint64_t i = 0; i < 1999; i++) {
+            uint64_t h = (i + 1) * 0x9E3779B97F4A7C15ull;
+
+            char id[40];
+            snprintf(id, sizeof(id), "%08x-%04x-4%03x-a%03x-%012llx",
+                (unsigned) (h >> 32), (unsigned) (h >> 16) & 0xFFFF, (unsigned) h & 0xFFF,
+                (unsigned) (h >> 20) & 0xFFF, (unsigned long long) (h * 31) & 0xFFFFFFFFFFFFull);
+            users.push_back(id);
+        }
+
+        vector<int64_t> times;
+        Song song;
+        for (int i = 0; i < 100000; i++) {
+            song.id = (i * 7919) % 10000 + 1;
+
+            auto start = now();
+            checkStatus(db->voteSong(users[i % users.size()], song, i % 3 ? 1 : -1));
+            auto end = now();
+
+            times.push_back((end - start).count());
+        }
+
+        sort(times.begin(), times.end());
+        cout << "vote p50 " << times[times.size() / 2] << endl;
+        cout << "vote p99 " << times[times.size() * 99 / 100] << endl;
+
+        // Reads limited to active users check each vote against them.
+        ReadOptions readOptions;
+        readOptions.sort = SortType::Votes;
+        readOptions.inactivity_threshold = 1800000;
+
+        auto start = now();
+        for (int i = 0; i < 5; i++) {
+            ResultSet<Song> songs;
+            checkStatus(db->getSongs(songs, readOptions));
+        }
+        auto end = now();
+
+        cout << "active read " << (end - start).count() / 5 << endl;
+    }
+
+    struct stat st;
+    stat("bench_users.db", &st);
+    cout << "file size " << st.st_size << endl;
+
+    // Each vote joined with its voter's activity, through a small
+    // page cache, as the vote and activity tables outgrow it.
+    sqlite3* sqlite = 0;
+    sqlite3_open("bench_users.db", &sqlite);
+    sqlite3_exec(sqlite, "PRAGMA cache_size = 100", 0, 0, 0);
+
+    for (int i = 0; i < 5; i++) {
+        sqlite3_exec(sqlite, "SELECT SUM(Vote) FROM SongVotes NATURAL JOIN UserActivity", 0, 0, 0);
+    }
+
+    int hits = 0, misses = 0, unused = 0;
+    sqlite3_db_status(sqlite, SQLITE_DBSTATUS_CACHE_HIT, &hits, &unused, 0);
+    sqlite3_db_status(sqlite, SQLITE_DBSTATUS_CACHE_MISS, &misses, &unused, 0);
+    cout << "cache hits " << hits << " misses " << misses << endl;
+
+    sqlite3_close(sqlite);
+}
+
+void benchPollAllocations() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_poll.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+
+    // Catalog names are mostly too long to be stored inline in a
+    // string, unlike the populator's.
+    vector<Genre> genres(100);
+    for (size_t i = 0; i < genres.size(); i++) {
+        genres[i].name = "Progressive Genre " + to_string(i);
+        checkStatus(db->addGenre(genres[i]));
+    }
+
+    vector<Artist> artists(1000);
+    for (size_t i = 0; i < artists.size(); i++) {
+        artists[i].name = "The Artist Formerly Known As " + to_string(i);
+        checkStatus(db->addArtist(artists[i]));
+    }
+
+    for (int i = 0; i < 10000; i++) {
+        Song song;
+        song.name   = "A Song Title That Runs Long " + to_string(i);
+        song.artist = artists[i % artists.size()];
+        song.genre  = genres[i % genres.size()];
+        checkStatus(db->addSong(song));
+    }
+
+    // Clients poll the same result set, as benchGetSongs does.
+    ReadOptions options;
+    options.result_limit = 1000;
+
+    ResultSet<Song> songs;
+    checkStatus(db->getSongs(songs, options));
+
+    vector<int64_t> times;
+    uint64_t before = allocations;
+    for (int i = 0; i < 1000; i++) {
+        auto start = now();
+        checkStatus(db->getSongs(songs, options));
+        auto end = now();
+
+        times.push_back((end - start).count());
+    }
+
+    sort(times.begin(), times.end());
+    cout << "rows " << songs.size() << endl;
+    cout << "allocations per poll " << (allocations - before) / 1000 << endl;
+    cout << "poll p50 " << times[times.size() / 2] << endl;
+    cout << "poll p99 " << times[times.size() * 99 / 100] << endl;
+}
+
+void benchInternedNames() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_names.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+
+    // A large catalog, with few artists and genres for its size,
+    // and names too long to be stored inline in a string.
+    vector<Genre> genres(50);
+    for (size_t i = 0; i < genres.size(); i++) {
+        genres[i].name = "Progressive Genre " + to_string(i);
+        checkStatus(db->addGenre(genres[i]));
+    }
+
+    vector<Artist> artists(2000);
+    for (size_t i = 0; i < artists.size(); i++) {
+        artists[i].name = "The Artist Formerly Known As " + to_string(i);
+        checkStatus(db->addArtist(artists[i]));
+    }
+
+    for (int i = 0; i < 100000; i++) {
+        Song song;
+        song.name   = "Song " + to_string(i);
+        song.artist = artists[i % artists.size()];
+        song.genre  = genres[i % genres.size()];
+        checkStatus(db->addSong(song));
+    }
+
+    // Each read decodes into a new result set, which is kept, so
+    // what it holds on to is counted.
+    ReadOptions options;
+
+    vector<int64_t> times;
+    for (int i = 0; i < 10; i++) {
+        ResultSet<Song> songs;
+
+        uint64_t before      = allocations;
+        uint64_t beforeBytes = allocated;
+
+        auto start = now();
+        checkStatus(db->getSongs(songs, options));
+        auto end = now();
+
+        times.push_back((end - start).count());
+
+        if (i == 0) {
+            cout << "rows " << songs.size() << endl;
+            cout << "allocations " << allocations - before << endl;
+            cout << "allocated bytes " << allocated - beforeBytes << endl;
+        }
+    }
+
+    sort(times.begin(), times.end());
+    cout << "read p50 " << times[times.size() / 2] << endl;
+}
+
+void benchColumnarReductions() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_columns.db", Options::TestOptions()));
+    checkStatus(populate_empty(raw, 100000, 2000, 50));
+    shared_ptr<DB> db(raw);
+
+    Song song;
+    for (int i = 0; i < 20000; i++) {
+        song.id = (i * 7919) % 100000 + 1;
+        checkStatus(db->voteSong("user" + to_string(i % 100), song, i % 3 ? 1 : -1));
+    }
+
+    ReadOptions options;
+    options.sort = SortType::Votes;
+
+    ResultSet<Song> rows;
+    ColumnarResultSet<Song> columns;
+
+    auto start = now();
+    checkStatus(db->getSongs(rows, options));
+    auto end = now();
+    cout << "row read " << (end - start).count() << endl;
+
+    start = now();
+    checkStatus(db->getSongs(columns, options));
+    end = now();
+    cout << "columnar read " << (end - start).count() << endl;
+
+    // Reading into the same set again reuses its rows.
+    start = now();
+    checkStatus(db->getSongs(columns, options));
+    end = now();
+    cout << "columnar reread " << (end - start).count() << endl;
+
+    // The same reductions, over structs and over columns.
+    int64_t total = 0;
+    start = now();
+    for (int i = 0; i < 100; i++) {
+        for (auto& s : rows) {
+            total += s.votes;
+        }
+
+        vector<int> histogram(10, 0);
+        for (auto& s : rows) {
+            histogram[min(max(s.count, 0), 9)]++;
+        }
+        total += histogram[0];
+    }
+    end = now();
+    cout << "row reductions " << (end - start).count() / 100 << " (" << total << ")" << endl;
+
+    total = 0;
+    start = now();
+    for (int i = 0; i < 100; i++) {
+        total += ColumnarResultSet<Song>::sum(columns.votes());
+        total += ColumnarResultSet<Song>::histogram(columns.counts(), 0, 1, 10)[0];
+    }
+    end = now();
+    cout << "columnar reductions " << (end - start).count() / 100 << " (" << total << ")" << endl;
+}
+
+// Builds a query the way an aggregating getSongs does, along with
+// a filter mask, from strings and vectors of either allocator.
+template<typename String, typename Vector>
+size_t buildQuery(const string& votes, int limit) {
+    String query = "SELECT Songs.SongID, Songs.Name, NULL, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.Name";
+    query += ", COUNT(SongVotes.SongID) as Count, COALESCE(SUM(SongVotes.Vote), 0) as Votes FROM Songs LEFT JOIN ";
+    query += votes.c_str();
+    query += " AS SongVotes ON Songs.SongID = SongVotes.SongID AND EXISTS ("
+        "    SELECT 1 FROM UserActivity"
+        "    WHERE UserActivity.UserKey = SongVotes.UserKey AND UserActivity.SessionID = SongVotes.SessionID"
+        "    AND UserActivity.LastActive > ?"
+        ") AND SongVotes.SessionID = ? ";
+    query += "LEFT JOIN Artists ON Songs.ArtistID = Artists.ArtistID ";
+    query += "LEFT JOIN Genres  ON Songs.GenreID  = Genres.GenreID ";
+    query += "GROUP BY Songs.SongID ORDER BY Votes DESC LIMIT ";
+    query += to_string(limit).c_str();
+
+    Vector mask(10000 / 64 + 1, 0);
+    return query.size() + mask.size();
+}
+
+void benchQueryArena() {
+    const int iterations = 1000000;
+    size_t total = 0;
+
+    uint64_t before = allocations;
+    auto start = now();
+    for (int i = 0; i < iterations; i++) {
+        total += buildQuery<string, vector<uint64_t>>("SongVotes", 1000);
+    }
+    auto end = now();
+
+    cout << "heap build " << (end - start).count() / iterations << " ns, "
+         << (allocations - before) / iterations << " allocations" << endl;
+
+    before = allocations;
+    start = now();
+    for (int i = 0; i < iterations; i++) {
+        Arena::Scope scope;
+        total += buildQuery<QueryString, ScratchVector<uint64_t>>("SongVotes", 1000);
+    }
+    end = now();
+
+    cout << "arena build " << (end - start).count() / iterations << " ns, "
+         << (allocations - before) / iterations << " allocations (" << total << ")" << endl;
+}
+
+// Returns OK through a call the compiler can't see through, as
+// the store's statuses are.
+Status __attribute__((noinline)) okStatus(int i) {
+    return i >= 0 ? Status::OK() : Status::Error("negative");
+}
+
+void benchStatusChecks() {
+    const int iterations = 10000000;
+    int failed = 0;
+
+    uint64_t before = allocations;
+    auto start = now();
+    for (int i = 0; i < iterations; i++) {
+        Status s = okStatus(i);
+        if (s != Status::OK()) {
+            failed++;
+        }
+    }
+    auto end = now();
+
+    cout << "status check " << double((end - start).count()) / iterations << " ns, "
+         << (allocations - before) / iterations << " allocations (" << failed << ")" << endl;
+
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_status.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+
+    Genre g;
+    g.name = "hello";
+    checkStatus(db->addGenre(g));
+
+    Artist a;
+    a.name = "is it me";
+    checkStatus(db->addArtist(a));
+
+    Song song;
+    song.name = "you're looking for!";
+    song.artist = a;
+    song.genre = g;
+    checkStatus(db->addSong(song));
+
+    const int votes = 3000;
+    string user = "this is a user";
+
+    before = allocations;
+    start = now();
+    for (int i = 0; i < votes; i++) {
+        checkStatus(db->voteSong(user, song, i % 2 ? 1 : -1));
+    }
+    end = now();
+
+    cout << "vote " << (end - start).count() / votes << " ns, "
+         << double(allocations - before) / votes << " allocations" << endl;
+}
+
+// Serves a burst of concurrent requests (a read of the top ten, or
+// a vote) with a thread per request, then with async calls.
+void benchAsyncRequests() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_async.db", Options::TestOptions()));
+    checkStatus(populate_empty(raw, 1000, 100, 10));
+    shared_ptr<DB> db(raw);
+
+    const int requests = 2000;
+
+    ReadOptions options;
+    options.result_limit = 10;
+
+    vector<ResultSet<Song>> sets(requests);
+    vector<Song> songs(requests);
+    for (int i = 0; i < requests; i++) {
+        songs[i].id = i % 1000 + 1;
+    }
+
+    auto request = [&](int i) {
+        if (i % 4 == 0) {
+            return db->voteSong("user" + to_string(i % 50), songs[i], 1);
+        }
+        return db->getSongs(sets[i], options);
+    };
+
+    auto start = now();
+    vector<thread> threads;
+    for (int i = 0; i < requests; i++) {
+        threads.emplace_back([&, i]() { checkStatus(request(i)); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end = now();
+
+    cout << "thread per request " << (end - start).count() / 1000000 << " ms" << endl;
+
+    mutex lock;
+    condition_variable finished;
+    int remaining = requests;
+    auto done = [&](Status s) {
+        checkStatus(s);
+
+        lock_guard<mutex> guard(lock);
+        if (--remaining == 0) {
+            finished.notify_one();
+        }
+    };
+
+    start = now();
+    for (int i = 0; i < requests; i++) {
+        if (i % 4 == 0) {
+            db->voteSongAsync("user" + to_string(i % 50), songs[i], 1, WriteOptions(), done);
+        } else {
+            db->getSongsAsync(sets[i], options, done);
+        }
+    }
+    {
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&]() { return remaining == 0; });
+    }
+    end = now();
+
+    cout << "async " << (end - start).count() / 1000000 << " ms" << endl;
+}
+
+// Votes from 1 to 64 threads at once, applying writes directly
+// on each thread, then batching them on a writer thread.
+void benchBatchedWrites() {
+    const int votes = 6400;
+
+    for (bool batched : { false, true }) {
+        Options options = Options::TestOptions();
+        options.batch_writes = batched;
+
+        DB* raw = 0;
+        checkStatus(open(raw, "bench_batched.db", options));
+        checkStatus(populate_empty(raw, 1000, 100, 10));
+        shared_ptr<DB> db(raw);
+
+        for (int producers = 1; producers <= 64; producers *= 2) {
+            auto start = now();
+
+            vector<thread> threads;
+            for (int t = 0; t < producers; t++) {
+                threads.emplace_back([&db, t, producers]() {
+                    string user = "user" + to_string(t);
+
+                    Song song;
+                    for (int i = 0; i < votes / producers; i++) {
+                        song.id = i % 1000 + 1;
+                        checkStatus(db->voteSong(user, song, i % 2 ? 1 : -1));
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+
+            auto end = now();
+
+            cout << (batched ? "batched " : "direct  ") << producers << " producers: "
+                 << votes * 1000000000LL / (end - start).count() << " votes/s" << endl;
+        }
+    }
+}
+
+// Aggregates a large vote history, without and then with a 5 ms
+// deadline, which bounds how long a read can hold its caller.
+void benchDeadlines() {
+    Options options = Options::TestOptions();
+    options.batch_writes = true;
+
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_deadlines.db", options));
+    checkStatus(populate_empty(raw, 20000, 500, 50));
+    shared_ptr<DB> db(raw);
+
+    // Batched writes apply in order, so the queued song waits
+    // for every vote.
+    for (int i = 0; i < 100000; i++) {
+        Song song;
+        song.id = i % 20000 + 1;
+        db->voteSongAsync("user" + to_string(i % 1000), song, 1, WriteOptions(), DB::Completion());
+    }
+    checkStatus(db->queueSong(1));
+
+    // Aggregated from the vote tables, rather than the tallies.
+    ReadOptions read;
+    read.inactivity_threshold = 3600000;
+
+    ResultSet<Song> songs;
+    for (int deadline : { 0, 5 }) {
+        int64_t slowest = 0;
+        for (int i = 0; i < 20; i++) {
+            read.deadline = deadline ? timestamp() + deadline : 0;
+
+            auto start = now();
+            Status s = db->getSongs(songs, read);
+            auto end = now();
+
+            if (!s.ok() && !s.deadlineExceeded()) {
+                checkStatus(s);
+            }
+
+            slowest = max<int64_t>(slowest, (end - start).count());
+        }
+
+        Stats stats;
+        checkStatus(db->getStats(stats));
+
+        cout << "deadline " << deadline << " ms: slowest read " << slowest / 1000 << " us, "
+             << stats.deadlines_exceeded << " exceeded so far" << endl;
+    }
+}
+
 int main() {
     // Generally I just call one of the above functions, and then
     // pipe the results into my histogram tool to get some sweet
@@ -6,8 +6,14 @@
 #include <memory>
 #include <random>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <vector>
 
 #include "skrillex/skrillex.hpp"
+#include "mapper/transforms.hpp"
+#include "sqlite3/sqlite3.h"
+#include "store/store.hpp"
+#include "mutator.hpp"
 
 using namespace std;
 using namespace skrillex;
@@ -112,6 +118,86 @@ void benchLookupNonExisting() {
     }
 }
 
+void benchNormalizedKeys() {
+    DB* raw = 0;
+    checkStatus(open(raw, "bench_normalized.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    Store* store = StoreMutator::getStore(raw);
+
+    default_random_engine rng(42);
+    uniform_int_distribution<> dist(0, characters.size() - 1);
+    auto randChar = [&dist, &rng]() { return characters[dist(rng)]; };
+
+    // Keys as combine() makes them: an artist and a song name.
+    vector<NormalizedKey> keys;
+    for (int i = 0; i < 1000000; i++) {
+        keys.push_back(combine(randomString(10, randChar), randomString(10, randChar)));
+    }
+
+    auto start = now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        checkStatus(store->insertNormalized(keys[i].hash, keys[i].text, 0, 0, 0));
+    }
+    auto end = now();
+
+    cout << "insert " << (end - start).count() / keys.size() << endl;
+
+    // The best of a few rounds, as lookups are short enough for
+    // anything else on the machine to skew them.
+    int64_t p50 = 0, p99 = 0;
+    for (int round = 0; round < 5; round++) {
+        vector<int64_t> times;
+        for (int i = 0; i < 100000; i++) {
+            Song song;
+            const NormalizedKey& key = keys[(i * 7919ull + round) % keys.size()];
+
+            auto start = now();
+            checkStatus(store->getNormalized(song, key.hash, key.text));
+            auto end = now();
+
+            times.push_back((end - start).count());
+        }
+
+        sort(times.begin(), times.end());
+        if (round == 0 || times[times.size() / 2] < p50) {
+            p50 = times[times.size() / 2];
+            p99 = times[times.size() * 99 / 100];
+        }
+    }
+
+    cout << "lookup p50 " << p50 << endl;
+    cout << "lookup p99 " << p99 << endl;
+
+    // The same lookups through one prepared statement, which leaves
+    // just the cost of finding the key.
+    sqlite3* sqlite = 0;
+    sqlite3_open("bench_normalized.db", &sqlite);
+
+    sqlite3_stmt* statement = 0;
+    sqlite3_prepare_v2(sqlite, "SELECT Normalized, SongID FROM Normalized WHERE Hash = ?", -1, &statement, 0);
+
+    start = now();
+    for (int i = 0; i < 100000; i++) {
+        const NormalizedKey& key = keys[(i * 7919ull) % keys.size()];
+
+        sqlite3_reset(statement);
+        sqlite3_bind_int64(statement, 1, static_cast<int64_t>(key.hash));
+        if (sqlite3_step(statement) != SQLITE_ROW) {
+            cerr << "Missing key " << key.text << endl;
+            exit(1);
+        }
+    }
+    end = now();
+
+    cout << "prepared lookup " << (end - start).count() / 100000 << endl;
+
+    sqlite3_finalize(statement);
+    sqlite3_close(sqlite);
+
+    struct stat st;
+    stat("bench_normalized.db", &st);
+    cout << "file size " << st.st_size << endl;
+}
 
 int main() {
     default_random_engine rng(random_device{}());
@@ -0,0 +1,187 @@
+//
+// columnar_result_set.hpp
+//
+// A columnar result set holds the same rows as a ResultSet, laid
+// out as a struct of arrays: every field is a contiguous column,
+// indexed by row, and names are stored back to back in a single
+// buffer, with the offset of each row's name (and one past the
+// last) in another column.
+//
+// It suits analytics over whole rankings, where a reduction only
+// touches the columns it needs. The reductions below are plain
+// loops over a column, which the compiler vectorizes.
+//
+//     ColumnarResultSet<Song> songs;
+//     db->getSongs(songs, options);
+//
+//     int64_t total = ColumnarResultSet<Song>::sum(songs.votes());
+//     for (size_t row : songs.top(songs.votes(), 10)) {
+//         std::cout << songs.name(row) << std::endl;
+//     }
+//
+// The artist and genre id columns are only filled for songs. Like
+// a ResultSet, a columnar result set can be reused (which also
+// reuses the rows a read is decoded into, before it is laid out as
+// columns), and is **not** thread safe.
+//
+
+#ifndef skrillex_columnar_result_set_hpp
+#define skrillex_columnar_result_set_hpp
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "skrillex/dbo.hpp"
+#include "skrillex/result_set.hpp"
+
+namespace skrillex {
+    namespace internal {
+        class ResultSetMutator;
+    }
+
+    template<typename T>
+    class ColumnarResultSet {
+    public:
+        ColumnarResultSet()
+        : name_offsets_(1, 0)
+        {
+        }
+
+        bool   empty() const { return ids_.empty(); }
+        size_t size()  const { return ids_.size(); }
+
+        const std::vector<int>&      ids()        const { return ids_; }
+        const std::vector<int>&      counts()     const { return counts_; }
+        const std::vector<int>&      votes()      const { return votes_; }
+        const std::vector<double>&   scores()     const { return scores_; }
+        const std::vector<uint64_t>& lastPlayed() const { return last_played_; }
+        const std::vector<int>&      artistIds()  const { return artist_ids_; }
+        const std::vector<int>&      genreIds()   const { return genre_ids_; }
+
+        // The names of every row, back to back, and where each row's
+        // starts (the name of row i ends where row i + 1's starts).
+        const std::string&           names()       const { return names_; }
+        const std::vector<uint32_t>& nameOffsets() const { return name_offsets_; }
+
+        std::string name(size_t row) const {
+            return names_.substr(name_offsets_[row], name_offsets_[row + 1] - name_offsets_[row]);
+        }
+
+        // The sum of a column.
+        static int64_t sum(const std::vector<int>& column) {
+            int64_t total = 0;
+            for (size_t i = 0; i < column.size(); i++) {
+                total += column[i];
+            }
+
+            return total;
+        }
+
+        // The rows of the (at most) k largest values of a column,
+        // largest first, ties broken by row.
+        static std::vector<size_t> top(const std::vector<int>& column, size_t k) {
+            std::vector<size_t> rows(column.size());
+            for (size_t i = 0; i < rows.size(); i++) {
+                rows[i] = i;
+            }
+
+            auto larger = [&column](size_t a, size_t b) {
+                return column[a] != column[b] ? column[a] > column[b] : a < b;
+            };
+
+            k = std::min(k, rows.size());
+            std::partial_sort(rows.begin(), rows.begin() + k, rows.end(), larger);
+            rows.resize(k);
+
+            return rows;
+        }
+
+        // Counts the values of a column into buckets of a width,
+        // the first starting at min. Values outside of the buckets
+        // are counted into the first or last.
+        static std::vector<size_t> histogram(const std::vector<int>& column, int min, int width, size_t buckets) {
+            std::vector<size_t> counts(buckets, 0);
+            if (buckets == 0 || width <= 0) {
+                return counts;
+            }
+
+            int last = static_cast<int>(buckets) - 1;
+            for (size_t i = 0; i < column.size(); i++) {
+                int bucket = (column[i] - min) / width;
+                bucket = column[i] < min ? 0 : std::min(bucket, last);
+                counts[bucket]++;
+            }
+
+            return counts;
+        }
+
+    private:
+        void clear() {
+            ids_.clear();
+            counts_.clear();
+            votes_.clear();
+            scores_.clear();
+            last_played_.clear();
+            artist_ids_.clear();
+            genre_ids_.clear();
+            names_.clear();
+            name_offsets_.assign(1, 0);
+        }
+
+        void reserve(size_t rows) {
+            ids_.reserve(rows);
+            counts_.reserve(rows);
+            votes_.reserve(rows);
+            scores_.reserve(rows);
+            last_played_.reserve(rows);
+            name_offsets_.reserve(rows + 1);
+        }
+
+        void appendCountable(const Countable& row, int id, uint64_t lastPlayed, const std::string& name) {
+            ids_.push_back(id);
+            counts_.push_back(row.count);
+            votes_.push_back(row.votes);
+            scores_.push_back(row.score);
+            last_played_.push_back(lastPlayed);
+
+            names_.append(name);
+            name_offsets_.push_back(static_cast<uint32_t>(names_.size()));
+        }
+
+        void append(const Song& row) {
+            appendCountable(row, row.id, row.last_played, row.name);
+            artist_ids_.push_back(row.artist.id);
+            genre_ids_.push_back(row.genre.id);
+        }
+
+        void append(const Artist& row) {
+            appendCountable(row, row.id, row.last_played, row.name);
+        }
+
+        void append(const Genre& row) {
+            appendCountable(row, row.id, row.last_played, row.name);
+        }
+
+        std::vector<int>      ids_;
+        std::vector<int>      counts_;
+        std::vector<int>      votes_;
+        std::vector<double>   scores_;
+        std::vector<uint64_t> last_played_;
+        std::vector<int>      artist_ids_;
+        std::vector<int>      genre_ids_;
+
+        std::string           names_;
+        std::vector<uint32_t> name_offsets_;
+
+        // The rows of the last read, kept so that the next one
+        // decodes into their storage, rather than fresh rows.
+        ResultSet<T> rows_;
+
+        friend class internal::ResultSetMutator;
+    };
+}
+
+#endif
@@ -14,29 +14,44 @@
 // upon creation time. It should be noted that once a DB object
 // is initialized, the session *cannot* be changed.
 //
+// Other sessions (e.g. one per room) can be opened alongside the
+// DB's own. Each open session has its own queue, buffer, and
+// tallies, and writes reach it by setting the session id in the
+// WriteOptions.
+//
 
 #ifndef skrillex_db_hpp
 #define skrillex_db_hpp
 
+#include <atomic>
+#include <functional>
+#include <future>
 #include <memory>
 #include <queue>
 #include <string>
 #include <vector>
 
+#include "skrillex/columnar_result_set.hpp"
 #include "skrillex/options.hpp"
 #include "skrillex/result_set.hpp"
+#include "skrillex/stats.hpp"
 #include "skrillex/status.hpp"
+#include "skrillex/subscription.hpp"
 
 namespace skrillex {
     namespace internal {
+        class Deadline;
+        class Notifier;
         class Store;
         class StoreMutator;
+        class WorkerPool;
+        class WriteQueue;
     }
 
     class Mapper;
 
     class DB;
-    Status open(DB*& db, std::string path, Options options);
+    Status open(DB*& db, const std::string& path, Options options);
 
     class DB {
     public:
@@ -54,20 +69,45 @@ namespace skrillex {
         Status getGenres(ResultSet<Genre>& set);
         Status getGenres(ResultSet<Genre>& set, ReadOptions options);
 
+        // Reads the same rows as above, into columns, for analytics
+        // over whole rankings (see columnar_result_set.hpp).
+        Status getSongs(ColumnarResultSet<Song>& set, ReadOptions options);
+        Status getArtists(ColumnarResultSet<Artist>& set, ReadOptions options);
+        Status getGenres(ColumnarResultSet<Genre>& set, ReadOptions options);
+
+        // Finds songs whose name, or artist's name, has a word that
+        // starts with the query, and artists whose name does, as
+        // the user types. Case, spaces, and punctuation are ignored.
+        // Matches are ranked by their votes in the session's tallies,
+        // so the session must be open, then by id.
+        Status searchSongs(const std::string& query, ResultSet<Song>& set);
+        Status searchSongs(const std::string& query, ResultSet<Song>& set, ReadOptions options);
+        Status searchArtists(const std::string& query, ResultSet<Artist>& set);
+        Status searchArtists(const std::string& query, ResultSet<Artist>& set, ReadOptions options);
+
         Status getPlayHistory(ResultSet<Song>& set);
         Status getPlayHistory(ResultSet<Song>& set, ReadOptions options);
 
-        Status setQueue(std::vector<int> songIds);
+        Status setQueue(const std::vector<int>& songIds);
+        Status setQueue(const std::vector<int>& songIds, WriteOptions options);
         Status getQueue(ResultSet<Song>& set);
+        Status getQueue(ResultSet<Song>& set, ReadOptions options);
         Status queueSong(int song_id);
+        Status queueSong(int song_id, WriteOptions options);
         Status clearQueue();
+        Status clearQueue(WriteOptions options);
 
         Status getBuffer(ResultSet<Song>& buffer);
+        Status getBuffer(ResultSet<Song>& buffer, ReadOptions options);
         Status bufferNext();
+        Status bufferNext(WriteOptions options);
         Status removeFromBuffer(int songId);
+        Status removeFromBuffer(int songId, WriteOptions options);
         Status songFinished();
+        Status songFinished(WriteOptions options);
 
-        Status setActivity(std::string userId, int64_t timestamp);
+        Status setActivity(const std::string& userId, int64_t timestamp);
+        Status setActivity(const std::string& userId, int64_t timestamp, WriteOptions options);
 
         Status addSong(Song& s);
         Status addArtist(Artist& artist);
@@ -75,20 +115,122 @@ namespace skrillex {
 
         Status markUnplayable(int songId);
 
-        Status voteSong(std::string userId, Song& song, int amount);
-        Status voteArtist(std::string userId, Artist& artist, int amount);
-        Status voteGenre(std::string userId, Genre& genre, int amount);
+        Status voteSong(const std::string& userId, Song& song, int amount);
+        Status voteSong(const std::string& userId, Song& song, int amount, WriteOptions options);
+        Status voteArtist(const std::string& userId, Artist& artist, int amount);
+        Status voteArtist(const std::string& userId, Artist& artist, int amount, WriteOptions options);
+        Status voteGenre(const std::string& userId, Genre& genre, int amount);
+        Status voteGenre(const std::string& userId, Genre& genre, int amount, WriteOptions options);
+
+        // Opens a brand new session alongside this DB's own.
+        Status createSession(int64_t& sessionId);
+
+        // Opens or closes an existing session alongside this
+        // DB's own. The DB's own session cannot be closed.
+        Status openSession(int64_t sessionId);
+        Status closeSession(int64_t sessionId);
 
         Status getSessionUserCount(int& userCount);
         Status getSessionUserCount(int& userCount, ReadOptions options);
+
+        // Calls back with the changes to the results of a read (see
+        // RankingDelta) whenever votes or the buffer change them. Set
+        // a result limit in the options to follow only the top-K.
+        Status subscribeSongs(ReadOptions options, RankingCallback<Song> callback, int& subscriptionId);
+        Status subscribeArtists(ReadOptions options, RankingCallback<Artist> callback, int& subscriptionId);
+        Status subscribeGenres(ReadOptions options, RankingCallback<Genre> callback, int& subscriptionId);
+
+        // Calls back whenever the queue or buffer of a session changes.
+        Status subscribeQueue(ReadOptions options, QueueCallback callback, int& subscriptionId);
+
+        Status unsubscribe(int subscriptionId);
+
+        Status getStats(Stats& stats);
+
+        // Asynchronous calls run their blocking counterparts on the
+        // DB's worker pool (see Options::async_threads), and either
+        // return a future of the status, or call back with it on a
+        // worker thread once done. Reads run in parallel, and writes
+        // one at a time, in the order they were made.
+        //
+        // Result sets and database objects are passed by reference,
+        // and must outlive the call. Everything else is copied. As
+        // writes run one at a time, a write's callback must not wait
+        // on another write. The callback may be empty, if the status
+        // is of no interest.
+        typedef std::function<void(Status)> Completion;
+
+        std::future<Status> getSongsAsync(ResultSet<Song>& set, ReadOptions options);
+        std::future<Status> getArtistsAsync(ResultSet<Artist>& set, ReadOptions options);
+        std::future<Status> getGenresAsync(ResultSet<Genre>& set, ReadOptions options);
+        std::future<Status> searchSongsAsync(const std::string& query, ResultSet<Song>& set, ReadOptions options);
+        std::future<Status> getQueueAsync(ResultSet<Song>& set, ReadOptions options);
+        std::future<Status> getBufferAsync(ResultSet<Song>& buffer, ReadOptions options);
+
+        void getSongsAsync(ResultSet<Song>& set, ReadOptions options, Completion done);
+        void getArtistsAsync(ResultSet<Artist>& set, ReadOptions options, Completion done);
+        void getGenresAsync(ResultSet<Genre>& set, ReadOptions options, Completion done);
+        void searchSongsAsync(const std::string& query, ResultSet<Song>& set, ReadOptions options, Completion done);
+        void getQueueAsync(ResultSet<Song>& set, ReadOptions options, Completion done);
+        void getBufferAsync(ResultSet<Song>& buffer, ReadOptions options, Completion done);
+
+        std::future<Status> voteSongAsync(const std::string& userId, Song& song, int amount, WriteOptions options);
+        std::future<Status> voteArtistAsync(const std::string& userId, Artist& artist, int amount, WriteOptions options);
+        std::future<Status> voteGenreAsync(const std::string& userId, Genre& genre, int amount, WriteOptions options);
+        std::future<Status> setActivityAsync(const std::string& userId, int64_t timestamp, WriteOptions options);
+        std::future<Status> queueSongAsync(int songId, WriteOptions options);
+        std::future<Status> bufferNextAsync(WriteOptions options);
+        std::future<Status> songFinishedAsync(WriteOptions options);
+
+        void voteSongAsync(const std::string& userId, Song& song, int amount, WriteOptions options, Completion done);
+        void voteArtistAsync(const std::string& userId, Artist& artist, int amount, WriteOptions options, Completion done);
+        void voteGenreAsync(const std::string& userId, Genre& genre, int amount, WriteOptions options, Completion done);
+        void setActivityAsync(const std::string& userId, int64_t timestamp, WriteOptions options, Completion done);
+        void queueSongAsync(int songId, WriteOptions options, Completion done);
+        void bufferNextAsync(WriteOptions options, Completion done);
+        void songFinishedAsync(WriteOptions options, Completion done);
     private:
-        DB(std::string path, Options options);
+        DB(const std::string& path, Options options);
         DB(const DB& other)  = delete;
         DB(const DB&& other) = delete;
 
-        friend Status open(DB*& db, std::string path, Options options);
+        friend Status open(DB*& db, const std::string& path, Options options);
         friend class internal::StoreMutator;
         friend class Mapper;
+
+        // Lets subscribers know a write to a session succeeded.
+        void touch(WriteOptions options, bool ranking, bool queue);
+
+        // Lets the ranking subscribers of every session know that a
+        // write to the catalog (or the unplayable songs) succeeded.
+        void touchRankings();
+
+        // Runs a call on the worker pool's reader or writer threads.
+        enum class Lane {
+            Read,
+            Write
+        };
+
+        std::future<Status> submit(Lane lane, std::function<Status()> call);
+        void submit(Lane lane, std::function<Status()> call, Completion done);
+
+        // Runs a read under the deadline of its options, unless it
+        // has already passed, or the read was cancelled.
+        template<typename Read>
+        Status bounded(const ReadOptions& options, Read read);
+
+        // Checks that a write's deadline hasn't passed, and that it
+        // wasn't cancelled, counting those abandoned.
+        Status admit(const WriteOptions& options);
+        Status admit(const internal::Deadline& deadline);
+
+        // Whether writes are batched (see Options::batch_writes), and
+        // this is not the writer thread, which applies them directly.
+        bool batching() const;
+
+        // Queues a write for the writer thread, and waits for its
+        // batch to commit.
+        Status applyBatched(std::function<Status()> write);
     private:
         enum class State {
             Closed,
@@ -100,7 +242,21 @@ namespace skrillex {
         State       db_state_;
         int64_t     session_id_;
 
+        std::atomic<uint64_t> deadlines_exceeded_;
+        std::atomic<uint64_t> cancelled_;
+
         std::unique_ptr<internal::Store> store_;
+
+        // Declared after the store, so that it (and any callbacks
+        // reading from the store) stops first.
+        std::unique_ptr<internal::Notifier> notifier_;
+
+        // Only set if writes are batched.
+        std::unique_ptr<internal::WriteQueue> writes_;
+
+        // Stopped first, so that async calls already made finish
+        // while the store and notifier are still around.
+        std::unique_ptr<internal::WorkerPool> pool_;
     };
 }
 
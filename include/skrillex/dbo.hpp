@@ -3,6 +3,11 @@
 //
 // Objects wrapping internal database objects
 //
+// DBOs are plain values, and copy and move member-wise (moving
+// takes their strings rather than copying them). Artist and genre
+// names are shared rather than copied (see name.hpp), so a song is
+// cheap to copy, whatever the length of its artist or genre name.
+//
 
 #ifndef skrillex_dbo_hpp
 #define skrillex_dbo_hpp
@@ -10,6 +15,8 @@
 #include <iostream>
 #include <string>
 
+#include "skrillex/name.hpp"
+
 namespace skrillex {
 
 struct Countable {
@@ -17,14 +24,16 @@ struct Countable {
 
     int count;
     int votes;
+
+    // The decayed or trending score, for reads sorted by one.
+    double score;
 };
 
 struct Artist : public Countable {
     Artist();
-    Artist(const Artist&);
 
     int         id;
-    std::string name;
+    Name        name;
 
     // Unix timestamp
     uint64_t    last_played;
@@ -35,10 +44,9 @@ struct Artist : public Countable {
 
 struct Genre : public Countable {
     Genre();
-    Genre(const Genre&);
 
     int         id;
-    std::string name;
+    Name        name;
 
     // Unix timestamp
     uint64_t    last_played;
@@ -48,7 +56,6 @@ struct Genre : public Countable {
 
 struct Song : public Countable {
     Song();
-    Song(const Song&);
 
     int         id;
     Artist      artist;
@@ -10,6 +10,7 @@
 #ifndef skrillex_parser_hpp
 #define skrillex_parser_hpp
 
+#include <future>
 #include <memory>
 #include <boost/optional.hpp>
 
@@ -37,16 +38,26 @@ namespace skrillex {
         // Result the mapped Song object.
         //
         // Note: This function may modify the underlying store.
-        Status map(Song& result, std::string song, std::string artist, std::string genre);
+        Status map(Song& result, const std::string& song, const std::string& artist, const std::string& genre);
 
         // Lookup attempts to lookup a corresponding song for a given
         // <song name, artist name> combination. If a song cannot be
         // found, Status::NotFound() is returned.
-        Status lookup(Song& result, std::string song, std::string artist);
+        Status lookup(Song& result, const std::string& song, const std::string& artist);
 
         // Lookup attempts to lookup a corresponding artist for a given
         // artist name. If an artist cannot be found, Status::NotFound() is returned.
-        Status lookup(Artist& result, std::string artist);
+        Status lookup(Artist& result, const std::string& artist);
+
+        // Asynchronous map and lookup, as with the DB's asynchronous
+        // calls. Maps may write, so they run one at a time, along with
+        // the DB's other writes. The result, and the mapper, must
+        // outlive the call.
+        std::future<Status> mapAsync(Song& result, const std::string& song, const std::string& artist, const std::string& genre);
+        void mapAsync(Song& result, const std::string& song, const std::string& artist, const std::string& genre, DB::Completion done);
+
+        std::future<Status> lookupAsync(Song& result, const std::string& song, const std::string& artist);
+        void lookupAsync(Song& result, const std::string& song, const std::string& artist, DB::Completion done);
     };
 }
 
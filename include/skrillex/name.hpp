@@ -0,0 +1,84 @@
+//
+// name.hpp
+//
+// A Name is an immutable string, shared rather than copied. It
+// reads like a const std::string (to which it converts), and can
+// be assigned from one.
+//
+// Artists and genres are named with them, so the many songs of a
+// result set that share an artist or genre share its name too,
+// rather than each carrying its own copy. Reads hand out the names
+// the database has interned, so they are shared across result sets
+// as well.
+//
+// Copying a Name is safe across threads, as with a shared_ptr.
+//
+
+#ifndef skrillex_name_hpp
+#define skrillex_name_hpp
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace skrillex {
+    class Name {
+    public:
+        Name();
+        Name(const char* text);
+        Name(const char* text, size_t length);
+        Name(const std::string& text);
+        Name(std::string&& text);
+
+        const std::string& str() const {
+            return text_ ? *text_ : empty_;
+        }
+
+        operator const std::string&() const {
+            return str();
+        }
+
+        const char* c_str() const { return str().c_str(); }
+        size_t      size()  const { return str().size(); }
+        bool        empty() const { return str().empty(); }
+
+        void clear() {
+            text_.reset();
+        }
+
+        // Whether two names share the same text, rather than equal
+        // text. Interned names of the same entity always do.
+        bool shares(const Name& other) const {
+            return text_ == other.text_;
+        }
+
+        friend bool operator==(const Name& a, const Name& b)               { return a.shares(b) || a.str() == b.str(); }
+        friend bool operator==(const Name& a, const std::string& b)        { return a.str() == b; }
+        friend bool operator==(const std::string& a, const Name& b)        { return a == b.str(); }
+        friend bool operator==(const Name& a, const char* b)               { return a.str() == b; }
+        friend bool operator==(const char* a, const Name& b)               { return a == b.str(); }
+        friend bool operator!=(const Name& a, const Name& b)               { return !(a == b); }
+        friend bool operator!=(const Name& a, const std::string& b)        { return !(a == b); }
+        friend bool operator!=(const std::string& a, const Name& b)        { return !(a == b); }
+        friend bool operator!=(const Name& a, const char* b)               { return !(a == b); }
+        friend bool operator!=(const char* a, const Name& b)               { return !(a == b); }
+        friend bool operator<(const Name& a, const Name& b)                { return a.str() < b.str(); }
+
+        friend std::string operator+(const Name& a, const std::string& b)  { return a.str() + b; }
+        friend std::string operator+(const std::string& a, const Name& b)  { return a + b.str(); }
+        friend std::string operator+(const Name& a, const char* b)         { return a.str() + b; }
+        friend std::string operator+(const char* a, const Name& b)         { return a + b.str(); }
+
+        friend std::ostream& operator<<(std::ostream& os, const Name& name) {
+            return os << name.str();
+        }
+
+    private:
+        static const std::string empty_;
+
+        std::shared_ptr<const std::string> text_;
+    };
+}
+
+#endif
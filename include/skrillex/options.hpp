@@ -8,12 +8,77 @@
 #ifndef skrillex_options_hpp
 #define skrillex_options_hpp
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace skrillex {
 
 enum SortType {
     None,
     Counts,
-    Votes
+    Votes,
+
+    // Votes, each halved for every Options::decay_half_life
+    // since it was cast.
+    Decayed,
+
+    // Upvotes within the last Options::trending_window,
+    // approximately.
+    Trending,
+
+    // A song's votes plus those of its artist and genre, as
+    // weighed by ReadOptions. Artists and genres are ranked
+    // by their votes alone.
+    Composite
+};
+
+// The fields of a row that a read fills in, combined into a
+// mask. Ids are always filled in.
+enum Field {
+    FieldIds        = 0,
+
+    // Count and votes, and the score, if sorted by one.
+    FieldCounts     = 1 << 0,
+
+    // The name of the song, artist, or genre itself.
+    FieldNames      = 1 << 1,
+
+    // The id and name of a song's artist, or genre.
+    FieldArtist     = 1 << 2,
+    FieldGenre      = 1 << 3,
+
+    FieldLastPlayed = 1 << 4,
+
+    FieldAll        = (1 << 5) - 1
+};
+
+// Cancels the reads and writes whose options hold it (or a copy
+// of it). A default constructed token is never cancelled, and
+// costs nothing to copy; make a live one with Create().
+class CancelToken {
+public:
+    CancelToken() {}
+
+    static CancelToken Create() {
+        CancelToken token;
+        token.cancelled_ = std::make_shared<std::atomic<bool>>(false);
+        return token;
+    }
+
+    void cancel() {
+        if (cancelled_) {
+            *cancelled_ = true;
+        }
+    }
+
+    bool live() const      { return cancelled_ != nullptr; }
+    bool cancelled() const { return cancelled_ && *cancelled_; }
+
+private:
+    std::shared_ptr<std::atomic<bool>> cancelled_;
 };
 
 struct Options {
@@ -38,11 +103,122 @@ struct Options {
     // and WriteOptions.
     //
     // Special Cases:
-    //     0: Create a new session
+    //     0: Create a new session. It starts with the queue
+    //        and buffer of the last default session, so
+    //        those survive a restart, though votes do not.
+    //
+    // Any other value restores that session, which must
+    // already exist. Its votes, play history, and queue are
+    // picked up where they left off.
     //
     // Default: 0
     int session_id;
 
+    // The number of votes between snapshots of the session
+    // tallies. Restoring a session loads the latest snapshot,
+    // and replays at most this many votes on top of it.
+    //
+    // Default: 10000
+    int snapshot_interval;
+
+    // Store the votes and play history of each new session in
+    // a file of its own (<path>.session-<id>), rather than in
+    // the main database. The catalog stays in the main file.
+    //
+    // Live queries then only touch the current session's data.
+    // Reads of other sessions attach their files on demand.
+    // SQLite limits how many files can be attached at once, so
+    // at most SQLITE_LIMIT_ATTACHED - 1 partitioned sessions
+    // can be open together.
+    //
+    // Default: false
+    bool partition_sessions;
+
+    // The time, in milliseconds, over which changes are gathered
+    // up before subscribers are notified of them. A longer
+    // interval means fewer notifications (and fewer reads to
+    // produce them), but staler results.
+    //
+    // Default: 100
+    int notification_interval;
+
+    // The number of changes each open session remembers for
+    // delta reads (see ReadOptions::delta). A result set older
+    // than the oldest remembered change is read in full.
+    //
+    // Default: 4096
+    int change_log_size;
+
+    // The time, in milliseconds, over which a vote loses half
+    // its weight for SortType::Decayed.
+    //
+    // Default: 1 800 000 (30 minutes)
+    int decay_half_life;
+
+    // The time, in milliseconds, over which upvotes count for
+    // SortType::Trending.
+    //
+    // Default: 900 000 (15 minutes)
+    int trending_window;
+
+    // Refill an empty queue from the session's ranking when a
+    // song is buffered, rather than failing. The best ranked
+    // song that is not buffered, unplayable, or recently played,
+    // and whose artist did not recently play, is queued.
+    //
+    // Default: false
+    bool autofill;
+
+    // The ranking autofill picks from. Either Counts or Votes.
+    //
+    // Default: Counts
+    SortType autofill_sort;
+
+    // The number of latest tracks whose artists autofill will
+    // not pick again. If zero, artists may repeat.
+    //
+    // Default: 3
+    int autofill_artist_gap;
+
+    // The time, in milliseconds, before autofill picks a song
+    // played in the session again. If zero, it never does.
+    //
+    // Default: 0
+    int autofill_replay_interval;
+
+    // The time, in milliseconds, a song counts as recently
+    // played for ReadOptions::filter_played.
+    //
+    // Default: 3 600 000 (1 hour)
+    int played_window;
+
+    // The number of threads serving asynchronous reads (see
+    // DB::getSongsAsync). Asynchronous writes are served by a
+    // thread of their own. Threads are started on first use.
+    //
+    // Default: 2
+    int async_threads;
+
+    // Apply every write on a single writer thread, which gathers
+    // the writes made in the meantime into one transaction. Writes
+    // wait for their transaction to commit, so each costs less
+    // under contention, but more when made one at a time.
+    //
+    // Batches are transactions, so this cannot be combined with
+    // partition_sessions, which attaches files outside of them.
+    //
+    // If a batch fails to commit, it is rolled back, but its writes
+    // have already been applied in memory. Every later write and
+    // read then fails, until the database is reopened.
+    //
+    // Default: false
+    bool batch_writes;
+
+    // The most writes batched into one transaction.
+    //
+    // Default: 256
+    int write_batch_size;
+
     Options();
 
     static Options TestOptions();
@@ -66,6 +242,12 @@ struct ReadOptions {
 
     // The sorting to be applied when reading.
     //
+    // Decayed, trending, and composite scores are only kept
+    // for open sessions, so reads sorted by them must be
+    // served from tallies (see inactivity_threshold). Decayed
+    // and trending scores are kept in memory, and start afresh
+    // whenever a session is loaded.
+    //
     // Default: Counts
     SortType sort;
 
@@ -73,6 +255,12 @@ struct ReadOptions {
     // there data is no longer returned. If zero, then a
     // user can be inactive an infinite amount of time.
     //
+    // Reads of the current (or any open) session with a
+    // threshold of zero are served from in-memory tallies,
+    // rather than by aggregating the vote tables. Likewise,
+    // reads of session -1 are served from totals kept over
+    // closed sessions.
+    //
     // Default: 1 800 000 (30 minutes)
     int inactivity_threshold;
 
@@ -81,11 +269,89 @@ struct ReadOptions {
     // Default: true
     bool filter_buffered;
 
+    // Filter out songs that are marked unplayable.
+    //
+    // Default: true
+    bool filter_unplayable;
+
+    // Filter out songs played in the session within the last
+    // Options::played_window.
+    //
+    // Default: false
+    bool filter_played;
+
+    // Only read songs in these genres, or by these artists. Artist
+    // and genre reads are limited to the ids of their own kind.
+    //
+    // Default: empty (no limit)
+    std::vector<int> genre_ids;
+    std::vector<int> artist_ids;
+
+    // Only read rows with at least this many votes, and counts.
+    //
+    // Default: INT_MIN, 0 (no limit)
+    int min_votes;
+    int min_count;
+
+    // Only read rows whose name starts with this prefix. Matching
+    // is exact, and case sensitive.
+    //
+    // Default: empty (no limit)
+    std::string name_prefix;
+
+    // The weight of a song's own votes, and of its artist's
+    // and genre's, in SortType::Composite.
+    //
+    // Default: 1, 0.5, 0.25
+    double song_weight;
+    double artist_weight;
+    double genre_weight;
+
+    // Update the result set in place, rather than reading it
+    // again, by applying only the rows that changed since it
+    // was last read. The set must hold the results of an
+    // earlier read with the same options.
+    //
+    // Only reads served from tallies (see inactivity_threshold)
+    // of an open session can be applied as deltas. Any other
+    // read, or one the remembered changes cannot bring up to
+    // date, is read in full.
+    //
+    // Default: false
+    bool delta;
+
+    // The fields to fill in (see Field). Fields that are not
+    // asked for are left at their defaults, and the joins and
+    // conversions they need are skipped, though a read may
+    // still fill in more than it was asked for.
+    //
+    // Default: FieldAll
+    int fields;
+
+    // The time, in milliseconds since the epoch, at which the read
+    // is abandoned with Status::DeadlineExceeded, if it has not
+    // finished. A read whose deadline has passed by the time it
+    // starts (e.g. one queued behind others) is not started at all.
+    // If zero, reads have no deadline.
+    //
+    // Only queries can be abandoned part way, so a read served from
+    // tallies always finishes once started.
+    //
+    // Default: 0
+    int64_t deadline;
+
+    // Abandons the read with Status::Cancelled once cancelled, as
+    // if its deadline had passed.
+    //
+    // Default: none
+    CancelToken cancel;
+
     ReadOptions();
 };
 
 struct WriteOptions {
-    // Writes will only persist to the specified session.
+    // Writes will only persist to the specified session,
+    // which must be open.
     //
     // Special Cases:
     //     0: Current Session
@@ -93,6 +359,13 @@ struct WriteOptions {
     // Default: 0
     int session_id;
 
+    // As with ReadOptions, except that writes are only abandoned
+    // before they start. A write that has started always finishes.
+    //
+    // Default: 0, none
+    int64_t     deadline;
+    CancelToken cancel;
+
     WriteOptions();
 };
 
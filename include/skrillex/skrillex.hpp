@@ -8,12 +8,15 @@
 #ifndef skrillex_skrillex_hpp
 #define skrillex_skrillex_hpp
 
+#include "skrillex/columnar_result_set.hpp"
 #include "skrillex/db.hpp"
 #include "skrillex/dbo.hpp"
 #include "skrillex/mapper.hpp"
 #include "skrillex/options.hpp"
 #include "skrillex/result_set.hpp"
+#include "skrillex/stats.hpp"
 #include "skrillex/status.hpp"
+#include "skrillex/subscription.hpp"
 
 #endif
 
@@ -0,0 +1,30 @@
+//
+// stats.hpp
+//
+// Counts of what a DB has done since it was opened, for callers
+// to shed load by (see DB::getStats).
+//
+
+#ifndef skrillex_stats_hpp
+#define skrillex_stats_hpp
+
+#include <cstdint>
+
+namespace skrillex {
+    struct Stats {
+        // Reads and writes abandoned (or never started) as their
+        // deadline had passed (see ReadOptions::deadline).
+        uint64_t deadlines_exceeded;
+
+        // Reads and writes abandoned as they were cancelled.
+        uint64_t cancelled;
+
+        Stats()
+        : deadlines_exceeded(0)
+        , cancelled(0)
+        {
+        }
+    };
+}
+
+#endif
@@ -6,34 +6,85 @@
 // If the status is not OK, then an error message
 // is provided.
 //
+// A Status is a single pointer, which is null when OK, so OK
+// statuses are free to create, copy and compare. The code and
+// message of an error are held in a state shared (and counted)
+// by its copies, so only creating an error allocates.
+//
 
 #ifndef skrillex_status_hpp
 #define skrillex_status_hpp
 
 #include <ostream>
 #include <string>
+#include <utility>
 
 namespace skrillex {
     class Status {
     private:
         enum class Code {
-            OK             = 0,
-            NotFound       = 1,
-            NotImplemented = 2,
-            Error          = 3
+            OK               = 0,
+            NotFound         = 1,
+            NotImplemented   = 2,
+            Error            = 3,
+
+            // A read or write abandoned at its deadline, or when
+            // cancelled (see ReadOptions::deadline).
+            DeadlineExceeded = 4,
+            Cancelled        = 5
         };
 
+        struct State;
+
     public:
         Status()
-        : code_(Code::OK)
+        : state_(nullptr)
+        {
+        }
+
+        Status(const Status& other)
+        : state_(other.state_)
         {
+            if (state_) {
+                ref(state_);
+            }
+        }
+
+        Status(Status&& other)
+        : state_(other.state_)
+        {
+            other.state_ = nullptr;
+        }
+
+        ~Status() {
+            if (state_) {
+                unref(state_);
+            }
+        }
+
+        Status& operator=(const Status& other) {
+            if (state_ != other.state_) {
+                Status copy(other);
+                std::swap(state_, copy.state_);
+            }
+            return *this;
+        }
+
+        Status& operator=(Status&& other) {
+            std::swap(state_, other.state_);
+            return *this;
         }
 
         // We make it a friend operator so comparing the static
         // functions (i.e. Status::OK()) to a status doesn't cause
         // problems (looking at you, gtest)
-        friend bool operator==(const Status& a, const Status& b);
-        friend bool operator!=(const Status& a, const Status& b);
+        friend bool operator==(const Status& a, const Status& b) {
+            return a.state_ == b.state_ || (a.state_ && b.state_ && equal(a, b));
+        }
+
+        friend bool operator!=(const Status& a, const Status& b) {
+            return !(a == b);
+        }
 
         friend std::ostream& operator<<(std::ostream& os, const Status& status);
 
@@ -46,49 +97,49 @@ namespace skrillex {
         }
 
         static Status NotFound(std::string message) {
-            return Status(Code::NotFound, message);
+            return Status(Code::NotFound, std::move(message));
         }
 
         static Status NotImplemented(std::string message) {
-            return Status(Code::NotImplemented, message);
+            return Status(Code::NotImplemented, std::move(message));
         }
 
         static Status Error(std::string message) {
-            return Status(Code::Error, message);
+            return Status(Code::Error, std::move(message));
         }
 
-        bool ok() const             { return code_ == Code::OK; }
-        bool notFound() const       { return code_ == Code::NotFound; }
-        bool NotImplemented() const { return code_ == Code::NotImplemented; }
-        bool error() const          { return code_ == Code::Error; }
-
-        std::string message() const {
-            return message_;
+        static Status DeadlineExceeded(std::string message) {
+            return Status(Code::DeadlineExceeded, std::move(message));
         }
 
-        std::string string() const {
-            switch (code_) {
-                case Code::OK:             return "Status: OK";
-                case Code::NotFound:       return "Status: NotFound - " + message_;
-                case Code::NotImplemented: return "Status: NotImplemented - " + message_;
-                case Code::Error:          return "Status: Error - " + message_;
-                default:                   return message_;
-            }
+        static Status Cancelled(std::string message) {
+            return Status(Code::Cancelled, std::move(message));
         }
 
+        bool ok() const               { return state_ == nullptr; }
+        bool notFound() const         { return code() == Code::NotFound; }
+        bool NotImplemented() const   { return code() == Code::NotImplemented; }
+        bool error() const            { return code() == Code::Error; }
+        bool deadlineExceeded() const { return code() == Code::DeadlineExceeded; }
+        bool cancelled() const        { return code() == Code::Cancelled; }
+
+        const std::string& message() const;
+
+        std::string string() const;
+
     private:
-        Status(Code code, std::string message)
-        : code_(code)
-        , message_(std::move(message))
-        {
-        }
+        Status(Code code, std::string message);
+
+        Code code() const;
+
+        static void ref(State* state);
+        static void unref(State* state);
+        static bool equal(const Status& a, const Status& b);
 
     private:
-        Code        code_;
-        std::string message_;
+        State* state_;
 
     };
 }
 
 #endif
-
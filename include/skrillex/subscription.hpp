@@ -0,0 +1,66 @@
+//
+// subscription.hpp
+//
+// Subscriptions let clients hear about changes, rather than
+// discovering them by polling. See DB::subscribeSongs, etc.
+//
+// Notifications are coalesced: every change made within the
+// notification interval (see Options) is delivered as a single
+// delta. Callbacks are run one at a time, on a thread owned by
+// the DB, and so should return quickly.
+//
+
+#ifndef skrillex_subscription_hpp
+#define skrillex_subscription_hpp
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "skrillex/dbo.hpp"
+
+namespace skrillex {
+    // The changes to a ranking (the results of a read) since the
+    // last notification. The first notification of a subscription
+    // holds the whole ranking.
+    template<typename T>
+    struct RankingDelta {
+        RankingDelta()
+        : size(0)
+        {
+        }
+
+        // Entries that are new to the ranking, have moved, or whose
+        // count or votes changed, each with its new position.
+        std::vector<std::pair<int, T>> changed;
+
+        // The ids of entries that are no longer in the ranking.
+        std::vector<int> removed;
+
+        // The size of the ranking after these changes.
+        int size;
+    };
+
+    // The queue and/or buffer, if they have changed since the
+    // last notification, as song ids in order.
+    struct QueueDelta {
+        QueueDelta()
+        : queue_changed(false)
+        , buffer_changed(false)
+        {
+        }
+
+        bool             queue_changed;
+        std::vector<int> queue;
+
+        bool             buffer_changed;
+        std::vector<int> buffer;
+    };
+
+    template<typename T>
+    using RankingCallback = std::function<void(const RankingDelta<T>&)>;
+
+    typedef std::function<void(const QueueDelta&)> QueueCallback;
+}
+
+#endif
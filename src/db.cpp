@@ -1,32 +1,45 @@
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "skrillex/db.hpp"
 #include "store/store.hpp"
+#include "store/deadline.hpp"
 #include "store/sqlite3_store.hpp"
+#include "mutator.hpp"
+#include "notifier.hpp"
+#include "write_queue.hpp"
+#include "worker_pool.hpp"
 
 using namespace std;
 using namespace skrillex::internal;
 
 namespace skrillex {
-    DB::DB(string path, Options options)
-    : db_path_(move(path))
+    DB::DB(const string& path, Options options)
+    : db_path_(path)
     , db_options_(options)
+    , deadlines_exceeded_(0)
+    , cancelled_(0)
     {
     }
 
     DB::~DB() {
+        // Async calls and batched writes already made run before the
+        // DB closes.
+        pool_.reset();
+        writes_.reset();
         db_state_ = State::Closed;
     }
 
-    Status open(DB*& db, string path, Options options) {
+    Status open(DB*& db, const string& path, Options options) {
         if (db) {
             return Status::Error("Database is already open.");
         }
-        if (options.session_id) {
-            return Status::Error("SQLite3 does not support restoring sessions.");
+        if (options.batch_writes && options.partition_sessions) {
+            return Status::Error("Batched writes cannot be combined with partitioned sessions.");
         }
-
         db = new DB(path, options);
         db->db_state_ = DB::State::Open;
 
@@ -37,10 +50,26 @@ namespace skrillex {
             return s;
         }
 
-        if ((s = db->store_->createSession())) {
+        if (options.session_id) {
+            s = db->store_->restoreSession(options.session_id);
+        } else {
+            s = db->store_->createSession();
+        }
+
+        if (s) {
+            return s;
+        }
+
+        if ((s = db->store_->getSession(db->session_id_))) {
             return s;
         }
 
+        db->notifier_.reset(new Notifier(db->session_id_, options.notification_interval));
+        if (options.batch_writes) {
+            db->writes_.reset(new WriteQueue(*db->store_, options.write_batch_size));
+        }
+
+        db->pool_.reset(new WorkerPool(options.async_threads));
         return Status::OK();
     }
 
@@ -60,94 +89,280 @@ namespace skrillex {
             return Status::Error("Database closed.");
         }
 
-        return store_->getSongs(rs, options);
+        return bounded(options, [&]() { return store_->getSongs(rs, options); });
     }
     Status DB::getArtists(ResultSet<Artist>& rs, ReadOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->getArtists(rs, options);
+        return bounded(options, [&]() { return store_->getArtists(rs, options); });
     }
     Status DB::getGenres(ResultSet<Genre>& rs, ReadOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->getGenres(rs, options);
+        return bounded(options, [&]() { return store_->getGenres(rs, options); });
+    }
+
+    // Reads rows into the set's own, and lays them out as columns.
+    // The rows are kept, so a set that is read into again reuses
+    // their storage (and their names'), as a ResultSet would.
+    template<typename T>
+    Status readColumns(ColumnarResultSet<T>& set, function<Status(ResultSet<T>&)> read) {
+        ResultSet<T>& rows = ResultSetMutator::getRows(set);
+        Status s = read(rows);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        ResultSetMutator::assign(set, ResultSetMutator::getVector(rows));
+        return Status::OK();
+    }
+
+    Status DB::getSongs(ColumnarResultSet<Song>& set, ReadOptions options) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        // The row read is bounded by the options' deadline.
+        return readColumns<Song>(set, [this, options](ResultSet<Song>& rows) { return getSongs(rows, options); });
+    }
+
+    Status DB::getArtists(ColumnarResultSet<Artist>& set, ReadOptions options) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        return readColumns<Artist>(set, [this, options](ResultSet<Artist>& rows) { return getArtists(rows, options); });
+    }
+
+    Status DB::getGenres(ColumnarResultSet<Genre>& set, ReadOptions options) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        return readColumns<Genre>(set, [this, options](ResultSet<Genre>& rows) { return getGenres(rows, options); });
+    }
+
+    Status DB::searchSongs(const string& query, ResultSet<Song>& rs)     { return searchSongs(query, rs, ReadOptions()); }
+    Status DB::searchArtists(const string& query, ResultSet<Artist>& rs) { return searchArtists(query, rs, ReadOptions()); }
+
+    Status DB::searchSongs(const string& query, ResultSet<Song>& rs, ReadOptions options) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        return bounded(options, [&]() { return store_->searchSongs(query, rs, options); });
+    }
+    Status DB::searchArtists(const string& query, ResultSet<Artist>& rs, ReadOptions options) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        return bounded(options, [&]() { return store_->searchArtists(query, rs, options); });
+    }
+
+    Status DB::setQueue(const vector<int>& songIds) {
+        return setQueue(songIds, WriteOptions());
     }
 
-    Status DB::setQueue(vector<int> songIds) {
+    Status DB::setQueue(const vector<int>& songIds, WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->setQueue(songIds);
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return setQueue(songIds, options); });
+        }
+
+        Status s = store_->setQueue(songIds, options);
+        if (s == Status::OK()) {
+            touch(options, false, true);
+        }
+
+        return s;
     }
 
     Status DB::getQueue(ResultSet<Song>& set) {
+        return getQueue(set, ReadOptions());
+    }
+
+    Status DB::getQueue(ResultSet<Song>& set, ReadOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->getQueue(set);
+        return bounded(options, [&]() { return store_->getQueue(set, options); });
     }
 
     Status DB::queueSong(int song_id) {
+        return queueSong(song_id, WriteOptions());
+    }
+
+    Status DB::queueSong(int song_id, WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->queueSong(song_id);
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return queueSong(song_id, options); });
+        }
+
+        Status s = store_->queueSong(song_id, options);
+        if (s == Status::OK()) {
+            touch(options, false, true);
+        }
+
+        return s;
     }
 
     Status DB::clearQueue() {
+        return clearQueue(WriteOptions());
+    }
+
+    Status DB::clearQueue(WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->clearQueue();
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return clearQueue(options); });
+        }
+
+        Status s = store_->clearQueue(options);
+        if (s == Status::OK()) {
+            touch(options, false, true);
+        }
+
+        return s;
     }
 
     Status DB::getBuffer(ResultSet<Song>& set) {
+        return getBuffer(set, ReadOptions());
+    }
+
+    Status DB::getBuffer(ResultSet<Song>& set, ReadOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->getBuffer(set);
+        return bounded(options, [&]() { return store_->getBuffer(set, options); });
     }
 
     Status DB::bufferNext() {
+        return bufferNext(WriteOptions());
+    }
+
+    Status DB::bufferNext(WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->bufferNext();
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return bufferNext(options); });
+        }
+
+        Status s = store_->bufferNext(options);
+        if (s == Status::OK()) {
+            touch(options, true, true);
+        }
+
+        return s;
     }
 
     Status DB::removeFromBuffer(int songId) {
+        return removeFromBuffer(songId, WriteOptions());
+    }
+
+    Status DB::removeFromBuffer(int songId, WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->removeFromBuffer(songId);
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return removeFromBuffer(songId, options); });
+        }
+
+        Status s = store_->removeFromBuffer(songId, options);
+        if (s == Status::OK()) {
+            touch(options, true, true);
+        }
+
+        return s;
     }
 
     Status DB::songFinished() {
+        return songFinished(WriteOptions());
+    }
+
+    Status DB::songFinished(WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->songFinished();
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return songFinished(options); });
+        }
+
+        Status s = store_->songFinished(options);
+        if (s == Status::OK()) {
+            touch(options, true, true);
+        }
+
+        return s;
     }
 
+    Status DB::setActivity(const std::string& userId, int64_t timestamp) {
+        return setActivity(userId, timestamp, WriteOptions());
+    }
 
-    Status DB::setActivity(std::string userId, int64_t timestamp) {
+    Status DB::setActivity(const std::string& userId, int64_t timestamp, WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->setActivity(userId, timestamp);
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return setActivity(userId, timestamp, options); });
+        }
+
+        return store_->setActivity(userId, timestamp, options);
     }
 
     Status DB::addSong(Song& song) {
@@ -155,7 +370,17 @@ namespace skrillex {
             return Status::Error("Database closed.");
         }
 
-        return store_->addSong(song);
+        if (batching()) {
+            return applyBatched([&]() { return addSong(song); });
+        }
+
+        // With autofill, new songs enter the rankings.
+        Status s = store_->addSong(song);
+        if (s == Status::OK()) {
+            touchRankings();
+        }
+
+        return s;
     }
 
     Status DB::addArtist(Artist& artist) {
@@ -163,6 +388,10 @@ namespace skrillex {
             return Status::Error("Database closed.");
         }
 
+        if (batching()) {
+            return applyBatched([&]() { return addArtist(artist); });
+        }
+
         return store_->addArtist(artist);
     }
 
@@ -171,6 +400,10 @@ namespace skrillex {
             return Status::Error("Database closed.");
         }
 
+        if (batching()) {
+            return applyBatched([&]() { return addGenre(genre); });
+        }
+
         return store_->addGenre(genre);
     }
 
@@ -179,33 +412,132 @@ namespace skrillex {
             return Status::Error("Database closed.");
         }
 
-        return store_->markUnplayable(songId);
+        if (batching()) {
+            return applyBatched([&]() { return markUnplayable(songId); });
+        }
+
+        // Unplayable songs are filtered out of the rankings.
+        Status s = store_->markUnplayable(songId);
+        if (s == Status::OK()) {
+            touchRankings();
+        }
+
+        return s;
+    }
+
+    Status DB::voteSong(const std::string& userId, Song& song, int amount) {
+        return voteSong(userId, song, amount, WriteOptions());
+    }
+
+    Status DB::voteSong(const std::string& userId, Song& song, int amount, WriteOptions options) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return voteSong(userId, song, amount, options); });
+        }
+
+        Status s = store_->voteSong(userId, song, amount, options);
+        if (s == Status::OK()) {
+            touch(options, true, false);
+        }
+
+        return s;
     }
 
-    Status DB::voteSong(std::string userId, Song& song, int amount) {
+    Status DB::voteArtist(const std::string& userId, Artist& artist, int amount) {
+        return voteArtist(userId, artist, amount, WriteOptions());
+    }
+
+    Status DB::voteArtist(const std::string& userId, Artist& artist, int amount, WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->voteSong(userId, song, amount, WriteOptions());
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return voteArtist(userId, artist, amount, options); });
+        }
+
+        Status s = store_->voteArtist(userId, artist, amount, options);
+        if (s == Status::OK()) {
+            touch(options, true, false);
+        }
+
+        return s;
+    }
+
+    Status DB::voteGenre(const std::string& userId, Genre& genre, int amount) {
+        return voteGenre(userId, genre, amount, WriteOptions());
     }
 
-    Status DB::voteArtist(std::string userId, Artist& artist, int amount) {
+    Status DB::voteGenre(const std::string& userId, Genre& genre, int amount, WriteOptions options) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->voteArtist(userId, artist, amount, WriteOptions());
+        Status admitted = admit(options);
+        if (admitted != Status::OK()) {
+            return admitted;
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return voteGenre(userId, genre, amount, options); });
+        }
+
+        Status s = store_->voteGenre(userId, genre, amount, options);
+        if (s == Status::OK()) {
+            touch(options, true, false);
+        }
+
+        return s;
     }
 
-    Status DB::voteGenre(std::string userId, Genre& genre, int amount) {
+    Status DB::createSession(int64_t& sessionId) {
         if (!isOpen()) {
             return Status::Error("Database closed.");
         }
 
-        return store_->voteGenre(userId, genre, amount, WriteOptions());
+        if (batching()) {
+            return applyBatched([&]() { return createSession(sessionId); });
+        }
+
+        return store_->addSession(sessionId);
     }
 
+    Status DB::openSession(int64_t sessionId) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return openSession(sessionId); });
+        }
+
+        return store_->openSession(sessionId);
+    }
+
+    Status DB::closeSession(int64_t sessionId) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        if (batching()) {
+            return applyBatched([&]() { return closeSession(sessionId); });
+        }
+
+        return store_->closeSession(sessionId);
+    }
 
     Status DB::getSessionUserCount(int& userCount) {
         return getSessionUserCount(userCount, ReadOptions());
@@ -216,6 +548,355 @@ namespace skrillex {
             return Status::Error("Database closed.");
         }
 
-        return store_->getSessionUserCount(userCount, options);
+        return bounded(options, [&]() { return store_->getSessionUserCount(userCount, options); });
+    }
+
+    namespace {
+        template<typename T>
+        function<void()> rankingRefresh(function<Status(ResultSet<T>&)> read, RankingCallback<T> callback) {
+            auto last  = make_shared<vector<T>>();
+            auto first = make_shared<bool>(true);
+
+            return [=]() {
+                ResultSet<T> set;
+                if (read(set) != Status::OK()) {
+                    return;
+                }
+
+                vector<T>& current = ResultSetMutator::getVector(set);
+                RankingDelta<T> delta = diffRanking(*last, current);
+                if (!*first && delta.changed.empty() && delta.removed.empty()) {
+                    return;
+                }
+
+                *first = false;
+                last->swap(current);
+                callback(delta);
+            };
+        }
+    }
+
+    Status DB::subscribeSongs(ReadOptions options, RankingCallback<Song> callback, int& subscriptionId) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        int64_t sessionId = options.session_id ? options.session_id : session_id_;
+        auto read = [this, options](ResultSet<Song>& set) { return store_->getSongs(set, options); };
+
+        subscriptionId = notifier_->add(sessionId, Topic::Ranking, rankingRefresh<Song>(read, callback));
+        return Status::OK();
+    }
+
+    Status DB::subscribeArtists(ReadOptions options, RankingCallback<Artist> callback, int& subscriptionId) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        int64_t sessionId = options.session_id ? options.session_id : session_id_;
+        auto read = [this, options](ResultSet<Artist>& set) { return store_->getArtists(set, options); };
+
+        subscriptionId = notifier_->add(sessionId, Topic::Ranking, rankingRefresh<Artist>(read, callback));
+        return Status::OK();
+    }
+
+    Status DB::subscribeGenres(ReadOptions options, RankingCallback<Genre> callback, int& subscriptionId) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        int64_t sessionId = options.session_id ? options.session_id : session_id_;
+        auto read = [this, options](ResultSet<Genre>& set) { return store_->getGenres(set, options); };
+
+        subscriptionId = notifier_->add(sessionId, Topic::Ranking, rankingRefresh<Genre>(read, callback));
+        return Status::OK();
+    }
+
+    Status DB::subscribeQueue(ReadOptions options, QueueCallback callback, int& subscriptionId) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        auto last  = make_shared<QueueDelta>();
+        auto first = make_shared<bool>(true);
+
+        auto refresh = [this, options, callback, last, first]() {
+            ResultSet<Song> queue;
+            ResultSet<Song> buffer;
+            if (store_->getQueue(queue, options) != Status::OK() ||
+                store_->getBuffer(buffer, options) != Status::OK()) {
+                return;
+            }
+
+            QueueDelta delta;
+            for (auto& song : queue) {
+                delta.queue.push_back(song.id);
+            }
+            for (auto& song : buffer) {
+                delta.buffer.push_back(song.id);
+            }
+
+            delta.queue_changed  = *first || delta.queue  != last->queue;
+            delta.buffer_changed = *first || delta.buffer != last->buffer;
+            if (!delta.queue_changed && !delta.buffer_changed) {
+                return;
+            }
+
+            *first = false;
+            last->queue  = delta.queue;
+            last->buffer = delta.buffer;
+
+            if (!delta.queue_changed) {
+                delta.queue.clear();
+            }
+            if (!delta.buffer_changed) {
+                delta.buffer.clear();
+            }
+
+            callback(delta);
+        };
+
+        int64_t sessionId = options.session_id ? options.session_id : session_id_;
+        subscriptionId = notifier_->add(sessionId, Topic::Queue, refresh);
+        return Status::OK();
+    }
+
+    Status DB::unsubscribe(int subscriptionId) {
+        if (!isOpen()) {
+            return Status::Error("Database closed.");
+        }
+
+        notifier_->remove(subscriptionId);
+        return Status::OK();
+    }
+
+    future<Status> DB::getSongsAsync(ResultSet<Song>& set, ReadOptions options) {
+        return submit(Lane::Read, [this, &set, options]() { return getSongs(set, options); });
+    }
+
+    void DB::getSongsAsync(ResultSet<Song>& set, ReadOptions options, Completion done) {
+        submit(Lane::Read, [this, &set, options]() { return getSongs(set, options); }, done);
+    }
+
+    future<Status> DB::getArtistsAsync(ResultSet<Artist>& set, ReadOptions options) {
+        return submit(Lane::Read, [this, &set, options]() { return getArtists(set, options); });
+    }
+
+    void DB::getArtistsAsync(ResultSet<Artist>& set, ReadOptions options, Completion done) {
+        submit(Lane::Read, [this, &set, options]() { return getArtists(set, options); }, done);
+    }
+
+    future<Status> DB::getGenresAsync(ResultSet<Genre>& set, ReadOptions options) {
+        return submit(Lane::Read, [this, &set, options]() { return getGenres(set, options); });
+    }
+
+    void DB::getGenresAsync(ResultSet<Genre>& set, ReadOptions options, Completion done) {
+        submit(Lane::Read, [this, &set, options]() { return getGenres(set, options); }, done);
+    }
+
+    future<Status> DB::searchSongsAsync(const string& query, ResultSet<Song>& set, ReadOptions options) {
+        return submit(Lane::Read, [this, query, &set, options]() { return searchSongs(query, set, options); });
+    }
+
+    void DB::searchSongsAsync(const string& query, ResultSet<Song>& set, ReadOptions options, Completion done) {
+        submit(Lane::Read, [this, query, &set, options]() { return searchSongs(query, set, options); }, done);
+    }
+
+    future<Status> DB::getQueueAsync(ResultSet<Song>& set, ReadOptions options) {
+        return submit(Lane::Read, [this, &set, options]() { return getQueue(set, options); });
+    }
+
+    void DB::getQueueAsync(ResultSet<Song>& set, ReadOptions options, Completion done) {
+        submit(Lane::Read, [this, &set, options]() { return getQueue(set, options); }, done);
+    }
+
+    future<Status> DB::getBufferAsync(ResultSet<Song>& buffer, ReadOptions options) {
+        return submit(Lane::Read, [this, &buffer, options]() { return getBuffer(buffer, options); });
+    }
+
+    void DB::getBufferAsync(ResultSet<Song>& buffer, ReadOptions options, Completion done) {
+        submit(Lane::Read, [this, &buffer, options]() { return getBuffer(buffer, options); }, done);
+    }
+
+    future<Status> DB::voteSongAsync(const string& userId, Song& song, int amount, WriteOptions options) {
+        return submit(Lane::Write, [this, userId, &song, amount, options]() { return voteSong(userId, song, amount, options); });
+    }
+
+    void DB::voteSongAsync(const string& userId, Song& song, int amount, WriteOptions options, Completion done) {
+        submit(Lane::Write, [this, userId, &song, amount, options]() { return voteSong(userId, song, amount, options); }, done);
+    }
+
+    future<Status> DB::voteArtistAsync(const string& userId, Artist& artist, int amount, WriteOptions options) {
+        return submit(Lane::Write, [this, userId, &artist, amount, options]() { return voteArtist(userId, artist, amount, options); });
+    }
+
+    void DB::voteArtistAsync(const string& userId, Artist& artist, int amount, WriteOptions options, Completion done) {
+        submit(Lane::Write, [this, userId, &artist, amount, options]() { return voteArtist(userId, artist, amount, options); }, done);
+    }
+
+    future<Status> DB::voteGenreAsync(const string& userId, Genre& genre, int amount, WriteOptions options) {
+        return submit(Lane::Write, [this, userId, &genre, amount, options]() { return voteGenre(userId, genre, amount, options); });
+    }
+
+    void DB::voteGenreAsync(const string& userId, Genre& genre, int amount, WriteOptions options, Completion done) {
+        submit(Lane::Write, [this, userId, &genre, amount, options]() { return voteGenre(userId, genre, amount, options); }, done);
+    }
+
+    future<Status> DB::setActivityAsync(const string& userId, int64_t timestamp, WriteOptions options) {
+        return submit(Lane::Write, [this, userId, timestamp, options]() { return setActivity(userId, timestamp, options); });
+    }
+
+    void DB::setActivityAsync(const string& userId, int64_t timestamp, WriteOptions options, Completion done) {
+        submit(Lane::Write, [this, userId, timestamp, options]() { return setActivity(userId, timestamp, options); }, done);
+    }
+
+    future<Status> DB::queueSongAsync(int songId, WriteOptions options) {
+        return submit(Lane::Write, [this, songId, options]() { return queueSong(songId, options); });
+    }
+
+    void DB::queueSongAsync(int songId, WriteOptions options, Completion done) {
+        submit(Lane::Write, [this, songId, options]() { return queueSong(songId, options); }, done);
+    }
+
+    future<Status> DB::bufferNextAsync(WriteOptions options) {
+        return submit(Lane::Write, [this, options]() { return bufferNext(options); });
+    }
+
+    void DB::bufferNextAsync(WriteOptions options, Completion done) {
+        submit(Lane::Write, [this, options]() { return bufferNext(options); }, done);
+    }
+
+    future<Status> DB::songFinishedAsync(WriteOptions options) {
+        return submit(Lane::Write, [this, options]() { return songFinished(options); });
+    }
+
+    void DB::songFinishedAsync(WriteOptions options, Completion done) {
+        submit(Lane::Write, [this, options]() { return songFinished(options); }, done);
+    }
+
+    future<Status> DB::submit(Lane lane, function<Status()> call) {
+        auto result = make_shared<promise<Status>>();
+        future<Status> status = result->get_future();
+
+        submit(lane, move(call), [result](Status s) { result->set_value(s); });
+        return status;
+    }
+
+    void DB::submit(Lane lane, function<Status()> call, Completion done) {
+        if (!isOpen() || !pool_) {
+            if (done) {
+                done(Status::Error("Database closed."));
+            }
+            return;
+        }
+
+        // Batched writes go straight to the writer thread.
+        if (lane == Lane::Write && writes_) {
+            writes_->push(move(call), move(done));
+            return;
+        }
+
+        auto task = [call, done]() {
+            Status s = call();
+            if (done) {
+                done(s);
+            }
+        };
+
+        if (lane == Lane::Write) {
+            pool_->write(task);
+        } else {
+            pool_->read(task);
+        }
+    }
+
+    template<typename Read>
+    Status DB::bounded(const ReadOptions& options, Read read) {
+        // The store no longer matches the disk.
+        if (writes_) {
+            Status failed = writes_->failure();
+            if (failed != Status::OK()) {
+                return failed;
+            }
+        }
+
+        Deadline deadline(options.deadline, options.cancel);
+        if (!deadline.bounded()) {
+            return read();
+        }
+
+        Status s = admit(deadline);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        Deadline::Scope scope(deadline);
+        s = read();
+
+        // The read failed as its query was interrupted.
+        if (scope.interrupted()) {
+            return admit(deadline);
+        }
+
+        return s;
+    }
+
+    Status DB::admit(const WriteOptions& options) {
+        Deadline deadline(options.deadline, options.cancel);
+        if (!deadline.bounded()) {
+            return Status::OK();
+        }
+
+        return admit(deadline);
+    }
+
+    Status DB::admit(const Deadline& deadline) {
+        Status s = deadline.check();
+        if (s.deadlineExceeded()) {
+            deadlines_exceeded_++;
+        } else if (s.cancelled()) {
+            cancelled_++;
+        }
+
+        return s;
+    }
+
+    Status DB::getStats(Stats& stats) {
+        stats.deadlines_exceeded = deadlines_exceeded_;
+        stats.cancelled          = cancelled_;
+        return Status::OK();
+    }
+
+    bool DB::batching() const {
+        return writes_ && !writes_->current();
+    }
+
+    Status DB::applyBatched(function<Status()> write) {
+        promise<Status> result;
+        future<Status> status = result.get_future();
+
+        writes_->push(move(write), [&result](Status s) { result.set_value(s); });
+        return status.get();
+    }
+
+    void DB::touch(WriteOptions options, bool ranking, bool queue) {
+        if (!notifier_) {
+            return;
+        }
+
+        int64_t sessionId = options.session_id ? options.session_id : session_id_;
+
+        if (ranking) {
+            notifier_->touch(sessionId, Topic::Ranking);
+        }
+        if (queue) {
+            notifier_->touch(sessionId, Topic::Queue);
+        }
+    }
+
+    void DB::touchRankings() {
+        if (notifier_) {
+            notifier_->touchAll(Topic::Ranking);
+        }
     }
 }
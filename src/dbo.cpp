@@ -1,36 +1,13 @@
 #include "skrillex/dbo.hpp"
 
 namespace skrillex {
-    Countable::Countable() : count(0), votes(0) {}
+    Countable::Countable() : count(0), votes(0), score(0) {}
 
-    Artist::Artist() : id(0), name(""), last_played(0) {}
-    Artist::Artist(const Artist& o)
-    : id(o.id)
-    , name(o.name)
-    , last_played(o.last_played)
-    , Countable(o)
-    {
-    }
+    Artist::Artist() : id(0), last_played(0) {}
 
-    Genre::Genre() : id(0), name(""), last_played(0) {}
-    Genre::Genre(const Genre& o)
-    : id(o.id)
-    , name(o.name)
-    , last_played(o.last_played)
-    , Countable(o)
-    {
-    }
+    Genre::Genre() : id(0), last_played(0) {}
 
     Song::Song() : id(0), name(""), last_played(0) {}
-    Song::Song(const Song& o)
-    : id(o.id)
-    , name(o.name)
-    , last_played(o.last_played)
-    , artist(o.artist)
-    , genre(o.genre)
-    , Countable(o)
-    {
-    }
 
     bool operator==(const Artist& a, const Artist& b) {
         return a.id == b.id;
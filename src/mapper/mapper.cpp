@@ -15,36 +15,41 @@ namespace skrillex {
     Mapper::Mapper(shared_ptr<DB> db) : db_(db) {}
     Mapper::~Mapper() {}
 
-    Status Mapper::map(Song& result, string songName, string artistName, string genreName) {
+    Status Mapper::map(Song& result, const string& songName, const string& artistName, const string& genreName) {
+        // Maps may insert, so they are batched like any other write.
+        if (db_->batching()) {
+            return db_->applyBatched([&]() { return map(result, songName, artistName, genreName); });
+        }
+
         Status s = Status::OK();
-        string nGenre  = "";
-        string nArtist = "";
 
-        trim(songName);
-        trim(artistName);
-        trim(genreName);
+        // Normalizing drops whitespace anyway, so names are only
+        // trimmed when they are stored.
+        bool hasSong   = !blank(songName);
+        bool hasArtist = !blank(artistName);
+        bool hasGenre  = !blank(genreName);
 
-        if (songName == "" && artistName != "" && genreName != "") {
+        if (!hasSong && hasArtist && hasGenre) {
             return Status::Error("Invalid operation: Can not map <artist, genre>");
         }
 
-        if (genreName != "") {
-            nGenre = normalize(FieldType::GenreField, genreName);
+        if (hasGenre) {
+            NormalizedKey nGenre = normalize(FieldType::GenreField, genreName);
 
             // Perform genre lookup.
-            s = db_->store_->getNormalized(result, nGenre);
+            s = db_->store_->getNormalized(result, nGenre.hash, nGenre.text);
 
             // No mapping was found, so insert the new genre and link.
             if (s.notFound()) {
                 // Insert genre
-                result.genre.name = genreName;
+                result.genre.name = trim_copy(genreName);
                 s = db_->addGenre(result.genre);
                 if (s != Status::OK()) {
                     return s;
                 }
 
                 // Insert link
-                s = db_->store_->insertNormalized(nGenre, 0, 0, result.genre.id);
+                s = db_->store_->insertNormalized(nGenre.hash, nGenre.text, 0, 0, result.genre.id);
                 if (s != Status::OK()) {
                     return s;
                 }
@@ -53,23 +58,23 @@ namespace skrillex {
             }
         }
 
-        if (artistName != "") {
-            nArtist = normalize(FieldType::ArtistField, artistName);
+        if (hasArtist) {
+            NormalizedKey nArtist = normalize(FieldType::ArtistField, artistName);
 
             // Perform artist lookup.
-            s = db_->store_->getNormalized(result, nArtist);
+            s = db_->store_->getNormalized(result, nArtist.hash, nArtist.text);
 
             // No mapping was found, so insert thew new artist and link.
             if (s.notFound()) {
                 // Insert artist
-                result.artist.name = artistName;
+                result.artist.name = trim_copy(artistName);
                 s = db_->addArtist(result.artist);
                 if (s != Status::OK()) {
                     return s;
                 }
 
                 // Insert link
-                s = db_->store_->insertNormalized(nArtist, 0, result.artist.id, 0);
+                s = db_->store_->insertNormalized(nArtist.hash, nArtist.text, 0, result.artist.id, 0);
                 if (s != Status::OK()) {
                     return s;
                 }
@@ -78,8 +83,8 @@ namespace skrillex {
             }
         }
 
-        if (songName != "") {
-            string nSong = combine(songName, artistName);
+        if (hasSong) {
+            NormalizedKey nSong = combine(songName, artistName);
 
             // Song is special case in the fact that a genre
             // can be linked to a song after the fact (this is
@@ -90,36 +95,36 @@ namespace skrillex {
             // behind the third if statement.
 
             // Perform song lookup.
-            s = db_->store_->getNormalized(result, nSong);
+            s = db_->store_->getNormalized(result, nSong.hash, nSong.text);
 
             // No mapping was found, so insert the new song and link.
             if (s.notFound()) {
                 // Insert song
-                result.name = songName;
+                result.name = trim_copy(songName);
                 s = db_->addSong(result);
                 if (s != Status::OK()) {
                     return s;
                 }
 
                 // Insert link
-                s = db_->store_->insertNormalized(nSong, result.id, result.artist.id, result.genre.id);
+                s = db_->store_->insertNormalized(nSong.hash, nSong.text, result.id, result.artist.id, result.genre.id);
                 if (s != Status::OK()) {
                     return s;
                 }
             } else if (s != Status::OK()) {
                 return s;
-            } else if (genreName != "") {
+            } else if (hasGenre) {
                 // We need to view the normalized entry without our
                 // genre entry contaminating, to see if we need to link.
                 Song test;
-                s = db_->store_->getNormalized(test, nSong);
+                s = db_->store_->getNormalized(test, nSong.hash, nSong.text);
                 if (s != Status::OK()) {
                     return s;
                 }
 
                 // No previous genre, let's link.
                 if (test.genre.id == 0) {
-                    s = db_->store_->insertNormalized(nSong, result.id, result.artist.id, result.genre.id);
+                    s = db_->store_->insertNormalized(nSong.hash, nSong.text, result.id, result.artist.id, result.genre.id);
                     if (s != Status::OK()) {
                         return s;
                     }
@@ -130,23 +135,20 @@ namespace skrillex {
         return Status::OK();
     }
 
-    Status Mapper::lookup(Song& result, std::string songName, std::string artistName) {
-        trim(songName);
-        trim(artistName);
-
-        if (songName == "") {
+    Status Mapper::lookup(Song& result, const string& songName, const string& artistName) {
+        if (blank(songName)) {
             return Status::Error("Invalid Operation: Must speciy song name when performing lookup");
         }
 
-        string nSong = combine(songName, artistName);
-        return db_->store_->getNormalized(result, nSong);
+        NormalizedKey nSong = combine(songName, artistName);
+        return db_->store_->getNormalized(result, nSong.hash, nSong.text);
     }
 
-    Status Mapper::lookup(Artist& result, string artistName) {
-        trim(artistName);
+    Status Mapper::lookup(Artist& result, const string& artistName) {
+        NormalizedKey nArtist = normalize(FieldType::ArtistField, artistName);
 
         Song song;
-        Status s = db_->store_->getNormalized(song, normalize(FieldType::ArtistField, artistName));
+        Status s = db_->store_->getNormalized(song, nArtist.hash, nArtist.text);
         if (s != Status::OK()) {
             return s;
         }
@@ -154,4 +156,20 @@ namespace skrillex {
         result = song.artist;
         return Status::OK();
     }
+
+    future<Status> Mapper::mapAsync(Song& result, const string& song, const string& artist, const string& genre) {
+        return db_->submit(DB::Lane::Write, [this, &result, song, artist, genre]() { return map(result, song, artist, genre); });
+    }
+
+    void Mapper::mapAsync(Song& result, const string& song, const string& artist, const string& genre, DB::Completion done) {
+        db_->submit(DB::Lane::Write, [this, &result, song, artist, genre]() { return map(result, song, artist, genre); }, done);
+    }
+
+    future<Status> Mapper::lookupAsync(Song& result, const string& song, const string& artist) {
+        return db_->submit(DB::Lane::Read, [this, &result, song, artist]() { return lookup(result, song, artist); });
+    }
+
+    void Mapper::lookupAsync(Song& result, const string& song, const string& artist, DB::Completion done) {
+        db_->submit(DB::Lane::Read, [this, &result, song, artist]() { return lookup(result, song, artist); }, done);
+    }
 }
@@ -1,31 +1,63 @@
-#include <algorithm>
 #include <cctype>
-#include <functional>
 #include <string>
 
 #include "mapper/transforms.hpp"
+#include "util/hash.hpp"
 
 using namespace std;
 
 namespace skrillex {
 namespace internal {
-    string normalize(FieldType type, string value) {
-        // Remove everything that is not alphanumeric.
-        value.erase(remove_if(value.begin(), value.end(), [](char x) { return !isalnum(x); }), value.end());
+    // Appends a character to a key, keeping its hash in step.
+    void appendKey(NormalizedKey& key, char c) {
+        key.text += c;
+        key.hash  = fnv1a(key.hash, c);
+    }
 
-        // Convert to lowercase.
-        transform(value.begin(), value.end(), value.begin(), ::tolower);
+    // Appends the alphanumerics of a value to a key, lowercased.
+    void appendKey(NormalizedKey& key, const string& value) {
+        for (char c : value) {
+            if (isalnum(c)) {
+                appendKey(key, static_cast<char>(::tolower(c)));
+            }
+        }
+    }
+
+    NormalizedKey normalize(FieldType type, const string& value) {
+        NormalizedKey key;
+        key.hash = FNV_OFFSET;
+        key.text.reserve(value.size() + 1);
 
         switch (type) {
-            case GenreField:  return "G" + value;
-            case ArtistField: return "A" + value;
+            case GenreField:  appendKey(key, 'G'); break;
+            case ArtistField: appendKey(key, 'A'); break;
             case None:
-                return value;
+                break;
         }
+
+        appendKey(key, value);
+        return key;
     }
 
-    string combine(string song, string artist) {
-        return "S" + normalize(FieldType::None, artist) + normalize(FieldType::None, song);
+    NormalizedKey combine(const string& song, const string& artist) {
+        NormalizedKey key;
+        key.hash = FNV_OFFSET;
+        key.text.reserve(song.size() + artist.size() + 1);
+
+        appendKey(key, 'S');
+        appendKey(key, artist);
+        appendKey(key, song);
+        return key;
+    }
+
+    bool blank(const string& value) {
+        for (char c : value) {
+            if (!isspace(static_cast<unsigned char>(c))) {
+                return false;
+            }
+        }
+
+        return true;
     }
 }
 }
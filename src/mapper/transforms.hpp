@@ -1,6 +1,7 @@
 #ifndef skrillex_parser_transforms_hpp
 #define skrillex_parser_transforms_hpp
 
+#include <cstdint>
 #include <string>
 
 namespace skrillex {
@@ -11,13 +12,22 @@ namespace internal {
         GenreField
     };
 
+    // A normalized key, and its hash (see util/hash.hpp), which
+    // is what the Normalized table is keyed by.
+    struct NormalizedKey {
+        std::string text;
+        uint64_t    hash;
+    };
+
     // Normalizes a given input based on its field type.
-    std::string normalize(FieldType type, std::string value);
+    NormalizedKey normalize(FieldType type, const std::string& value);
 
     // Combine normalized fields into a single field.
-    std::string combine(std::string song, std::string artist);
+    NormalizedKey combine(const std::string& song, const std::string& artist);
+
+    // Whether a value is empty, or only whitespace.
+    bool blank(const std::string& value);
 }
 }
 
 #endif
-
@@ -11,6 +11,7 @@
 
 #include <vector>
 
+#include "skrillex/columnar_result_set.hpp"
 #include "skrillex/db.hpp"
 #include "skrillex/result_set.hpp"
 
@@ -27,6 +28,21 @@ namespace internal {
         static int& getVersion(ResultSet<T>& rs) {
             return rs.data_version_;
         }
+
+        template<typename T>
+        static ResultSet<T>& getRows(ColumnarResultSet<T>& set) {
+            return set.rows_;
+        }
+
+        // Replaces the contents of a columnar result set with rows.
+        template<typename T>
+        static void assign(ColumnarResultSet<T>& set, const std::vector<T>& rows) {
+            set.clear();
+            set.reserve(rows.size());
+            for (auto& row : rows) {
+                set.append(row);
+            }
+        }
     };
 
     class StoreMutator {
@@ -0,0 +1,33 @@
+#include "skrillex/name.hpp"
+
+using namespace std;
+
+namespace skrillex {
+    const string Name::empty_;
+
+    Name::Name() {}
+
+    Name::Name(const char* text) {
+        if (text && *text) {
+            text_ = make_shared<const string>(text);
+        }
+    }
+
+    Name::Name(const char* text, size_t length) {
+        if (length) {
+            text_ = make_shared<const string>(text, length);
+        }
+    }
+
+    Name::Name(const string& text) {
+        if (!text.empty()) {
+            text_ = make_shared<const string>(text);
+        }
+    }
+
+    Name::Name(string&& text) {
+        if (!text.empty()) {
+            text_ = make_shared<const string>(move(text));
+        }
+    }
+}
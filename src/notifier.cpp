@@ -0,0 +1,153 @@
+#include "notifier.hpp"
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    Notifier::Notifier(int64_t defaultSession, int interval)
+    : default_session_(defaultSession)
+    , interval_(interval)
+    , next_id_(1)
+    , pending_(false)
+    , stopping_(false)
+    {
+    }
+
+    Notifier::~Notifier() {
+        {
+            lock_guard<mutex> lock(lock_);
+            stopping_ = true;
+        }
+
+        changed_.notify_all();
+
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    int Notifier::add(int64_t sessionId, Topic topic, function<void()> refresh) {
+        shared_ptr<Subscription> subscription = make_shared<Subscription>();
+        subscription->session_id = sessionId;
+        subscription->topic      = topic;
+        subscription->refresh    = move(refresh);
+        subscription->dirty      = true;
+        subscription->removed    = false;
+
+        lock_guard<mutex> lock(lock_);
+
+        // The thread is only started once someone is listening.
+        if (!thread_.joinable()) {
+            thread_ = thread(&Notifier::run, this);
+        }
+
+        int id = next_id_++;
+        subscriptions_[id] = subscription;
+
+        pending_ = true;
+        changed_.notify_one();
+
+        return id;
+    }
+
+    void Notifier::remove(int id) {
+        // The thread is started under lock_, by add().
+        thread::id notifier;
+        {
+            lock_guard<mutex> lock(lock_);
+            notifier = thread_.get_id();
+
+            auto it = subscriptions_.find(id);
+            if (it == subscriptions_.end()) {
+                return;
+            }
+
+            it->second->removed = true;
+            subscriptions_.erase(it);
+        }
+
+        // Wait out a refresh that may already have started.
+        if (this_thread::get_id() != notifier) {
+            lock_guard<mutex> refreshing(refresh_lock_);
+        }
+    }
+
+    void Notifier::touch(int64_t sessionId, Topic topic) {
+        lock_guard<mutex> lock(lock_);
+
+        bool any = false;
+        for (auto& entry : subscriptions_) {
+            Subscription& subscription = *entry.second;
+            if (subscription.topic != topic) {
+                continue;
+            }
+
+            if (subscription.session_id == sessionId ||
+                (subscription.session_id == -1 && sessionId != default_session_)) {
+                subscription.dirty = true;
+                any = true;
+            }
+        }
+
+        if (any && !pending_) {
+            pending_ = true;
+            changed_.notify_one();
+        }
+    }
+
+    void Notifier::touchAll(Topic topic) {
+        lock_guard<mutex> lock(lock_);
+
+        bool any = false;
+        for (auto& entry : subscriptions_) {
+            Subscription& subscription = *entry.second;
+            if (subscription.topic == topic) {
+                subscription.dirty = true;
+                any = true;
+            }
+        }
+
+        if (any && !pending_) {
+            pending_ = true;
+            changed_.notify_one();
+        }
+    }
+
+    void Notifier::run() {
+        unique_lock<mutex> lock(lock_);
+
+        while (true) {
+            changed_.wait(lock, [this]() { return pending_ || stopping_; });
+
+            // Let the rest of a burst arrive, so it is delivered as one.
+            changed_.wait_for(lock, interval_, [this]() { return stopping_; });
+            if (stopping_) {
+                return;
+            }
+
+            pending_ = false;
+
+            vector<shared_ptr<Subscription>> dirty;
+            for (auto& entry : subscriptions_) {
+                if (entry.second->dirty) {
+                    entry.second->dirty = false;
+                    dirty.push_back(entry.second);
+                }
+            }
+
+            lock.unlock();
+
+            {
+                lock_guard<mutex> refreshing(refresh_lock_);
+                for (auto& subscription : dirty) {
+                    if (!subscription->removed) {
+                        subscription->refresh();
+                    }
+                }
+            }
+
+            lock.lock();
+        }
+    }
+}
+}
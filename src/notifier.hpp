@@ -0,0 +1,117 @@
+//
+// notifier.hpp
+//
+// The Notifier drives subscriptions. Writes mark the topics
+// they affect as changed, and a background thread refreshes
+// every subscription following a changed topic, at most once
+// per interval. A burst of writes therefore costs one refresh
+// per subscription, however many writes it contains.
+//
+
+#ifndef skrillex_notifier_hpp
+#define skrillex_notifier_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "skrillex/subscription.hpp"
+
+namespace skrillex {
+namespace internal {
+    enum class Topic {
+        Ranking,
+        Queue
+    };
+
+    class Notifier {
+    public:
+        // Subscriptions to session -1 follow every session except
+        // defaultSession. interval is in milliseconds.
+        Notifier(int64_t defaultSession, int interval);
+        Notifier(const Notifier& other) = delete;
+        ~Notifier();
+
+        // Subscribes to a topic of a session. refresh is run on the
+        // notifier thread once, as soon as possible, and then again
+        // after each change to the topic.
+        int add(int64_t sessionId, Topic topic, std::function<void()> refresh);
+
+        // Unsubscribes. Once this returns, refresh will not be run
+        // again, unless this is called from within a refresh.
+        void remove(int id);
+
+        // Marks a topic of a session as changed.
+        void touch(int64_t sessionId, Topic topic);
+
+        // Marks a topic of every session as changed, for writes that
+        // are not made to any one session (such as the catalog's).
+        void touchAll(Topic topic);
+
+    private:
+        struct Subscription {
+            int64_t               session_id;
+            Topic                 topic;
+            std::function<void()> refresh;
+            bool                  dirty;
+            std::atomic<bool>     removed;
+        };
+
+        void run();
+
+    private:
+        const int64_t                   default_session_;
+        const std::chrono::milliseconds interval_;
+
+        std::mutex              lock_;
+        std::condition_variable changed_;
+
+        std::map<int, std::shared_ptr<Subscription>> subscriptions_;
+        int  next_id_;
+        bool pending_;
+        bool stopping_;
+
+        // Held by the notifier thread while refreshing.
+        std::mutex  refresh_lock_;
+        std::thread thread_;
+    };
+
+    // Computes the changes from one ranking to another.
+    template<typename T>
+    RankingDelta<T> diffRanking(const std::vector<T>& before, const std::vector<T>& after) {
+        RankingDelta<T> delta;
+        delta.size = after.size();
+
+        std::set<int> ids;
+        for (size_t i = 0; i < after.size(); i++) {
+            const T& entry = after[i];
+            ids.insert(entry.id);
+
+            if (i >= before.size() ||
+                before[i].id    != entry.id    ||
+                before[i].count != entry.count ||
+                before[i].votes != entry.votes) {
+                delta.changed.push_back(std::make_pair((int) i, entry));
+            }
+        }
+
+        for (auto& entry : before) {
+            if (ids.find(entry.id) == ids.end()) {
+                delta.removed.push_back(entry.id);
+            }
+        }
+
+        return delta;
+    }
+}
+}
+
+#endif
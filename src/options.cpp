@@ -1,3 +1,5 @@
+#include <climits>
+
 #include "skrillex/options.hpp"
 
 namespace skrillex {
@@ -6,6 +8,20 @@ namespace skrillex {
     , recreate(false)
     , enable_caching(true)
     , session_id(0)
+    , snapshot_interval(10000)
+    , partition_sessions(false)
+    , notification_interval(100)
+    , change_log_size(4096)
+    , decay_half_life(1800000)
+    , trending_window(900000)
+    , autofill(false)
+    , autofill_sort(SortType::Counts)
+    , autofill_artist_gap(3)
+    , autofill_replay_interval(0)
+    , played_window(3600000)
+    , async_threads(2)
+    , batch_writes(false)
+    , write_batch_size(256)
     {
     }
 
@@ -13,13 +29,24 @@ namespace skrillex {
     : session_id(0)
     , result_limit(0)
     , sort(SortType::Counts)
-    , filter_buffered(true)
     , inactivity_threshold(1800000)
+    , filter_buffered(true)
+    , filter_unplayable(true)
+    , filter_played(false)
+    , min_votes(INT_MIN)
+    , min_count(0)
+    , song_weight(1)
+    , artist_weight(0.5)
+    , genre_weight(0.25)
+    , delta(false)
+    , fields(FieldAll)
+    , deadline(0)
     {
     }
 
     WriteOptions::WriteOptions()
     : session_id(0)
+    , deadline(0)
     {
     }
 
@@ -1,19 +1,60 @@
+#include <atomic>
 #include <ostream>
 #include "skrillex/status.hpp"
 
 using namespace std;
 
 namespace skrillex {
-    bool operator==(const Status& a, const Status& b) {
-        return a.code_ == b.code_ && a.message_ == b.message_;
+    struct Status::State {
+        atomic<int> refs;
+        Code        code;
+        std::string message;
+    };
+
+    namespace {
+        const string empty;
+    }
+
+    Status::Status(Code code, std::string message)
+    : state_(new State{ { 1 }, code, move(message) })
+    {
+    }
+
+    Status::Code Status::code() const {
+        return state_ ? state_->code : Code::OK;
+    }
+
+    const string& Status::message() const {
+        return state_ ? state_->message : empty;
     }
 
-    bool operator!=(const Status& a, const Status& b) {
-        return !(a == b);
+    string Status::string() const {
+        switch (code()) {
+            case Code::OK:               return "Status: OK";
+            case Code::NotFound:         return "Status: NotFound - " + message();
+            case Code::NotImplemented:   return "Status: NotImplemented - " + message();
+            case Code::Error:            return "Status: Error - " + message();
+            case Code::DeadlineExceeded: return "Status: DeadlineExceeded - " + message();
+            case Code::Cancelled:        return "Status: Cancelled - " + message();
+            default:                     return message();
+        }
+    }
+
+    void Status::ref(State* state) {
+        state->refs.fetch_add(1, memory_order_relaxed);
+    }
+
+    void Status::unref(State* state) {
+        if (state->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+            delete state;
+        }
+    }
+
+    bool Status::equal(const Status& a, const Status& b) {
+        return a.code() == b.code() && a.message() == b.message();
     }
 
     ostream& operator<<(ostream& os, const Status& status) {
         return os << status.message();
     }
 }
-
@@ -0,0 +1,56 @@
+#include "store/deadline.hpp"
+
+#include "util/time.hpp"
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    namespace {
+        thread_local Deadline* current = nullptr;
+    }
+
+    Deadline::Deadline(int64_t deadline, const CancelToken& cancel)
+    : deadline_(deadline)
+    , cancel_(cancel)
+    , interrupted_(false)
+    {
+    }
+
+    bool Deadline::passed() const {
+        return cancel_.cancelled() || (deadline_ && timestamp() >= deadline_);
+    }
+
+    Status Deadline::check() const {
+        if (cancel_.cancelled()) {
+            return Status::Cancelled("Cancelled.");
+        }
+        if (deadline_ && (interrupted_ || timestamp() >= deadline_)) {
+            return Status::DeadlineExceeded("Deadline exceeded.");
+        }
+
+        return Status::OK();
+    }
+
+    int Deadline::progress(void*) {
+        Deadline* deadline = current;
+        if (!deadline || !deadline->passed()) {
+            return 0;
+        }
+
+        deadline->interrupted_ = true;
+        return 1;
+    }
+
+    Deadline::Scope::Scope(Deadline& deadline)
+    : deadline_(deadline)
+    , previous_(current)
+    {
+        current = &deadline;
+    }
+
+    Deadline::Scope::~Scope() {
+        current = previous_;
+    }
+}
+}
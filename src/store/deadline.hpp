@@ -0,0 +1,69 @@
+//
+// deadline.hpp
+//
+// A Deadline bounds a read or write by its options' deadline and
+// cancellation. Before starting, it is checked. While a read runs,
+// a Deadline::Scope makes the store's progress handler interrupt
+// any query run on the thread once the deadline passes (or the
+// read is cancelled).
+//
+// The handler is installed on the whole connection, which every
+// thread shares, so it only interrupts queries of the thread whose
+// scope is current. sqlite3_interrupt() would interrupt them all.
+//
+
+#ifndef skrillex_deadline_hpp
+#define skrillex_deadline_hpp
+
+#include <cstdint>
+
+#include "skrillex/options.hpp"
+#include "skrillex/status.hpp"
+
+namespace skrillex {
+namespace internal {
+    class Deadline {
+    public:
+        Deadline(int64_t deadline, const CancelToken& cancel);
+
+        // Whether there is a deadline, or token, to check at all.
+        bool bounded() const {
+            return deadline_ != 0 || cancel_.live();
+        }
+
+        // DeadlineExceeded or Cancelled, once either has happened,
+        // otherwise OK.
+        Status check() const;
+
+        // Interrupts the queries of the calling thread, while it
+        // lives, once its deadline has passed.
+        class Scope {
+        public:
+            Scope(Deadline& deadline);
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            // Whether a query was interrupted.
+            bool interrupted() const { return deadline_.interrupted_; }
+
+        private:
+            Deadline& deadline_;
+            Deadline* previous_;
+        };
+
+        // The progress handler of the store's connection.
+        static int progress(void*);
+
+    private:
+        bool passed() const;
+
+        const int64_t      deadline_;
+        const CancelToken& cancel_;
+        bool               interrupted_;
+    };
+}
+}
+
+#endif
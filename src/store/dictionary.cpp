@@ -0,0 +1,37 @@
+#include "store/dictionary.hpp"
+
+#include <cstring>
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    void Dictionary::intern(EntityKind kind, int id, const char* text, size_t length, Name& name) {
+        if (id <= 0 || length == 0) {
+            name = Name(text, length);
+            return;
+        }
+
+        lock_guard<mutex> lock(lock_);
+
+        vector<Name>& names = kind == EntityKind::Genre ? genres_ : artists_;
+        if (id >= (int) names.size()) {
+            names.resize(id + 1);
+        }
+
+        const string& interned = names[id].str();
+        if (interned.size() != length || memcmp(interned.data(), text, length) != 0) {
+            names[id] = Name(text, length);
+        }
+
+        name = names[id];
+    }
+
+    void Dictionary::clear() {
+        lock_guard<mutex> lock(lock_);
+
+        artists_.clear();
+        genres_.clear();
+    }
+}
+}
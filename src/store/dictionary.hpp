@@ -0,0 +1,45 @@
+//
+// dictionary.hpp
+//
+// A Dictionary interns the names of artists and genres by id, so
+// that every row read with the same artist or genre shares the one
+// copy of its name (see skrillex/name.hpp), within and across
+// result sets.
+//
+// Rows are decoded with the name the database returned, which is
+// checked against the interned one, so the dictionary needs no
+// loading, and a name that changed is simply interned again.
+//
+// Dictionary is thread safe. Its lock is taken after any other,
+// and never held while taking another.
+//
+
+#ifndef skrillex_dictionary_hpp
+#define skrillex_dictionary_hpp
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "skrillex/name.hpp"
+#include "store/tally.hpp"
+
+namespace skrillex {
+namespace internal {
+    class Dictionary {
+    public:
+        // Sets name to the interned name of an artist or genre,
+        // interning text as it if the id has no name, or another.
+        void intern(EntityKind kind, int id, const char* text, size_t length, Name& name);
+
+        void clear();
+
+    private:
+        std::mutex        lock_;
+        std::vector<Name> artists_;
+        std::vector<Name> genres_;
+    };
+}
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include "store/name_index.hpp"
+
+#include <cctype>
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    NameIndex::NameIndex()
+    : sorted_(0)
+    {
+    }
+
+    void NameIndex::add(int id, const string& name) {
+        size_t base = keys_.size();
+
+        // Words start wherever a letter or digit follows anything else.
+        vector<size_t> starts;
+        bool inWord = false;
+        for (char c : name) {
+            if (!isalnum(static_cast<unsigned char>(c))) {
+                inWord = false;
+                continue;
+            }
+
+            if (!inWord) {
+                starts.push_back(keys_.size() - base);
+                inWord = true;
+            }
+
+            keys_ += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+
+        size_t length = keys_.size() - base;
+        for (size_t start : starts) {
+            Entry e;
+            e.offset = base + start;
+            e.length = length - start;
+            e.id     = id;
+            entries_.push_back(e);
+        }
+
+        if (id < 0) {
+            return;
+        }
+
+        if (id >= (int) names_.size()) {
+            names_.resize(id + 1, Name());
+        }
+
+        Name& n  = names_[id];
+        n.offset = base;
+        n.length = length;
+        n.first  = starts_.size();
+        n.words  = starts.size();
+        starts_.insert(starts_.end(), starts.begin(), starts.end());
+    }
+
+    size_t NameIndex::count(const string& prefix) {
+        if (prefix.empty()) {
+            return 0;
+        }
+
+        merge();
+
+        auto first = lowerBound(prefix);
+        auto last  = upper_bound(first, entries_.end(), prefix, [this](const string& prefix, const Entry& e) {
+            return !startsWith(e, prefix) && keys_.compare(e.offset, e.length, prefix) > 0;
+        });
+
+        return last - first;
+    }
+
+    bool NameIndex::matches(int id, const string& prefix) const {
+        if (id < 0 || id >= (int) names_.size() || prefix.empty()) {
+            return false;
+        }
+
+        const Name& n = names_[id];
+        for (uint32_t w = n.first; w < n.first + n.words; w++) {
+            uint32_t start = starts_[w];
+            if (n.length - start >= prefix.size() && keys_.compare(n.offset + start, prefix.size(), prefix) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    size_t NameIndex::size() const {
+        return entries_.size();
+    }
+
+    void NameIndex::clear() {
+        keys_.clear();
+        entries_.clear();
+        sorted_ = 0;
+
+        names_.clear();
+        starts_.clear();
+    }
+
+    string NameIndex::normalize(const string& text) {
+        string result;
+        for (char c : text) {
+            if (isalnum(static_cast<unsigned char>(c))) {
+                result += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            }
+        }
+
+        return result;
+    }
+
+    vector<NameIndex::Entry>::iterator NameIndex::lowerBound(const string& prefix) {
+        return lower_bound(entries_.begin(), entries_.end(), prefix, [this](const Entry& e, const string& prefix) {
+            return keys_.compare(e.offset, e.length, prefix) < 0;
+        });
+    }
+
+    bool NameIndex::less(const Entry& a, const Entry& b) const {
+        int c = keys_.compare(a.offset, a.length, keys_, b.offset, b.length);
+        return c != 0 ? c < 0 : a.id < b.id;
+    }
+
+    void NameIndex::merge() {
+        if (sorted_ == entries_.size()) {
+            return;
+        }
+
+        auto less = [this](const Entry& a, const Entry& b) {
+            return this->less(a, b);
+        };
+
+        sort(entries_.begin() + sorted_, entries_.end(), less);
+        inplace_merge(entries_.begin(), entries_.begin() + sorted_, entries_.end(), less);
+
+        sorted_ = entries_.size();
+    }
+}
+}
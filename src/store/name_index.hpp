@@ -0,0 +1,101 @@
+//
+// name_index.hpp
+//
+// A NameIndex finds entities by the start of their name, or of
+// any word within it, as a search box would while typing.
+//
+// Names are normalized (lowercase letters and digits only) and
+// stored back to back. Every word start within a name is an entry
+// pointing into that text, and entries are kept sorted by the text
+// that follows them, so the matches of a prefix are adjacent. New
+// entries are appended as they come, and merged in by the next
+// lookup. The words of each id are also kept, so a single id can
+// be checked against a prefix without a lookup.
+//
+// NameIndex is **not** thread safe.
+//
+
+#ifndef skrillex_name_index_hpp
+#define skrillex_name_index_hpp
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace skrillex {
+namespace internal {
+    class NameIndex {
+    public:
+        NameIndex();
+
+        // Indexes an id under a name, and under each word within it.
+        void add(int id, const std::string& name);
+
+        // Calls f(id) for every entry whose text starts with the
+        // prefix, which must already be normalized. An id may be
+        // passed more than once, if several of its words match.
+        template<typename F>
+        void match(const std::string& prefix, F f) {
+            if (prefix.empty()) {
+                return;
+            }
+
+            merge();
+
+            for (auto it = lowerBound(prefix); it != entries_.end() && startsWith(*it, prefix); it++) {
+                f(it->id);
+            }
+        }
+
+        // The number of entries match would pass.
+        size_t count(const std::string& prefix);
+
+        // Whether any word of an id's name starts with the prefix.
+        bool matches(int id, const std::string& prefix) const;
+
+        // Sorts the entries added since the last lookup, and merges
+        // them into the rest. Lookups do this themselves.
+        void merge();
+
+        size_t size() const;
+        void   clear();
+
+        // Lowercases text, and drops all but letters and digits.
+        static std::string normalize(const std::string& text);
+
+    private:
+        struct Entry {
+            uint32_t offset;
+            uint32_t length;
+            int      id;
+        };
+
+        // An id's name, and where its words start (starts_[first]
+        // onwards), relative to the name.
+        struct Name {
+            uint32_t offset;
+            uint32_t length;
+            uint32_t first;
+            uint32_t words;
+        };
+
+        bool less(const Entry& a, const Entry& b) const;
+        bool startsWith(const Entry& e, const std::string& prefix) const {
+            return e.length >= prefix.size() && keys_.compare(e.offset, prefix.size(), prefix) == 0;
+        }
+
+        std::vector<Entry>::iterator lowerBound(const std::string& prefix);
+
+        std::string        keys_;
+        std::vector<Entry> entries_;
+        size_t             sorted_;
+
+        std::vector<Name>     names_;
+        std::vector<uint32_t> starts_;
+    };
+}
+}
+
+#endif
@@ -0,0 +1,146 @@
+#include "store/scores.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    // Weights double every half life past the landmark, so it is
+    // moved before they can lose precision against new votes.
+    const int64_t MAX_HALF_LIVES = 64;
+
+    // An odd multiplier per sketch row.
+    const uint64_t SEEDS[Scores::Depth] = {
+        0x9E3779B97F4A7C15ull,
+        0xC2B2AE3D27D4EB4Full,
+        0x165667B19E3779F9ull,
+        0xD6E8FEB86659FD93ull
+    };
+
+    Scores::Scores(int64_t halfLife, int64_t window)
+    : half_life_(max<int64_t>(halfLife, 1))
+    , landmark_(0)
+    , bucket_length_(max<int64_t>(window / Buckets, 1))
+    , bucket_(0)
+    {
+    }
+
+    void Scores::apply(EntityKind kind, int id, int votes, int64_t now) {
+        int k = static_cast<int>(kind);
+        if (id <= 0 || votes == 0) {
+            return;
+        }
+
+        // Also sets the landmark on the first vote.
+        if (now - landmark_ > MAX_HALF_LIVES * half_life_) {
+            rebase(now);
+        }
+
+        if (id >= (int) weights_[k].size()) {
+            weights_[k].resize(id + 1, 0);
+        }
+
+        weights_[k][id] += votes * exp2((double) (now - landmark_) / half_life_);
+
+        if (votes < 0) {
+            return;
+        }
+
+        // Sketches are only allocated once something trends.
+        if (window_.empty()) {
+            window_.assign(Depth * Width, 0);
+            for (auto& bucket : buckets_) {
+                bucket.assign(Depth * Width, 0);
+            }
+            bucket_ = now / bucket_length_;
+        }
+
+        advance(now);
+
+        Sketch& bucket = buckets_[bucket_ % Buckets];
+        for (int row = 0; row < Depth; row++) {
+            int i = slot(row, kind, id);
+            bucket[i]  += votes;
+            window_[i] += votes;
+        }
+    }
+
+    void Scores::advance(int64_t now) {
+        int64_t bucket = now / bucket_length_;
+        if (window_.empty() || bucket <= bucket_) {
+            return;
+        }
+
+        if (bucket - bucket_ >= Buckets) {
+            fill(window_.begin(), window_.end(), 0);
+            for (auto& b : buckets_) {
+                fill(b.begin(), b.end(), 0);
+            }
+        } else {
+            for (int64_t b = bucket_ + 1; b <= bucket; b++) {
+                Sketch& expired = buckets_[b % Buckets];
+                for (size_t i = 0; i < expired.size(); i++) {
+                    window_[i] -= expired[i];
+                    expired[i]  = 0;
+                }
+            }
+        }
+
+        bucket_ = bucket;
+    }
+
+    double Scores::decayed(EntityKind kind, int id, int64_t now) const {
+        int k = static_cast<int>(kind);
+        if (id <= 0 || id >= (int) weights_[k].size()) {
+            return 0;
+        }
+
+        return weights_[k][id] * exp2((double) (landmark_ - now) / half_life_);
+    }
+
+    int Scores::trending(EntityKind kind, int id) const {
+        if (id <= 0 || window_.empty()) {
+            return 0;
+        }
+
+        int estimate = window_[slot(0, kind, id)];
+        for (int row = 1; row < Depth; row++) {
+            estimate = min(estimate, window_[slot(row, kind, id)]);
+        }
+
+        return estimate;
+    }
+
+    void Scores::clear() {
+        for (int k = 0; k < Tally::NumKinds; k++) {
+            weights_[k].clear();
+        }
+
+        landmark_ = 0;
+        bucket_   = 0;
+
+        window_.clear();
+        for (auto& bucket : buckets_) {
+            bucket.clear();
+        }
+    }
+
+    int Scores::slot(int row, EntityKind kind, int id) const {
+        uint64_t key = (static_cast<uint64_t>(kind) << 32) | static_cast<uint32_t>(id);
+        return row * Width + (int) (((key * SEEDS[row]) >> 32) % Width);
+    }
+
+    void Scores::rebase(int64_t now) {
+        double scale = exp2((double) (landmark_ - now) / half_life_);
+        for (int k = 0; k < Tally::NumKinds; k++) {
+            for (auto& weight : weights_[k]) {
+                weight *= scale;
+            }
+        }
+
+        landmark_ = now;
+    }
+}
+}
@@ -0,0 +1,77 @@
+//
+// scores.hpp
+//
+// Scores holds the time-weighted votes of every song, artist,
+// and genre within a single session. Like Tally, it is kept up
+// to date on each vote, so reads never revisit the votes.
+//
+// Decayed scores are exact. Each vote is weighted by how long
+// after a fixed landmark it was cast, rather than every score
+// being decayed as time passes, so a vote touches only its own
+// entry. Reads scale by the time since the landmark, which moves
+// forward once the weights grow large.
+//
+// Trending scores are approximate. Upvotes are counted in a ring
+// of time buckets spanning the window, each a count-min sketch,
+// so memory does not grow with the catalog. Estimates may be too
+// high (when entities share counters), but never too low.
+//
+// Scores is **not** thread safe.
+//
+
+#ifndef skrillex_scores_hpp
+#define skrillex_scores_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "store/tally.hpp"
+
+namespace skrillex {
+namespace internal {
+    class Scores {
+    public:
+        static const int Buckets = 16;
+        static const int Depth   = 4;
+        static const int Width   = 1024;
+
+        // Times are in milliseconds.
+        Scores(int64_t halfLife, int64_t window);
+
+        // Adds votes to an entity, cast at the given time.
+        void apply(EntityKind kind, int id, int votes, int64_t now);
+
+        // Drops upvotes that have fallen out of the window.
+        void advance(int64_t now);
+
+        // The votes of an entity, each halved for every half life
+        // since it was cast.
+        double decayed(EntityKind kind, int id, int64_t now) const;
+
+        // The upvotes of an entity within the window, as of the
+        // last advance.
+        int trending(EntityKind kind, int id) const;
+
+        void clear();
+
+    private:
+        typedef std::vector<int> Sketch;
+
+        int slot(int row, EntityKind kind, int id) const;
+
+        // Rescales the weights so that the landmark is now.
+        void rebase(int64_t now);
+
+        int64_t half_life_;
+        int64_t landmark_;
+        std::vector<double> weights_[Tally::NumKinds];
+
+        int64_t bucket_length_;
+        int64_t bucket_;
+        Sketch  buckets_[Buckets];
+        Sketch  window_;
+    };
+}
+}
+
+#endif
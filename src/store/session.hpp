@@ -0,0 +1,97 @@
+//
+// session.hpp
+//
+// The in-memory state of an open session.
+//
+// Each session (room) has its own queue, buffer, and tallies,
+// each behind its own lock, so activity in one session never
+// contends with another.
+//
+
+#ifndef skrillex_session_hpp
+#define skrillex_session_hpp
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "skrillex/dbo.hpp"
+#include "store/scores.hpp"
+#include "store/tally.hpp"
+#include "util/bitmap.hpp"
+
+namespace skrillex {
+namespace internal {
+    // A row whose tallies, buffering, or catalog entry changed.
+    // Rows with row set must be re-read, not just re-tallied.
+    struct Change {
+        int        version;
+        EntityKind kind;
+        int        id;
+        bool       row;
+    };
+
+    struct Session {
+        Session(int64_t id, int64_t halfLife, int64_t trendingWindow)
+        : id(id)
+        , logged_votes(0)
+        , scores(halfLife, trendingWindow)
+        , log_start(0)
+        {
+        }
+
+        Session(const Session& other) = delete;
+
+        const int64_t id;
+
+        std::recursive_mutex queue_lock;
+        std::vector<Song>    queue;
+
+        std::mutex        buffer_lock;
+        Bitmap            buffer_ids;
+        std::vector<Song> buffer;
+
+        // Votes since the last snapshot are tracked alongside
+        // the tallies, and share the same lock.
+        std::mutex tally_lock;
+        Tally      tally;
+        int        logged_votes;
+
+        // Decayed and trending scores, which are kept only in
+        // memory. Also guarded by the tally lock.
+        Scores scores;
+
+        // The changes since log_start, oldest first, for delta
+        // reads. Also guarded by the tally lock.
+        std::deque<Change> changes;
+        int                log_start;
+
+        // When each song was last played, its plays within the
+        // played window (oldest first), and the songs they were
+        // of. Also guarded by the tally lock.
+        std::map<int, int64_t>                last_played;
+        std::deque<std::pair<int64_t, int>>   plays;
+        Bitmap                                played;
+
+        // For autofill: the songs it may pick by rank (as their
+        // negated score, then id), the plays of songs left out
+        // until their replay interval passes (oldest first), and
+        // the artists of the latest tracks. Buffered, unplayable
+        // and recently played songs are not ranked. Also guarded
+        // by the tally lock.
+        std::set<std::pair<int, int>>         ranking;
+        std::deque<std::pair<int64_t, int>>   resting;
+        std::deque<int>                       recent_artists;
+
+        // Songs with any votes, by their negated votes, then id,
+        // for searches. Also guarded by the tally lock.
+        std::set<std::pair<int, int>> voted;
+    };
+}
+}
+
+#endif
@@ -1,9 +1,11 @@
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 #include <sys/stat.h>
 
 #include "store/sqlite3_bootstrap.hpp"
+#include "util/hash.hpp"
 #include "sqlite3/sqlite3.h"
 
 using namespace std;
@@ -11,6 +13,19 @@ using namespace std;
 namespace skrillex {
 namespace internal {
     const vector<string> DROP_TABLES = {
+        "DROP TABLE IF EXISTS QueueEntries",
+        "DROP TABLE IF EXISTS BufferEntries",
+        "DROP TABLE IF EXISTS UnplayableSongs",
+
+        "DROP TABLE IF EXISTS VoteLog",
+        "DROP TABLE IF EXISTS TallySnapshots",
+        "DROP TABLE IF EXISTS SessionSnapshots",
+        "DROP TABLE IF EXISTS SessionPartitions",
+        "DROP TABLE IF EXISTS RolledUpSessions",
+        "DROP TABLE IF EXISTS ClosedSessions",
+        "DROP TABLE IF EXISTS Rollups",
+        "DROP TABLE IF EXISTS DefaultSession",
+
         "DROP TABLE IF EXISTS PlayHistory",
         "DROP TABLE IF EXISTS SongVotes",
         "DROP TABLE IF EXISTS ArtistVotes",
@@ -18,6 +33,7 @@ namespace internal {
 
         "DROP TABLE IF EXISTS SessionHistory",
         "DROP TABLE IF EXISTS UserActivity",
+        "DROP TABLE IF EXISTS Users",
 
         "DROP TABLE IF EXISTS Normalized",
 
@@ -46,12 +62,19 @@ namespace internal {
         "    FOREIGN KEY(GenreID)  REFERENCES Genres(GenreID)"
         ")",
 
+        // Reads filtered by genre or artist only visit their songs.
+        "CREATE INDEX IF NOT EXISTS SongsGenre  ON Songs(GenreID)",
+        "CREATE INDEX IF NOT EXISTS SongsArtist ON Songs(ArtistID)",
+
+        // Normalized keys (see mapper/transforms.hpp) are looked up by
+        // their hash, as the rowid. A key whose hash is taken has the
+        // next free one, so the key itself is kept to tell them apart.
         "CREATE TABLE IF NOT EXISTS Normalized ("
+        "    Hash       INTEGER PRIMARY KEY,"
         "    Normalized VARCHAR(255) NOT NULL,"
         "    SongID     INT,"
         "    ArtistID   INT,"
         "    GenreID    INT,"
-        "    PRIMARY KEY(Normalized),"
         "    FOREIGN KEY(SongID)    REFERENCES Songs(SongID),"
         "    FOREIGN KEY(ArtistID)  REFERENCES Artists(ArtistID),"
         "    FOREIGN KEY(GenreID)   REFERENCES Genres(GenreID)"
@@ -62,42 +85,54 @@ namespace internal {
         "    Date      DATETIME NOT NULL"
         ")",
 
+        // Users are known by their device id, but every other table
+        // refers to them by key, which is far smaller to store and
+        // index, and cheaper to compare.
+        "CREATE TABLE IF NOT EXISTS Users ("
+        "    UserKey INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "    UserID  VARCHAR(255) NOT NULL UNIQUE"
+        ")",
+
         "CREATE TABLE IF NOT EXISTS UserActivity ("
-        "    UserID     VARCHAR(255) NOT NULL PRIMARY KEY,"
-        "    LastActive DATETIME NOT NULL"
+        "    UserKey    INT NOT NULL,"
+        "    SessionID  INT NOT NULL,"
+        "    LastActive DATETIME NOT NULL,"
+        "    PRIMARY KEY(UserKey, SessionID),"
+        "    FOREIGN KEY(UserKey)   REFERENCES Users(UserKey),"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
         ")",
 
         "CREATE TABLE IF NOT EXISTS ArtistVotes ("
         "    ArtistID  INT NOT NULL,"
         "    SessionID INT NOT NULL,"
-        "    UserID    VARCHAR(255) NOT NULL,"
+        "    UserKey   INT NOT NULL,"
         "    Vote      INT NOT NULL DEFAULT 0,"
-        "    PRIMARY KEY(ArtistID, SessionID, UserID),"
+        "    PRIMARY KEY(ArtistID, SessionID, UserKey),"
         "    FOREIGN KEY(ArtistID)  REFERENCES Artists(ArtistID),"
         "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID),"
-        "    FOREIGN KEY(UserID)    REFERENCES UserActivity(UserID)"
+        "    FOREIGN KEY(UserKey, SessionID) REFERENCES UserActivity(UserKey, SessionID)"
         ")",
 
         "CREATE TABLE IF NOT EXISTS GenreVotes ("
         "    GenreID   INT NOT NULL,"
         "    SessionID INT NOT NULL,"
-        "    UserID    VARCHAR(255) NOT NULL,"
+        "    UserKey   INT NOT NULL,"
         "    Vote      INT NOT NULL DEFAULT 0,"
-        "    PRIMARY KEY(GenreID, SessionID, UserID),"
+        "    PRIMARY KEY(GenreID, SessionID, UserKey),"
         "    FOREIGN KEY(GenreID)   REFERENCES Genres(GenreID),"
         "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID),"
-        "    FOREIGN KEY(UserID)    REFERENCES UserActivity(UserID)"
+        "    FOREIGN KEY(UserKey, SessionID) REFERENCES UserActivity(UserKey, SessionID)"
         ")",
 
         "CREATE TABLE IF NOT EXISTS SongVotes ("
         "    SongID    INT NOT NULL,"
         "    SessionID INT NOT NULL,"
-        "    UserID    VARCHAR(255) NOT NULL,"
+        "    UserKey   INT NOT NULL,"
         "    Vote      INT NOT NULL DEFAULT 0,"
-        "    PRIMARY KEY(SongID, SessionID, UserID),"
+        "    PRIMARY KEY(SongID, SessionID, UserKey),"
         "    FOREIGN KEY(SongID)    REFERENCES Songs(SongID),"
         "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID),"
-        "    FOREIGN KEY(UserID)    REFERENCES UserActivity(UserID)"
+        "    FOREIGN KEY(UserKey, SessionID) REFERENCES UserActivity(UserKey, SessionID)"
         ")",
 
         "CREATE TABLE IF NOT EXISTS PlayHistory ("
@@ -105,9 +140,441 @@ namespace internal {
         "    SessionID INT NOT NULL,"
         "    Timestamp BIGINT NOT NULL,"
         "    PRIMARY KEY(SongID, SessionID)"
+        ")",
+
+        // Each session's queue and buffer, and the unplayable set,
+        // are mirrored here so they survive a restart. Position is
+        // the rowid, so appends are cheap, and a session's entries
+        // can be read back in a single sequential scan.
+        "CREATE TABLE IF NOT EXISTS QueueEntries ("
+        "    Position  INTEGER PRIMARY KEY,"
+        "    SongID    INT NOT NULL,"
+        "    SessionID INT NOT NULL DEFAULT 0,"
+        "    FOREIGN KEY(SongID)    REFERENCES Songs(SongID),"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        "CREATE INDEX IF NOT EXISTS QueueEntriesSession ON QueueEntries(SessionID, Position)",
+
+        "CREATE TABLE IF NOT EXISTS BufferEntries ("
+        "    Position  INTEGER PRIMARY KEY,"
+        "    SongID    INT NOT NULL,"
+        "    SessionID INT NOT NULL DEFAULT 0,"
+        "    FOREIGN KEY(SongID)    REFERENCES Songs(SongID),"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        "CREATE INDEX IF NOT EXISTS BufferEntriesSession ON BufferEntries(SessionID, Position)",
+
+        "CREATE TABLE IF NOT EXISTS UnplayableSongs ("
+        "    SongID INTEGER PRIMARY KEY,"
+        "    FOREIGN KEY(SongID) REFERENCES Songs(SongID)"
+        ")",
+
+        // A session's tallies are persisted as a snapshot, plus a log
+        // of every (count, vote) delta since that snapshot. Restoring
+        // a session is the snapshot with the log replayed on top.
+        //
+        // A session only has a row in SessionSnapshots once its tallies
+        // are being tracked. Sessions without one are rebuilt from the
+        // vote tables.
+        "CREATE TABLE IF NOT EXISTS SessionSnapshots ("
+        "    SessionID INTEGER PRIMARY KEY,"
+        "    Timestamp BIGINT NOT NULL,"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        "CREATE TABLE IF NOT EXISTS TallySnapshots ("
+        "    SessionID INT NOT NULL,"
+        "    Kind      INT NOT NULL,"
+        "    EntityID  INT NOT NULL,"
+        "    Count     INT NOT NULL,"
+        "    Votes     INT NOT NULL,"
+        "    PRIMARY KEY(SessionID, Kind, EntityID),"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        "CREATE TABLE IF NOT EXISTS VoteLog ("
+        "    Seq       INTEGER PRIMARY KEY,"
+        "    SessionID INT NOT NULL,"
+        "    Kind      INT NOT NULL,"
+        "    EntityID  INT NOT NULL,"
+        "    Count     INT NOT NULL,"
+        "    Votes     INT NOT NULL,"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        "CREATE INDEX IF NOT EXISTS VoteLogSession ON VoteLog(SessionID)",
+
+        // Sessions whose votes and play history live in their
+        // own file, rather than the tables above.
+        "CREATE TABLE IF NOT EXISTS SessionPartitions ("
+        "    SessionID INTEGER PRIMARY KEY,"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        // The count and vote totals of each entity, over every
+        // closed session (those listed in RolledUpSessions).
+        "CREATE TABLE IF NOT EXISTS Rollups ("
+        "    Kind     INT NOT NULL,"
+        "    EntityID INT NOT NULL,"
+        "    Count    INT NOT NULL,"
+        "    Votes    INT NOT NULL,"
+        "    PRIMARY KEY(Kind, EntityID)"
+        ")",
+
+        "CREATE TABLE IF NOT EXISTS RolledUpSessions ("
+        "    SessionID INTEGER PRIMARY KEY,"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        // Sessions that no store has open. Any other session may
+        // be open in another handle on the same file.
+        "CREATE TABLE IF NOT EXISTS ClosedSessions ("
+        "    SessionID INTEGER PRIMARY KEY,"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")",
+
+        // The session last opened as a store's default (a single
+        // row), whose queue and buffer the next default takes over.
+        "CREATE TABLE IF NOT EXISTS DefaultSession ("
+        "    Slot      INTEGER PRIMARY KEY CHECK (Slot = 0),"
+        "    SessionID INT NOT NULL,"
+        "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+        ")"
+    };
+
+    // The tables in a session partition. They mirror their
+    // counterparts above, less the foreign keys, which cannot
+    // reach across database files.
+    const vector<string> PARTITION_TABLES = {
+        "ArtistVotes ("
+        "    ArtistID  INT NOT NULL,"
+        "    SessionID INT NOT NULL,"
+        "    UserKey   INT NOT NULL,"
+        "    Vote      INT NOT NULL DEFAULT 0,"
+        "    PRIMARY KEY(ArtistID, SessionID, UserKey)"
+        ")",
+
+        "GenreVotes ("
+        "    GenreID   INT NOT NULL,"
+        "    SessionID INT NOT NULL,"
+        "    UserKey   INT NOT NULL,"
+        "    Vote      INT NOT NULL DEFAULT 0,"
+        "    PRIMARY KEY(GenreID, SessionID, UserKey)"
+        ")",
+
+        "SongVotes ("
+        "    SongID    INT NOT NULL,"
+        "    SessionID INT NOT NULL,"
+        "    UserKey   INT NOT NULL,"
+        "    Vote      INT NOT NULL DEFAULT 0,"
+        "    PRIMARY KEY(SongID, SessionID, UserKey)"
+        ")",
+
+        "PlayHistory ("
+        "    SongID    INT NOT NULL,"
+        "    SessionID INT NOT NULL,"
+        "    Timestamp BIGINT NOT NULL,"
+        "    PRIMARY KEY(SongID, SessionID)"
         ")"
     };
 
+    // The vote tables of a partition (the first entries of
+    // PARTITION_TABLES), and the column of the entity voted for.
+    const vector<pair<string, string>> PARTITION_VOTE_TABLES = {
+        { "ArtistVotes", "ArtistID" },
+        { "GenreVotes",  "GenreID" },
+        { "SongVotes",   "SongID" }
+    };
+
+    // The schema versions written by this build.
+    const int SCHEMA_VERSION    = 4;
+    const int PARTITION_VERSION = 1;
+
+    Status rehash_normalized(sqlite3* db);
+
+    // The queries of a migration, and a step that needs more than
+    // SQL (if any), run after them in the same transaction.
+    struct Migration {
+        vector<string> queries;
+        Status (*fixup)(sqlite3* db);
+    };
+
+    // MIGRATIONS[i] brings a schema from version i to i + 1. Each
+    // must work against any database created before it, including
+    // ones that are missing tables added since.
+    const vector<Migration> MIGRATIONS = {
+        // 1: Sessions have their own queue, buffer, and active users.
+        {{
+            "CREATE TABLE IF NOT EXISTS QueueEntries (Position INTEGER PRIMARY KEY, SongID INT NOT NULL)",
+            "CREATE TABLE IF NOT EXISTS BufferEntries (Position INTEGER PRIMARY KEY, SongID INT NOT NULL)",
+            "ALTER TABLE QueueEntries  ADD COLUMN SessionID INT NOT NULL DEFAULT 0",
+            "ALTER TABLE BufferEntries ADD COLUMN SessionID INT NOT NULL DEFAULT 0",
+
+            // The old queue belonged to whichever session was last open.
+            "UPDATE QueueEntries  SET SessionID = (SELECT COALESCE(MAX(SessionID), 0) FROM SessionHistory)",
+            "UPDATE BufferEntries SET SessionID = (SELECT COALESCE(MAX(SessionID), 0) FROM SessionHistory)",
+
+            // Users were active globally, so they are treated as active
+            // in every session they voted in.
+            "CREATE TABLE UserActivityMigration ("
+            "    UserID     VARCHAR(255) NOT NULL,"
+            "    SessionID  INT NOT NULL,"
+            "    LastActive DATETIME NOT NULL,"
+            "    PRIMARY KEY(UserID, SessionID)"
+            ")",
+            "INSERT INTO UserActivityMigration "
+            "SELECT Voters.UserID, Voters.SessionID, UserActivity.LastActive FROM ("
+            "    SELECT UserID, SessionID FROM SongVotes   UNION "
+            "    SELECT UserID, SessionID FROM ArtistVotes UNION "
+            "    SELECT UserID, SessionID FROM GenreVotes"
+            ") AS Voters "
+            "JOIN UserActivity ON Voters.UserID = UserActivity.UserID",
+            "DROP TABLE UserActivity",
+            "ALTER TABLE UserActivityMigration RENAME TO UserActivity"
+        }, nullptr},
+
+        // 2: Users are keyed by integers, rather than their device ids.
+        {{
+            "CREATE TABLE IF NOT EXISTS Users ("
+            "    UserKey INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "    UserID  VARCHAR(255) NOT NULL UNIQUE"
+            ")",
+            "INSERT OR IGNORE INTO Users (UserID) "
+            "SELECT UserID FROM UserActivity UNION "
+            "SELECT UserID FROM SongVotes    UNION "
+            "SELECT UserID FROM ArtistVotes  UNION "
+            "SELECT UserID FROM GenreVotes",
+
+            "CREATE TABLE UserActivityMigration ("
+            "    UserKey    INT NOT NULL,"
+            "    SessionID  INT NOT NULL,"
+            "    LastActive DATETIME NOT NULL,"
+            "    PRIMARY KEY(UserKey, SessionID),"
+            "    FOREIGN KEY(UserKey)   REFERENCES Users(UserKey),"
+            "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+            ")",
+            "INSERT INTO UserActivityMigration "
+            "SELECT Users.UserKey, T.SessionID, T.LastActive FROM UserActivity AS T JOIN Users ON Users.UserID = T.UserID",
+            "DROP TABLE UserActivity",
+            "ALTER TABLE UserActivityMigration RENAME TO UserActivity",
+
+            "CREATE TABLE ArtistVotesMigration ("
+            "    ArtistID  INT NOT NULL,"
+            "    SessionID INT NOT NULL,"
+            "    UserKey   INT NOT NULL,"
+            "    Vote      INT NOT NULL DEFAULT 0,"
+            "    PRIMARY KEY(ArtistID, SessionID, UserKey),"
+            "    FOREIGN KEY(ArtistID)  REFERENCES Artists(ArtistID),"
+            "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID),"
+            "    FOREIGN KEY(UserKey, SessionID) REFERENCES UserActivity(UserKey, SessionID)"
+            ")",
+            "INSERT INTO ArtistVotesMigration "
+            "SELECT T.ArtistID, T.SessionID, Users.UserKey, T.Vote FROM ArtistVotes AS T JOIN Users ON Users.UserID = T.UserID",
+            "DROP TABLE ArtistVotes",
+            "ALTER TABLE ArtistVotesMigration RENAME TO ArtistVotes",
+
+            "CREATE TABLE GenreVotesMigration ("
+            "    GenreID   INT NOT NULL,"
+            "    SessionID INT NOT NULL,"
+            "    UserKey   INT NOT NULL,"
+            "    Vote      INT NOT NULL DEFAULT 0,"
+            "    PRIMARY KEY(GenreID, SessionID, UserKey),"
+            "    FOREIGN KEY(GenreID)   REFERENCES Genres(GenreID),"
+            "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID),"
+            "    FOREIGN KEY(UserKey, SessionID) REFERENCES UserActivity(UserKey, SessionID)"
+            ")",
+            "INSERT INTO GenreVotesMigration "
+            "SELECT T.GenreID, T.SessionID, Users.UserKey, T.Vote FROM GenreVotes AS T JOIN Users ON Users.UserID = T.UserID",
+            "DROP TABLE GenreVotes",
+            "ALTER TABLE GenreVotesMigration RENAME TO GenreVotes",
+
+            "CREATE TABLE SongVotesMigration ("
+            "    SongID    INT NOT NULL,"
+            "    SessionID INT NOT NULL,"
+            "    UserKey   INT NOT NULL,"
+            "    Vote      INT NOT NULL DEFAULT 0,"
+            "    PRIMARY KEY(SongID, SessionID, UserKey),"
+            "    FOREIGN KEY(SongID)    REFERENCES Songs(SongID),"
+            "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID),"
+            "    FOREIGN KEY(UserKey, SessionID) REFERENCES UserActivity(UserKey, SessionID)"
+            ")",
+            "INSERT INTO SongVotesMigration "
+            "SELECT T.SongID, T.SessionID, Users.UserKey, T.Vote FROM SongVotes AS T JOIN Users ON Users.UserID = T.UserID",
+            "DROP TABLE SongVotes",
+            "ALTER TABLE SongVotesMigration RENAME TO SongVotes"
+        }, nullptr},
+
+        // 3: Normalized keys are looked up by their hash. The rows are
+        // copied over by rehash_normalized, as SQL cannot hash them.
+        {{
+            "ALTER TABLE Normalized RENAME TO NormalizedMigration",
+            "CREATE TABLE Normalized ("
+            "    Hash       INTEGER PRIMARY KEY,"
+            "    Normalized VARCHAR(255) NOT NULL,"
+            "    SongID     INT,"
+            "    ArtistID   INT,"
+            "    GenreID    INT,"
+            "    FOREIGN KEY(SongID)    REFERENCES Songs(SongID),"
+            "    FOREIGN KEY(ArtistID)  REFERENCES Artists(ArtistID),"
+            "    FOREIGN KEY(GenreID)   REFERENCES Genres(GenreID)"
+            ")"
+        }, rehash_normalized},
+
+        // 4: Sessions are marked closed. Until now, every session was
+        // taken to be closed when a store opened.
+        {{
+            "CREATE TABLE IF NOT EXISTS ClosedSessions ("
+            "    SessionID INTEGER PRIMARY KEY,"
+            "    FOREIGN KEY(SessionID) REFERENCES SessionHistory(SessionID)"
+            ")",
+            "INSERT OR IGNORE INTO ClosedSessions SELECT SessionID FROM SessionHistory"
+        }, nullptr}
+    };
+
+    Status run(sqlite3* db, const string& query) {
+        sqlite3_stmt* statement = 0;
+
+        int r = sqlite3_prepare_v2(db, query.c_str(), -1, &statement, 0);
+        if (r) {
+            return Status::Error(sqlite3_errmsg(db));
+        }
+
+        while ((r = sqlite3_step(statement)) == SQLITE_ROW) {
+        }
+
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db));
+        }
+
+        return Status::OK();
+    }
+
+    // Reads the first column of a single row query.
+    Status query_int(sqlite3* db, const string& query, int& result) {
+        sqlite3_stmt* statement = 0;
+
+        if (sqlite3_prepare_v2(db, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db));
+        }
+
+        int r = sqlite3_step(statement);
+        if (r == SQLITE_ROW) {
+            result = sqlite3_column_int(statement, 0);
+        }
+
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_ROW && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db));
+        }
+
+        return Status::OK();
+    }
+
+    // Moves the rows of NormalizedMigration into Normalized, under
+    // their hashes, probing past any hash that is already taken.
+    Status rehash_normalized(sqlite3* db) {
+        sqlite3_stmt* select = 0;
+        sqlite3_stmt* insert = 0;
+
+        if (sqlite3_prepare_v2(db, "SELECT Normalized, SongID, ArtistID, GenreID FROM NormalizedMigration", -1, &select, 0) ||
+            sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO Normalized VALUES (?, ?, ?, ?, ?)", -1, &insert, 0)) {
+            sqlite3_finalize(select);
+            return Status::Error(sqlite3_errmsg(db));
+        }
+
+        Status s;
+        int r = 0;
+        while (!s && (r = sqlite3_step(select)) == SQLITE_ROW) {
+            string key(reinterpret_cast<const char*>(sqlite3_column_text(select, 0)), sqlite3_column_bytes(select, 0));
+
+            for (uint64_t probe = fnv1a(key); ; probe++) {
+                sqlite3_reset(insert);
+                if (sqlite3_bind_int64(insert, 1, static_cast<int64_t>(probe)) ||
+                    sqlite3_bind_text(insert, 2, key.c_str(), key.size(), SQLITE_STATIC) ||
+                    sqlite3_bind_value(insert, 3, sqlite3_column_value(select, 1)) ||
+                    sqlite3_bind_value(insert, 4, sqlite3_column_value(select, 2)) ||
+                    sqlite3_bind_value(insert, 5, sqlite3_column_value(select, 3)) ||
+                    sqlite3_step(insert) != SQLITE_DONE) {
+                    s = Status::Error(sqlite3_errmsg(db));
+                    break;
+                }
+
+                if (sqlite3_changes(db)) {
+                    break;
+                }
+            }
+        }
+
+        if (!s && r != SQLITE_DONE) {
+            s = Status::Error(sqlite3_errmsg(db));
+        }
+
+        sqlite3_finalize(select);
+        sqlite3_finalize(insert);
+
+        if (s) {
+            return s;
+        }
+
+        return run(db, "DROP TABLE NormalizedMigration");
+    }
+
+    Status migrate(sqlite3* db) {
+        int version = 0;
+        int existing = 0;
+
+        Status s = query_int(db, "PRAGMA user_version", version);
+        if (s) {
+            return s;
+        }
+
+        // A database without any tables yet is created at
+        // the current version, and has nothing to migrate.
+        s = query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'Songs'", existing);
+        if (s) {
+            return s;
+        }
+
+        if (!existing || version >= SCHEMA_VERSION) {
+            return Status::OK();
+        }
+
+        if ((s = run(db, "BEGIN"))) {
+            return s;
+        }
+
+        for (int v = version; v < SCHEMA_VERSION && !s; v++) {
+            const Migration& migration = MIGRATIONS[v];
+            for (auto& query : migration.queries) {
+                if ((s = run(db, query))) {
+                    break;
+                }
+            }
+
+            if (!s && migration.fixup) {
+                s = migration.fixup(db);
+            }
+        }
+
+        if (s) {
+            run(db, "ROLLBACK");
+            return Status::Error("Could not migrate database: " + s.message());
+        }
+
+        s = run(db, "PRAGMA user_version = " + to_string(SCHEMA_VERSION));
+        if (s) {
+            run(db, "ROLLBACK");
+            return s;
+        }
+
+        return run(db, "COMMIT");
+    }
+
     bool exists(const std::string& name) {
         struct stat buffer;
         return (stat(name.c_str(), &buffer) == 0);
@@ -167,23 +634,96 @@ namespace internal {
             }
         }
 
+        // Bring an existing database up to date before creating
+        // any tables that are new to this version.
+        if ((s = migrate(db))) {
+            return s;
+        }
+
         // Create tables, if necessary
         for (auto& query : CREATE_TABLES) {
-            sqlite3_stmt* statement = 0;
+            if ((s = run(db, query))) {
+                return s;
+            }
+        }
+
+        return run(db, "PRAGMA user_version = " + to_string(SCHEMA_VERSION));
+    }
+
+    // Brings a partition written by an older build up to date.
+    // Its users are added to the main database's Users table.
+    Status migrate_partition(sqlite3* db, const string& schema) {
+        int version = 0;
+        int existing = 0;
+
+        Status s = query_int(db, "PRAGMA " + schema + ".user_version", version);
+        if (s) {
+            return s;
+        }
+
+        s = query_int(db, "SELECT COUNT(*) FROM " + schema + ".sqlite_master WHERE type = 'table' AND name = 'SongVotes'", existing);
+        if (s) {
+            return s;
+        }
+
+        if (!existing || version >= PARTITION_VERSION) {
+            return Status::OK();
+        }
 
-            r = sqlite3_prepare_v2(db, query.c_str(), -1, &statement, 0);
-            while ((r = sqlite3_step(statement)) == SQLITE_ROW) {
+        if ((s = run(db, "SAVEPOINT MigratePartition"))) {
+            return s;
+        }
+
+        // 1: Users are keyed by integers, rather than their device ids.
+        for (size_t i = 0; i < PARTITION_VOTE_TABLES.size() && !s; i++) {
+            const string& name   = PARTITION_VOTE_TABLES[i].first;
+            const string& column = PARTITION_VOTE_TABLES[i].second;
+            string table = schema + "." + name;
+
+            vector<string> queries = {
+                "CREATE TABLE " + table + "Migration" + PARTITION_TABLES[i].substr(name.size()),
+                "INSERT OR IGNORE INTO main.Users (UserID) SELECT UserID FROM " + table,
+                "INSERT INTO " + table + "Migration "
+                "SELECT T." + column + ", T.SessionID, Users.UserKey, T.Vote FROM " + table + " AS T "
+                "JOIN main.Users AS Users ON Users.UserID = T.UserID",
+                "DROP TABLE " + table,
+                "ALTER TABLE " + table + "Migration RENAME TO " + name
+            };
+
+            for (auto& query : queries) {
+                if ((s = run(db, query))) {
+                    break;
+                }
             }
+        }
 
-            if (r != SQLITE_DONE) {
-                return Status::Error(sqlite3_errmsg(db));
+        if (s) {
+            run(db, "ROLLBACK TO MigratePartition");
+            run(db, "RELEASE MigratePartition");
+            return Status::Error("Could not migrate partition: " + s.message());
+        }
+
+        return run(db, "RELEASE MigratePartition");
+    }
+
+    Status bootstrap_partition(sqlite3* db, const string& schema) {
+        Status s = migrate_partition(db, schema);
+        if (s) {
+            return s;
+        }
+
+        for (auto& table : PARTITION_TABLES) {
+            if ((s = run(db, "CREATE TABLE IF NOT EXISTS " + schema + "." + table))) {
+                return s;
             }
+        }
 
-            sqlite3_finalize(statement);
+        if ((s = run(db, "PRAGMA " + schema + ".user_version = " + to_string(PARTITION_VERSION)))) {
+            return s;
         }
 
-        return Status::OK();
+        // Partitions share the main file's (lack of) durability.
+        return run(db, "PRAGMA " + schema + ".synchronous = off");
     }
 }
 }
-
@@ -13,6 +13,10 @@ namespace internal {
             sqlite3*& db,
             bool create_if_missing,
             bool recreate);
+
+    // Creates the tables of a session partition, attached
+    // to db under the given schema name.
+    Status bootstrap_partition(sqlite3* db, const std::string& schema);
 }
 }
 
@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
 #include <iostream>
 #include <set>
 
 #include "skrillex/result_set.hpp"
 #include "sqlite3/sqlite3.h"
+#include "store/deadline.hpp"
 #include "store/sqlite3_store.hpp"
 #include "util/time.hpp"
 #include "mutator.hpp"
@@ -11,12 +15,281 @@ using namespace std;
 
 namespace skrillex {
 namespace internal {
+    // Indexed by EntityKind.
+    const string VOTE_TABLES[] = { "SongVotes", "ArtistVotes", "GenreVotes" };
+    const string ID_COLUMNS[]  = { "SongID", "ArtistID", "GenreID" };
+
+    // The most rows read back by id, rather than by a scan.
+    const size_t MAX_LOOKUP_IDS = 1000;
+
+    // Sorts (stable) and truncates results that were not
+    // ordered by the database.
+    template<typename T>
+    void sortAndLimit(vector<T>& data, const ReadOptions& options) {
+        switch (options.sort) {
+            case SortType::Counts:
+                stable_sort(data.begin(), data.end(), [](const T& a, const T& b) {
+                    return a.count > b.count;
+                });
+                break;
+            case SortType::Votes:
+                stable_sort(data.begin(), data.end(), [](const T& a, const T& b) {
+                    return a.votes > b.votes;
+                });
+                break;
+            case SortType::Decayed:
+            case SortType::Trending:
+            case SortType::Composite:
+                stable_sort(data.begin(), data.end(), [](const T& a, const T& b) {
+                    return a.score > b.score;
+                });
+                break;
+            default:
+                break;
+        }
+
+        if (options.result_limit > 0 && (int) data.size() > options.result_limit) {
+            data.erase(data.begin() + options.result_limit, data.end());
+        }
+    }
+
+    // Whether a read is sorted by a score only kept for open sessions.
+    bool scored(const ReadOptions& options) {
+        return options.sort == SortType::Decayed
+            || options.sort == SortType::Trending
+            || options.sort == SortType::Composite;
+    }
+
+    // Whether a read has predicates a delta cannot keep up with.
+    bool predicated(const ReadOptions& options) {
+        return !options.genre_ids.empty()
+            || !options.artist_ids.empty()
+            || !options.name_prefix.empty()
+            || options.min_votes != INT_MIN
+            || options.min_count > 0;
+    }
+
+    // Appends a number to a query.
+    void appendInt(QueryString& query, int64_t value) {
+        char number[24];
+        query.append(number, snprintf(number, sizeof(number), "%lld", (long long) value));
+    }
+
+    // Appends ids to a query, separated by commas.
+    void appendIds(QueryString& query, const vector<int>& ids) {
+        char id[16];
+        for (size_t i = 0; i < ids.size(); i++) {
+            query.append(id, snprintf(id, sizeof(id), i ? ",%d" : "%d", ids[i]));
+        }
+    }
+
+    // The conditions a read places on the catalog table of a kind,
+    // joined by AND, or empty if there are none. The name prefix
+    // is bound to :prefix (see bindPrefix).
+    QueryString catalogPredicates(EntityKind kind, const ReadOptions& options) {
+        const char* table = kind == EntityKind::Song ? "Songs" : kind == EntityKind::Artist ? "Artists" : "Genres";
+
+        QueryString predicates;
+        if (!options.genre_ids.empty() && kind != EntityKind::Artist) {
+            predicates.append(table).append(".GenreID IN (");
+            appendIds(predicates, options.genre_ids);
+            predicates.append(")");
+        }
+
+        if (!options.artist_ids.empty() && kind != EntityKind::Genre) {
+            predicates.append(predicates.empty() ? "" : " AND ").append(table).append(".ArtistID IN (");
+            appendIds(predicates, options.artist_ids);
+            predicates.append(")");
+        }
+
+        if (!options.name_prefix.empty()) {
+            predicates.append(predicates.empty() ? "" : " AND ").append("instr(").append(table).append(".Name, :prefix) = 1");
+        }
+
+        return predicates;
+    }
+
+    int bindPrefix(sqlite3_stmt* statement, const ReadOptions& options) {
+        int index = sqlite3_bind_parameter_index(statement, ":prefix");
+        if (!index) {
+            return SQLITE_OK;
+        }
+
+        return sqlite3_bind_text(statement, index, options.name_prefix.c_str(), -1, SQLITE_TRANSIENT);
+    }
+
+    // Drops rows below the minimum votes and counts of a read.
+    template<typename T>
+    void applyMinimums(vector<T>& data, const ReadOptions& options) {
+        if (options.min_votes == INT_MIN && options.min_count <= 0) {
+            return;
+        }
+
+        data.erase(remove_if(data.begin(), data.end(), [&options](const T& t) {
+            return t.votes < options.min_votes || t.count < options.min_count;
+        }), data.end());
+    }
+
+    // The HAVING clause for the minimums of an aggregating read.
+    QueryString havingMinimums(const ReadOptions& options) {
+        QueryString having;
+        if (options.min_votes == INT_MIN && options.min_count <= 0) {
+            return having;
+        }
+
+        char clause[64];
+        having.append(clause, snprintf(clause, sizeof(clause), "HAVING Votes >= %d AND Count >= %d ", options.min_votes, options.min_count));
+
+        return having;
+    }
+
+    // The catalog columns of a song read. Those a read does not
+    // want are NULL rather than left out, so that every read has
+    // the same layout (see decodeSong).
+    QueryString songColumns(int fields) {
+        QueryString columns = "Songs.SongID";
+        columns += fields & FieldNames      ? ", Songs.Name"                     : ", NULL";
+        columns += fields & FieldLastPlayed ? ", PlayHistory.Timestamp"          : ", NULL";
+        columns += fields & FieldArtist     ? ", Artists.ArtistID, Artists.Name" : ", NULL, NULL";
+        columns += fields & FieldGenre      ? ", Genres.GenreID, Genres.Name"    : ", NULL, NULL";
+
+        return columns;
+    }
+
+    // The joins the catalog columns of a song read need.
+    QueryString songJoins(int fields, const string& history, int64_t sessionId) {
+        QueryString joins;
+        if (fields & FieldArtist) {
+            joins += "LEFT JOIN Artists ON Songs.ArtistID = Artists.ArtistID ";
+        }
+
+        if (fields & FieldGenre) {
+            joins += "LEFT JOIN Genres  ON Songs.GenreID  = Genres.GenreID ";
+        }
+
+        if (fields & FieldLastPlayed) {
+            char session[24];
+            joins.append("LEFT JOIN ").append(history.c_str())
+                 .append(" AS PlayHistory ON Songs.SongID = PlayHistory.SongID AND PlayHistory.SessionID = ")
+                 .append(session, snprintf(session, sizeof(session), "%lld ", (long long) sessionId));
+        }
+
+        return joins;
+    }
+
+    // Reads a text column into a string, reusing its capacity.
+    void readText(sqlite3_stmt* statement, int column, string& text) {
+        const char* data = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+        if (data) {
+            text.assign(data, sqlite3_column_bytes(statement, column));
+        } else {
+            text.clear();
+        }
+    }
+
+    // Resets a row left over from an earlier read to a default one,
+    // keeping the capacity of its strings.
+    void resetRow(Artist& a) {
+        a = Artist();
+    }
+
+    void resetRow(Genre& g) {
+        g = Genre();
+    }
+
+    void resetRow(Song& s) {
+        string name = move(s.name);
+
+        s = Song();
+        s.name = move(name);
+        s.name.clear();
+    }
+
+    // The next row to fill when (re)filling a result set, which is
+    // one left over from its last read while there are any. Once
+    // filled, the set is cut down to the rows used.
+    template<typename T>
+    T& nextRow(vector<T>& rows, size_t& used) {
+        if (used < rows.size()) {
+            resetRow(rows[used]);
+        } else {
+            rows.emplace_back();
+        }
+
+        return rows[used++];
+    }
+
+    // Reads the name of an artist or genre, as the one interned
+    // for its id.
+    void readName(sqlite3_stmt* statement, int column, EntityKind kind, int id, Dictionary& dictionary, Name& name) {
+        const char* data = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+        dictionary.intern(kind, id, data, data ? sqlite3_column_bytes(statement, column) : 0, name);
+    }
+
+    // Reads the catalog columns of a song, skipping the text of
+    // those the read did not want.
+    void decodeSong(sqlite3_stmt* statement, int fields, Dictionary& dictionary, Song& s) {
+        s.id = sqlite3_column_int(statement, 0);
+
+        if (fields & FieldNames) {
+            readText(statement, 1, s.name);
+        }
+
+        if (fields & FieldLastPlayed) {
+            s.last_played = sqlite3_column_int64(statement, 2);
+        }
+
+        if (fields & FieldArtist) {
+            s.artist.id = sqlite3_column_int(statement, 3);
+            if (s.artist.id > 0) {
+                readName(statement, 4, EntityKind::Artist, s.artist.id, dictionary, s.artist.name);
+            }
+        }
+
+        if (fields & FieldGenre) {
+            s.genre.id = sqlite3_column_int(statement, 5);
+            if (s.genre.id > 0) {
+                readName(statement, 6, EntityKind::Genre, s.genre.id, dictionary, s.genre.name);
+            }
+        }
+    }
+
+    // The lower bound on UserActivity.LastActive for a read.
+    int64_t activeSince(const ReadOptions& options) {
+        if (options.inactivity_threshold == 0) {
+            return 0;
+        }
+
+        return timestamp() - options.inactivity_threshold;
+    }
+
     Sqlite3Store::Sqlite3Store()
     : db_(0)
+    , session_id_(0)
+    , partition_sessions_(false)
+    , partitioned_(false)
+    , snapshot_interval_(10000)
+    , version_(0)
+    , change_log_size_(4096)
+    , decay_half_life_(1800000)
+    , trending_window_(900000)
+    , autofill_(false)
+    , autofill_sort_(SortType::Counts)
+    , autofill_artist_gap_(3)
+    , autofill_replay_interval_(0)
+    , played_window_(3600000)
     {
     }
 
     Sqlite3Store::~Sqlite3Store() {
+        for (auto& entry : sessions_) {
+            lock_guard<mutex> lock(entry.second->tally_lock);
+            Status s = retire(*entry.second);
+            if (s != Status::OK()) {
+                cout << "Could not close session - " << s.message() << endl;
+            }
+        }
+
         if (db_) {
             int ret = sqlite3_close(db_);
             if (ret != SQLITE_OK) {
@@ -25,557 +298,3070 @@ namespace internal {
                 cout << "Code: " << ret << endl;
             }
         }
-    }
+    }
+
+    Status Sqlite3Store::open(const std::string& path, Options options) {
+        Status s = bootstrap(path, db_, options.create_if_missing, options.recreate);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        // Reads with a deadline are interrupted through this, checked
+        // every thousand or so virtual machine instructions.
+        sqlite3_progress_handler(db_, 1000, &Deadline::progress, nullptr);
+
+        path_               = path;
+        partition_sessions_ = options.partition_sessions;
+        snapshot_interval_  = options.snapshot_interval;
+        change_log_size_    = options.change_log_size;
+        decay_half_life_    = options.decay_half_life;
+        trending_window_    = options.trending_window;
+
+        autofill_                 = options.autofill;
+        autofill_sort_            = options.autofill_sort;
+        autofill_artist_gap_      = max(options.autofill_artist_gap, 0);
+        autofill_replay_interval_ = options.autofill_replay_interval;
+
+        played_window_ = options.played_window;
+
+        if ((s = recover())) {
+            return s;
+        }
+
+        // Sessions whose close did not make it into the rollups.
+        // Those left open by a crash are rolled up once they are
+        // restored and closed again, as another handle may still
+        // have them open.
+        return rollUpClosed();
+    }
+
+    Status Sqlite3Store::execute(const string& query, initializer_list<int64_t> params) {
+        return execute(query.c_str(), params);
+    }
+
+    Status Sqlite3Store::execute(const char* query, initializer_list<int64_t> params) {
+        sqlite3_stmt* statement = 0;
+
+        if (sqlite3_prepare_v2(db_, query, -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int i = 0;
+        for (int64_t param : params) {
+            if (sqlite3_bind_int64(statement, ++i, param)) {
+                sqlite3_finalize(statement);
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+        }
+
+        int r = sqlite3_step(statement);
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_OK && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::recover() {
+        sqlite3_stmt* statement = 0;
+
+        string query = "SELECT SongID FROM UnplayableSongs";
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        lock_guard<mutex> lock(unplayable_lock_);
+        unplayable_song_ids_.clear();
+
+        int result = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            unplayable_song_ids_.add(sqlite3_column_int(statement, 0));
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        query = "SELECT SessionID FROM SessionPartitions";
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+        partitions_.clear();
+
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            partitions_.insert(sqlite3_column_int64(statement, 0));
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        partitioned_ = !partitions_.empty();
+
+        query = "SELECT SongID, ArtistID, GenreID, Name FROM Songs";
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        lock_guard<mutex> catalog_lock(catalog_lock_);
+        songs_.clear();
+        song_artists_.clear();
+        song_genres_.clear();
+        song_names_.clear();
+        artist_names_.clear();
+        artist_songs_.clear();
+
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            indexSong(sqlite3_column_int(statement, 0), sqlite3_column_int(statement, 1), sqlite3_column_int(statement, 2),
+                      reinterpret_cast<const char*>(sqlite3_column_text(statement, 3)));
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        query = "SELECT ArtistID, Name FROM Artists";
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            artist_names_.add(sqlite3_column_int(statement, 0), reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        // Sorted now, rather than by the first search.
+        song_names_.merge();
+        artist_names_.merge();
+
+        return Status::OK();
+    }
+
+    void Sqlite3Store::indexSong(int songId, int artistId, int genreId, const string& name) {
+        if (songId <= 0) {
+            return;
+        }
+
+        if (songId >= (int) song_artists_.size()) {
+            song_artists_.resize(songId + 1, 0);
+            song_genres_.resize(songId + 1, 0);
+        }
+
+        // Songs without an artist or genre share the empty entry.
+        songs_.add(songId);
+        song_artists_[songId] = max(artistId, 0);
+        song_genres_[songId]  = max(genreId, 0);
+
+        song_names_.add(songId, name);
+        if (artistId > 0) {
+            if (artistId >= (int) artist_songs_.size()) {
+                artist_songs_.resize(artistId + 1);
+            }
+
+            artist_songs_[artistId].push_back(songId);
+        }
+    }
+
+    Status Sqlite3Store::loadQueue(Session& session) {
+        sqlite3_stmt* statement = 0;
+
+        // Both come back in one sequential read. The first column
+        // tags which structure the row belongs to, and the second
+        // keeps the queue and buffer in their original order.
+        string query =
+            "SELECT 0, QueueEntries.Position, Songs.SongID, Songs.Name, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.Name FROM QueueEntries "
+            "JOIN Songs        ON QueueEntries.SongID = Songs.SongID "
+            "LEFT JOIN Artists ON Songs.ArtistID = Artists.ArtistID "
+            "LEFT JOIN Genres  ON Songs.GenreID  = Genres.GenreID "
+            "WHERE QueueEntries.SessionID = ? "
+            "UNION ALL "
+            "SELECT 1, BufferEntries.Position, Songs.SongID, Songs.Name, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.Name FROM BufferEntries "
+            "JOIN Songs        ON BufferEntries.SongID = Songs.SongID "
+            "LEFT JOIN Artists ON Songs.ArtistID = Artists.ArtistID "
+            "LEFT JOIN Genres  ON Songs.GenreID  = Genres.GenreID "
+            "WHERE BufferEntries.SessionID = ? "
+            "ORDER BY 1, 2";
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int64(statement, 1, session.id) || sqlite3_bind_int64(statement, 2, session.id)) {
+            sqlite3_finalize(statement);
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        lock_guard<recursive_mutex> queue_lock(session.queue_lock);
+        lock_guard<mutex> buffer_lock(session.buffer_lock);
+
+        session.queue.clear();
+        session.buffer.clear();
+        session.buffer_ids.clear();
+
+        int result = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            Song s;
+            s.id          = sqlite3_column_int(statement, 2);
+            s.name        = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 3)));
+
+            s.artist.id   = sqlite3_column_int(statement, 4);
+            if (s.artist.id > 0) {
+                readName(statement, 5, EntityKind::Artist, s.artist.id, dictionary_, s.artist.name);
+            }
+
+            s.genre.id    = sqlite3_column_int(statement, 6);
+            if (s.genre.id > 0) {
+                readName(statement, 7, EntityKind::Genre, s.genre.id, dictionary_, s.genre.name);
+            }
+
+            if (sqlite3_column_int(statement, 0) == 0) {
+                session.queue.push_back(s);
+            } else {
+                session.buffer_ids.add(s.id);
+                session.buffer.push_back(s);
+            }
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        return Status::OK();
+    }
+
+    unique_lock<recursive_mutex> Sqlite3Store::lockPartitions() {
+        if (partitioned_) {
+            return unique_lock<recursive_mutex>(write_lock_);
+        }
+
+        return unique_lock<recursive_mutex>(write_lock_, defer_lock);
+    }
+
+    Status Sqlite3Store::attach(int64_t sessionId) {
+        if (attached_.find(sessionId) != attached_.end()) {
+            return Status::OK();
+        }
+
+        string schema = "s" + to_string(sessionId);
+
+        // Make room by detaching a partition no open session needs.
+        int limit = sqlite3_limit(db_, SQLITE_LIMIT_ATTACHED, -1);
+        if ((int) attached_.size() >= limit) {
+            auto it = attached_.begin();
+            while (it != attached_.end() && pinned_.find(*it) != pinned_.end()) {
+                it++;
+            }
+
+            if (it == attached_.end()) {
+                return Status::Error("Too many partitioned sessions open");
+            }
+
+            Status s = execute("DETACH DATABASE s" + to_string(*it));
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            attached_.erase(it);
+        }
+
+        sqlite3_stmt* statement = 0;
+        string query = "ATTACH DATABASE ? AS " + schema;
+        string file  = path_ + ".session-" + to_string(sessionId);
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_text(statement, 1, file.c_str(), file.size(), SQLITE_STATIC)) {
+            sqlite3_finalize(statement);
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int r = sqlite3_step(statement);
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_OK && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        attached_.insert(sessionId);
+
+        return bootstrap_partition(db_, schema);
+    }
+
+    Status Sqlite3Store::table(const string& name, int64_t sessionId, string& result) {
+        if (partitions_.find(sessionId) == partitions_.end()) {
+            result = name;
+            return Status::OK();
+        }
+
+        result = "s" + to_string(sessionId) + "." + name;
+        return attach(sessionId);
+    }
+
+    Status Sqlite3Store::historyTable(const string& name, int64_t sessionId, string& result) {
+        if (!partitioned_) {
+            result = name;
+            return Status::OK();
+        }
+
+        // Gather every session's rows into one temporary table, as
+        // there are more partitions than can be attached at once.
+        result = "temp.History" + name;
+
+        Status s = execute("DROP TABLE IF EXISTS " + result);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        if ((s = execute("CREATE TEMP TABLE History" + name + " AS SELECT * FROM main." + name + " WHERE SessionID != ?", { sessionId }))) {
+            return s;
+        }
+
+        for (int64_t partition : partitions_) {
+            if (partition == sessionId) {
+                continue;
+            }
+
+            string source;
+            if ((s = table(name, partition, source))) {
+                return s;
+            }
+
+            if ((s = execute("INSERT INTO " + result + " SELECT * FROM " + source))) {
+                return s;
+            }
+        }
+
+        return Status::OK();
+    }
+
+    shared_ptr<Session> Sqlite3Store::findSession(int64_t sessionId) {
+        lock_guard<mutex> lock(sessions_lock_);
+
+        if (sessionId == 0) {
+            sessionId = session_id_;
+        }
+
+        auto it = sessions_.find(sessionId);
+        if (it == sessions_.end()) {
+            return nullptr;
+        }
+
+        return it->second;
+    }
+
+    Status Sqlite3Store::findSession(int64_t sessionId, shared_ptr<Session>& session) {
+        session = findSession(sessionId);
+        if (!session) {
+            return Status::NotFound("Session is not open");
+        }
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::getSongs(ResultSet<Song>& set, ReadOptions options) {
+        // The temporaries of a read (its query, and filter masks)
+        // come from the thread's arena, freed at once when it ends.
+        Arena::Scope scope;
+
+        shared_ptr<Session> session = options.session_id >= 0 ? findSession(options.session_id) : nullptr;
+        if (session && options.inactivity_threshold == 0 && options.sort != SortType::None) {
+            if (options.sort == SortType::Composite) {
+                return getCompositeSongs(*session, set, options);
+            }
+
+            if (options.delta) {
+                bool applied = false;
+                Status s = getDelta(*session, EntityKind::Song, set, options, applied);
+                if (s != Status::OK() || applied) {
+                    return s;
+                }
+            }
+
+            return getSongsFromTallies(*session, set, options);
+        }
+
+        // Scores are only kept for the tallies of open sessions.
+        if (scored(options)) {
+            return Status::Error("Sort requires an open session, and no inactivity threshold");
+        }
+
+        shared_ptr<Session> current = options.session_id == -1 ? findSession(0) : nullptr;
+        if (current && options.inactivity_threshold == 0) {
+            Tally totals;
+            Status s = loadHistory(EntityKind::Song, current->id, totals);
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            return getSongsFromTallies(*current, set, options, &totals);
+        }
+
+        vector<Song>& set_data = ResultSetMutator::getVector<Song>(set);
+        ResultSetMutator::getVersion(set) = 0;
+
+        // Historical reads are filtered by the default session's
+        // buffer and plays.
+        shared_ptr<Session> buffered = session ? session : findSession(0);
+
+        ScratchVector<uint64_t> filtered;
+        filterMask(buffered.get(), options, filtered);
+
+        sqlite3_stmt* statement = 0;
+
+        int64_t sessionId = options.session_id;
+        if (sessionId <= 0) {
+            lock_guard<mutex> lock(sessions_lock_);
+            sessionId = session_id_;
+        }
+
+        auto partition_lock = lockPartitions();
+
+        string votes;
+        Status s = options.session_id != -1 ? table("SongVotes", sessionId, votes) : historyTable("SongVotes", sessionId, votes);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        string history;
+        if ((s = table("PlayHistory", sessionId, history))) {
+            return s;
+        }
+
+        // Votes are only aggregated if they are read, or ranked by.
+        bool aggregated = (options.fields & FieldCounts)
+            || options.sort == SortType::Counts
+            || options.sort == SortType::Votes
+            || predicated(options);
+
+        // Mirror, mirror, on the wall
+        // Who is the ugliest query, of them all
+        QueryString query = "SELECT " + songColumns(options.fields);
+        if (!aggregated) {
+            query += ", 0, 0 FROM Songs ";
+        } else {
+            query +=
+                ", COUNT(SongVotes.SongID) as Count, COALESCE(SUM(SongVotes.Vote), 0) as Votes FROM Songs "
+                "LEFT JOIN ";
+            query += votes.c_str();
+            query +=
+                " AS SongVotes ON Songs.SongID = SongVotes.SongID AND EXISTS ("
+                "    SELECT 1 FROM UserActivity"
+                "    WHERE UserActivity.UserKey = SongVotes.UserKey AND UserActivity.SessionID = SongVotes.SessionID"
+                "    AND UserActivity.LastActive > ?"
+                ") ";
+
+            // TODO: Proper semantics for last played.
+            if (options.session_id != -1) {
+                query += "AND SongVotes.SessionID = ? ";
+            } else {
+                query += "AND SongVotes.SessionID != ? ";
+            }
+        }
+
+        query += songJoins(options.fields, history, sessionId);
+
+        QueryString predicates = catalogPredicates(EntityKind::Song, options);
+        if (!predicates.empty()) {
+            query += "WHERE " + predicates + " ";
+        }
+
+        if (aggregated) {
+            query += "GROUP BY Songs.SongID " + havingMinimums(options);
+        }
+
+        switch (options.sort) {
+            case SortType::Counts:
+                query += " ORDER BY Count DESC";
+                break;
+            case SortType::Votes:
+                query += " ORDER BY Votes DESC";
+                break;
+            default:
+                break;
+        }
+
+        // Filtered rows are skipped as they are stepped, so a limit in
+        // SQL would come up short; the loop below stops at it instead.
+        if (options.result_limit > 0 && filtered.empty()) {
+            query += " LIMIT ";
+            appendInt(query, options.result_limit);
+        }
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (aggregated && sqlite3_bind_int64(statement, 1, activeSince(options))) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (aggregated && sqlite3_bind_int64(statement, 2, sessionId)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (bindPrefix(statement, options)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        bool completed = false;
+        size_t used = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            int id = sqlite3_column_int(statement, 0);
+
+            // If the returned ID is zero, then there are actually zero results. However,
+            // since we use COUNT(), a row will still be returned, so we must perform this check.
+            if (id == 0) {
+                completed = true;
+                break;
+            }
+
+            if (Bitmap::test(filtered, id)) {
+                continue;
+            }
+
+            Song& s = nextRow(set_data, used);
+            decodeSong(statement, options.fields, dictionary_, s);
+            s.count       = sqlite3_column_int(statement, 7);
+            s.votes       = sqlite3_column_int(statement, 8);
+
+            if (options.result_limit > 0 && used == (size_t) options.result_limit) {
+                completed = true;
+                break;
+            }
+        }
+
+        sqlite3_finalize(statement);
+        set_data.resize(used);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE && !completed) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+		return Status::OK();
+	}
+
+    Status Sqlite3Store::getArtists(ResultSet<Artist>& set, ReadOptions options) {
+        Arena::Scope scope;
+
+        shared_ptr<Session> session = options.session_id >= 0 ? findSession(options.session_id) : nullptr;
+        if (session && options.inactivity_threshold == 0 && options.sort != SortType::None) {
+            if (options.delta) {
+                bool applied = false;
+                Status s = getDelta(*session, EntityKind::Artist, set, options, applied);
+                if (s != Status::OK() || applied) {
+                    return s;
+                }
+            }
+
+            return getCountablesFromTallies(*session, EntityKind::Artist, set, options);
+        }
+
+        // Scores are only kept for the tallies of open sessions.
+        if (scored(options)) {
+            return Status::Error("Sort requires an open session, and no inactivity threshold");
+        }
+
+        shared_ptr<Session> current = options.session_id == -1 ? findSession(0) : nullptr;
+        if (current && options.inactivity_threshold == 0) {
+            Tally totals;
+            Status s = loadHistory(EntityKind::Artist, current->id, totals);
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            return getCountablesFromTallies(*current, EntityKind::Artist, set, options, &totals);
+        }
+
+        vector<Artist>& set_data = ResultSetMutator::getVector<Artist>(set);
+        ResultSetMutator::getVersion(set) = 0;
+
+        sqlite3_stmt* statement = 0;
+
+        int64_t sessionId = options.session_id;
+        if (sessionId <= 0) {
+            lock_guard<mutex> lock(sessions_lock_);
+            sessionId = session_id_;
+        }
+
+        auto partition_lock = lockPartitions();
+
+        string votes;
+        Status s = options.session_id != -1 ? table("ArtistVotes", sessionId, votes) : historyTable("ArtistVotes", sessionId, votes);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        QueryString query =
+            "SELECT Artists.ArtistID, " + QueryString(options.fields & FieldNames ? "Name" : "NULL") + ", COUNT(ArtistVotes.ArtistID) as Count, COALESCE(SUM(ArtistVotes.Vote), 0) as Votes FROM Artists "
+            "LEFT JOIN " + votes.c_str() + " AS ArtistVotes ON Artists.ArtistID = ArtistVotes.ArtistID AND EXISTS ("
+            "    SELECT 1 FROM UserActivity"
+            "    WHERE UserActivity.UserKey = ArtistVotes.UserKey AND UserActivity.SessionID = ArtistVotes.SessionID"
+            "    AND UserActivity.LastActive > ?"
+            ") ";
+
+        if (options.session_id != -1) {
+            query += "AND ArtistVotes.SessionID = ? ";
+        } else {
+            query += "AND ArtistVotes.SessionID != ? ";
+        }
+
+        QueryString predicates = catalogPredicates(EntityKind::Artist, options);
+        if (!predicates.empty()) {
+            query += "WHERE " + predicates + " ";
+        }
+
+        query += "GROUP BY Artists.ArtistID " + havingMinimums(options);
+
+        switch (options.sort) {
+            case SortType::Counts:
+                query += "ORDER BY Count DESC ";
+                break;
+            case SortType::Votes:
+                query += "ORDER BY Votes DESC ";
+                break;
+            default:
+                break;
+        }
+
+        if (options.result_limit > 0) {
+            query += "LIMIT ";
+            appendInt(query, options.result_limit);
+        }
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int64(statement, 1, activeSince(options))) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int64(statement, 2, sessionId)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (bindPrefix(statement, options)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        bool completed = false;
+        size_t used = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            int id = sqlite3_column_int(statement, 0);
+
+            // See; getSongs
+            if (id == 0) {
+                completed = true;
+                break;
+            }
+
+            Artist& a = nextRow(set_data, used);
+            a.id         = id;
+
+            if (options.fields & FieldNames) {
+                readName(statement, 1, EntityKind::Artist, a.id, dictionary_, a.name);
+            }
+
+            a.count      = sqlite3_column_int(statement, 2);
+            a.votes      = sqlite3_column_int(statement, 3);
+        }
+
+        sqlite3_finalize(statement);
+        set_data.resize(used);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE && !completed) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+		return Status::OK();
+	}
+    Status Sqlite3Store::getGenres(ResultSet<Genre>& set, ReadOptions options) {
+        Arena::Scope scope;
+
+        shared_ptr<Session> session = options.session_id >= 0 ? findSession(options.session_id) : nullptr;
+        if (session && options.inactivity_threshold == 0 && options.sort != SortType::None) {
+            if (options.delta) {
+                bool applied = false;
+                Status s = getDelta(*session, EntityKind::Genre, set, options, applied);
+                if (s != Status::OK() || applied) {
+                    return s;
+                }
+            }
+
+            return getCountablesFromTallies(*session, EntityKind::Genre, set, options);
+        }
+
+        // Scores are only kept for the tallies of open sessions.
+        if (scored(options)) {
+            return Status::Error("Sort requires an open session, and no inactivity threshold");
+        }
+
+        shared_ptr<Session> current = options.session_id == -1 ? findSession(0) : nullptr;
+        if (current && options.inactivity_threshold == 0) {
+            Tally totals;
+            Status s = loadHistory(EntityKind::Genre, current->id, totals);
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            return getCountablesFromTallies(*current, EntityKind::Genre, set, options, &totals);
+        }
+
+        vector<Genre>& set_data = ResultSetMutator::getVector<Genre>(set);
+        ResultSetMutator::getVersion(set) = 0;
+
+        sqlite3_stmt* statement = 0;
+
+        int64_t sessionId = options.session_id;
+        if (sessionId <= 0) {
+            lock_guard<mutex> lock(sessions_lock_);
+            sessionId = session_id_;
+        }
+
+        auto partition_lock = lockPartitions();
+
+        string votes;
+        Status s = options.session_id != -1 ? table("GenreVotes", sessionId, votes) : historyTable("GenreVotes", sessionId, votes);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        QueryString query = "SELECT Genres.GenreID, " + QueryString(options.fields & FieldNames ? "Name" : "NULL") + ", COUNT(GenreVotes.GenreID) as Count, COALESCE(SUM(GenreVotes.Vote), 0) as Votes FROM Genres "
+            "LEFT JOIN " + votes.c_str() + " AS GenreVotes ON Genres.GenreID = GenreVotes.GenreID AND EXISTS ("
+            "    SELECT 1 FROM UserActivity"
+            "    WHERE UserActivity.UserKey = GenreVotes.UserKey AND UserActivity.SessionID = GenreVotes.SessionID"
+            "    AND UserActivity.LastActive > ?"
+            ") ";
+
+        if (options.session_id != -1) {
+            query += "AND GenreVotes.SessionID = ? ";
+        } else {
+            query += "AND GenreVotes.SessionID != ? ";
+        }
+
+        QueryString predicates = catalogPredicates(EntityKind::Genre, options);
+        if (!predicates.empty()) {
+            query += "WHERE " + predicates + " ";
+        }
+
+        query += "GROUP BY Genres.GenreID " + havingMinimums(options);
+
+        switch (options.sort) {
+            case SortType::Counts:
+                query += "ORDER BY Count DESC ";
+                break;
+            case SortType::Votes:
+                query += "ORDER BY Votes DESC ";
+                break;
+            default:
+                break;
+        }
+
+        if (options.result_limit > 0) {
+            query += "LIMIT ";
+            appendInt(query, options.result_limit);
+        }
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int64(statement, 1, activeSince(options))) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int64(statement, 2, sessionId)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (bindPrefix(statement, options)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        bool completed = false;
+        size_t used = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            int id = sqlite3_column_int(statement, 0);
+
+            // See: getSongs
+            if (id == 0) {
+                completed = true;
+                break;
+            }
+
+            Genre& g = nextRow(set_data, used);
+            g.id    = id;
+
+            if (options.fields & FieldNames) {
+                readName(statement, 1, EntityKind::Genre, g.id, dictionary_, g.name);
+            }
+
+            g.count = sqlite3_column_int(statement, 2);
+            g.votes = sqlite3_column_int(statement, 3);
+        }
+
+        sqlite3_finalize(statement);
+        set_data.resize(used);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE && !completed) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+		return Status::OK();
+	}
+
+    Status Sqlite3Store::searchSongs(const string& query, ResultSet<Song>& set, ReadOptions options) {
+        Arena::Scope scope;
+
+        vector<Song>& set_data = ResultSetMutator::getVector<Song>(set);
+        set_data.clear();
+        ResultSetMutator::getVersion(set) = 0;
+
+        shared_ptr<Session> session = findSession(max(options.session_id, 0));
+        if (!session) {
+            return Status::Error("Search requires an open session");
+        }
+
+        string prefix = NameIndex::normalize(query);
+        if (prefix.empty()) {
+            return Status::OK();
+        }
+
+        // Filtered songs start out seen, so they are never matched.
+        ScratchVector<uint64_t> seen;
+        filterMask(session.get(), options, seen);
+
+        vector<int> matches;
+        auto match = [&seen, &matches](int id) {
+            if (seen.size() <= (size_t) id / 64) {
+                seen.resize(id / 64 + 1, 0);
+            }
+
+            uint64_t bit = uint64_t(1) << (id % 64);
+            if (!(seen[id / 64] & bit)) {
+                seen[id / 64] |= bit;
+                matches.push_back(id);
+            }
+        };
+
+        {
+            lock_guard<mutex> catalog_lock(catalog_lock_);
+
+            // The entries that match, counting every song of an artist.
+            size_t range = song_names_.count(prefix);
+            artist_names_.match(prefix, [this, &range](int artistId) {
+                if (artistId < (int) artist_songs_.size()) {
+                    range += artist_songs_[artistId].size();
+                }
+            });
+
+            // A broad prefix matches far more songs than are asked for.
+            // With matches spread evenly, walking every song in rank
+            // order until enough match takes about limit * size / range
+            // steps, rather than range steps to rank every match.
+            size_t limit = max(options.result_limit, 0);
+            if (limit > 0 && range * range > limit * song_names_.size()) {
+                lock_guard<mutex> lock(session->tally_lock);
+                walkRanking(*session, prefix, seen, limit, matches);
+            } else {
+                seen.reserve(song_artists_.size() / 64 + 1);
+
+                song_names_.match(prefix, match);
+                artist_names_.match(prefix, [this, &match](int artistId) {
+                    if (artistId < (int) artist_songs_.size()) {
+                        for (int id : artist_songs_[artistId]) {
+                            match(id);
+                        }
+                    }
+                });
+            }
+        }
+
+        searchRank(*session, EntityKind::Song, matches, options, set_data);
+
+        if (!(options.fields & ~FieldCounts)) {
+            return Status::OK();
+        }
+
+        return readSongRows(session->id, options.fields, set_data);
+    }
+
+    Status Sqlite3Store::searchArtists(const string& query, ResultSet<Artist>& set, ReadOptions options) {
+        vector<Artist>& set_data = ResultSetMutator::getVector<Artist>(set);
+        set_data.clear();
+        ResultSetMutator::getVersion(set) = 0;
+
+        shared_ptr<Session> session = findSession(max(options.session_id, 0));
+        if (!session) {
+            return Status::Error("Search requires an open session");
+        }
+
+        string prefix = NameIndex::normalize(query);
+        if (prefix.empty()) {
+            return Status::OK();
+        }
+
+        vector<int> matches;
+        {
+            lock_guard<mutex> catalog_lock(catalog_lock_);
+            artist_names_.match(prefix, [&matches](int id) {
+                matches.push_back(id);
+            });
+        }
+
+        sort(matches.begin(), matches.end());
+        matches.erase(unique(matches.begin(), matches.end()), matches.end());
+
+        searchRank(*session, EntityKind::Artist, matches, options, set_data);
+
+        if (set_data.empty() || !(options.fields & FieldNames)) {
+            return Status::OK();
+        }
+
+        map<int, Artist*> rows;
+        string ids;
+        for (auto& a : set_data) {
+            rows[a.id] = &a;
+            ids += (ids.empty() ? "" : ",") + to_string(a.id);
+        }
+
+        sqlite3_stmt* statement = 0;
+
+        string select = "SELECT ArtistID, Name FROM Artists WHERE ArtistID IN (" + ids + ")";
+
+        if (sqlite3_prepare_v2(db_, select.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            auto it = rows.find(sqlite3_column_int(statement, 0));
+            if (it != rows.end()) {
+                readName(statement, 1, EntityKind::Artist, it->first, dictionary_, it->second->name);
+            }
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        return Status::OK();
+    }
+
+    void Sqlite3Store::walkRanking(Session& session, const string& prefix, const ScratchVector<uint64_t>& filtered, size_t limit, vector<int>& matches) {
+        auto eligible = [&](int id) {
+            if (Bitmap::test(filtered, id)) {
+                return false;
+            }
+
+            return song_names_.matches(id, prefix)
+                || (id < (int) song_artists_.size() && artist_names_.matches(song_artists_[id], prefix));
+        };
+
+        // Songs with upvotes, best first.
+        auto it = session.voted.begin();
+        for (; it != session.voted.end() && it->first < 0 && matches.size() < limit; it++) {
+            if (eligible(it->second)) {
+                matches.push_back(it->second);
+            }
+        }
+
+        // Then songs without any, in id order.
+        for (size_t id = 1; id < song_artists_.size() && matches.size() < limit; id++) {
+            if (songs_.contains(id) && session.tally.votes(EntityKind::Song, id) == 0 && eligible(id)) {
+                matches.push_back(id);
+            }
+        }
+
+        // Then songs with downvotes, least first.
+        for (it = session.voted.lower_bound(make_pair(1, 0)); it != session.voted.end() && matches.size() < limit; it++) {
+            if (eligible(it->second)) {
+                matches.push_back(it->second);
+            }
+        }
+    }
+
+    template<typename T>
+    void Sqlite3Store::searchRank(Session& session, EntityKind kind, const vector<int>& matches, const ReadOptions& options, vector<T>& rows) {
+        vector<pair<int, int>> ranked;
+        ranked.reserve(matches.size());
+
+        {
+            lock_guard<mutex> lock(session.tally_lock);
+            for (int id : matches) {
+                ranked.push_back(make_pair(-session.tally.votes(kind, id), id));
+            }
+
+            size_t limit = options.result_limit > 0 ? min<size_t>(options.result_limit, ranked.size()) : ranked.size();
+            partial_sort(ranked.begin(), ranked.begin() + limit, ranked.end());
+            ranked.resize(limit);
+
+            rows.resize(ranked.size());
+            for (size_t i = 0; i < ranked.size(); i++) {
+                rows[i].id    = ranked[i].second;
+                rows[i].count = session.tally.count(kind, rows[i].id);
+                rows[i].votes = session.tally.votes(kind, rows[i].id);
+            }
+        }
+    }
+
+    Status Sqlite3Store::getSongsFromTallies(Session& session, ResultSet<Song>& set, ReadOptions options, const Tally* totals) {
+        Arena::Scope scope;
+
+        vector<Song>& set_data = ResultSetMutator::getVector<Song>(set);
+
+        // Taken before anything is read, so that any change the
+        // results miss is newer, and applied by the next delta.
+        int version = 0;
+        if (!totals) {
+            lock_guard<mutex> lock(session.tally_lock);
+            version = version_;
+        }
+
+        ScratchVector<uint64_t> filtered;
+        filterMask(&session, options, filtered);
+
+        sqlite3_stmt* statement = 0;
+
+        auto partition_lock = lockPartitions();
+
+        string history;
+        Status s = table("PlayHistory", session.id, history);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        QueryString query = "SELECT " + songColumns(options.fields) + " FROM Songs " + songJoins(options.fields, history, session.id);
+
+        QueryString predicates = catalogPredicates(EntityKind::Song, options);
+        if (!predicates.empty()) {
+            query += "WHERE " + predicates;
+        }
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (bindPrefix(statement, options)) {
+            sqlite3_finalize(statement);
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        size_t used = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            if (Bitmap::test(filtered, sqlite3_column_int(statement, 0))) {
+                continue;
+            }
+
+            decodeSong(statement, options.fields, dictionary_, nextRow(set_data, used));
+        }
+
+        sqlite3_finalize(statement);
+        set_data.resize(used);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        {
+            unique_lock<mutex> lock(session.tally_lock, defer_lock);
+            if (!totals) {
+                lock.lock();
+            }
+
+            const Tally& tally = totals ? *totals : session.tally;
+            for (auto& s : set_data) {
+                s.count = tally.count(EntityKind::Song, s.id);
+                s.votes = tally.votes(EntityKind::Song, s.id);
+            }
+
+            if (!totals) {
+                score(session, EntityKind::Song, set_data, options.sort);
+            }
+        }
+
+        applyMinimums(set_data, options);
+        sortAndLimit(set_data, options);
+        ResultSetMutator::getVersion(set) = version;
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::getCompositeSongs(Session& session, ResultSet<Song>& set, ReadOptions options) {
+        Arena::Scope scope;
+
+        vector<Song>& set_data = ResultSetMutator::getVector<Song>(set);
+        ResultSetMutator::getVersion(set) = 0;
+
+        ScratchVector<uint64_t> filtered;
+        filterMask(&session, options, filtered);
+
+        // Catalog predicates are matched by the database up front,
+        // through the indexes on Songs.
+        ScratchVector<uint64_t> matched;
+        bool matching = !catalogPredicates(EntityKind::Song, options).empty();
+        if (matching) {
+            Status s = matchSongs(options, matched);
+            if (s != Status::OK()) {
+                return s;
+            }
+        }
+
+        // A single pass over the catalog index scores every song.
+        vector<double> scores;
+        vector<int>    ranked;
+        {
+            lock_guard<mutex> catalog_lock(catalog_lock_);
+            lock_guard<mutex> lock(session.tally_lock);
+
+            session.tally.composite(song_artists_, song_genres_,
+                                    options.song_weight, options.artist_weight, options.genre_weight,
+                                    scores);
+
+            // Then the filters are applied a word at a time.
+            ScratchVector<uint64_t> eligible;
+            songs_.orInto(eligible);
+            for (size_t w = 0; w < eligible.size() && w < filtered.size(); w++) {
+                eligible[w] &= ~filtered[w];
+            }
+
+            if (matching) {
+                eligible.resize(min(eligible.size(), matched.size()));
+                for (size_t w = 0; w < eligible.size(); w++) {
+                    eligible[w] &= matched[w];
+                }
+            }
+
+            for (size_t w = 0; w < eligible.size(); w++) {
+                for (uint64_t bits = eligible[w]; bits; bits &= bits - 1) {
+                    size_t id = w * 64 + __builtin_ctzll(bits);
+                    if (id >= scores.size()) {
+                        continue;
+                    }
+
+                    if (session.tally.votes(EntityKind::Song, id) < options.min_votes ||
+                        session.tally.count(EntityKind::Song, id) < options.min_count) {
+                        continue;
+                    }
+
+                    ranked.push_back(id);
+                }
+            }
+        }
+
+        // Ties fall in catalog order, as they do for other sorts.
+        auto ranks = [&scores](int a, int b) {
+            return scores[a] != scores[b] ? scores[a] > scores[b] : a < b;
+        };
+
+        bool limited = options.result_limit > 0 && options.result_limit < (int) ranked.size();
+        if (limited) {
+            partial_sort(ranked.begin(), ranked.begin() + options.result_limit, ranked.end(), ranks);
+            ranked.erase(ranked.begin() + options.result_limit, ranked.end());
+        } else {
+            sort(ranked.begin(), ranked.end(), ranks);
+        }
+
+        if (ranked.empty()) {
+            set_data.clear();
+            return Status::OK();
+        }
+
+        size_t used = 0;
+        for (size_t i = 0; i < ranked.size(); i++) {
+            Song& s = nextRow(set_data, used);
+            s.id    = ranked[i];
+            s.score = scores[ranked[i]];
+        }
+        set_data.resize(used);
+
+        {
+            lock_guard<mutex> lock(session.tally_lock);
+            for (auto& s : set_data) {
+                s.count = session.tally.count(EntityKind::Song, s.id);
+                s.votes = session.tally.votes(EntityKind::Song, s.id);
+            }
+        }
+
+        // Ids and counts alone never touch the catalog tables.
+        if (!(options.fields & ~FieldCounts)) {
+            return Status::OK();
+        }
+
+        return readSongRows(session.id, options.fields, set_data);
+    }
+
+    Status Sqlite3Store::readSongRows(int64_t sessionId, int fields, vector<Song>& rows) {
+        Arena::Scope scope;
+
+        if (rows.empty()) {
+            return Status::OK();
+        }
+
+        int maxId = 0;
+        for (auto& row : rows) {
+            maxId = max(maxId, row.id);
+        }
+
+        vector<int> positions(maxId + 1, -1);
+        for (size_t i = 0; i < rows.size(); i++) {
+            positions[rows[i].id] = i;
+        }
+
+        sqlite3_stmt* statement = 0;
+
+        auto partition_lock = lockPartitions();
+
+        string history;
+        Status s = table("PlayHistory", sessionId, history);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        QueryString query = "SELECT " + songColumns(fields) + " FROM Songs " + songJoins(fields, history, sessionId);
+
+        // Past a point, a single scan beats looking up every id.
+        if (rows.size() <= MAX_LOOKUP_IDS) {
+            query += "WHERE Songs.SongID IN (";
+            for (size_t i = 0; i < rows.size(); i++) {
+                if (i) {
+                    query += ",";
+                }
+                appendInt(query, rows[i].id);
+            }
+            query += ")";
+        }
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            int id = sqlite3_column_int(statement, 0);
+            if (id <= maxId && positions[id] >= 0) {
+                decodeSong(statement, fields, dictionary_, rows[positions[id]]);
+            }
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        return Status::OK();
+    }
+
+    template<typename T>
+    Status Sqlite3Store::getCountablesFromTallies(Session& session, EntityKind kind, ResultSet<T>& set, ReadOptions options, const Tally* totals) {
+        Arena::Scope scope;
+
+        vector<T>& set_data = ResultSetMutator::getVector<T>(set);
+
+        int version = 0;
+        if (!totals) {
+            lock_guard<mutex> lock(session.tally_lock);
+            version = version_;
+        }
+
+        sqlite3_stmt* statement = 0;
+
+        QueryString name  = options.fields & FieldNames ? "Name" : "NULL";
+        QueryString query = kind == EntityKind::Artist
+            ? "SELECT ArtistID, " + name + " FROM Artists"
+            : "SELECT GenreID, "  + name + " FROM Genres";
+
+        QueryString predicates = catalogPredicates(kind, options);
+        if (!predicates.empty()) {
+            query += " WHERE " + predicates;
+        }
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (bindPrefix(statement, options)) {
+            sqlite3_finalize(statement);
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        size_t used = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            T& t = nextRow(set_data, used);
+            t.id   = sqlite3_column_int(statement, 0);
+            if (options.fields & FieldNames) {
+                readName(statement, 1, kind, t.id, dictionary_, t.name);
+            }
+        }
+
+        sqlite3_finalize(statement);
+        set_data.resize(used);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        {
+            unique_lock<mutex> lock(session.tally_lock, defer_lock);
+            if (!totals) {
+                lock.lock();
+            }
+
+            const Tally& tally = totals ? *totals : session.tally;
+            for (auto& t : set_data) {
+                t.count = tally.count(kind, t.id);
+                t.votes = tally.votes(kind, t.id);
+            }
+
+            if (!totals) {
+                score(session, kind, set_data, options.sort);
+            }
+        }
+
+        applyMinimums(set_data, options);
+        sortAndLimit(set_data, options);
+        ResultSetMutator::getVersion(set) = version;
+
+        return Status::OK();
+    }
+
+    template<typename T>
+    void Sqlite3Store::score(Session& session, EntityKind kind, vector<T>& rows, SortType sort) {
+        if (sort == SortType::Composite) {
+            for (auto& t : rows) {
+                t.score = t.votes;
+            }
+            return;
+        }
+
+        if (sort != SortType::Decayed && sort != SortType::Trending) {
+            return;
+        }
+
+        int64_t now = timestamp();
+        session.scores.advance(now);
+
+        for (auto& t : rows) {
+            t.score = sort == SortType::Decayed
+                ? session.scores.decayed(kind, t.id, now)
+                : session.scores.trending(kind, t.id);
+        }
+    }
+
+    template<typename T>
+    Status Sqlite3Store::getDelta(Session& session, EntityKind kind, ResultSet<T>& set, ReadOptions options, bool& applied) {
+        Arena::Scope scope;
+
+        vector<T>& set_data = ResultSetMutator::getVector<T>(set);
+        int&       version  = ResultSetMutator::getVersion(set);
+
+        // Scores and the played window move with time alone, so
+        // cannot be logged. Nor are rows matched against predicates.
+        applied = false;
+        if (version <= 0 || scored(options) || options.filter_played || predicated(options)) {
+            return Status::OK();
+        }
+
+        // The rows changed since the set was read, with their
+        // current tallies, and which of them must be re-read.
+        vector<T>     changed;
+        std::set<int> rows;
+        int           latest = 0;
+
+        {
+            lock_guard<mutex> lock(session.tally_lock);
+            if (version < session.log_start) {
+                return Status::OK();
+            }
+
+            std::set<int> ids;
+            for (auto it = session.changes.rbegin(); it != session.changes.rend() && it->version > version; it++) {
+                if (it->kind != kind) {
+                    continue;
+                }
+
+                ids.insert(it->id);
+                if (it->row) {
+                    rows.insert(it->id);
+                }
+            }
+
+            for (int id : ids) {
+                T t;
+                t.id    = id;
+                t.count = session.tally.count(kind, id);
+                t.votes = session.tally.votes(kind, id);
+                changed.push_back(t);
+            }
+
+            latest = version_;
+        }
+
+        // Filters only change before being logged, so they are at
+        // least as new as the tallies.
+        std::set<int> hidden;
+        if (kind == EntityKind::Song) {
+            ScratchVector<uint64_t> filtered;
+            filterMask(&session, options, filtered);
+
+            for (auto& t : changed) {
+                if (Bitmap::test(filtered, t.id)) {
+                    hidden.insert(t.id);
+                }
+            }
+        }
+
+        auto score = [&options](const T& t) {
+            return options.sort == SortType::Votes ? t.votes : t.count;
+        };
+
+        // Rows outside a truncated set ranked below its last row,
+        // and those that did not change still do.
+        bool truncated = options.result_limit > 0 && (int) set_data.size() >= options.result_limit;
+        T    boundary  = truncated ? set_data.back() : T();
+
+        // Ties fall in catalog order, as they do in a full read.
+        auto ranks = [&score](const T& a, const T& b) {
+            return score(a) != score(b) ? score(a) > score(b) : a.id < b.id;
+        };
+
+        // The rows that did not change keep their order, so those
+        // that did are taken out, and merged back in where they
+        // now rank. Changed rows are in id order.
+        auto byId = [](const T& a, const T& b) {
+            return a.id < b.id;
+        };
+
+        vector<T>    moved;
+        vector<bool> seen(changed.size());
+        set_data.erase(remove_if(set_data.begin(), set_data.end(), [&](T& t) {
+            auto c = lower_bound(changed.begin(), changed.end(), t, byId);
+            if (c == changed.end() || c->id != t.id) {
+                return false;
+            }
+
+            if (hidden.find(t.id) == hidden.end()) {
+                t.count = c->count;
+                t.votes = c->votes;
+                moved.push_back(t);
+            }
+
+            seen[c - changed.begin()] = true;
+            return true;
+        }), set_data.end());
+
+        std::set<int> entering;
+        for (size_t i = 0; i < changed.size(); i++) {
+            if (!seen[i] && hidden.find(changed[i].id) == hidden.end()) {
+                entering.insert(changed[i].id);
+                moved.push_back(changed[i]);
+            }
+        }
+
+        sort(moved.begin(), moved.end(), ranks);
+
+        size_t unchanged = set_data.size();
+        move(moved.begin(), moved.end(), back_inserter(set_data));
+        inplace_merge(set_data.begin(), set_data.begin() + unchanged, set_data.end(), ranks);
+
+        if (options.result_limit > 0 && (int) set_data.size() > options.result_limit) {
+            set_data.erase(set_data.begin() + options.result_limit, set_data.end());
+        }
+
+        // If a row could have been overtaken by one that did not
+        // change, that row is unknown, and so is the new ranking.
+        if (truncated && ((int) set_data.size() < options.result_limit || ranks(boundary, set_data.back()))) {
+            return Status::OK();
+        }
+
+        // Rows are only re-read for the catalog fields they hold.
+        bool catalog = options.fields & ~FieldCounts;
+        for (auto& t : set_data) {
+            if (!catalog || (entering.find(t.id) == entering.end() && rows.find(t.id) == rows.end())) {
+                continue;
+            }
+
+            Status s = refresh(session, t);
+            if (s != Status::OK()) {
+                return s;
+            }
+        }
+
+        version = latest;
+        applied = true;
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::refresh(Session& session, Song& song) {
+        Song s;
+        Status status = getSongFromId(s, song.id, session.id);
+        if (status != Status::OK()) {
+            return status;
+        }
+
+        song.name        = s.name;
+        song.last_played = s.last_played;
+        song.artist      = s.artist;
+        song.genre       = s.genre;
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::refresh(Session&, Artist& artist) {
+        sqlite3_stmt* statement = 0;
+
+        string query = "SELECT Name FROM Artists WHERE ArtistID = ?";
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int(statement, 1, artist.id)) {
+            sqlite3_finalize(statement);
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int r = sqlite3_step(statement);
+        if (r == SQLITE_ROW) {
+            readName(statement, 0, EntityKind::Artist, artist.id, dictionary_, artist.name);
+        }
+
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_ROW && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::refresh(Session&, Genre& genre) {
+        sqlite3_stmt* statement = 0;
+
+        string query = "SELECT Name FROM Genres WHERE GenreID = ?";
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int(statement, 1, genre.id)) {
+            sqlite3_finalize(statement);
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int r = sqlite3_step(statement);
+        if (r == SQLITE_ROW) {
+            readName(statement, 0, EntityKind::Genre, genre.id, dictionary_, genre.name);
+        }
+
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_ROW && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        return Status::OK();
+    }
+
+    void Sqlite3Store::logChange(Session& session, EntityKind kind, int id, bool row) {
+        session.changes.push_back(Change{ ++version_, kind, id, row });
+
+        while (session.changes.size() > change_log_size_) {
+            session.log_start = session.changes.front().version;
+            session.changes.pop_front();
+        }
+    }
+
+    void Sqlite3Store::logCatalogChange(EntityKind kind, int id, bool added) {
+        vector<shared_ptr<Session>> sessions;
+        {
+            lock_guard<mutex> lock(sessions_lock_);
+            for (auto& entry : sessions_) {
+                sessions.push_back(entry.second);
+            }
+        }
+
+        for (auto& session : sessions) {
+            lock_guard<mutex> lock(session->tally_lock);
+            logChange(*session, kind, id, true);
+
+            if (autofill_ && kind == EntityKind::Song) {
+                if (added) {
+                    session->ranking.insert(make_pair(0, id));
+                } else {
+                    session->ranking.erase(make_pair(-autofillScore(session->tally, id), id));
+                }
+            }
+        }
+    }
+
+    Status Sqlite3Store::loadPlays(Session& session) {
+        vector<pair<int64_t, int>> plays;
+
+        {
+            sqlite3_stmt* statement = 0;
+
+            auto partition_lock = lockPartitions();
+
+            string history;
+            Status s = table("PlayHistory", session.id, history);
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            string query = "SELECT SongID, Timestamp FROM " + history + " WHERE SessionID = ? ORDER BY Timestamp";
+
+            if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+
+            if (sqlite3_bind_int64(statement, 1, session.id)) {
+                sqlite3_finalize(statement);
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+
+            int result = 0;
+            while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+                plays.push_back(make_pair(sqlite3_column_int64(statement, 1), sqlite3_column_int(statement, 0)));
+            }
+
+            sqlite3_finalize(statement);
+
+            if (result != SQLITE_OK && result != SQLITE_DONE) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+        }
+
+        lock_guard<mutex> lock(session.tally_lock);
+        for (auto& play : plays) {
+            recordPlay(session, play.second, play.first);
+        }
+
+        expirePlays(session, timestamp());
+
+        return Status::OK();
+    }
+
+    void Sqlite3Store::recordPlay(Session& session, int songId, int64_t timestamp) {
+        session.last_played[songId] = timestamp;
+        session.plays.push_back(make_pair(timestamp, songId));
+        session.played.add(songId);
+
+        if (autofill_) {
+            session.ranking.erase(make_pair(-autofillScore(session.tally, songId), songId));
+
+            if (autofill_replay_interval_ > 0) {
+                session.resting.push_back(make_pair(timestamp, songId));
+            }
+        }
+
+        expirePlays(session, timestamp);
+    }
+
+    void Sqlite3Store::expirePlays(Session& session, int64_t now) {
+        while (!session.plays.empty() && session.plays.front().first <= now - played_window_) {
+            pair<int64_t, int> play = session.plays.front();
+            session.plays.pop_front();
+
+            // A later play keeps the song in the window.
+            if (session.last_played[play.second] <= play.first) {
+                session.played.remove(play.second);
+            }
+        }
+    }
+
+    void Sqlite3Store::filterMask(Session* session, const ReadOptions& options, ScratchVector<uint64_t>& mask) {
+        mask.clear();
+
+        if (options.filter_unplayable) {
+            lock_guard<mutex> lock(unplayable_lock_);
+            unplayable_song_ids_.orInto(mask);
+        }
+
+        if (!session) {
+            return;
+        }
+
+        if (options.filter_buffered) {
+            lock_guard<mutex> lock(session->buffer_lock);
+            session->buffer_ids.orInto(mask);
+        }
+
+        if (options.filter_played) {
+            lock_guard<mutex> lock(session->tally_lock);
+            expirePlays(*session, timestamp());
+            session->played.orInto(mask);
+        }
+    }
+
+    Status Sqlite3Store::matchSongs(const ReadOptions& options, ScratchVector<uint64_t>& mask) {
+        Arena::Scope scope;
+
+        mask.clear();
+
+        sqlite3_stmt* statement = 0;
+
+        QueryString query = "SELECT SongID FROM Songs WHERE " + catalogPredicates(EntityKind::Song, options);
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (bindPrefix(statement, options)) {
+            sqlite3_finalize(statement);
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int result = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            size_t id = sqlite3_column_int(statement, 0);
+            if (mask.size() <= id / 64) {
+                mask.resize(id / 64 + 1, 0);
+            }
+
+            mask[id / 64] |= uint64_t(1) << (id % 64);
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        return Status::OK();
+    }
+
+    void Sqlite3Store::loadAutofill(Session& session) {
+        Arena::Scope scope;
+
+        lock_guard<mutex> buffer_lock(session.buffer_lock);
+        lock_guard<mutex> tally_lock(session.tally_lock);
+
+        // The latest tracks are those played, then those buffered.
+        vector<int> tracks;
+        for (auto& song : session.buffer) {
+            tracks.push_back(song.id);
+        }
+
+        vector<pair<int64_t, int>> played;
+        for (auto& entry : session.last_played) {
+            played.push_back(make_pair(entry.second, entry.first));
+        }
+        sort(played.begin(), played.end());
+
+        size_t skip = played.size() + tracks.size() > autofill_artist_gap_ ? played.size() + tracks.size() - autofill_artist_gap_ : 0;
+        for (size_t i = skip; i < played.size() + tracks.size(); i++) {
+            int songId = i < played.size() ? played[i].second : tracks[i - played.size()];
+            session.recent_artists.push_back(songId < (int) song_artists_.size() ? song_artists_[songId] : 0);
+        }
+
+        int64_t now = timestamp();
+        rankRested(session, now);
+
+        ScratchVector<uint64_t> songs;
+        songs_.orInto(songs);
+        for (size_t w = 0; w < songs.size(); w++) {
+            for (uint64_t bits = songs[w]; bits; bits &= bits - 1) {
+                rank(session, w * 64 + __builtin_ctzll(bits), now);
+            }
+        }
+    }
+
+    int Sqlite3Store::autofillScore(const Tally& tally, int songId) {
+        return autofill_sort_ == SortType::Votes
+            ? tally.votes(EntityKind::Song, songId)
+            : tally.count(EntityKind::Song, songId);
+    }
+
+    void Sqlite3Store::rank(Session& session, int songId, int64_t now) {
+        if (session.buffer_ids.contains(songId)) {
+            return;
+        }
+
+        auto played = session.last_played.find(songId);
+        if (played != session.last_played.end() &&
+            (autofill_replay_interval_ == 0 || now - played->second < autofill_replay_interval_)) {
+            return;
+        }
+
+        {
+            lock_guard<mutex> lock(unplayable_lock_);
+            if (unplayable_song_ids_.contains(songId)) {
+                return;
+            }
+        }
+
+        session.ranking.insert(make_pair(-autofillScore(session.tally, songId), songId));
+    }
+
+    void Sqlite3Store::rankRested(Session& session, int64_t now) {
+        while (!session.resting.empty() && session.resting.front().first <= now - autofill_replay_interval_) {
+            pair<int64_t, int> play = session.resting.front();
+            session.resting.pop_front();
+
+            // A later play rests the song again.
+            if (session.last_played[play.second] <= play.first) {
+                rank(session, play.second, now);
+            }
+        }
+    }
+
+    int Sqlite3Store::pickNext(Session& session) {
+        lock_guard<mutex> buffer_lock(session.buffer_lock);
+        lock_guard<mutex> tally_lock(session.tally_lock);
+
+        rankRested(session, timestamp());
+
+        // Only eligible songs are ranked, so the only ones visited
+        // above the pick are by the artists of the latest tracks.
+        for (auto& entry : session.ranking) {
+            int id = entry.second;
+
+            int artist = id < (int) song_artists_.size() ? song_artists_[id] : 0;
+            if (artist > 0 && find(session.recent_artists.begin(), session.recent_artists.end(), artist) != session.recent_artists.end()) {
+                continue;
+            }
+
+            return id;
+        }
+
+        return 0;
+    }
+
+    Status Sqlite3Store::getSongFromId(Song& s, int songId) {
+        int64_t sessionId = 0;
+        getSession(sessionId);
+
+        return getSongFromId(s, songId, sessionId);
+    }
+
+    Status Sqlite3Store::getSongFromId(Song& s, int songId, int64_t sessionId) {
+        sqlite3_stmt* statement = 0;
+
+        auto partition_lock = lockPartitions();
+
+        string history;
+        Status status = table("PlayHistory", sessionId, history);
+        if (status != Status::OK()) {
+            return status;
+        }
+
+        string query =
+            "SELECT Songs.SongID, Songs.Name, PlayHistory.Timestamp, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.Name FROM Songs "
+            "LEFT JOIN Artists ON Songs.ArtistID = Artists.ArtistID "
+            "LEFT JOIN Genres  ON Songs.GenreID  = Genres.GenreID "
+            "LEFT JOIN " + history + " AS PlayHistory ON Songs.SongID = PlayHistory.SongID AND PlayHistory.SessionID = " + to_string(sessionId) + " "
+            "WHERE Songs.SongID = " + to_string(songId);
+
+        int result = 0;
+        s.id = -1;
+
+        sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0);
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            s.id          = sqlite3_column_int(statement, 0);
+            s.name        = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
+            s.last_played = sqlite3_column_int64(statement, 2);
+
+            s.artist.id   = sqlite3_column_int(statement, 3);
+            if (s.artist.id > 0) {
+                readName(statement, 4, EntityKind::Artist, s.artist.id, dictionary_, s.artist.name);
+            }
+
+            s.genre.id    = sqlite3_column_int(statement, 5);
+            if (s.genre.id > 0) {
+                readName(statement, 6, EntityKind::Genre, s.genre.id, dictionary_, s.genre.name);
+            }
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+		if (s.id == -1) {
+            return Status::NotFound("Could not find song");
+        }
+
+		return Status::OK();
+	}
+
+    Status Sqlite3Store::getPlayHistory(ResultSet<Song>& set, ReadOptions options) {
+        vector<Song>& set_data =  ResultSetMutator::getVector<Song>(set);
+        set_data.clear();
+        ResultSetMutator::getVersion(set) = 0;
+
+        sqlite3_stmt* statement = 0;
+
+        string query =
+            "SELECT Songs.SongID, Songs.Name, Date, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.NAME "
+            "LEFT JOIN Artists ON Songs.ArtistID = Artists.ArtistID "
+            "LEFT JOIN Genres  ON Songs.GenreID  = Genres.GenreID "
+            "JOIN PlayHistory  ON Songs.SongID   = PlayHistory.SongID "
+            "ORDER BY DESC Timestamp";
+
+        if (options.result_limit > 0) {
+            query += " LIMIT " + to_string(options.result_limit);
+        }
+
+        int result = 0;
+        sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0);
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            Song s;
+
+            s.id          = sqlite3_column_int(statement, 0);
+            s.name        = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
+            s.count       = sqlite3_column_int(statement, 2);
+            s.votes       = sqlite3_column_int(statement, 3);
+            s.last_played = sqlite3_column_int64(statement, 4);
+
+            s.artist.id   = sqlite3_column_int(statement, 5);
+            if (s.artist.id > 0) {
+                readName(statement, 6, EntityKind::Artist, s.artist.id, dictionary_, s.artist.name);
+            }
+
+            s.genre.id    = sqlite3_column_int(statement, 7);
+            if (s.genre.id > 0) {
+                readName(statement, 8, EntityKind::Genre, s.genre.id, dictionary_, s.genre.name);
+            }
+
+            set_data.push_back(move(s));
+        }
+
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+		return Status::OK();
+    }
+
+    Status Sqlite3Store::setQueue(const vector<int>& songIds, WriteOptions options) {
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        lock_guard<recursive_mutex> lock(session->queue_lock);
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+
+        // The savepoint keeps the persisted queue from ending up
+        // half replaced if one of the songs cannot be found.
+        if ((s = execute("SAVEPOINT SetQueue"))) {
+            return s;
+        }
+
+        vector<Song> previous;
+        previous.swap(session->queue);
+
+        s = execute("DELETE FROM `QueueEntries` WHERE SessionID = ?", { session->id });
+        for (auto it = songIds.begin(); it != songIds.end() && s == Status::OK(); it++) {
+            s = queueSong(*it, options);
+        }
+
+        if (s != Status::OK()) {
+            session->queue.swap(previous);
+            execute("ROLLBACK TO SetQueue");
+            execute("RELEASE SetQueue");
+            return s;
+        }
+
+        return execute("RELEASE SetQueue");
+    }
+
+    Status Sqlite3Store::getQueue(ResultSet<Song>& set, ReadOptions options) {
+        // The queue is persisted in QueueEntries, but the session
+        // queue is always kept in sync, so reads never touch the db.
+        vector<Song>& set_data = ResultSetMutator::getVector(set);
+        ResultSetMutator::getVersion(set) = 0;
+
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        lock_guard<recursive_mutex> lock(session->queue_lock);
+        set_data.assign(session->queue.begin(), session->queue.end());
+
+		return Status::OK();
+	}
+    Status Sqlite3Store::queueSong(int songId, WriteOptions options) {
+        {
+            lock_guard<mutex> lock(unplayable_lock_);
+            if (unplayable_song_ids_.contains(songId)) {
+                return Status::OK();
+            }
+        }
+
+        shared_ptr<Session> session;
+        Status status = findSession(options.session_id, session);
+        if (status != Status::OK()) {
+            return status;
+        }
+
+        Song s;
+		status = getSongFromId(s, songId, session->id);
+		if (status != Status::OK()){
+			return status;
+		}
+
+        lock_guard<recursive_mutex> lock(session->queue_lock);
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+
+        status = execute("INSERT INTO `QueueEntries` (`SongID`, `SessionID`) VALUES (?, ?)", { songId, session->id });
+        if (status != Status::OK()) {
+            return status;
+        }
+
+        session->queue.push_back(s);
+
+		return Status::OK();
+	}
+    Status Sqlite3Store::clearQueue(WriteOptions options) {
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        lock_guard<recursive_mutex> lock(session->queue_lock);
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+
+        s = execute("DELETE FROM `QueueEntries` WHERE SessionID = ?", { session->id });
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        session->queue.clear();
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::getBuffer(ResultSet<Song>& set, ReadOptions options) {
+        vector<Song>& set_data = ResultSetMutator::getVector(set);
+        ResultSetMutator::getVersion(set) = 0;
+
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        lock_guard<mutex> lock(session->buffer_lock);
+        set_data.assign(session->buffer.begin(), session->buffer.end());
+
+		return Status::OK();
+	}
+
+    Status Sqlite3Store::bufferNext(WriteOptions options) {
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        unique_lock<mutex> catalog_lock(catalog_lock_, defer_lock);
+        if (autofill_) {
+            catalog_lock.lock();
+        }
+
+        lock_guard<recursive_mutex> queue_lock(session->queue_lock);
+
+        if (session->queue.empty()) {
+            int songId = autofill_ ? pickNext(*session) : 0;
+            if (!songId) {
+                return Status::Error("Queue empty");
+            }
+
+            catalog_lock.unlock();
+            if ((s = queueSong(songId, options))) {
+                return s;
+            }
+        }
+
+        if (catalog_lock) {
+            catalog_lock.unlock();
+        }
+
+        lock_guard<mutex> buffer_lock(session->buffer_lock);
+        unique_lock<recursive_mutex> write_lock(write_lock_);
+
+        if ((s = execute("SAVEPOINT BufferNext"))) {
+            return s;
+        }
+
+        s = execute(
+            "INSERT INTO `BufferEntries` (`SongID`, `SessionID`) "
+            "SELECT SongID, SessionID FROM QueueEntries WHERE SessionID = ? ORDER BY Position LIMIT 1", { session->id });
+        if (s == Status::OK()) {
+            s = execute(
+                "DELETE FROM `QueueEntries` WHERE Position = "
+                "(SELECT MIN(Position) FROM QueueEntries WHERE SessionID = ?)", { session->id });
+        }
+
+        if (s != Status::OK()) {
+            execute("ROLLBACK TO BufferNext");
+            execute("RELEASE BufferNext");
+            return s;
+        }
+
+        s = execute("RELEASE BufferNext");
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        write_lock.unlock();
+
+        int songId   = session->queue.begin()->id;
+        int artistId = session->queue.begin()->artist.id;
+
+        copy(session->queue.begin(), session->queue.begin() + 1, back_inserter(session->buffer));
+        session->buffer_ids.add(songId);
+        session->queue.erase(session->queue.begin());
+
+        lock_guard<mutex> tally_lock(session->tally_lock);
+        logChange(*session, EntityKind::Song, songId, false);
+
+        if (autofill_) {
+            session->ranking.erase(make_pair(-autofillScore(session->tally, songId), songId));
+
+            session->recent_artists.push_back(artistId);
+            while (session->recent_artists.size() > autofill_artist_gap_) {
+                session->recent_artists.pop_front();
+            }
+        }
+
+		return Status::OK();
+	}
+
+    Status Sqlite3Store::removeFromBuffer(int songId, WriteOptions options) {
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        lock_guard<mutex> lock(session->buffer_lock);
+        vector<Song>& buffer = session->buffer;
+
+        if (buffer.empty()) {
+            return Status::OK();
+        }
+
+        // Locate the first instance of songId.
+        auto pos = buffer.end();
+        for (auto it = buffer.begin(); it != buffer.end(); it++) {
+            if (it->id == songId) {
+                pos = it;
+                break;
+            }
+        }
+
+        if (pos == buffer.end()) {
+            return Status::NotFound("Could not remove song from buffer");
+        }
+
+        {
+            lock_guard<recursive_mutex> write_lock(write_lock_);
+
+            s = execute(
+                "DELETE FROM `BufferEntries` WHERE Position = "
+                "(SELECT MIN(Position) FROM BufferEntries WHERE SessionID = ? AND SongID = ?)", { session->id, songId });
+            if (s != Status::OK()) {
+                return s;
+            }
+        }
+
+        buffer.erase(pos);
+
+        // The same song may have been buffered more than once.
+        auto other = find_if(buffer.begin(), buffer.end(), [songId](const Song& song) {
+            return song.id == songId;
+        });
+        if (other == buffer.end()) {
+            session->buffer_ids.remove(songId);
+
+            lock_guard<mutex> tally_lock(session->tally_lock);
+            logChange(*session, EntityKind::Song, songId, false);
+
+            if (autofill_) {
+                rank(*session, songId, timestamp());
+            }
+        }
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::songFinished(WriteOptions options) {
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        Song song;
+
+        {
+            lock_guard<mutex> lock(session->buffer_lock);
+            if (session->buffer.empty()) {
+                return Status::Error("Buffer empty");
+            }
+
+            lock_guard<recursive_mutex> write_lock(write_lock_);
+            s = execute(
+                "DELETE FROM `BufferEntries` WHERE Position = "
+                "(SELECT MIN(Position) FROM BufferEntries WHERE SessionID = ?)", { session->id });
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            song = session->buffer.front();
+            session->buffer_ids.remove(song.id);
+            session->buffer.erase(session->buffer.begin());
+        }
+
+        song.last_played = timestamp();
+
+        // Interesting Question: Can we just save updated song?
+        //
+        // No! The song_queue_ acts purely as a cache. When a
+        // song in inserted to song_queue_, it's data is pulled
+        // from the database, and inserted. The data is never
+        // touched again! What this means is that at the time
+        // of popping off the queue, the data may be in an
+        // invalid state, so we must update the item before
+        // saving!
+        //
+        // After a few months (coming back fresh), while the above
+        // statement is true in the sense of stale data, we only
+        // need to update timestamp, which is trivial in SQL, so
+        // no need to update. My guess is that comment was written
+        {
+            lock_guard<recursive_mutex> write_lock(write_lock_);
+
+            string history;
+            if ((s = table("PlayHistory", session->id, history))) {
+                return s;
+            }
+
+            s = execute(
+                "REPLACE INTO " + history + " (`SongID`, `SessionID`, `Timestamp`) VALUES (?, ?, ?)",
+                { song.id, session->id, (int64_t) song.last_played });
+            if (s != Status::OK()) {
+                return s;
+            }
+        }
+
+        // Its last play changed, as did its buffering.
+        lock_guard<mutex> lock(session->tally_lock);
+        logChange(*session, EntityKind::Song, song.id, true);
+
+        recordPlay(*session, song.id, song.last_played);
+
+        return Status::OK();
+	}
+
+	Status Sqlite3Store::setActivity(const std::string& userId, int64_t timestamp, WriteOptions options) {
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
+
+        int key = 0;
+        if ((s = userKey(userId, key))) {
+            return s;
+        }
+
+        return setActivity(*session, key, timestamp);
+    }
+
+    Status Sqlite3Store::setActivity(Session& session, int userKey, int64_t timestamp) {
+        sqlite3_stmt* statement = 0;
+
+        // SQLite3 does not support an INSERT OR UPDATE query, so we have
+        // two options:
+        //     1. Delete and Recreate: This doesn't work due to FK constraints
+        //     2. Try update, if fail, insert: Annoying, but should be okay in most cases.
+        const char* query = "UPDATE `UserActivity` SET LastActive = ? where UserKey = ? AND SessionID = ?";
+
+        // Held across both statements, as sqlite3_changes() counts the
+        // last statement run by any thread on the connection.
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+
+        if (sqlite3_prepare_v2(db_, query, -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int64(statement, 1, timestamp)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int(statement, 2, userKey)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_int64(statement, 3, session.id)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        int r = sqlite3_step(statement);
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_OK && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
 
-    Status Sqlite3Store::open(std::string path, Options options) {
-        return bootstrap(path, db_, options.create_if_missing, options.recreate);
-    }
+        int affected = sqlite3_changes(db_);
+        if (affected) {
+            return Status::OK();
+        }
 
-    Status Sqlite3Store::getSongs(ResultSet<Song>& set, ReadOptions options) {
-        vector<Song>& set_data = ResultSetMutator::getVector<Song>(set);
-        set_data.clear();
+        query = "INSERT INTO `UserActivity` (`UserKey`, `SessionID`, `LastActive`) VALUES (?, ?, ?)";
 
-        sqlite3_stmt* statement = 0;
+        if (sqlite3_prepare_v2(db_, query, -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
 
-        // Mirror, mirror, on the wall
-        // Who is the ugliest query, of them all
-        string query =
-            "SELECT Songs.SongID, Songs.Name, COUNT(SongVotes.SongID) as Count, COALESCE(SUM(SongVotes.Vote), 0) as Votes, PlayHistory.Timestamp, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.Name, SongVotes.SessionID FROM Songs "
-            "LEFT JOIN SongVotes ON Songs.SongID = SongVotes.SongID AND SongVotes.UserID IN ("
-            "    SELECT UserID FROM UserActivity"
-            "    WHERE UserActivity.LastActive > ?"
-            ") ";
+        if (sqlite3_bind_int(statement, 1, userKey)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
 
-        // TODO: Proper semantics for last played.
-        if (options.session_id != -1) {
-            query += "AND SongVotes.SessionID = ? ";
-        } else {
-            query += "AND SongVotes.SessionID != ? ";
+        if (sqlite3_bind_int64(statement, 2, session.id)) {
+            return Status::Error(sqlite3_errmsg(db_));
         }
 
-        query +=
-            "LEFT JOIN Artists     ON Songs.ArtistID = Artists.ArtistID "
-            "LEFT JOIN Genres      ON Songs.GenreID  = Genres.GenreID "
-            "LEFT JOIN PlayHistory ON Songs.SongID   = PlayHistory.SongID AND PlayHistory.SessionID = ? "
-            "GROUP BY Songs.SongID ";
+        if (sqlite3_bind_int64(statement, 3, timestamp)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
 
-        switch (options.sort) {
-            case SortType::Counts:
-                query += " ORDER BY Count DESC";
-                break;
-            case SortType::Votes:
-                query += " ORDER BY Votes DESC";
-                break;
-            default:
-                break;
+        r = sqlite3_step(statement);
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_OK && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (options.result_limit > 0) {
-            query += " LIMIT " + to_string(options.result_limit);
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::userKey(const string& userId, int& key) {
+        lock_guard<mutex> lock(users_lock_);
+
+        auto it = user_keys_.find(userId);
+        if (it != user_keys_.end()) {
+            key = it->second;
+            return Status::OK();
         }
 
+        // Seen before this was opened, or never.
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+        sqlite3_stmt* statement = 0;
+
+        string query = "SELECT UserKey FROM `Users` WHERE UserID = ?";
+
         if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_int64(statement, 1, timestamp() - options.inactivity_threshold)) {
+        if (sqlite3_bind_text(statement, 1, userId.c_str(), userId.size(), SQLITE_STATIC)) {
+            sqlite3_finalize(statement);
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (options.session_id <= 0) {
-            options.session_id = session_id_;
+        int r = sqlite3_step(statement);
+        if (r == SQLITE_ROW) {
+            key = sqlite3_column_int(statement, 0);
         }
 
-        if (sqlite3_bind_int64(statement, 2, options.session_id)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        sqlite3_finalize(statement);
 
-        if (sqlite3_bind_int64(statement, 3, options.session_id)) {
+        if (r != SQLITE_ROW && r != SQLITE_DONE) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        std::set<int> song_buffer_ids;
-        if (options.filter_buffered) {
-            lock_guard<mutex> lock(buffer_lock_);
-            copy(song_buffer_ids_.begin(), song_buffer_ids_.end(), inserter(song_buffer_ids, song_buffer_ids.begin()));
-        }
+        if (r == SQLITE_DONE) {
+            string insert = "INSERT INTO `Users` (`UserID`) VALUES (?)";
 
-        int result = 0;
-        bool completed = false;
-        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
-            Song s;
-            s.id          = sqlite3_column_int(statement, 0);
+            if (sqlite3_prepare_v2(db_, insert.c_str(), -1, &statement, 0)) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
 
-            // If the returned ID is zero, then there are actually zero results. However,
-            // since we use COUNT(), a row will still be returned, so we must perform this check.
-            if (s.id == 0) {
-                completed = true;
-                break;
+            if (sqlite3_bind_text(statement, 1, userId.c_str(), userId.size(), SQLITE_STATIC)) {
+                sqlite3_finalize(statement);
+                return Status::Error(sqlite3_errmsg(db_));
             }
 
-            if (options.filter_buffered) {
-                if (song_buffer_ids.find(s.id) != song_buffer_ids.end()) {
-                    continue;
-                }
+            r = sqlite3_step(statement);
+            sqlite3_finalize(statement);
+
+            if (r != SQLITE_OK && r != SQLITE_DONE) {
+                return Status::Error(sqlite3_errmsg(db_));
             }
 
-            s.name        = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
-            s.count       = sqlite3_column_int(statement, 2);
-            s.votes       = sqlite3_column_int(statement, 3);
-            s.last_played = sqlite3_column_int64(statement, 4);
+            // Read back by id rather than through the connection's last
+            // rowid, so the key does not depend on what ran in between.
+            if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
 
-            s.artist.id   = sqlite3_column_int(statement, 5);
-            if (s.artist.id > 0) {
-                s.artist.name = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 6)));
+            if (sqlite3_bind_text(statement, 1, userId.c_str(), userId.size(), SQLITE_STATIC)) {
+                sqlite3_finalize(statement);
+                return Status::Error(sqlite3_errmsg(db_));
             }
 
-            s.genre.id    = sqlite3_column_int(statement, 7);
-            if (s.genre.id > 0) {
-                s.genre.name  = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 8)));
+            r = sqlite3_step(statement);
+            if (r == SQLITE_ROW) {
+                key = sqlite3_column_int(statement, 0);
             }
 
-            set_data.push_back(s);
+            sqlite3_finalize(statement);
+
+            if (r != SQLITE_ROW) {
+                return Status::Error(r == SQLITE_DONE ? "User was not added" : sqlite3_errmsg(db_));
+            }
         }
 
-        sqlite3_finalize(statement);
+        user_keys_[userId] = key;
 
-        if (result != SQLITE_OK && result != SQLITE_DONE && !completed) {
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::addSong(Song& song) {
+        sqlite3_stmt* statement = 0;
+
+        string query = "INSERT INTO `Songs` (`ArtistID`, `GenreID`, `Name`) VALUES (?, ?, ?)";
+
+        // Held across the insert and sqlite3_last_insert_rowid(),
+        // which are per connection.
+        unique_lock<recursive_mutex> write_lock(write_lock_);
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-		return Status::OK();
-	}
+        if (sqlite3_bind_int(statement, 1, song.artist.id)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
 
-    Status Sqlite3Store::getArtists(ResultSet<Artist>& set, ReadOptions options) {
-        vector<Artist>& set_data = ResultSetMutator::getVector<Artist>(set);
-        set_data.clear();
+        if (sqlite3_bind_int(statement, 2, song.genre.id)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
 
-        sqlite3_stmt* statement = 0;
+        if (sqlite3_bind_text(statement, 3, song.name.c_str(), song.name.size(), SQLITE_STATIC)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
 
-        string query =
-            "SELECT Artists.ArtistID, Name, COUNT(ArtistVotes.ArtistID) as Count, COALESCE(SUM(ArtistVotes.Vote), 0) as Votes FROM Artists "
-            "LEFT JOIN ArtistVotes on Artists.ArtistID = ArtistVotes.ArtistID AND ArtistVotes.UserID IN ("
-            "    SELECT UserID FROM UserActivity"
-            "    WHERE UserActivity.LastActive > ?"
-            ") ";
+        int r = sqlite3_step(statement);
+        sqlite3_finalize(statement);
 
-        if (options.session_id != -1) {
-            query += "AND SessionID = ? ";
-        } else {
-            query += "AND SessionID != ? ";
+        song.id = (int) sqlite3_last_insert_rowid(db_);
+        song.last_played = 0;
+
+        if (r != SQLITE_OK && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
         }
 
-        query += "GROUP BY Artists.ArtistID ";
+        write_lock.unlock();
 
-        switch (options.sort) {
-            case SortType::Counts:
-                query += "ORDER BY Count DESC ";
-                break;
-            case SortType::Votes:
-                query += "ORDER BY Votes DESC ";
-                break;
-            default:
-                break;
+        {
+            lock_guard<mutex> catalog_lock(catalog_lock_);
+            indexSong(song.id, song.artist.id, song.genre.id, song.name);
         }
 
-        if (options.result_limit > 0) {
-            query += "LIMIT " + to_string(options.result_limit);
-        }
+        logCatalogChange(EntityKind::Song, song.id, true);
+
+        return Status::OK();
+	}
+    Status Sqlite3Store::addArtist(Artist& artist) {
+        sqlite3_stmt* statement = 0;
+
+        string query = "INSERT INTO `Artists` (`Name`) VALUES (?)";
+
+        unique_lock<recursive_mutex> write_lock(write_lock_);
 
         if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_int64(statement, 1, timestamp() - options.inactivity_threshold)) {
+        if (sqlite3_bind_text(statement, 1, artist.name.c_str(), artist.name.size(), SQLITE_STATIC)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (options.session_id <= 0) {
-            options.session_id = session_id_;
-        }
+        int r = sqlite3_step(statement);
+        sqlite3_finalize(statement);
 
-        if (sqlite3_bind_int64(statement, 2, options.session_id)) {
+        artist.id = (int) sqlite3_last_insert_rowid(db_);
+
+        if (r != SQLITE_OK && r != SQLITE_DONE) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        int result = 0;
-        bool completed = false;
-        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
-            Artist a;
-            a.id         = sqlite3_column_int(statement, 0);
+        write_lock.unlock();
 
-            // See; getSongs
-            if (a.id == 0) {
-                completed = true;
-                break;
-            }
+        {
+            lock_guard<mutex> catalog_lock(catalog_lock_);
+            artist_names_.add(artist.id, artist.name);
+        }
 
-            a.name       = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
-            a.count      = sqlite3_column_int(statement, 2);
-            a.votes      = sqlite3_column_int(statement, 3);
-            set_data.push_back(a);
+        logCatalogChange(EntityKind::Artist, artist.id, true);
+
+		return Status::OK();
+	}
+    Status Sqlite3Store::addGenre(Genre& genre) {
+		sqlite3_stmt* statement = 0;
+
+        string query = "INSERT INTO `Genres` (`Name`) VALUES (?)";
+
+        unique_lock<recursive_mutex> write_lock(write_lock_);
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (sqlite3_bind_text(statement, 1, genre.name.c_str(), genre.name.size(), SQLITE_STATIC)) {
+            return Status::Error(sqlite3_errmsg(db_));
         }
 
+        int r = sqlite3_step(statement);
         sqlite3_finalize(statement);
 
-        if (result != SQLITE_OK && result != SQLITE_DONE && !completed) {
+        genre.id = (int) sqlite3_last_insert_rowid(db_);
+
+        if (r != SQLITE_OK && r != SQLITE_DONE) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
+        write_lock.unlock();
+
+        logCatalogChange(EntityKind::Genre, genre.id, true);
+
 		return Status::OK();
 	}
-    Status Sqlite3Store::getGenres(ResultSet<Genre>& set, ReadOptions options) {
-        vector<Genre>& set_data = ResultSetMutator::getVector<Genre>(set);
-        set_data.clear();
 
-        sqlite3_stmt* statement = 0;
+    Status Sqlite3Store::insertNormalized(uint64_t hash, const string& normalized, int songId, int artistId, int genreId) {
+        sqlite3_stmt* insert = 0;
+        sqlite3_stmt* update = 0;
 
-        string query = "SELECT Genres.GenreID, Name, COUNT(GenreVotes.GenreID) as Count, COALESCE(SUM(GenreVotes.Vote), 0) as Votes FROM Genres "
-            "LEFT JOIN GenreVotes on Genres.GenreID = GenreVotes.GenreID AND GenreVotes.UserID IN ("
-            "    SELECT UserID FROM UserActivity"
-            "    WHERE UserActivity.LastActive > ?"
-            ") ";
+        string query = "INSERT OR IGNORE INTO `Normalized` (`Hash`, `Normalized`, `SongID`, `ArtistID`, `GenreID`) VALUES (?, ?, ?, ?, ?)";
 
-        if (options.session_id != -1) {
-            query += "AND SessionID = ? ";
-        } else {
-            query += "AND SessionID != ? ";
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &insert, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
         }
 
-        query += "GROUP BY Genres.GenreID ";
+        lock_guard<recursive_mutex> write_lock(write_lock_);
 
-        switch (options.sort) {
-            case SortType::Counts:
-                query += "ORDER BY Count DESC ";
+        // A key takes its hash if free, or else the first free one
+        // after it. Either way, it is replaced wherever it already is.
+        Status s;
+        for (uint64_t probe = hash; ; probe++) {
+            sqlite3_reset(insert);
+            if (sqlite3_bind_int64(insert, 1, static_cast<int64_t>(probe)) ||
+                sqlite3_bind_text(insert, 2, normalized.c_str(), normalized.size(), SQLITE_STATIC) ||
+                sqlite3_bind_int(insert, 3, songId) ||
+                sqlite3_bind_int(insert, 4, artistId) ||
+                sqlite3_bind_int(insert, 5, genreId) ||
+                sqlite3_step(insert) != SQLITE_DONE) {
+                s = Status::Error(sqlite3_errmsg(db_));
                 break;
-            case SortType::Votes:
-                query += "ORDER BY Votes DESC ";
+            }
+
+            if (sqlite3_changes(db_)) {
                 break;
-            default:
+            }
+
+            // Only prepared once the hash turns out to be taken.
+            query = "UPDATE `Normalized` SET SongID = ?, ArtistID = ?, GenreID = ? WHERE Hash = ? AND Normalized = ?";
+
+            if (!update && sqlite3_prepare_v2(db_, query.c_str(), -1, &update, 0)) {
+                s = Status::Error(sqlite3_errmsg(db_));
                 break;
-        }
+            }
 
-        if (options.result_limit > 0) {
-            query += "LIMIT " + to_string(options.result_limit);
-        }
+            sqlite3_reset(update);
+            if (sqlite3_bind_int(update, 1, songId) ||
+                sqlite3_bind_int(update, 2, artistId) ||
+                sqlite3_bind_int(update, 3, genreId) ||
+                sqlite3_bind_int64(update, 4, static_cast<int64_t>(probe)) ||
+                sqlite3_bind_text(update, 5, normalized.c_str(), normalized.size(), SQLITE_STATIC) ||
+                sqlite3_step(update) != SQLITE_DONE) {
+                s = Status::Error(sqlite3_errmsg(db_));
+                break;
+            }
 
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
+            if (sqlite3_changes(db_)) {
+                break;
+            }
         }
 
-        if (sqlite3_bind_int64(statement, 1, timestamp() - options.inactivity_threshold)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        sqlite3_finalize(insert);
+        sqlite3_finalize(update);
 
-        if (options.session_id <= 0) {
-            options.session_id = session_id_;
-        }
+        return s;
+    }
 
-        if (sqlite3_bind_int64(statement, 2, options.session_id)) {
+    Status Sqlite3Store::getNormalized(Song& song, uint64_t hash, const string& normalized) {
+        sqlite3_stmt* statement = 0;
+
+        const char* query =
+            "SELECT Normalized.Normalized, Normalized.SongID, Songs.Name, Normalized.ArtistID, Artists.Name, Normalized.GenreID, Genres.Name FROM Normalized "
+            "LEFT JOIN Songs   ON Normalized.SongID == Songs.SongID "
+            "LEFT JOIN Artists ON Normalized.ArtistID == Artists.ArtistID "
+            "LEFT JOIN Genres  ON Normalized.GenreID == Genres.GenreID "
+            "WHERE Normalized.Hash = ?";
+
+        if (sqlite3_prepare_v2(db_, query, -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
+        // Probes from the key's hash until it or a free hash is
+        // found (see insertNormalized).
         int result = 0;
-        bool completed = false;
-        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
-            Genre g;
-            g.id    = sqlite3_column_int(statement, 0);
+        bool found = false;
+        for (uint64_t probe = hash; ; probe++) {
+            sqlite3_reset(statement);
+            if (sqlite3_bind_int64(statement, 1, static_cast<int64_t>(probe))) {
+                sqlite3_finalize(statement);
+                return Status::Error(sqlite3_errmsg(db_));
+            }
 
-            // See: getSongs
-            if (g.id == 0) {
-                completed = true;
+            if ((result = sqlite3_step(statement)) != SQLITE_ROW) {
                 break;
             }
 
-            g.name  = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
-            g.count = sqlite3_column_int(statement, 2);
-            g.votes = sqlite3_column_int(statement, 3);
-            set_data.push_back(g);
+            const char* text   = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+            int         length = sqlite3_column_bytes(statement, 0);
+            if (normalized.compare(0, string::npos, text, length) == 0) {
+                found = true;
+                break;
+            }
+        }
+
+        if (found) {
+            int id = sqlite3_column_int(statement, 1);
+            if (id != 0) {
+                song.id   = id;
+                readText(statement, 2, song.name);
+            }
+
+            id = sqlite3_column_int(statement, 3);
+            if (id != 0) {
+                song.artist.id   = id;
+                readName(statement, 4, EntityKind::Artist, id, dictionary_, song.artist.name);
+            }
+
+            id = sqlite3_column_int(statement, 5);
+            if (id != 0) {
+                song.genre.id   = id;
+                readName(statement, 6, EntityKind::Genre, id, dictionary_, song.genre.name);
+            }
         }
 
         sqlite3_finalize(statement);
 
-        if (result != SQLITE_OK && result != SQLITE_DONE && !completed) {
+        if (!found && result != SQLITE_OK && result != SQLITE_DONE) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-		return Status::OK();
-	}
+        if (!found) {
+            return Status::NotFound("Could not find normalized entry");
+        }
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::beginBatch() {
+        // Every sequence of writes holds the write lock throughout,
+        // so the savepoints of writes made during the batch (on any
+        // thread) nest inside it, and are committed along with it.
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+        return execute("SAVEPOINT Batch");
+    }
 
-    Status Sqlite3Store::getSongFromId(Song& s, int songId) {
-        sqlite3_stmt* statement = 0;
+    Status Sqlite3Store::commitBatch() {
+        lock_guard<recursive_mutex> write_lock(write_lock_);
 
-        string query =
-            "SELECT Songs.SongID, Songs.Name, PlayHistory.Timestamp, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.Name FROM Songs "
-            "LEFT JOIN Artists     ON Songs.ArtistID = Artists.ArtistID "
-            "LEFT JOIN Genres      ON Songs.GenreID  = Genres.GenreID "
-            "LEFT JOIN PlayHistory ON Songs.SongID   = PlayHistory.SongID AND PlayHistory.SessionID = " + to_string(session_id_) + " "
-            "WHERE Songs.SongID = " + to_string(songId);
+        // The batch is the outermost savepoint, so releasing it
+        // commits. If that fails (say, the file is busy), releasing
+        // it again would fail alike, so the transaction is rolled
+        // back outright.
+        Status s = execute("RELEASE Batch");
+        if (s != Status::OK()) {
+            execute("ROLLBACK");
+        }
 
-        int result = 0;
-        s.id = -1;
+        return s;
+    }
 
-        sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0);
-        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
-            s.id          = sqlite3_column_int(statement, 0);
-            s.name        = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
-            s.last_played = sqlite3_column_int64(statement, 2);
+    Status Sqlite3Store::markUnplayable(int songId) {
+        // queueSong checks the unplayable set under the write lock
+        // (from setQueue), so the insert is made before taking it.
+        Status s;
+        {
+            lock_guard<recursive_mutex> write_lock(write_lock_);
+            s = execute("INSERT OR IGNORE INTO `UnplayableSongs` (`SongID`) VALUES (?)", { songId });
+        }
 
-            s.artist.id   = sqlite3_column_int(statement, 3);
-            if (s.artist.id > 0) {
-                s.artist.name = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 4)));
-            }
+        if (s != Status::OK()) {
+            return s;
+        }
 
-            s.genre.id    = sqlite3_column_int(statement, 5);
-            if (s.genre.id > 0) {
-                s.genre.name  = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 6)));
-            }
+        {
+            lock_guard<mutex> unplayable_lock(unplayable_lock_);
+            unplayable_song_ids_.add(songId);
         }
 
-        sqlite3_finalize(statement);
+        logCatalogChange(EntityKind::Song, songId, false);
 
-        if (result != SQLITE_OK && result != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::voteSong(const std::string& userId, Song& song, int amount, WriteOptions options) {
+        if (song.id == 0) {
+            return Status::Error("Cannot count a song that does not exist");
         }
 
-		if (s.id == -1) {
-            return Status::NotFound("Could not find song");
+        return vote(EntityKind::Song, userId, song.id, amount, options);
+	}
+    Status Sqlite3Store::voteArtist(const std::string& userId, Artist& artist, int amount, WriteOptions options) {
+        if (artist.id == 0) {
+            return Status::Error("Cannot count an artist that does not exist");
         }
 
-		return Status::OK();
+        return vote(EntityKind::Artist, userId, artist.id, amount, options);
 	}
+    Status Sqlite3Store::voteGenre(const std::string& userId, Genre& genre, int amount, WriteOptions options) {
+        if (genre.id == 0) {
+            return Status::Error("Cannot count a genre that does not exist");
+        }
 
-    Status Sqlite3Store::getPlayHistory(ResultSet<Song>& set, ReadOptions options) {
-        vector<Song>& set_data =  ResultSetMutator::getVector<Song>(set);
-        set_data.clear();
+        return vote(EntityKind::Genre, userId, genre.id, amount, options);
+	}
 
+    Status Sqlite3Store::vote(EntityKind kind, const string& userId, int id, int amount, WriteOptions options) {
         sqlite3_stmt* statement = 0;
+        int k = static_cast<int>(kind);
 
-        string query =
-            "SELECT Songs.SongID, Songs.Name, Date, Artists.ArtistID, Artists.Name, Genres.GenreID, Genres.NAME "
-            "LEFT JOIN Artists ON Songs.ArtistID = Artists.ArtistID "
-            "LEFT JOIN Genres  ON Songs.GenreID  = Genres.GenreID "
-            "JOIN PlayHistory  ON Songs.SongID   = PlayHistory.SongID "
-            "ORDER BY DESC Timestamp";
+        shared_ptr<Session> session;
+        Status s = findSession(options.session_id, session);
+        if (s != Status::OK()) {
+            return s;
+        }
 
-        if (options.result_limit > 0) {
-            query += " LIMIT " + to_string(options.result_limit);
+        int key = 0;
+        if ((s = userKey(userId, key))) {
+            return s;
         }
 
-        int result = 0;
-        sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0);
-        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
-            Song s;
+        // The tallies move by the difference between this vote and the
+        // user's previous one (if any), so the lookup and replace must
+        // not interleave with another vote.
+        lock_guard<mutex> lock(session->tally_lock);
+        lock_guard<recursive_mutex> write_lock(write_lock_);
 
-            s.id          = sqlite3_column_int(statement, 0);
-            s.name        = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
-            s.count       = sqlite3_column_int(statement, 2);
-            s.votes       = sqlite3_column_int(statement, 3);
-            s.last_played = sqlite3_column_int64(statement, 4);
+        if ((s = setActivity(*session, key, timestamp()))) {
+            return s;
+        }
 
-            s.artist.id   = sqlite3_column_int(statement, 5);
-            if (s.artist.id > 0) {
-                s.artist.name = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 6)));
-            }
+        string source;
+        if ((s = table(VOTE_TABLES[k], session->id, source))) {
+            return s;
+        }
 
-            s.genre.id    = sqlite3_column_int(statement, 7);
-            if (s.genre.id > 0) {
-                s.genre.name  = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 8)));
-            }
+        // Both queries are built in the one buffer, as votes are the
+        // hottest write.
+        string query;
+        query.reserve(160);
+        query.append("SELECT Vote FROM ").append(source)
+             .append(" WHERE ").append(ID_COLUMNS[k]).append(" = ? AND SessionID = ? AND UserKey = ?");
 
-            set_data.push_back(s);
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            return Status::Error(sqlite3_errmsg(db_));
         }
 
-        sqlite3_finalize(statement);
-
-        if (result != SQLITE_OK && result != SQLITE_DONE) {
+        if (sqlite3_bind_int(statement, 1, id) ||
+            sqlite3_bind_int64(statement, 2, session->id) ||
+            sqlite3_bind_int(statement, 3, key)) {
+            sqlite3_finalize(statement);
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-		return Status::OK();
-    }
+        bool existed  = false;
+        int  previous = 0;
 
-    Status Sqlite3Store::setQueue(vector<int> songIds) {
-        lock_guard<recursive_mutex> lock(queue_lock_);
+        int r = sqlite3_step(statement);
+        if (r == SQLITE_ROW) {
+            existed  = true;
+            previous = sqlite3_column_int(statement, 0);
+        }
 
-        song_queue_.clear();
+        sqlite3_finalize(statement);
 
-        for (auto it = songIds.begin(); it != songIds.end(); it++) {
-            Status s = queueSong(*it);
-            if (s != Status::OK()) {
-                return s;
-            }
+        if (r != SQLITE_ROW && r != SQLITE_DONE) {
+            return Status::Error(sqlite3_errmsg(db_));
         }
 
-        return Status::OK();
-    }
+        int count = existed ? 0 : 1;
+        int votes = amount - previous;
 
-    Status Sqlite3Store::getQueue(ResultSet<Song>& set) {
-        // For now, there's not a huge motivation to put the
-        // queue into the db, since it's reset when the program
-        // end anyway.
-        vector<Song>& set_data = ResultSetMutator::getVector(set);
-        set_data.clear();
+        if ((s = execute("SAVEPOINT Vote"))) {
+            return s;
+        }
 
-        lock_guard<recursive_mutex> lock(queue_lock_);
-        copy(song_queue_.begin(), song_queue_.end(), back_inserter(set_data));
+        query.assign("REPLACE INTO ").append(source)
+             .append(" (`").append(ID_COLUMNS[k]).append("`, `SessionID`, `UserKey`, `Vote`) VALUES (?, ?, ?, ?)");
 
-		return Status::OK();
-	}
-    Status Sqlite3Store::queueSong(int songId) {
-        {
-            lock_guard<recursive_mutex> lock(queue_lock_);
-            if (unplayable_song_ids_.find(songId) != unplayable_song_ids_.end()) {
-                return Status::OK();
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            s = Status::Error(sqlite3_errmsg(db_));
+        } else if (sqlite3_bind_int(statement, 1, id) ||
+                   sqlite3_bind_int64(statement, 2, session->id) ||
+                   sqlite3_bind_int(statement, 3, key) ||
+                   sqlite3_bind_int(statement, 4, amount)) {
+            s = Status::Error(sqlite3_errmsg(db_));
+        } else {
+            r = sqlite3_step(statement);
+            if (r != SQLITE_OK && r != SQLITE_DONE) {
+                s = Status::Error(sqlite3_errmsg(db_));
             }
         }
 
-        Song s;
-		Status status = getSongFromId(s, songId);
-		if (status != Status::OK()){
-			return status;
-		}
+        sqlite3_finalize(statement);
 
-        lock_guard<recursive_mutex> lock(queue_lock_);
-        song_queue_.push_back(s);
+        if (s == Status::OK() && (count || votes)) {
+            s = execute(
+                "INSERT INTO `VoteLog` (`SessionID`, `Kind`, `EntityID`, `Count`, `Votes`) VALUES (?, ?, ?, ?, ?)",
+                { session->id, k, id, count, votes });
+        }
 
-		return Status::OK();
-	}
-    Status Sqlite3Store::clearQueue() {
-        lock_guard<recursive_mutex> lock(queue_lock_);
-        song_queue_.clear();
+        if (s != Status::OK()) {
+            execute("ROLLBACK TO Vote");
+            execute("RELEASE Vote");
+            return s;
+        }
 
-        return Status::OK();
-    }
+        if ((s = execute("RELEASE Vote"))) {
+            return s;
+        }
 
-    Status Sqlite3Store::getBuffer(ResultSet<Song>& set) {
-        vector<Song>& set_data = ResultSetMutator::getVector(set);
-        set_data.clear();
+        if (!count && !votes) {
+            return Status::OK();
+        }
 
-        lock_guard<mutex> lock(buffer_lock_);
-        copy(song_buffer_.begin(), song_buffer_.end(), back_inserter(set_data));
+        // Re-ranked for autofill, from the score it had before.
+        bool ranked = autofill_ && kind == EntityKind::Song &&
+            session->ranking.erase(make_pair(-autofillScore(session->tally, id), id)) > 0;
 
-		return Status::OK();
-	}
+        if (kind == EntityKind::Song) {
+            session->voted.erase(make_pair(-session->tally.votes(kind, id), id));
+        }
 
-    Status Sqlite3Store::bufferNext() {
-        lock_guard<recursive_mutex> queue_lock(queue_lock_);
+        session->tally.apply(kind, id, count, votes);
 
-        if (song_queue_.empty()) {
-            return Status::Error("Queue empty");
+        if (ranked) {
+            session->ranking.insert(make_pair(-autofillScore(session->tally, id), id));
         }
 
-        lock_guard<mutex> buffer_lock(buffer_lock_);
+        if (kind == EntityKind::Song && session->tally.votes(kind, id) != 0) {
+            session->voted.insert(make_pair(-session->tally.votes(kind, id), id));
+        }
+        session->scores.apply(kind, id, votes, timestamp());
+        logChange(*session, kind, id, false);
 
-        copy(song_queue_.begin(), song_queue_.begin() + 1, back_inserter(song_buffer_));
-        song_buffer_ids_.insert(song_queue_.begin()->id);
-        song_queue_.erase(song_queue_.begin());
+        if (++session->logged_votes >= snapshot_interval_) {
+            return snapshot(*session);
+        }
 
 		return Status::OK();
 	}
 
-    Status Sqlite3Store::removeFromBuffer(int songId) {
-        lock_guard<mutex> lock(buffer_lock_);
+    Status Sqlite3Store::snapshot(Session& session) {
+        session.logged_votes = 0;
 
-        if (song_buffer_.empty()) {
-            return Status::OK();
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+
+        Status s = execute("SAVEPOINT Snapshot");
+        if (s != Status::OK()) {
+            return s;
         }
 
-        // Locate the first instance of songId.
-        auto pos = song_buffer_.end();
-        for (auto it = song_buffer_.begin(); it != song_buffer_.end(); it++) {
-            if (it->id == songId) {
-                pos = it;
-                break;
-            }
+        s = execute("DELETE FROM `TallySnapshots` WHERE SessionID = ?", { session.id });
+
+        sqlite3_stmt* statement = 0;
+        string query = "INSERT INTO `TallySnapshots` (`SessionID`, `Kind`, `EntityID`, `Count`, `Votes`) VALUES (?, ?, ?, ?, ?)";
+
+        if (s == Status::OK() && sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+            s = Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (pos == song_buffer_.end()) {
-            return Status::NotFound("Could not remove song from buffer");
+        if (s == Status::OK()) {
+            session.tally.forEach([&](EntityKind kind, int id, int count, int votes) {
+                if (s != Status::OK()) {
+                    return;
+                }
+
+                sqlite3_reset(statement);
+                if (sqlite3_bind_int64(statement, 1, session.id) ||
+                    sqlite3_bind_int(statement, 2, static_cast<int>(kind)) ||
+                    sqlite3_bind_int(statement, 3, id) ||
+                    sqlite3_bind_int(statement, 4, count) ||
+                    sqlite3_bind_int(statement, 5, votes) ||
+                    sqlite3_step(statement) != SQLITE_DONE) {
+                    s = Status::Error(sqlite3_errmsg(db_));
+                }
+            });
         }
 
-        song_buffer_.erase(pos);
-        return Status::OK();
-    }
+        sqlite3_finalize(statement);
 
-    Status Sqlite3Store::songFinished() {
-        if (song_buffer_.empty()) {
-            return Status::Error("Buffer empty");
+        if (s == Status::OK()) {
+            s = execute("DELETE FROM `VoteLog` WHERE SessionID = ?", { session.id });
         }
 
-        Song song;
+        if (s == Status::OK()) {
+            s = execute("REPLACE INTO `SessionSnapshots` (`SessionID`, `Timestamp`) VALUES (?, ?)", { session.id, timestamp() });
+        }
 
-        {
-            lock_guard<mutex> lock(buffer_lock_);
-            song = song_buffer_.front();
-            song_buffer_ids_.erase(song.id);
-            song_buffer_.erase(song_buffer_.begin());
+        if (s != Status::OK()) {
+            execute("ROLLBACK TO Snapshot");
+            execute("RELEASE Snapshot");
+            return s;
         }
 
-        song.last_played = timestamp();
+        return execute("RELEASE Snapshot");
+    }
 
-        // Interesting Question: Can we just save updated song?
-        //
-        // No! The song_queue_ acts purely as a cache. When a
-        // song in inserted to song_queue_, it's data is pulled
-        // from the database, and inserted. The data is never
-        // touched again! What this means is that at the time
-        // of popping off the queue, the data may be in an
-        // invalid state, so we must update the item before
-        // saving!
-        //
-        // After a few months (coming back fresh), while the above
-        // statement is true in the sense of stale data, we only
-        // need to update timestamp, which is trivial in SQL, so
-        // no need to update. My guess is that comment was written
+    Status Sqlite3Store::loadTallies(Session& session) {
         sqlite3_stmt* statement = 0;
 
-        string query = "REPLACE INTO `PlayHistory` (`SongID`, `SessionID`, `Timestamp`) VALUES (?, ?, ?)";
+        session.tally.clear();
+        session.logged_votes = 0;
+
+        string query = "SELECT Timestamp FROM SessionSnapshots WHERE SessionID = ?";
 
         if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_int(statement, 1, song.id)) {
+        if (sqlite3_bind_int64(statement, 1, session.id)) {
+            sqlite3_finalize(statement);
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_int(statement, 2, session_id_)) {
+        int r = sqlite3_step(statement);
+        bool tracked = r == SQLITE_ROW;
+        sqlite3_finalize(statement);
+
+        if (r != SQLITE_ROW && r != SQLITE_DONE) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_int64(statement, 3, song.last_played)) {
+        // Tracked sessions are their snapshot plus the log tail. Anything
+        // else predates snapshots, and has to be rebuilt the slow way.
+        if (tracked) {
+            query =
+                "SELECT Kind, EntityID, Count, Votes, 0 FROM TallySnapshots WHERE SessionID = ? "
+                "UNION ALL "
+                "SELECT Kind, EntityID, Count, Votes, 1 FROM VoteLog WHERE SessionID = ?";
+        } else {
+            query =
+                "SELECT 0, SongID,   COUNT(*), SUM(Vote), 0 FROM SongVotes   WHERE SessionID = ? GROUP BY SongID "
+                "UNION ALL "
+                "SELECT 1, ArtistID, COUNT(*), SUM(Vote), 0 FROM ArtistVotes WHERE SessionID = ? GROUP BY ArtistID "
+                "UNION ALL "
+                "SELECT 2, GenreID,  COUNT(*), SUM(Vote), 0 FROM GenreVotes  WHERE SessionID = ? GROUP BY GenreID";
+        }
+
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        int r = sqlite3_step(statement);
+        for (int i = 1; i <= sqlite3_bind_parameter_count(statement); i++) {
+            if (sqlite3_bind_int64(statement, i, session.id)) {
+                sqlite3_finalize(statement);
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+        }
+
+        while ((r = sqlite3_step(statement)) == SQLITE_ROW) {
+            session.tally.apply(
+                static_cast<EntityKind>(sqlite3_column_int(statement, 0)),
+                sqlite3_column_int(statement, 1),
+                sqlite3_column_int(statement, 2),
+                sqlite3_column_int(statement, 3));
+
+            session.logged_votes += sqlite3_column_int(statement, 4);
+        }
+
         sqlite3_finalize(statement);
 
         if (r != SQLITE_OK && r != SQLITE_DONE) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-		return Status::OK();
-	}
+        session.voted.clear();
+        session.tally.forEach([&session](EntityKind kind, int id, int, int votes) {
+            if (kind == EntityKind::Song && votes != 0) {
+                session.voted.insert(make_pair(-votes, id));
+            }
+        });
+
+        if (!tracked) {
+            return snapshot(session);
+        }
+
+        return Status::OK();
+    }
 
-	Status Sqlite3Store::setActivity(std::string userId, int64_t timestamp) {
+    Status Sqlite3Store::insertSession(int64_t& result) {
         sqlite3_stmt* statement = 0;
 
-        // SQLite3 does not support an INSERT OR UPDATE query, so we have
-        // two options:
-        //     1. Delete and Recreate: This doesn't work due to FK constraints
-        //     2. Try update, if fail, insert: Annoying, but should be okay in most cases.
-        string query = "UPDATE `UserActivity` SET LastActive = ? where UserID = ?";
+        // Held across the insert and sqlite3_last_insert_rowid(),
+        // which is per connection, not per statement.
+        lock_guard<recursive_mutex> write_lock(write_lock_);
 
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        string query = "INSERT INTO `SessionHistory` (`Date`) VALUES (?)";
 
-        if (sqlite3_bind_int64(statement, 1, timestamp)) {
+        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_text(statement, 2, userId.c_str(), userId.size(), SQLITE_STATIC)) {
+        if (sqlite3_bind_int64(statement, 1, timestamp())) {
+            sqlite3_finalize(statement);
             return Status::Error(sqlite3_errmsg(db_));
         }
 
@@ -586,191 +3372,294 @@ namespace internal {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        int affected = sqlite3_changes(db_);
-        if (affected) {
-            return Status::OK();
+        result = (int64_t) sqlite3_last_insert_rowid(db_);
+
+        // Track the tallies from the start, so restoring this
+        // session never has to fall back to the vote tables.
+        Status s = execute("INSERT INTO `SessionSnapshots` (`SessionID`, `Timestamp`) VALUES (?, ?)", { result, timestamp() });
+        if (s != Status::OK() || !partition_sessions_) {
+            return s;
+        }
+
+        if ((s = execute("INSERT INTO `SessionPartitions` (`SessionID`) VALUES (?)", { result }))) {
+            return s;
         }
 
-        query = "INSERT INTO `UserActivity` (`UserId`, `LastActive`) VALUES (?, ?)";
+        // Session ids are reused when the database is recreated, so
+        // a partition may be left over from a previous incarnation.
+        remove((path_ + ".session-" + to_string(result)).c_str());
 
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        partitions_.insert(result);
+        partitioned_ = true;
+
+        return Status::OK();
+    }
+
+    Status Sqlite3Store::loadSession(int64_t sessionId, bool created) {
+        shared_ptr<Session> session = make_shared<Session>(sessionId, decay_half_life_, trending_window_);
+
+        // Result sets read before a session was last loaded cannot
+        // be brought up to date from its changes.
+        session->log_start = ++version_;
+
+        // A new session has nothing to load.
+        if (!created) {
+            sqlite3_stmt* statement = 0;
+
+            string query = "SELECT SessionID FROM `SessionHistory` WHERE SessionID = ?";
+
+            if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+
+            if (sqlite3_bind_int64(statement, 1, sessionId)) {
+                sqlite3_finalize(statement);
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+
+            int r = sqlite3_step(statement);
+            sqlite3_finalize(statement);
+
+            if (r == SQLITE_DONE) {
+                return Status::NotFound("Session does not exist");
+            } else if (r != SQLITE_ROW) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
+
+            Status s = loadQueue(*session);
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            lock_guard<mutex> lock(session->tally_lock);
+            if ((s = loadTallies(*session))) {
+                return s;
+            }
+
+            // Its votes are live again, so no longer part of the rollups.
+            {
+                lock_guard<recursive_mutex> write_lock(write_lock_);
+                if ((s = execute("DELETE FROM `ClosedSessions` WHERE SessionID = ?", { session->id }))) {
+                    return s;
+                }
+            }
+
+            if ((s = rollUp(*session, -1))) {
+                return s;
+            }
         }
 
-        if (sqlite3_bind_text(statement, 1, userId.c_str(), userId.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        // Open sessions keep their partition attached, with a spare
+        // slot left for reads of any other session.
+        {
+            lock_guard<recursive_mutex> write_lock(write_lock_);
+
+            if (partitions_.find(sessionId) != partitions_.end()) {
+                if ((int) pinned_.size() + 1 >= sqlite3_limit(db_, SQLITE_LIMIT_ATTACHED, -1)) {
+                    return Status::Error("Too many partitioned sessions open");
+                }
+
+                pinned_.insert(sessionId);
+
+                Status s = attach(sessionId);
+                if (s != Status::OK()) {
+                    pinned_.erase(sessionId);
+                    return s;
+                }
+            }
+        }
+
+        if (!created) {
+            Status s = loadPlays(*session);
+            if (s != Status::OK()) {
+                return s;
+            }
         }
 
-        if (sqlite3_bind_int64(statement, 2, timestamp)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        // Held until the session is registered, so that songs
+        // added meanwhile are still ranked.
+        unique_lock<mutex> catalog_lock(catalog_lock_, defer_lock);
+        if (autofill_) {
+            catalog_lock.lock();
+            loadAutofill(*session);
         }
 
-        r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
-
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        lock_guard<mutex> lock(sessions_lock_);
+        sessions_.insert(make_pair(sessionId, session));
 
         return Status::OK();
     }
 
-    Status Sqlite3Store::addSong(Song& song) {
-        sqlite3_stmt* statement = 0;
+    Status Sqlite3Store::unloadSession(int64_t sessionId) {
+        shared_ptr<Session> session;
 
-        string query = "INSERT INTO `Songs` (`ArtistID`, `GenreID`, `Name`) VALUES (?, ?, ?)";
+        {
+            lock_guard<mutex> lock(sessions_lock_);
 
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+            auto it = sessions_.find(sessionId);
+            if (it == sessions_.end()) {
+                return Status::NotFound("Session is not open");
+            }
 
-        if (sqlite3_bind_int(statement, 1, song.artist.id)) {
-            return Status::Error(sqlite3_errmsg(db_));
+            session = it->second;
+            sessions_.erase(it);
         }
 
-        if (sqlite3_bind_int(statement, 2, song.genre.id)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        // Writes that raced the unload are still in the vote log,
+        // and are replayed if the session is opened again.
+        lock_guard<mutex> lock(session->tally_lock);
+        Status s = retire(*session);
 
-        if (sqlite3_bind_text(statement, 3, song.name.c_str(), song.name.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        lock_guard<recursive_mutex> write_lock(write_lock_);
+        pinned_.erase(sessionId);
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
+        return s;
+    }
 
-        song.id = (int) sqlite3_last_insert_rowid(db_);
-        song.last_played = 0;
+    Status Sqlite3Store::retire(Session& session) {
+        // Marked first, so that the rollup is finished by the next
+        // open if it fails here.
+        {
+            lock_guard<recursive_mutex> write_lock(write_lock_);
 
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+            Status s = execute("INSERT OR IGNORE INTO `ClosedSessions` (`SessionID`) VALUES (?)", { session.id });
+            if (s != Status::OK()) {
+                return s;
+            }
         }
 
-        return Status::OK();
-	}
-    Status Sqlite3Store::addArtist(Artist& artist) {
-        sqlite3_stmt* statement = 0;
+        Status s = snapshot(session);
+        if (s != Status::OK()) {
+            return s;
+        }
 
-        string query = "INSERT INTO `Artists` (`Name`) VALUES (?)";
+        return rollUp(session, 1);
+    }
 
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+    Status Sqlite3Store::rollUp(Session& session, int sign) {
+        lock_guard<recursive_mutex> write_lock(write_lock_);
 
-        if (sqlite3_bind_text(statement, 1, artist.name.c_str(), artist.name.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        Status s = execute("SAVEPOINT RollUp");
+        if (s != Status::OK()) {
+            return s;
         }
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
-
-        artist.id = (int) sqlite3_last_insert_rowid(db_);
+        if (sign > 0) {
+            s = execute("INSERT OR IGNORE INTO `RolledUpSessions` (`SessionID`) VALUES (?)", { session.id });
+        } else {
+            s = execute("DELETE FROM `RolledUpSessions` WHERE SessionID = ?", { session.id });
+        }
 
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+        // Nothing to do if the session was already in (or out of) the rollups.
+        if (s != Status::OK() || sqlite3_changes(db_) == 0) {
+            execute("RELEASE RollUp");
+            return s;
         }
 
-		return Status::OK();
-	}
-    Status Sqlite3Store::addGenre(Genre& genre) {
-		sqlite3_stmt* statement = 0;
+        sqlite3_stmt* insert = 0;
+        sqlite3_stmt* update = 0;
 
-        string query = "INSERT INTO `Genres` (`Name`) VALUES (?)";
+        string insertQuery = "INSERT OR IGNORE INTO `Rollups` (`Kind`, `EntityID`, `Count`, `Votes`) VALUES (?, ?, 0, 0)";
+        string updateQuery = "UPDATE `Rollups` SET Count = Count + ?, Votes = Votes + ? WHERE Kind = ? AND EntityID = ?";
 
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        if (sqlite3_prepare_v2(db_, insertQuery.c_str(), -1, &insert, 0) ||
+            sqlite3_prepare_v2(db_, updateQuery.c_str(), -1, &update, 0)) {
+            s = Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_text(statement, 1, genre.name.c_str(), genre.name.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        if (s == Status::OK()) {
+            session.tally.forEach([&](EntityKind kind, int id, int count, int votes) {
+                if (s != Status::OK()) {
+                    return;
+                }
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
+                sqlite3_reset(insert);
+                sqlite3_reset(update);
+                if (sqlite3_bind_int(insert, 1, static_cast<int>(kind)) ||
+                    sqlite3_bind_int(insert, 2, id) ||
+                    sqlite3_step(insert) != SQLITE_DONE ||
+                    sqlite3_bind_int(update, 1, sign * count) ||
+                    sqlite3_bind_int(update, 2, sign * votes) ||
+                    sqlite3_bind_int(update, 3, static_cast<int>(kind)) ||
+                    sqlite3_bind_int(update, 4, id) ||
+                    sqlite3_step(update) != SQLITE_DONE) {
+                    s = Status::Error(sqlite3_errmsg(db_));
+                }
+            });
+        }
 
-        genre.id = (int) sqlite3_last_insert_rowid(db_);
+        sqlite3_finalize(insert);
+        sqlite3_finalize(update);
 
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+        if (s != Status::OK()) {
+            execute("ROLLBACK TO RollUp");
+            execute("RELEASE RollUp");
+            return s;
         }
 
-		return Status::OK();
-	}
+        return execute("RELEASE RollUp");
+    }
 
-    Status Sqlite3Store::insertNormalized(string normalized, int songId, int artistId, int genreId) {
+    Status Sqlite3Store::rollUpClosed() {
         sqlite3_stmt* statement = 0;
 
-        string query = "REPLACE INTO `Normalized` (`Normalized`, `SongID`, `ArtistID`, `GenreID`) VALUES (?, ?, ?, ?)";
+        string query = "SELECT SessionID FROM ClosedSessions WHERE SessionID NOT IN (SELECT SessionID FROM RolledUpSessions)";
 
         if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_text(statement, 1, normalized.c_str(), normalized.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        vector<int64_t> sessionIds;
 
-        if (sqlite3_bind_int(statement, 2, songId)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        int result = 0;
+        while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
+            sessionIds.push_back(sqlite3_column_int64(statement, 0));
         }
 
-        if (sqlite3_bind_int(statement, 3, artistId)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
-        if (sqlite3_bind_int(statement, 4, genreId)) {
+        sqlite3_finalize(statement);
+
+        if (result != SQLITE_OK && result != SQLITE_DONE) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
+        for (int64_t sessionId : sessionIds) {
+            Session session(sessionId, decay_half_life_, trending_window_);
+            lock_guard<mutex> lock(session.tally_lock);
 
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+            Status s = loadTallies(session);
+            if (s != Status::OK()) {
+                return s;
+            }
+
+            if ((s = rollUp(session, 1))) {
+                return s;
+            }
         }
 
         return Status::OK();
     }
 
-    Status Sqlite3Store::getNormalized(Song& song, string normalized) {
+    Status Sqlite3Store::loadHistory(EntityKind kind, int64_t sessionId, Tally& totals) {
         sqlite3_stmt* statement = 0;
 
-        string query =
-            "SELECT Normalized.SongID, Songs.Name, Normalized.ArtistID, Artists.Name, Normalized.GenreID, Genres.Name FROM Normalized "
-            "LEFT JOIN Songs   ON Normalized.SongID == Songs.SongID "
-            "LEFT JOIN Artists ON Normalized.ArtistID == Artists.ArtistID "
-            "LEFT JOIN Genres  ON Normalized.GenreID == Genres.GenreID "
-            "WHERE Normalized.Normalized = ?";
+        string query = "SELECT EntityID, Count, Votes FROM Rollups WHERE Kind = ?";
 
         if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_text(statement, 1, normalized.c_str(), normalized.size(), SQLITE_STATIC)) {
+        if (sqlite3_bind_int(statement, 1, static_cast<int>(kind))) {
+            sqlite3_finalize(statement);
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        int id = 0;
-        int count = 0;
         int result = 0;
         while ((result = sqlite3_step(statement)) == SQLITE_ROW) {
-            count++;
-            id = sqlite3_column_int(statement, 0);
-            if (id != 0) {
-                song.id   = id;
-                song.name = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)));
-            }
-
-            id = sqlite3_column_int(statement, 2);
-            if (id != 0) {
-                song.artist.id   = id;
-                song.artist.name = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 3)));
-            }
-
-            id = sqlite3_column_int(statement, 4);
-            if (id != 0) {
-                song.genre.id   = id;
-                song.genre.name = string(reinterpret_cast<const char*>(sqlite3_column_text(statement, 5)));
-            }
+            totals.apply(
+                kind,
+                sqlite3_column_int(statement, 0),
+                sqlite3_column_int(statement, 1),
+                sqlite3_column_int(statement, 2));
         }
 
         sqlite3_finalize(statement);
@@ -779,180 +3668,175 @@ namespace internal {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (!count) {
-            return Status::NotFound("Could not find normalized entry");
+        // Open sessions are never in the rollups, so any besides
+        // the excluded one are added from their live tallies.
+        vector<shared_ptr<Session>> open;
+        {
+            lock_guard<mutex> lock(sessions_lock_);
+            for (auto& entry : sessions_) {
+                if (entry.first != sessionId) {
+                    open.push_back(entry.second);
+                }
+            }
         }
 
-        return Status::OK();
-    }
+        for (auto& session : open) {
+            lock_guard<mutex> lock(session->tally_lock);
+            session->tally.forEach([&](EntityKind k, int id, int count, int votes) {
+                if (k == kind) {
+                    totals.apply(kind, id, count, votes);
+                }
+            });
+        }
 
-    Status Sqlite3Store::markUnplayable(int songId) {
-        lock_guard<recursive_mutex> lock(queue_lock_);
-        unplayable_song_ids_.insert(songId);
         return Status::OK();
     }
 
-    Status Sqlite3Store::voteSong(std::string userId, Song& song, int amount, WriteOptions options) {
-        sqlite3_stmt* statement = 0;
-
-        if (song.id == 0) {
-            return Status::Error("Cannot count a song that does not exist");
-        }
-
-        Status s = setActivity(userId, timestamp());
+    Status Sqlite3Store::createSession() {
+        int64_t result = 0;
+        return createSession(result);
+	}
+    Status Sqlite3Store::createSession(int64_t& result) {
+        Status s = insertSession(result);
         if (s != Status::OK()) {
             return s;
         }
 
-        string query = "REPLACE INTO `SongVotes` (`SongID`, `SessionID`, `UserID`, `Vote`) VALUES (?, ?, ?, ?)";
-
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
-
-        if (sqlite3_bind_int(statement, 1, song.id)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        // The queue and buffer carry over from the last default
+        // session, so they survive a restart, as the votes do not.
+        bool adopted = false;
+        if ((s = setDefaultSession(result, true, adopted))) {
+            return s;
         }
 
-        if (sqlite3_bind_int(statement, 2, session_id_)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        if ((s = loadSession(result, !adopted))) {
+            return s;
         }
 
-        if (sqlite3_bind_text(statement, 3, userId.c_str(), userId.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        int64_t previous = 0;
 
-        if (sqlite3_bind_int(statement, 4, amount)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        {
+            lock_guard<mutex> lock(sessions_lock_);
+            previous    = session_id_;
+            session_id_ = result;
         }
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
-
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+        // Leave the outgoing session with an up to date snapshot.
+        if (previous > 0) {
+            return unloadSession(previous);
         }
 
-		return Status::OK();
+        return Status::OK();
 	}
-    Status Sqlite3Store::voteArtist(std::string userId, Artist& artist, int amount, WriteOptions options) {
-        sqlite3_stmt* statement = 0;
-
-        if (artist.id == 0) {
-            return Status::Error("Cannot count an artist that does not exist");
-        }
 
-        Status s = setActivity(userId, timestamp());
+    Status Sqlite3Store::restoreSession(int64_t sessionId) {
+        Status s = openSession(sessionId);
         if (s != Status::OK()) {
             return s;
         }
 
-        string query = "REPLACE INTO `ArtistVotes` (`ArtistID`, `SessionID`, `UserID`, `Vote`) VALUES (?, ?, ?, ?)";
-
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        bool adopted = false;
+        if ((s = setDefaultSession(sessionId, false, adopted))) {
+            return s;
         }
 
-        if (sqlite3_bind_int(statement, 1, artist.id)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        int64_t previous = 0;
 
-        if (sqlite3_bind_int(statement, 2, session_id_)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        {
+            lock_guard<mutex> lock(sessions_lock_);
+            previous    = session_id_;
+            session_id_ = sessionId;
         }
 
-        if (sqlite3_bind_text(statement, 3, userId.c_str(), userId.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        if (previous > 0 && previous != sessionId) {
+            return unloadSession(previous);
         }
 
-        if (sqlite3_bind_int(statement, 4, amount)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        return Status::OK();
+    }
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
+    Status Sqlite3Store::setDefaultSession(int64_t sessionId, bool adopt, bool& adopted) {
+        sqlite3_stmt* statement = 0;
+        int64_t previous = 0;
 
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        lock_guard<recursive_mutex> write_lock(write_lock_);
 
-		return Status::OK();
-	}
-    Status Sqlite3Store::voteGenre(std::string userId, Genre& genre, int amount, WriteOptions options) {
-        sqlite3_stmt* statement = 0;
+        if (adopt) {
+            string query = "SELECT SessionID FROM `DefaultSession`";
 
-        if (genre.id == 0) {
-            return Status::Error("Cannot count a song that does not exist");
-        }
+            if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
 
-        Status s = setActivity(userId, timestamp());
-        if (s != Status::OK()) {
-            return s;
-        }
+            int r = sqlite3_step(statement);
+            if (r == SQLITE_ROW) {
+                previous = sqlite3_column_int64(statement, 0);
+            }
 
-        string query = "REPLACE INTO `GenreVotes` (`GenreID`, `SessionID`, `UserID`, `Vote`) VALUES (?, ?, ?, ?)";
+            sqlite3_finalize(statement);
 
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
+            if (r != SQLITE_ROW && r != SQLITE_DONE) {
+                return Status::Error(sqlite3_errmsg(db_));
+            }
         }
 
-        if (sqlite3_bind_int(statement, 1, genre.id)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        Status s = execute("SAVEPOINT DefaultSession");
+        if (s != Status::OK()) {
+            return s;
         }
 
-        if (sqlite3_bind_int(statement, 2, session_id_)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        if (previous > 0 && previous != sessionId) {
+            s = execute("UPDATE `QueueEntries` SET SessionID = ? WHERE SessionID = ?", { sessionId, previous });
+            if (s == Status::OK()) {
+                s = execute("UPDATE `BufferEntries` SET SessionID = ? WHERE SessionID = ?", { sessionId, previous });
+            }
+            adopted = true;
         }
 
-        if (sqlite3_bind_text(statement, 3, userId.c_str(), userId.size(), SQLITE_STATIC)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        if (s == Status::OK()) {
+            s = execute("REPLACE INTO `DefaultSession` (`Slot`, `SessionID`) VALUES (0, ?)", { sessionId });
         }
 
-        if (sqlite3_bind_int(statement, 4, amount)) {
-            return Status::Error(sqlite3_errmsg(db_));
+        if (s != Status::OK()) {
+            adopted = false;
+            execute("ROLLBACK TO DefaultSession");
+            execute("RELEASE DefaultSession");
+            return s;
         }
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
+        return execute("RELEASE DefaultSession");
+    }
 
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+    Status Sqlite3Store::addSession(int64_t& result) {
+        Status s = insertSession(result);
+        if (s != Status::OK()) {
+            return s;
         }
 
-		return Status::OK();
-	}
-
-    Status Sqlite3Store::createSession() {
-        int64_t result = 0;
-        return createSession(result);
-	}
-    Status Sqlite3Store::createSession(int64_t& result) {
-        sqlite3_stmt* statement = 0;
-
-        string query = "INSERT INTO `SessionHistory` (`Date`) VALUES (?)";
-
-        if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
-            return Status::Error(sqlite3_errmsg(db_));
-        }
+        return loadSession(result, true);
+    }
 
-        if (sqlite3_bind_int64(statement, 1, timestamp())) {
-            return Status::Error(sqlite3_errmsg(db_));
+    Status Sqlite3Store::openSession(int64_t sessionId) {
+        if (findSession(sessionId)) {
+            return Status::OK();
         }
 
-        int r = sqlite3_step(statement);
-        sqlite3_finalize(statement);
+        return loadSession(sessionId, false);
+    }
 
-        if (r != SQLITE_OK && r != SQLITE_DONE) {
-            return Status::Error(sqlite3_errmsg(db_));
+    Status Sqlite3Store::closeSession(int64_t sessionId) {
+        {
+            lock_guard<mutex> lock(sessions_lock_);
+            if (sessionId == session_id_) {
+                return Status::Error("Cannot close the default session");
+            }
         }
 
-        session_id_ = (int64_t) sqlite3_last_insert_rowid(db_);
-        result = session_id_;
-
-		return Status::OK();
-	}
+        return unloadSession(sessionId);
+    }
 
     Status Sqlite3Store::getSession(int64_t& result) {
+        lock_guard<mutex> lock(sessions_lock_);
         result = session_id_;
 		return Status::OK();
 	}
@@ -982,13 +3866,28 @@ namespace internal {
     Status Sqlite3Store::getSessionUserCount(int& userCount, ReadOptions options) {
         sqlite3_stmt* statement = 0;
 
-        string query = "SELECT COUNT(*) FROM UserActivity WHERE LastActive > ?";
+        string query = "SELECT COUNT(*) FROM UserActivity WHERE LastActive > ? ";
+
+        if (options.session_id != -1) {
+            query += "AND SessionID = ?";
+        } else {
+            query += "AND SessionID != ?";
+        }
 
         if (sqlite3_prepare_v2(db_, query.c_str(), -1, &statement, 0)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
-        if (sqlite3_bind_int64(statement, 1, timestamp() - options.inactivity_threshold)) {
+        if (sqlite3_bind_int64(statement, 1, activeSince(options))) {
+            return Status::Error(sqlite3_errmsg(db_));
+        }
+
+        if (options.session_id <= 0) {
+            lock_guard<mutex> lock(sessions_lock_);
+            options.session_id = session_id_;
+        }
+
+        if (sqlite3_bind_int64(statement, 2, options.session_id)) {
             return Status::Error(sqlite3_errmsg(db_));
         }
 
@@ -1,10 +1,14 @@
 #ifndef skrillex_sqlite3store_hpp
 #define skrillex_sqlite3store_hpp
 
+#include <atomic>
+#include <initializer_list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "skrillex/dbo.hpp"
@@ -12,9 +16,15 @@
 #include "skrillex/result_set.hpp"
 #include "skrillex/status.hpp"
 
+#include "store/dictionary.hpp"
+#include "store/name_index.hpp"
 #include "store/store.hpp"
+#include "store/session.hpp"
 #include "store/sqlite3_bootstrap.hpp"
+#include "store/tally.hpp"
 #include "sqlite3/sqlite3.h"
+#include "util/arena.hpp"
+#include "util/bitmap.hpp"
 
 namespace skrillex {
 namespace internal {
@@ -25,67 +35,306 @@ namespace internal {
         Sqlite3Store(Sqlite3Store&& other)      = delete;
         ~Sqlite3Store();
 
-        Status open(std::string path, Options options);
+        Status open(const std::string& path, Options options);
 
         Status getSongs(ResultSet<Song>& set, ReadOptions options);
         Status getArtists(ResultSet<Artist>& set, ReadOptions options);
         Status getGenres(ResultSet<Genre>& set, ReadOptions options);
 
+        Status searchSongs(const std::string& query, ResultSet<Song>& set, ReadOptions options);
+        Status searchArtists(const std::string& query, ResultSet<Artist>& set, ReadOptions options);
+
         Status getSongFromId(Song& s, int songId);
 
         Status getPlayHistory(ResultSet<Song>& set, ReadOptions options);
 
-        Status setQueue(std::vector<int> songIds);
-        Status getQueue(ResultSet<Song>& set);
-        Status queueSong(int songId);
-        Status clearQueue();
+        Status setQueue(const std::vector<int>& songIds, WriteOptions options);
+        Status getQueue(ResultSet<Song>& set, ReadOptions options);
+        Status queueSong(int songId, WriteOptions options);
+        Status clearQueue(WriteOptions options);
 
-        Status getBuffer(ResultSet<Song>& set);
-        Status bufferNext();
-        Status removeFromBuffer(int songId);
-        Status songFinished();
+        Status getBuffer(ResultSet<Song>& set, ReadOptions options);
+        Status bufferNext(WriteOptions options);
+        Status removeFromBuffer(int songId, WriteOptions options);
+        Status songFinished(WriteOptions options);
 
-        Status setActivity(std::string userId, int64_t timestamp);
+        Status setActivity(const std::string& userId, int64_t timestamp, WriteOptions options);
 
         Status addSong(Song& song);
         Status addArtist(Artist& artist);
         Status addGenre(Genre& genre);
 
-        Status insertNormalized(std::string normalized, int songId, int artistId, int genreId);
-        Status getNormalized(Song& song, std::string normalizedName);
+        Status insertNormalized(uint64_t hash, const std::string& normalized, int songId, int artistId, int genreId);
+        Status getNormalized(Song& song, uint64_t hash, const std::string& normalized);
 
         Status markUnplayable(int songId);
 
-        Status voteSong(std::string userId, Song& song, int amount, WriteOptions options);
-        Status voteArtist(std::string userId, Artist& artist, int amount, WriteOptions options);
-        Status voteGenre(std::string userId, Genre& genre, int amount, WriteOptions options);
+        Status voteSong(const std::string& userId, Song& song, int amount, WriteOptions options);
+        Status voteArtist(const std::string& userId, Artist& artist, int amount, WriteOptions options);
+        Status voteGenre(const std::string& userId, Genre& genre, int amount, WriteOptions options);
 
         Status createSession();
         Status createSession(int64_t& result);
+        Status restoreSession(int64_t sessionId);
+
+        Status addSession(int64_t& result);
+        Status openSession(int64_t sessionId);
+        Status closeSession(int64_t sessionId);
 
         Status getSession(int64_t& result);
         Status getSessionCount(int& result);
 
+        Status beginBatch();
+        Status commitBatch();
+
         Status getSessionUserCount(int& userCount, ReadOptions options);
     private:
-        Status insertUser(std::string userId);
+        // Executes a query that returns no rows, binding each of
+        // params (in order) as an integer.
+        Status execute(const char* query, std::initializer_list<int64_t> params = {});
+        Status execute(const std::string& query, std::initializer_list<int64_t> params = {});
+
+        // Rebuilds the unplayable set, the set of partitioned
+        // sessions, and the catalog index, from their persisted
+        // tables.
+        Status recover();
+
+        // Adds a song to the catalog index. Requires catalog_lock_.
+        void indexSong(int songId, int artistId, int genreId, const std::string& name);
+
+        // Builds a dense mask of the songs a read filters out. The
+        // session, if any, is the one whose buffer and plays count.
+        // Must not hold any of its locks.
+        void filterMask(Session* session, const ReadOptions& options, ScratchVector<uint64_t>& mask);
+
+        // Builds a dense mask of the songs that match the catalog
+        // predicates of a read (see catalogPredicates).
+        Status matchSongs(const ReadOptions& options, ScratchVector<uint64_t>& mask);
+
+        // Loads when songs were last played in a session.
+        Status loadPlays(Session& session);
+
+        // Records a play, unranking the song for autofill, and
+        // forgets plays that have fallen out of the played window.
+        // Requires session.tally_lock.
+        void recordPlay(Session& session, int songId, int64_t timestamp);
+        void expirePlays(Session& session, int64_t now);
+
+        // Looks up an open session. Zero refers to the default session.
+        std::shared_ptr<Session> findSession(int64_t sessionId);
+        Status findSession(int64_t sessionId, std::shared_ptr<Session>& session);
+
+        // Inserts a new row into SessionHistory.
+        Status insertSession(int64_t& result);
+
+        // Loads a session's queue, buffer, and tallies, and makes it
+        // available for reads and writes.
+        Status loadSession(int64_t sessionId, bool created);
+
+        // Snapshots a session, and drops its in-memory state.
+        Status unloadSession(int64_t sessionId);
+
+        // Records sessionId as the default session. If adopt, it also
+        // takes over the queue and buffer of the previous default,
+        // setting adopted if there was one.
+        Status setDefaultSession(int64_t sessionId, bool adopt, bool& adopted);
+
+        Status getSongFromId(Song& s, int songId, int64_t sessionId);
+
+        // Locks write_lock_ if any session is partitioned, so that
+        // attachments outlive the statements that read from them.
+        std::unique_lock<std::recursive_mutex> lockPartitions();
+
+        // Attaches a session's partition as schema s<id>, detaching
+        // one no open session needs if at the limit. Requires
+        // write_lock_, and must not be inside a savepoint.
+        Status attach(int64_t sessionId);
+
+        // Names the table holding a session's votes or play history,
+        // which is in its partition if it has one. Requires write_lock_
+        // (see lockPartitions) until the name is no longer used.
+        Status table(const std::string& name, int64_t sessionId, std::string& result);
+
+        // Names a table holding the rows of every session except one,
+        // gathering them from each partition if there are any.
+        Status historyTable(const std::string& name, int64_t sessionId, std::string& result);
+
+        // Marks a user (by key) as active in a session.
+        Status setActivity(Session& session, int userKey, int64_t timestamp);
+
+        // The key of a user, by device id, adding the user if new.
+        Status userKey(const std::string& userId, int& key);
+
+        // Records a vote, keeping the vote log and tallies in step.
+        Status vote(EntityKind kind, const std::string& userId, int id, int amount, WriteOptions options);
+
+        // Replaces the persisted snapshot of a session's tallies,
+        // and truncates its vote log. Requires session.tally_lock.
+        Status snapshot(Session& session);
+
+        // Rebuilds the tallies of a session from its snapshot and
+        // vote log. Requires session.tally_lock.
+        Status loadTallies(Session& session);
+
+        // Rebuilds the queue and buffer of a session from their
+        // persisted tables.
+        Status loadQueue(Session& session);
+
+        // Adds (sign 1) or removes (sign -1) a session's tallies from
+        // the rollups of closed sessions. Requires session.tally_lock.
+        Status rollUp(Session& session, int sign);
+
+        // Marks a session closed, snapshots its tallies, and adds
+        // them to the rollups. Requires session.tally_lock.
+        Status retire(Session& session);
+
+        // Adds every closed session not yet in the rollups to them.
+        // Only safe before any session is opened.
+        Status rollUpClosed();
+
+        // Totals the counts and votes of a given kind over every
+        // session except one, from the rollups and open sessions.
+        Status loadHistory(EntityKind kind, int64_t sessionId, Tally& totals);
+
+        // Reads the catalog of a given kind without aggregating any
+        // votes, taking counts and votes from the session's tallies
+        // instead, or from totals if given.
+        Status getSongsFromTallies(Session& session, ResultSet<Song>& set, ReadOptions options, const Tally* totals = nullptr);
+        template<typename T>
+        Status getCountablesFromTallies(Session& session, EntityKind kind, ResultSet<T>& set, ReadOptions options, const Tally* totals = nullptr);
+
+        // Ranks songs by SortType::Composite over the catalog
+        // index, and reads only the rows that make the cut.
+        Status getCompositeSongs(Session& session, ResultSet<Song>& set, ReadOptions options);
+
+        // Finds the best ranked songs that match a search, by walking
+        // the session's songs in rank order. Requires catalog_lock_
+        // and session.tally_lock.
+        void walkRanking(Session& session, const std::string& prefix, const ScratchVector<uint64_t>& filtered, size_t limit, std::vector<int>& matches);
+
+        // Ranks the matches of a search by the session's votes, and
+        // fills in the ids and counts of those that make the cut.
+        template<typename T>
+        void searchRank(Session& session, EntityKind kind, const std::vector<int>& matches, const ReadOptions& options, std::vector<T>& rows);
+
+        // Reads the catalog fields of rows that already hold their
+        // ids (see ReadOptions::fields), by looking up just those ids.
+        Status readSongRows(int64_t sessionId, int fields, std::vector<Song>& rows);
+
+        // Fills in the score each row is sorted by, if the read is
+        // sorted by one. Requires session.tally_lock.
+        template<typename T>
+        void score(Session& session, EntityKind kind, std::vector<T>& rows, SortType sort);
+
+        // Brings a result set read from a session's tallies up to
+        // date with the changes since it was read. Leaves applied
+        // false if it cannot, in which case it must be read in full.
+        template<typename T>
+        Status getDelta(Session& session, EntityKind kind, ResultSet<T>& set, ReadOptions options, bool& applied);
+
+        // Re-reads the catalog entry of a row, keeping its tallies.
+        Status refresh(Session& session, Song& song);
+        Status refresh(Session& session, Artist& artist);
+        Status refresh(Session& session, Genre& genre);
+
+        // Ranks every eligible song for autofill, and gathers the
+        // artists of the latest tracks. Requires catalog_lock_, and
+        // the queue and plays to be loaded.
+        void loadAutofill(Session& session);
+
+        // The score a song is ranked by for autofill.
+        int autofillScore(const Tally& tally, int songId);
+
+        // Ranks a song for autofill, unless it is buffered,
+        // unplayable or was played within the replay interval, and
+        // ranks again the songs whose interval has passed since.
+        // Require session.buffer_lock and session.tally_lock.
+        void rank(Session& session, int songId, int64_t now);
+        void rankRested(Session& session, int64_t now);
+
+        // Picks the song autofill would queue next, or 0 if none is
+        // eligible. Requires catalog_lock_ and session.queue_lock.
+        int pickNext(Session& session);
+
+        // Records a change for delta reads, forgetting the oldest
+        // if the log is full. Requires session.tally_lock.
+        void logChange(Session& session, EntityKind kind, int id, bool row);
+
+        // Records a catalog change in every open session, ranking
+        // added songs for autofill.
+        void logCatalogChange(EntityKind kind, int id, bool added);
 
     private:
         sqlite3* db_;
 
-        std::recursive_mutex queue_lock_;
-        std::vector<Song> song_queue_;
-        std::set<int> unplayable_song_ids_;
+        // A leaf: nothing else is taken while it is held, so it may
+        // be taken under any other lock, write_lock_ included.
+        std::mutex unplayable_lock_;
+        Bitmap     unplayable_song_ids_;
+
+        // Guards the session map, and the default session id. The
+        // sessions themselves are guarded by their own locks.
+        std::mutex sessions_lock_;
+        std::map<int64_t, std::shared_ptr<Session>> sessions_;
+        int64_t session_id_;
+
+        // Savepoints, sqlite3_changes() and sqlite3_last_insert_rowid()
+        // are per connection, so every write (and every sequence that
+        // reads them back) holds this. The innermost lock, but for
+        // the leaves (unplayable_lock_, and the dictionary's).
+        std::recursive_mutex write_lock_;
+
+        std::string path_;
+        bool        partition_sessions_;
+
+        // Partitioned sessions, those with their partition attached,
+        // and those whose partition must stay attached (i.e. open).
+        // Guarded by write_lock_.
+        std::set<int64_t> partitions_;
+        std::set<int64_t> attached_;
+        std::set<int64_t> pinned_;
+        std::atomic<bool> partitioned_;
+
+        int snapshot_interval_;
 
-        std::mutex buffer_lock_;
-        std::set<int> song_buffer_ids_;
-        std::vector<Song> song_buffer_;
+        // The version of the latest change to any session. Result
+        // sets are tagged with it when read from tallies.
+        std::atomic<int> version_;
+        size_t           change_log_size_;
 
+        int64_t decay_half_life_;
+        int64_t trending_window_;
 
-	int64_t session_id_;
+        // The artist and genre of every song, indexed by song id,
+        // for composite reads. Always locked before any session.
+        std::mutex        catalog_lock_;
+        Bitmap            songs_;
+        std::vector<int>  song_artists_;
+        std::vector<int>  song_genres_;
+
+        // Song and artist names, and the songs of every artist,
+        // for searches. Guarded by catalog_lock_.
+        NameIndex                     song_names_;
+        NameIndex                     artist_names_;
+        std::vector<std::vector<int>> artist_songs_;
+
+        // The interned names of artists and genres, which every read
+        // hands out. Guards itself.
+        Dictionary dictionary_;
+
+        bool     autofill_;
+        SortType autofill_sort_;
+        size_t   autofill_artist_gap_;
+        int64_t  autofill_replay_interval_;
+
+        int64_t played_window_;
+
+        // The keys of users seen since this was opened. Locked before
+        // write_lock_, and no other.
+        std::mutex                           users_lock_;
+        std::unordered_map<std::string, int> user_keys_;
     };
 }
 }
 
 #endif
-
@@ -14,27 +14,30 @@ namespace internal {
     public:
         virtual ~Store() { }
 
-        virtual Status open(std::string db, Options options) = 0;
+        virtual Status open(const std::string& db, Options options) = 0;
 
         virtual Status getSongs(ResultSet<Song>& set, ReadOptions options) = 0;
         virtual Status getArtists(ResultSet<Artist>& set, ReadOptions options) = 0;
         virtual Status getGenres(ResultSet<Genre>& set, ReadOptions options) = 0;
 
+        virtual Status searchSongs(const std::string& query, ResultSet<Song>& set, ReadOptions options) = 0;
+        virtual Status searchArtists(const std::string& query, ResultSet<Artist>& set, ReadOptions options) = 0;
+
         virtual Status getSongFromId(Song& song, int songId) = 0;
 
         virtual Status getPlayHistory(ResultSet<Song>& set, ReadOptions options) = 0;
 
-        virtual Status setQueue(std::vector<int> songIds) = 0;
-        virtual Status getQueue(ResultSet<Song>& set) = 0;
-        virtual Status queueSong(int song_id) = 0;
-        virtual Status clearQueue() = 0;
+        virtual Status setQueue(const std::vector<int>& songIds, WriteOptions options) = 0;
+        virtual Status getQueue(ResultSet<Song>& set, ReadOptions options) = 0;
+        virtual Status queueSong(int song_id, WriteOptions options) = 0;
+        virtual Status clearQueue(WriteOptions options) = 0;
 
-        virtual Status getBuffer(ResultSet<Song>& set) = 0;
-        virtual Status bufferNext() = 0;
-        virtual Status removeFromBuffer(int songId) = 0;
-        virtual Status songFinished() = 0;
+        virtual Status getBuffer(ResultSet<Song>& set, ReadOptions options) = 0;
+        virtual Status bufferNext(WriteOptions options) = 0;
+        virtual Status removeFromBuffer(int songId, WriteOptions options) = 0;
+        virtual Status songFinished(WriteOptions options) = 0;
 
-        virtual Status setActivity(std::string userID, int64_t timestamp) = 0;
+        virtual Status setActivity(const std::string& userID, int64_t timestamp, WriteOptions options) = 0;
 
         virtual Status addSong(Song& song) = 0;
         virtual Status addArtist(Artist& artist) = 0;
@@ -42,20 +45,34 @@ namespace internal {
 
         virtual Status markUnplayable(int songId) = 0;
 
-        virtual Status insertNormalized(std::string normalized, int songId, int artistId, int genreId) = 0;
-        virtual Status getNormalized(Song& song, std::string normalizedName) = 0;
+        virtual Status insertNormalized(uint64_t hash, const std::string& normalized, int songId, int artistId, int genreId) = 0;
+        virtual Status getNormalized(Song& song, uint64_t hash, const std::string& normalized) = 0;
 
-        virtual Status voteSong(std::string userId, Song& s, int amount, WriteOptions options) = 0;
-        virtual Status voteArtist(std::string userId, Artist& s, int amount, WriteOptions options) = 0;
-        virtual Status voteGenre(std::string userId, Genre& s, int amount, WriteOptions options) = 0;
+        virtual Status voteSong(const std::string& userId, Song& s, int amount, WriteOptions options) = 0;
+        virtual Status voteArtist(const std::string& userId, Artist& s, int amount, WriteOptions options) = 0;
+        virtual Status voteGenre(const std::string& userId, Genre& s, int amount, WriteOptions options) = 0;
 
         virtual Status createSession() = 0;
         virtual Status createSession(int64_t& result) = 0;
+        virtual Status restoreSession(int64_t sessionId) = 0;
+
+        // Sessions open alongside the default session (i.e. rooms).
+        // Reads and writes reach them through their session id.
+        virtual Status addSession(int64_t& result) = 0;
+        virtual Status openSession(int64_t sessionId) = 0;
+        virtual Status closeSession(int64_t sessionId) = 0;
 
         virtual Status getSession(int64_t& result) = 0;
         virtual Status getSessionCount(int& result) = 0;
 
         virtual Status getSessionUserCount(int& userCount, ReadOptions options) = 0;
+
+        // Gathers the writes made between the two into one
+        // transaction, committed by commitBatch. If the commit
+        // fails, the transaction is rolled back, but the in-memory
+        // effects of its writes are not (see WriteQueue::failure).
+        virtual Status beginBatch() = 0;
+        virtual Status commitBatch() = 0;
     };
 }
 }
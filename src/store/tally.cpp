@@ -0,0 +1,87 @@
+#include "store/tally.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    void Tally::apply(EntityKind kind, int id, int count, int votes) {
+        int k = static_cast<int>(kind);
+        if (id <= 0) {
+            return;
+        }
+
+        if (id >= (int) counts_[k].size()) {
+            counts_[k].resize(id + 1, 0);
+            votes_[k].resize(id + 1, 0);
+        }
+
+        counts_[k][id] += count;
+        votes_[k][id]  += votes;
+    }
+
+    int Tally::count(EntityKind kind, int id) const {
+        int k = static_cast<int>(kind);
+        if (id <= 0 || id >= (int) counts_[k].size()) {
+            return 0;
+        }
+
+        return counts_[k][id];
+    }
+
+    int Tally::votes(EntityKind kind, int id) const {
+        int k = static_cast<int>(kind);
+        if (id <= 0 || id >= (int) votes_[k].size()) {
+            return 0;
+        }
+
+        return votes_[k][id];
+    }
+
+    int Tally::size(EntityKind kind) const {
+        return counts_[static_cast<int>(kind)].size();
+    }
+
+    void Tally::composite(const vector<int>& artists, const vector<int>& genres,
+                          double songWeight, double artistWeight, double genreWeight,
+                          vector<double>& scores) {
+        size_t songs = min(artists.size(), genres.size());
+        scores.assign(songs, 0);
+        if (songs == 0) {
+            return;
+        }
+
+        // Sized up front, so the loop below needs no bounds checks.
+        reserve(EntityKind::Song, songs);
+        reserve(EntityKind::Artist, *max_element(artists.begin(), artists.begin() + songs) + 1);
+        reserve(EntityKind::Genre, *max_element(genres.begin(), genres.begin() + songs) + 1);
+
+        const int* song   = votes_[static_cast<int>(EntityKind::Song)].data();
+        const int* artist = votes_[static_cast<int>(EntityKind::Artist)].data();
+        const int* genre  = votes_[static_cast<int>(EntityKind::Genre)].data();
+        const int* a      = artists.data();
+        const int* g      = genres.data();
+        double*    out    = scores.data();
+
+        for (size_t id = 0; id < songs; id++) {
+            out[id] = songWeight * song[id] + artistWeight * artist[a[id]] + genreWeight * genre[g[id]];
+        }
+    }
+
+    void Tally::reserve(EntityKind kind, int size) {
+        int k = static_cast<int>(kind);
+        if (size > (int) counts_[k].size()) {
+            counts_[k].resize(size, 0);
+            votes_[k].resize(size, 0);
+        }
+    }
+
+    void Tally::clear() {
+        for (int k = 0; k < NumKinds; k++) {
+            counts_[k].clear();
+            votes_[k].clear();
+        }
+    }
+}
+}
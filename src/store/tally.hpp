@@ -0,0 +1,73 @@
+//
+// tally.hpp
+//
+// A Tally holds the count and vote totals of every song,
+// artist, and genre within a single session. It is kept up
+// to date on each vote, so rankings over the session can be
+// produced without aggregating the vote tables.
+//
+// Entries are indexed densely by entity id, since ids are
+// handed out sequentially by the database.
+//
+// Tally is **not** thread safe.
+//
+
+#ifndef skrillex_tally_hpp
+#define skrillex_tally_hpp
+
+#include <cstddef>
+#include <vector>
+
+namespace skrillex {
+namespace internal {
+    enum class EntityKind {
+        Song   = 0,
+        Artist = 1,
+        Genre  = 2
+    };
+
+    class Tally {
+    public:
+        static const int NumKinds = 3;
+
+        // Adds the given count and votes to an entity.
+        void apply(EntityKind kind, int id, int count, int votes);
+
+        int count(EntityKind kind, int id) const;
+        int votes(EntityKind kind, int id) const;
+
+        // Returns one past the largest id with an entry.
+        int size(EntityKind kind) const;
+
+        // Scores every song by its votes, plus those of its artist
+        // and genre (artists[id] and genres[id]), each weighted.
+        // scores is indexed by song id, like artists and genres.
+        void composite(const std::vector<int>& artists, const std::vector<int>& genres,
+                       double songWeight, double artistWeight, double genreWeight,
+                       std::vector<double>& scores);
+
+        // Calls f(kind, id, count, votes) for every non-empty entry.
+        template<typename F>
+        void forEach(F f) const {
+            for (int k = 0; k < NumKinds; k++) {
+                for (size_t id = 0; id < counts_[k].size(); id++) {
+                    if (counts_[k][id] || votes_[k][id]) {
+                        f(static_cast<EntityKind>(k), (int) id, counts_[k][id], votes_[k][id]);
+                    }
+                }
+            }
+        }
+
+        void clear();
+
+    private:
+        // Ensures entries exist for ids below size.
+        void reserve(EntityKind kind, int size);
+
+        std::vector<int> counts_[NumKinds];
+        std::vector<int> votes_[NumKinds];
+    };
+}
+}
+
+#endif
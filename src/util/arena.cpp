@@ -0,0 +1,92 @@
+#include "util/arena.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    const size_t Arena::ChunkSize;
+
+    Arena::Arena()
+    : next_(nullptr)
+    , end_(nullptr)
+    , used_(0)
+    , chunks_(0)
+    , depth_(0)
+    {
+    }
+
+    Arena::~Arena() {
+        for (auto& c : blocks_) {
+            free(c.data);
+        }
+    }
+
+    void Arena::reset() {
+        used_ = 0;
+
+        if (blocks_.empty()) {
+            return;
+        }
+
+        // Keep the largest chunk, which the next read is most
+        // likely to fit in.
+        auto largest = max_element(blocks_.begin(), blocks_.end(), [](const Chunk& a, const Chunk& b) {
+            return a.size < b.size;
+        });
+
+        Chunk kept = *largest;
+        for (auto& c : blocks_) {
+            if (c.data != kept.data) {
+                free(c.data);
+            }
+        }
+
+        blocks_.assign(1, kept);
+        next_ = kept.data;
+        end_  = kept.data + kept.size;
+    }
+
+    void* Arena::grow(size_t size, size_t alignment) {
+        // Each chunk is at least twice the last, so a read that
+        // outgrows the arena settles into one chunk after a reset.
+        size_t chunk = max(ChunkSize, size + alignment);
+        if (!blocks_.empty()) {
+            chunk = max(chunk, blocks_.back().size * 2);
+        }
+
+        char* data = static_cast<char*>(malloc(chunk));
+        if (!data) {
+            throw bad_alloc();
+        }
+
+        blocks_.push_back(Chunk{ data, chunk });
+        chunks_++;
+
+        next_ = data;
+        end_  = data + chunk;
+
+        return allocate(size, alignment);
+    }
+
+    Arena& Arena::local() {
+        static thread_local Arena arena;
+        return arena;
+    }
+
+    Arena::Scope::Scope()
+    : arena_(Arena::local())
+    {
+        arena_.depth_++;
+    }
+
+    Arena::Scope::~Scope() {
+        if (--arena_.depth_ == 0) {
+            arena_.reset();
+        }
+    }
+}
+}
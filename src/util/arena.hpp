@@ -0,0 +1,139 @@
+//
+// arena.hpp
+//
+// An Arena hands out memory by bumping a pointer through chunks
+// it allocates, and frees nothing until it is reset, which frees
+// everything at once. The largest chunk is kept across resets, so
+// once an arena has grown to fit its workload, it stops allocating.
+//
+// Each thread has an arena for the temporaries of a single read
+// (queries being built, filter masks). A Scope marks a read: when
+// the outermost scope on a thread ends, its arena is reset, so
+// nothing allocated from it may outlive the scope.
+//
+// ArenaAllocator adapts the thread's arena to the standard
+// containers, as QueryString and ScratchVector do.
+//
+// Arena is **not** thread safe.
+//
+
+#ifndef skrillex_arena_hpp
+#define skrillex_arena_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace skrillex {
+namespace internal {
+    class Arena {
+    public:
+        // Chunks are at least this large.
+        static const size_t ChunkSize = 16384;
+
+        Arena();
+        ~Arena();
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+            uintptr_t p = (reinterpret_cast<uintptr_t>(next_) + alignment - 1) & ~(uintptr_t(alignment) - 1);
+            if (p + size > reinterpret_cast<uintptr_t>(end_)) {
+                return grow(size, alignment);
+            }
+
+            next_ = reinterpret_cast<char*>(p + size);
+            used_ += size;
+
+            return reinterpret_cast<void*>(p);
+        }
+
+        // Frees everything allocated, keeping the largest chunk.
+        void reset();
+
+        // Bytes handed out since the last reset, and the chunks
+        // allocated over the arena's life.
+        size_t used()   const { return used_; }
+        size_t chunks() const { return chunks_; }
+
+        // The calling thread's arena.
+        static Arena& local();
+
+        // Marks a read on the calling thread, resetting its arena
+        // once the outermost scope ends.
+        class Scope {
+        public:
+            Scope();
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            Arena& arena_;
+        };
+
+    private:
+        void* grow(size_t size, size_t alignment);
+
+        struct Chunk {
+            char*  data;
+            size_t size;
+        };
+
+        std::vector<Chunk> blocks_;
+        char*              next_;
+        char*              end_;
+        size_t             used_;
+        size_t             chunks_;
+        int                depth_;
+    };
+
+    // Allocates from the arena of the thread it was created on.
+    // Deallocation is a no-op; the memory returns on reset.
+    template<typename T>
+    class ArenaAllocator {
+    public:
+        typedef T value_type;
+
+        ArenaAllocator()
+        : arena_(&Arena::local())
+        {
+        }
+
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other)
+        : arena_(other.arena_)
+        {
+        }
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T*, size_t) {}
+
+        template<typename U>
+        bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena_; }
+
+        template<typename U>
+        bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena_; }
+
+    private:
+        Arena* arena_;
+
+        template<typename U>
+        friend class ArenaAllocator;
+    };
+
+    typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> QueryString;
+
+    template<typename T>
+    using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+}
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "util/bitmap.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    const size_t Bitmap::ContainerWords;
+
+    Bitmap::Bitmap()
+    : cardinality_(0)
+    {
+    }
+
+    void Bitmap::add(uint32_t id) {
+        Container* c = find(id >> 16, true);
+        uint16_t low = id & 0xFFFF;
+
+        if (!c->bits.empty()) {
+            uint64_t& word = c->bits[low / 64];
+            uint64_t  bit  = uint64_t(1) << (low % 64);
+            if (!(word & bit)) {
+                word |= bit;
+                c->cardinality++;
+                cardinality_++;
+            }
+            return;
+        }
+
+        auto it = lower_bound(c->array.begin(), c->array.end(), low);
+        if (it != c->array.end() && *it == low) {
+            return;
+        }
+
+        c->array.insert(it, low);
+        c->cardinality++;
+        cardinality_++;
+
+        // Past the limit, a bitset takes less space than the array.
+        if (c->array.size() > ArrayLimit) {
+            c->bits.assign(ContainerWords, 0);
+            for (uint16_t v : c->array) {
+                c->bits[v / 64] |= uint64_t(1) << (v % 64);
+            }
+            c->array.clear();
+            c->array.shrink_to_fit();
+        }
+    }
+
+    void Bitmap::remove(uint32_t id) {
+        Container* c = find(id >> 16, false);
+        if (!c) {
+            return;
+        }
+
+        uint16_t low = id & 0xFFFF;
+
+        if (!c->bits.empty()) {
+            uint64_t& word = c->bits[low / 64];
+            uint64_t  bit  = uint64_t(1) << (low % 64);
+            if (!(word & bit)) {
+                return;
+            }
+
+            word &= ~bit;
+            c->cardinality--;
+            cardinality_--;
+
+            if (c->cardinality <= ArrayLimit) {
+                for (size_t w = 0; w < c->bits.size(); w++) {
+                    for (uint64_t bits = c->bits[w]; bits; bits &= bits - 1) {
+                        c->array.push_back(w * 64 + __builtin_ctzll(bits));
+                    }
+                }
+                c->bits.clear();
+                c->bits.shrink_to_fit();
+            }
+        } else {
+            auto it = lower_bound(c->array.begin(), c->array.end(), low);
+            if (it == c->array.end() || *it != low) {
+                return;
+            }
+
+            c->array.erase(it);
+            c->cardinality--;
+            cardinality_--;
+        }
+
+        if (c->cardinality == 0) {
+            containers_.erase(containers_.begin() + (c - containers_.data()));
+        }
+    }
+
+    bool Bitmap::contains(uint32_t id) const {
+        const Container* c = find(id >> 16);
+        if (!c) {
+            return false;
+        }
+
+        uint16_t low = id & 0xFFFF;
+
+        if (!c->bits.empty()) {
+            return (c->bits[low / 64] >> (low % 64)) & 1;
+        }
+
+        return binary_search(c->array.begin(), c->array.end(), low);
+    }
+
+    size_t Bitmap::cardinality() const {
+        return cardinality_;
+    }
+
+    bool Bitmap::empty() const {
+        return cardinality_ == 0;
+    }
+
+    void Bitmap::clear() {
+        containers_.clear();
+        cardinality_ = 0;
+    }
+
+    Bitmap::Container* Bitmap::find(uint16_t key, bool create) {
+        auto it = lower_bound(containers_.begin(), containers_.end(), key, [](const Container& c, uint16_t key) {
+            return c.key < key;
+        });
+
+        if (it != containers_.end() && it->key == key) {
+            return &*it;
+        }
+
+        if (!create) {
+            return nullptr;
+        }
+
+        Container c;
+        c.key         = key;
+        c.cardinality = 0;
+
+        return &*containers_.insert(it, c);
+    }
+
+    const Bitmap::Container* Bitmap::find(uint16_t key) const {
+        auto it = lower_bound(containers_.begin(), containers_.end(), key, [](const Container& c, uint16_t key) {
+            return c.key < key;
+        });
+
+        if (it != containers_.end() && it->key == key) {
+            return &*it;
+        }
+
+        return nullptr;
+    }
+}
+}
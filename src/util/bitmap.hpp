@@ -0,0 +1,103 @@
+//
+// bitmap.hpp
+//
+// A compressed set of non-negative ids, laid out like a roaring
+// bitmap: ids are split by their upper 16 bits into containers,
+// each holding the lower 16 bits of its ids as a sorted array
+// while sparse, or as a 65536 bit bitset once dense.
+//
+// Scans apply bitmaps a word at a time, by expanding them into a
+// dense mask (see orInto), rather than probing per id.
+//
+// Bitmap is **not** thread safe.
+//
+
+#ifndef skrillex_bitmap_hpp
+#define skrillex_bitmap_hpp
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace skrillex {
+namespace internal {
+    class Bitmap {
+    public:
+        // Containers switch between arrays and bitsets at this size.
+        static const size_t ArrayLimit = 4096;
+
+        // The words of a container's bitset.
+        static const size_t ContainerWords = 65536 / 64;
+
+        Bitmap();
+
+        void add(uint32_t id);
+        void remove(uint32_t id);
+        bool contains(uint32_t id) const;
+
+        size_t cardinality() const;
+        bool   empty() const;
+        void   clear();
+
+        // Sets the bit of every id in a dense mask (bit id % 64 of
+        // word id / 64), growing the mask to fit.
+        template<typename Allocator>
+        void orInto(std::vector<uint64_t, Allocator>& words) const {
+            if (containers_.empty()) {
+                return;
+            }
+
+            size_t size = (size_t(containers_.back().key) + 1) * ContainerWords;
+            if (containers_.back().bits.empty()) {
+                size = (size_t(containers_.back().key) * 65536 + containers_.back().array.back()) / 64 + 1;
+            }
+
+            if (words.size() < size) {
+                words.resize(size, 0);
+            }
+
+            for (auto& c : containers_) {
+                size_t base = size_t(c.key) * ContainerWords;
+
+                if (!c.bits.empty()) {
+                    size_t end = std::min(ContainerWords, words.size() - base);
+                    for (size_t w = 0; w < end; w++) {
+                        words[base + w] |= c.bits[w];
+                    }
+                    continue;
+                }
+
+                for (uint16_t v : c.array) {
+                    words[base + v / 64] |= uint64_t(1) << (v % 64);
+                }
+            }
+        }
+
+        // Whether a dense mask has the bit of an id set.
+        template<typename Allocator>
+        static bool test(const std::vector<uint64_t, Allocator>& words, uint32_t id) {
+            size_t word = id / 64;
+            return word < words.size() && ((words[word] >> (id % 64)) & 1);
+        }
+
+    private:
+        struct Container {
+            uint16_t              key;
+            size_t                cardinality;
+            std::vector<uint16_t> array;
+            std::vector<uint64_t> bits;
+        };
+
+        // The container for a key, or null (or, if create is set,
+        // a new container) if there is none.
+        Container* find(uint16_t key, bool create);
+        const Container* find(uint16_t key) const;
+
+        std::vector<Container> containers_;
+        size_t                 cardinality_;
+    };
+}
+}
+
+#endif
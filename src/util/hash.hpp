@@ -0,0 +1,35 @@
+//
+// hash.hpp
+//
+// 64 bit FNV-1a, which can be folded into any pass that
+// already visits each character of a string in order.
+//
+
+#ifndef skrillex_hash_hpp
+#define skrillex_hash_hpp
+
+#include <cstdint>
+#include <string>
+
+namespace skrillex {
+namespace internal {
+    const uint64_t FNV_OFFSET = 14695981039346656037ull;
+    const uint64_t FNV_PRIME  = 1099511628211ull;
+
+    // Extends a hash by one character.
+    inline uint64_t fnv1a(uint64_t hash, char c) {
+        return (hash ^ static_cast<unsigned char>(c)) * FNV_PRIME;
+    }
+
+    inline uint64_t fnv1a(const std::string& text) {
+        uint64_t hash = FNV_OFFSET;
+        for (char c : text) {
+            hash = fnv1a(hash, c);
+        }
+
+        return hash;
+    }
+}
+}
+
+#endif
@@ -0,0 +1,82 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    WorkerPool::WorkerPool(int readers)
+    : readers_(max(readers, 1))
+    , stopping_(false)
+    {
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            lock_guard<mutex> lock(lock_);
+            stopping_ = true;
+        }
+
+        reads_.ready.notify_all();
+        writes_.ready.notify_all();
+
+        for (auto& t : reader_threads_) {
+            t.join();
+        }
+        if (writer_thread_.joinable()) {
+            writer_thread_.join();
+        }
+    }
+
+    void WorkerPool::read(function<void()> task) {
+        {
+            lock_guard<mutex> lock(lock_);
+
+            if (reader_threads_.empty()) {
+                for (int i = 0; i < readers_; i++) {
+                    reader_threads_.emplace_back(&WorkerPool::run, this, ref(reads_));
+                }
+            }
+
+            reads_.tasks.push_back(move(task));
+        }
+
+        reads_.ready.notify_one();
+    }
+
+    void WorkerPool::write(function<void()> task) {
+        {
+            lock_guard<mutex> lock(lock_);
+
+            if (!writer_thread_.joinable()) {
+                writer_thread_ = thread(&WorkerPool::run, this, ref(writes_));
+            }
+
+            writes_.tasks.push_back(move(task));
+        }
+
+        writes_.ready.notify_one();
+    }
+
+    void WorkerPool::run(Lane& lane) {
+        unique_lock<mutex> lock(lock_);
+
+        while (true) {
+            lane.ready.wait(lock, [this, &lane]() { return stopping_ || !lane.tasks.empty(); });
+
+            // Tasks submitted before the pool stopped still run.
+            if (lane.tasks.empty()) {
+                return;
+            }
+
+            function<void()> task = move(lane.tasks.front());
+            lane.tasks.pop_front();
+
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+}
+}
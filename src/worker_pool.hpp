@@ -0,0 +1,59 @@
+//
+// worker_pool.hpp
+//
+// The WorkerPool runs the DB's asynchronous calls. Reads are
+// shared by a fixed number of reader threads, and run in any
+// order. Writes run one at a time, in the order they were
+// submitted, on a writer thread of their own, so they never
+// contend with each other for the store's write lock, and a
+// client's writes land in the order it made them.
+//
+// Threads are only started once there is work for them. On
+// destruction, the pool finishes every task already submitted
+// before joining its threads.
+//
+
+#ifndef skrillex_worker_pool_hpp
+#define skrillex_worker_pool_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace skrillex {
+namespace internal {
+    class WorkerPool {
+    public:
+        WorkerPool(int readers);
+        WorkerPool(const WorkerPool& other) = delete;
+        ~WorkerPool();
+
+        void read(std::function<void()> task);
+        void write(std::function<void()> task);
+
+    private:
+        struct Lane {
+            std::deque<std::function<void()>> tasks;
+            std::condition_variable           ready;
+        };
+
+        void run(Lane& lane);
+
+    private:
+        const int readers_;
+
+        std::mutex lock_;
+        Lane       reads_;
+        Lane       writes_;
+        bool       stopping_;
+
+        std::vector<std::thread> reader_threads_;
+        std::thread              writer_thread_;
+    };
+}
+}
+
+#endif
@@ -0,0 +1,170 @@
+#include "write_queue.hpp"
+
+#include <algorithm>
+
+#include "store/store.hpp"
+
+using namespace std;
+
+namespace skrillex {
+namespace internal {
+    WriteQueue::WriteQueue(Store& store, int batchSize)
+    : store_(store)
+    , batch_size_(max(batchSize, 1))
+    , tail_(&stub_)
+    , head_(&stub_)
+    , waiting_(false)
+    , stopping_(false)
+    {
+        stub_.next = nullptr;
+        thread_ = thread(&WriteQueue::run, this);
+    }
+
+    WriteQueue::~WriteQueue() {
+        {
+            lock_guard<mutex> lock(lock_);
+            stopping_ = true;
+        }
+
+        ready_.notify_one();
+        thread_.join();
+    }
+
+    void WriteQueue::push(Write write, Completion done) {
+        Node* node  = new Node();
+        node->write = move(write);
+        node->done  = move(done);
+        node->next  = nullptr;
+
+        push(node);
+
+        // The writer flags that it is waiting before it last checks
+        // for writes, so either it sees this one, or this sees it
+        // waiting.
+        if (waiting_) {
+            lock_guard<mutex> lock(lock_);
+            ready_.notify_one();
+        }
+    }
+
+    bool WriteQueue::current() const {
+        return this_thread::get_id() == thread_.get_id();
+    }
+
+    Status WriteQueue::failure() {
+        lock_guard<mutex> lock(lock_);
+        return failure_;
+    }
+
+    void WriteQueue::push(Node* node) {
+        Node* previous = tail_.exchange(node);
+        previous->next = node;
+    }
+
+    WriteQueue::Node* WriteQueue::pop() {
+        Node* head = head_;
+        Node* next = head->next;
+
+        if (head == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+
+            head_ = next;
+            head  = next;
+            next  = next->next;
+        }
+
+        if (next) {
+            head_ = next;
+            return head;
+        }
+
+        // A writer has exchanged the tail, but not linked it yet.
+        if (head != tail_) {
+            return nullptr;
+        }
+
+        // head is the last write. The stub takes its place, so that
+        // it can be unlinked.
+        stub_.next = nullptr;
+        push(&stub_);
+
+        next = head->next;
+        if (next) {
+            head_ = next;
+            return head;
+        }
+
+        return nullptr;
+    }
+
+    bool WriteQueue::empty() const {
+        return tail_ == head_;
+    }
+
+    void WriteQueue::run() {
+        vector<Node*> batch;
+        batch.reserve(batch_size_);
+
+        while (true) {
+            Node* node = nullptr;
+            while (batch.size() < batch_size_ && (node = pop())) {
+                batch.push_back(node);
+            }
+
+            if (!batch.empty()) {
+                apply(batch);
+                batch.clear();
+                continue;
+            }
+
+            // A write is being pushed.
+            if (!empty()) {
+                this_thread::yield();
+                continue;
+            }
+
+            unique_lock<mutex> lock(lock_);
+            waiting_ = true;
+            ready_.wait(lock, [this]() { return stopping_ || !empty(); });
+            waiting_ = false;
+
+            if (stopping_ && empty()) {
+                return;
+            }
+        }
+    }
+
+    void WriteQueue::apply(const vector<Node*>& batch) {
+        Status failed = failure();
+
+        // If the batch can't be begun, each write commits on its own.
+        Status begun = failed ? failed : store_.beginBatch();
+
+        statuses_.clear();
+        for (Node* node : batch) {
+            statuses_.push_back(failed ? failed : node->write());
+        }
+
+        Status committed;
+        if (!failed && begun == Status::OK()) {
+            committed = store_.commitBatch();
+        }
+
+        if (committed != Status::OK()) {
+            lock_guard<mutex> lock(lock_);
+            failure_ = Status::Error("A batch of writes could not be committed, and the database must be reopened: " + committed.message());
+        }
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            Node* node = batch[i];
+            if (node->done) {
+                node->done(statuses_[i] == Status::OK() ? committed : statuses_[i]);
+            }
+
+            delete node;
+        }
+    }
+}
+}
@@ -0,0 +1,99 @@
+//
+// write_queue.hpp
+//
+// The WriteQueue applies every write of a DB on one writer thread,
+// when writes are batched (see Options::batch_writes). Writers push
+// onto a lock-free, multiple producer, single consumer queue, and
+// the writer thread drains it in batches, applying each batch in a
+// single transaction. A write completes once its batch commits.
+//
+// The queue is intrusive: the writer follows each write's link to
+// the next, and a stub node stands in when it runs dry, so pushes
+// only exchange the tail. The writer only sleeps (and writers only
+// wake it) when the queue is empty.
+//
+// On destruction, every write already pushed is applied before the
+// writer thread is joined.
+//
+// A batch that fails to commit is rolled back on disk, but the store
+// has already applied its writes in memory (tallies, queues, the
+// unplayable set, user keys, the catalog index), and cannot undo
+// them. So a failed commit is fatal: every later write fails, as do
+// the DB's reads, until the database is reopened from disk.
+//
+
+#ifndef skrillex_write_queue_hpp
+#define skrillex_write_queue_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "skrillex/status.hpp"
+
+namespace skrillex {
+namespace internal {
+    class Store;
+
+    class WriteQueue {
+    public:
+        typedef std::function<Status()>     Write;
+        typedef std::function<void(Status)> Completion;
+
+        // Batches hold at most batchSize writes.
+        WriteQueue(Store& store, int batchSize);
+        WriteQueue(const WriteQueue& other) = delete;
+        ~WriteQueue();
+
+        // Queues a write, calling back with its status on the writer
+        // thread once its batch commits. done may be empty.
+        void push(Write write, Completion done);
+
+        // Whether this is the writer thread, on which writes apply
+        // directly.
+        bool current() const;
+
+        // The error every write and read fails with once a batch has
+        // failed to commit, or OK.
+        Status failure();
+
+    private:
+        struct Node {
+            Write              write;
+            Completion         done;
+            std::atomic<Node*> next;
+        };
+
+        void  push(Node* node);
+        Node* pop();
+        bool  empty() const;
+
+        void run();
+        void apply(const std::vector<Node*>& batch);
+
+    private:
+        Store&       store_;
+        const size_t batch_size_;
+
+        // Writers exchange the tail; only the writer thread touches
+        // the head.
+        std::atomic<Node*> tail_;
+        Node*              head_;
+        Node               stub_;
+
+        std::atomic<bool>       waiting_;
+        bool                    stopping_;
+        std::mutex              lock_;
+        std::condition_variable ready_;
+
+        std::vector<Status> statuses_;
+        Status              failure_;
+        std::thread         thread_;
+    };
+}
+}
+
+#endif
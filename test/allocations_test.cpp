@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+#include "skrillex/skrillex.hpp"
+#include "skrillex/mapper.hpp"
+
+using namespace std;
+using namespace skrillex;
+
+// Every allocation made through operator new, so tests can bound
+// the allocations of hot paths. Sqlite allocates through malloc,
+// and is not counted.
+atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+TEST(AllocationTests, Vote) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+
+    Song song;
+    song.name        = "A Song Title That Runs Long";
+    song.artist.name = "The Artist Formerly Known As";
+    song.genre.name  = "Progressive Genre";
+    ASSERT_EQ(Status::OK(), db->addGenre(song.genre));
+    ASSERT_EQ(Status::OK(), db->addArtist(song.artist));
+    ASSERT_EQ(Status::OK(), db->addSong(song));
+
+    // User ids are too long to be stored inline in a string.
+    string user = "3f2b8c1e-4a7d-4e9b-a1c3-5d6e7f8a9b0c";
+    ASSERT_EQ(Status::OK(), db->voteSong(user, song, 1));
+
+    uint64_t before = allocations;
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(Status::OK(), db->voteSong(user, song, i % 2 ? 1 : -1));
+    }
+
+    // The vote queries, and the song's place in the vote ranking.
+    EXPECT_GE(3u, (allocations - before) / 100);
+
+    before = allocations;
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(Status::OK(), db->setActivity(user, i));
+    }
+
+    EXPECT_GE(1u, (allocations - before) / 100);
+}
+
+TEST(AllocationTests, Lookup) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    Mapper mapper(db);
+
+    string songName   = "  A Song Title That Runs Long";
+    string artistName = "The Artist Formerly Known As  ";
+
+    Song song;
+    ASSERT_EQ(Status::OK(), mapper.map(song, songName, artistName, "Progressive Genre"));
+
+    uint64_t before = allocations;
+    for (int i = 0; i < 100; i++) {
+        Song result;
+        ASSERT_EQ(Status::OK(), mapper.lookup(result, songName, artistName));
+        ASSERT_EQ(song.id, result.id);
+    }
+
+    // The normalized key, and the names read back.
+    EXPECT_GE(4u, (allocations - before) / 100);
+
+    before = allocations;
+    for (int i = 0; i < 100; i++) {
+        Song result;
+        ASSERT_EQ(Status::OK(), mapper.map(result, songName, artistName, "Progressive Genre"));
+        ASSERT_EQ(song.id, result.id);
+    }
+
+    // A lookup per name, and a second of the song to check its
+    // genre link.
+    EXPECT_GE(12u, (allocations - before) / 100);
+}
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <string>
+
+#include "util/arena.hpp"
+
+using namespace std;
+using namespace skrillex::internal;
+
+TEST(ArenaTests, Basic) {
+    Arena arena;
+    EXPECT_EQ(0u, arena.used());
+    EXPECT_EQ(0u, arena.chunks());
+
+    void* a = arena.allocate(10, 1);
+    void* b = arena.allocate(8, 8);
+    EXPECT_EQ(1u, arena.chunks());
+    EXPECT_EQ(18u, arena.used());
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(b) % 8);
+    EXPECT_LE(static_cast<char*>(a) + 10, static_cast<char*>(b));
+
+    // Larger than a chunk grows the arena.
+    arena.allocate(Arena::ChunkSize * 3, 8);
+    EXPECT_EQ(2u, arena.chunks());
+
+    // Resetting keeps the largest chunk, which then fits as much
+    // without growing again.
+    arena.reset();
+    EXPECT_EQ(0u, arena.used());
+    arena.allocate(Arena::ChunkSize * 3, 8);
+    EXPECT_EQ(2u, arena.chunks());
+}
+
+TEST(ArenaTests, Scope) {
+    Arena& arena = Arena::local();
+    arena.reset();
+
+    {
+        Arena::Scope outer;
+        QueryString query = "SELECT Songs.SongID FROM Songs ";
+        query += "WHERE Songs.GenreID IN (1,2,3)";
+        EXPECT_EQ("SELECT Songs.SongID FROM Songs WHERE Songs.GenreID IN (1,2,3)", string(query.c_str()));
+
+        {
+            Arena::Scope inner;
+            ScratchVector<uint64_t> mask(100, 0);
+            EXPECT_EQ(100u, mask.size());
+        }
+
+        // Inner scopes leave the arena to the outermost.
+        EXPECT_LT(0u, arena.used());
+    }
+
+    EXPECT_EQ(0u, arena.used());
+}
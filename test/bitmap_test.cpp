@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include "util/bitmap.hpp"
+
+using namespace std;
+using namespace skrillex::internal;
+
+TEST(BitmapTest, AddRemove) {
+    Bitmap bitmap;
+    EXPECT_TRUE(bitmap.empty());
+
+    bitmap.add(5);
+    bitmap.add(5);
+    bitmap.add(70000);
+    EXPECT_EQ(2, bitmap.cardinality());
+    EXPECT_TRUE(bitmap.contains(5));
+    EXPECT_TRUE(bitmap.contains(70000));
+    EXPECT_FALSE(bitmap.contains(6));
+    EXPECT_FALSE(bitmap.contains(65541));
+
+    bitmap.remove(5);
+    bitmap.remove(6);
+    EXPECT_EQ(1, bitmap.cardinality());
+    EXPECT_FALSE(bitmap.contains(5));
+
+    bitmap.clear();
+    EXPECT_TRUE(bitmap.empty());
+    EXPECT_FALSE(bitmap.contains(70000));
+}
+
+TEST(BitmapTest, DenseContainers) {
+    Bitmap bitmap;
+
+    // Past the array limit, the container becomes a bitset.
+    for (uint32_t id = 0; id < 2 * Bitmap::ArrayLimit; id += 2) {
+        bitmap.add(id);
+    }
+    bitmap.add(1);
+    EXPECT_EQ(Bitmap::ArrayLimit + 1, bitmap.cardinality());
+
+    for (uint32_t id = 0; id < 2 * Bitmap::ArrayLimit; id++) {
+        EXPECT_EQ(id % 2 == 0 || id == 1, bitmap.contains(id));
+    }
+
+    // And back again.
+    bitmap.remove(1);
+    bitmap.remove(0);
+    EXPECT_EQ(Bitmap::ArrayLimit - 1, bitmap.cardinality());
+    EXPECT_FALSE(bitmap.contains(0));
+    EXPECT_TRUE(bitmap.contains(2));
+}
+
+TEST(BitmapTest, Masks) {
+    Bitmap a, b;
+    for (uint32_t id = 0; id < 2 * Bitmap::ArrayLimit; id += 2) {
+        a.add(id);
+    }
+    b.add(3);
+    b.add(200000);
+
+    vector<uint64_t> mask;
+    a.orInto(mask);
+    b.orInto(mask);
+
+    EXPECT_TRUE(Bitmap::test(mask, 0));
+    EXPECT_TRUE(Bitmap::test(mask, 3));
+    EXPECT_TRUE(Bitmap::test(mask, 200000));
+    EXPECT_FALSE(Bitmap::test(mask, 1));
+    EXPECT_FALSE(Bitmap::test(mask, 200001));
+    EXPECT_FALSE(Bitmap::test(mask, 1 << 30));
+}
@@ -9,15 +9,28 @@
 // that's why I made them Countable. Ugh.
 //
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <thread>
+#include <vector>
+#include <sys/stat.h>
 #include <gtest/gtest.h>
 
 #include "skrillex/db.hpp"
 #include "skrillex/dbo.hpp"
 #include "skrillex/testing/populator.hpp"
 
+#include "sqlite3/sqlite3.h"
 #include "store/store.hpp"
+#include "util/hash.hpp"
+#include "util/time.hpp"
 #include "mutator.hpp"
 
 #define NUM_SONGS 10
@@ -501,6 +514,41 @@ TEST(Sqlite3DatabaseTests, SetQueue) {
     }
 }
 
+TEST(Sqlite3DatabaseTests, SetQueueUnplayable) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 100, 10, 5));
+    shared_ptr<DB> db(raw);
+
+    PopulatorData data = get_populator_data(100, 10, 5);
+
+    vector<int> songIds;
+    for (auto& song : data.songs) {
+        songIds.push_back(song.id);
+    }
+
+    // Replacing the queue checks each song against the unplayable
+    // set, so a lock order inversion with marking hangs both.
+    auto queueing = async(launch::async, [&]() {
+        for (int i = 0; i < 20; i++) {
+            EXPECT_EQ(Status::OK(), db->setQueue(songIds));
+        }
+    });
+    auto marking = async(launch::async, [&]() {
+        for (size_t i = 0; i < data.songs.size(); i += 2) {
+            EXPECT_EQ(Status::OK(), db->markUnplayable(data.songs[i].id));
+        }
+    });
+
+    ASSERT_EQ(future_status::ready, queueing.wait_for(chrono::seconds(30)));
+    ASSERT_EQ(future_status::ready, marking.wait_for(chrono::seconds(30)));
+
+    ResultSet<Song> queue;
+    EXPECT_EQ(Status::OK(), db->setQueue(songIds));
+    EXPECT_EQ(Status::OK(), db->getQueue(queue));
+    EXPECT_EQ(data.songs.size() / 2, queue.size());
+}
+
 TEST(Sqlite3DatabaseTests, Normalized) {
     DB* raw = 0;
     Status s = open(raw, "test.db", Options::TestOptions());
@@ -511,7 +559,7 @@ TEST(Sqlite3DatabaseTests, Normalized) {
     // We merely want to test whether or not IO for normalized
     // lookups work. We don't care about how normalization works.
     // As a result, we'll just make up our own normalization for
-    // test purposes.
+    // test purposes, with hashes that collide.
     Genre g;
     g.name = "Genre";
 
@@ -528,36 +576,1622 @@ TEST(Sqlite3DatabaseTests, Normalized) {
 
     EXPECT_EQ(Status::OK(), store->addSong(song));
 
-    EXPECT_EQ(Status::OK(), store->insertNormalized("genre", 0, 0, g.id));
-    EXPECT_EQ(Status::OK(), store->insertNormalized("artist", 0, a.id, 0));
-    EXPECT_EQ(Status::OK(), store->insertNormalized("song", song.id, 0, 0));
-    EXPECT_EQ(Status::OK(), store->insertNormalized("complete", song.id, song.artist.id, song.genre.id));
+    EXPECT_EQ(Status::OK(), store->insertNormalized(1, "genre", 0, 0, g.id));
+    EXPECT_EQ(Status::OK(), store->insertNormalized(1, "artist", 0, a.id, 0));
+    EXPECT_EQ(Status::OK(), store->insertNormalized(2, "song", song.id, 0, 0));
+    EXPECT_EQ(Status::OK(), store->insertNormalized(1, "complete", song.id, song.artist.id, song.genre.id));
 
     Song result;
-    EXPECT_EQ(Status::OK(), store->getNormalized(result, "genre"));
+    EXPECT_EQ(Status::OK(), store->getNormalized(result, 1, "genre"));
     EXPECT_EQ(0, result.id);
     EXPECT_EQ(0, result.artist.id);
     EXPECT_EQ(g.id, result.genre.id);
 
     result = Song();
-    EXPECT_EQ(Status::OK(), store->getNormalized(result, "artist"));
+    EXPECT_EQ(Status::OK(), store->getNormalized(result, 1, "artist"));
     EXPECT_EQ(0, result.id);
     EXPECT_EQ(a.id, result.artist.id);
     EXPECT_EQ(0, result.genre.id);
 
     result = Song();
-    EXPECT_EQ(Status::OK(), store->getNormalized(result, "song"));
+    EXPECT_EQ(Status::OK(), store->getNormalized(result, 2, "song"));
     EXPECT_EQ(song.id, result.id);
     EXPECT_EQ(0, result.artist.id);
     EXPECT_EQ(0, result.genre.id);
 
     result = Song();
-    EXPECT_EQ(Status::OK(), store->getNormalized(result, "complete"));
+    EXPECT_EQ(Status::OK(), store->getNormalized(result, 1, "complete"));
     EXPECT_EQ(song.id, result.id);
     EXPECT_EQ(song.name, result.name);
     EXPECT_EQ(a.id, result.artist.id);
     EXPECT_EQ(a.name, result.artist.name);
     EXPECT_EQ(g.id, result.genre.id);
     EXPECT_EQ(g.name, result.genre.name);
+
+    // Entries are replaced where they are, even past a collision.
+    EXPECT_EQ(Status::OK(), store->insertNormalized(1, "artist", 0, a.id, g.id));
+
+    result = Song();
+    EXPECT_EQ(Status::OK(), store->getNormalized(result, 1, "artist"));
+    EXPECT_EQ(a.id, result.artist.id);
+    EXPECT_EQ(g.id, result.genre.id);
+
+    EXPECT_TRUE(store->getNormalized(result, 1, "missing").notFound());
+    EXPECT_TRUE(store->getNormalized(result, 5, "song").notFound());
+}
+
+
+TEST(Sqlite3DatabaseTests, QueueRecovery) {
+    PopulatorData data = get_populator_data(10, 3, 3);
+
+    {
+        DB* raw = 0;
+        ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+
+        shared_ptr<DB> db(raw);
+        ASSERT_EQ(Status::OK(), populate_empty(raw, 10, 3, 3));
+
+        for (auto& song : data.songs) {
+            EXPECT_EQ(Status::OK(), db->queueSong(song.id));
+        }
+
+        // Buffer the first three, and finish the first.
+        for (int i = 0; i < 3; i++) {
+            EXPECT_EQ(Status::OK(), db->bufferNext());
+        }
+        EXPECT_EQ(Status::OK(), db->songFinished());
+        EXPECT_EQ(Status::OK(), db->markUnplayable(data.songs[9].id));
+    }
+
+    // Reopen the existing database, as we would after a crash.
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options()));
+    shared_ptr<DB> db(raw);
+
+    ResultSet<Song> queue;
+    EXPECT_EQ(Status::OK(), db->getQueue(queue));
+    EXPECT_EQ(7, queue.size());
+
+    int id = 3;
+    for (auto it = queue.begin(); it != queue.end(); it++, id++) {
+        EXPECT_EQ(data.songs[id], *it);
+        EXPECT_EQ(data.songs[id].name, it->name);
+        EXPECT_EQ(data.songs[id].artist.name, it->artist.name);
+    }
+
+    ResultSet<Song> buffer;
+    EXPECT_EQ(Status::OK(), db->getBuffer(buffer));
+    EXPECT_EQ(2, buffer.size());
+
+    id = 1;
+    for (auto it = buffer.begin(); it != buffer.end(); it++, id++) {
+        EXPECT_EQ(data.songs[id], *it);
+    }
+
+    // Buffered and unplayable songs are still filtered from reads.
+    ResultSet<Song> songs;
+    EXPECT_EQ(Status::OK(), db->getSongs(songs));
+    EXPECT_EQ(7, songs.size());
+
+    // And the unplayable song still cannot be queued.
+    EXPECT_EQ(Status::OK(), db->clearQueue());
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[9].id));
+    EXPECT_EQ(Status::OK(), db->getQueue(queue));
+    EXPECT_EQ(0, queue.size());
 }
 
+TEST(Sqlite3DatabaseTests, SessionRestore) {
+    ReadOptions tallied;
+    tallied.sort = SortType::Votes;
+    tallied.inactivity_threshold = 0;
+
+    ReadOptions aggregated;
+    aggregated.sort = SortType::Votes;
+
+    Options options = Options::TestOptions();
+    options.snapshot_interval = 4;
+
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 10, 3, 3));
+
+    PopulatorData data = get_populator_data(10, 3, 3);
+    Song first  = data.songs[0];
+    Song second = data.songs[1];
+
+    // Enough votes that some of them are only in the vote log.
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("u" + to_string(i), first, 1));
+    }
+    EXPECT_EQ(Status::OK(), db->voteSong("u0", second, -1));
+    EXPECT_EQ(Status::OK(), db->voteSong("u0", first, 5));
+    EXPECT_EQ(Status::OK(), db->voteArtist("u0", data.artists[2], 2));
+
+    int64_t session_id = 0;
+    StoreMutator::getStore(raw)->getSession(session_id);
+
+    auto verify = [&](shared_ptr<DB> db) {
+        for (auto options : { tallied, aggregated }) {
+            ResultSet<Song> songs;
+            EXPECT_EQ(Status::OK(), db->getSongs(songs, options));
+            EXPECT_EQ(10, songs.size());
+            EXPECT_EQ(first, *songs.begin());
+            EXPECT_EQ(3, songs.begin()->count);
+            EXPECT_EQ(7, songs.begin()->votes);
+
+            auto last = songs.begin() + (songs.size() - 1);
+            EXPECT_EQ(second, *last);
+            EXPECT_EQ(1, last->count);
+            EXPECT_EQ(-1, last->votes);
+
+            ResultSet<Artist> artists;
+            EXPECT_EQ(Status::OK(), db->getArtists(artists, options));
+            EXPECT_EQ(data.artists[2], *artists.begin());
+            EXPECT_EQ(2, artists.begin()->votes);
+        }
+    };
+
+    verify(db);
+
+    // Restore from a second handle while the first is still open,
+    // so the tail of the vote log has to be replayed.
+    Options restore;
+    restore.session_id = session_id;
+
+    DB* restoredRaw = 0;
+    ASSERT_EQ(Status::OK(), open(restoredRaw, "test.db", restore));
+    shared_ptr<DB> restored(restoredRaw);
+
+    int64_t restored_id = 0;
+    StoreMutator::getStore(restoredRaw)->getSession(restored_id);
+    EXPECT_EQ(session_id, restored_id);
+
+    verify(restored);
+    restored.reset();
+    db.reset();
+
+    // And again after a clean shutdown, where everything is in the snapshot.
+    restoredRaw = 0;
+    ASSERT_EQ(Status::OK(), open(restoredRaw, "test.db", restore));
+    restored.reset(restoredRaw);
+    verify(restored);
+
+    // Votes keep accumulating in the restored session.
+    EXPECT_EQ(Status::OK(), restored->voteSong("u3", first, 1));
+
+    ResultSet<Song> songs;
+    EXPECT_EQ(Status::OK(), restored->getSongs(songs, tallied));
+    EXPECT_EQ(4, songs.begin()->count);
+    EXPECT_EQ(8, songs.begin()->votes);
+
+    // Restoring a session that was never created fails.
+    restored.reset();
+    restoredRaw = 0;
+    restore.session_id = session_id + 10;
+    EXPECT_TRUE(open(restoredRaw, "test.db", restore).notFound());
+    delete restoredRaw;
+}
+
+TEST(Sqlite3DatabaseTests, Rooms) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 10, 3, 3));
+
+    PopulatorData data = get_populator_data(10, 3, 3);
+
+    int64_t room_id = 0;
+    ASSERT_EQ(Status::OK(), db->createSession(room_id));
+
+    WriteOptions room;
+    room.session_id = room_id;
+
+    ReadOptions roomRead;
+    roomRead.session_id = room_id;
+
+    // Queues and buffers are kept apart.
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[0].id));
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[1].id, room));
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[2].id, room));
+    EXPECT_EQ(Status::OK(), db->bufferNext(room));
+
+    ResultSet<Song> queue;
+    EXPECT_EQ(Status::OK(), db->getQueue(queue));
+    EXPECT_EQ(1, queue.size());
+    EXPECT_EQ(data.songs[0], *queue.begin());
+
+    EXPECT_EQ(Status::OK(), db->getQueue(queue, roomRead));
+    EXPECT_EQ(1, queue.size());
+    EXPECT_EQ(data.songs[2], *queue.begin());
+
+    ResultSet<Song> buffer;
+    EXPECT_EQ(Status::OK(), db->getBuffer(buffer));
+    EXPECT_EQ(0, buffer.size());
+    EXPECT_EQ(Status::OK(), db->getBuffer(buffer, roomRead));
+    EXPECT_EQ(1, buffer.size());
+
+    // As are votes and active users.
+    EXPECT_EQ(Status::OK(), db->voteSong("a", data.songs[3], 1));
+    EXPECT_EQ(Status::OK(), db->voteSong("a", data.songs[4], 1, room));
+    EXPECT_EQ(Status::OK(), db->voteSong("b", data.songs[4], 1, room));
+
+    for (int threshold : { 0, 1800000 }) {
+        ReadOptions ro;
+        ro.sort = SortType::Votes;
+        ro.inactivity_threshold = threshold;
+        ro.filter_buffered = false;
+
+        ResultSet<Song> songs;
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, ro));
+        EXPECT_EQ(data.songs[3], *songs.begin());
+        EXPECT_EQ(1, songs.begin()->votes);
+
+        ro.session_id = room_id;
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, ro));
+        EXPECT_EQ(data.songs[4], *songs.begin());
+        EXPECT_EQ(2, songs.begin()->votes);
+    }
+
+    int users = 0;
+    EXPECT_EQ(Status::OK(), db->getSessionUserCount(users));
+    EXPECT_EQ(1, users);
+    EXPECT_EQ(Status::OK(), db->getSessionUserCount(users, roomRead));
+    EXPECT_EQ(2, users);
+
+    // The DB's own session stays open, and closed rooms reject writes.
+    EXPECT_FALSE(db->closeSession(0) == Status::OK());
+    EXPECT_EQ(Status::OK(), db->closeSession(room_id));
+    EXPECT_TRUE(db->queueSong(data.songs[5].id, room).notFound());
+    EXPECT_TRUE(db->voteSong("a", data.songs[5], 1, room).notFound());
+
+    // Reopening a room picks up where it left off.
+    EXPECT_EQ(Status::OK(), db->openSession(room_id));
+    EXPECT_EQ(Status::OK(), db->getQueue(queue, roomRead));
+    EXPECT_EQ(1, queue.size());
+    EXPECT_EQ(Status::OK(), db->getBuffer(buffer, roomRead));
+    EXPECT_EQ(1, buffer.size());
+
+    ReadOptions tallied;
+    tallied.session_id = room_id;
+    tallied.sort = SortType::Votes;
+    tallied.inactivity_threshold = 0;
+    tallied.filter_buffered = false;
+
+    ResultSet<Song> songs;
+    EXPECT_EQ(Status::OK(), db->getSongs(songs, tallied));
+    EXPECT_EQ(data.songs[4], *songs.begin());
+    EXPECT_EQ(2, songs.begin()->votes);
+
+    EXPECT_TRUE(db->openSession(room_id + 10).notFound());
+}
+
+TEST(Sqlite3DatabaseTests, PartitionedSessions) {
+    Options options = Options::TestOptions();
+    options.partition_sessions = true;
+
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 10, 3, 3));
+
+    PopulatorData data = get_populator_data(10, 3, 3);
+
+    int64_t session_id = 0;
+    StoreMutator::getStore(raw)->getSession(session_id);
+
+    struct stat buffer;
+    EXPECT_EQ(0, stat(("test.db.session-" + to_string(session_id)).c_str(), &buffer));
+
+    EXPECT_EQ(Status::OK(), db->voteSong("a", data.songs[0], 1));
+    EXPECT_EQ(Status::OK(), db->voteSong("b", data.songs[0], 1));
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[1].id));
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(Status::OK(), db->songFinished());
+
+    // More rooms than can be attached at once, each closed after voting.
+    for (int i = 0; i < 12; i++) {
+        int64_t room_id = 0;
+        ASSERT_EQ(Status::OK(), db->createSession(room_id));
+
+        WriteOptions room;
+        room.session_id = room_id;
+        EXPECT_EQ(Status::OK(), db->voteSong("a", data.songs[2], 1, room));
+        EXPECT_EQ(Status::OK(), db->closeSession(room_id));
+    }
+
+    ReadOptions current;
+    current.sort = SortType::Votes;
+    current.filter_buffered = false;
+
+    ReadOptions history = current;
+    history.session_id = -1;
+
+    ReadOptions room = current;
+    room.session_id = session_id + 12;
+
+    auto verify = [&](shared_ptr<DB> db) {
+        ResultSet<Song> songs;
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, current));
+        EXPECT_EQ(data.songs[0], *songs.begin());
+        EXPECT_EQ(2, songs.begin()->votes);
+
+        auto played = find(songs.begin(), songs.end(), data.songs[1]);
+        ASSERT_TRUE(played != songs.end());
+        EXPECT_LT(0, played->last_played);
+
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, history));
+        EXPECT_EQ(data.songs[2], *songs.begin());
+        EXPECT_EQ(12, songs.begin()->votes);
+
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, room));
+        EXPECT_EQ(data.songs[2], *songs.begin());
+        EXPECT_EQ(1, songs.begin()->votes);
+    };
+
+    verify(db);
+    db.reset();
+
+    // The layout is remembered, whatever the options on reopening.
+    Options restore;
+    restore.session_id = session_id;
+
+    raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", restore));
+    db.reset(raw);
+    verify(db);
+}
+
+TEST(Sqlite3DatabaseTests, HistoryRollups) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_full(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES, 3));
+
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+
+    // Served from the rollups.
+    ReadOptions rolled;
+    rolled.session_id = -1;
+    rolled.inactivity_threshold = 0;
+    rolled.filter_buffered = false;
+
+    // Aggregated from the vote tables, with everyone still active.
+    ReadOptions aggregated = rolled;
+    aggregated.inactivity_threshold = 2000000000;
+
+    auto verify = [&](shared_ptr<DB> db) {
+        for (auto sort : { SortType::Counts, SortType::Votes }) {
+            rolled.sort = aggregated.sort = sort;
+
+            ResultSet<Song> expectedSongs, songs;
+            EXPECT_EQ(Status::OK(), db->getSongs(expectedSongs, aggregated));
+            EXPECT_EQ(Status::OK(), db->getSongs(songs, rolled));
+            ASSERT_EQ(expectedSongs.size(), songs.size());
+            for (auto e = expectedSongs.begin(), a = songs.begin(); e != expectedSongs.end(); e++, a++) {
+                EXPECT_EQ(*e, *a);
+                EXPECT_EQ(e->count, a->count);
+                EXPECT_EQ(e->votes, a->votes);
+            }
+
+            ResultSet<Artist> expectedArtists, artists;
+            EXPECT_EQ(Status::OK(), db->getArtists(expectedArtists, aggregated));
+            EXPECT_EQ(Status::OK(), db->getArtists(artists, rolled));
+            ASSERT_EQ(expectedArtists.size(), artists.size());
+            for (auto e = expectedArtists.begin(), a = artists.begin(); e != expectedArtists.end(); e++, a++) {
+                EXPECT_EQ(*e, *a);
+                EXPECT_EQ(e->count, a->count);
+                EXPECT_EQ(e->votes, a->votes);
+            }
+
+            ResultSet<Genre> expectedGenres, genres;
+            EXPECT_EQ(Status::OK(), db->getGenres(expectedGenres, aggregated));
+            EXPECT_EQ(Status::OK(), db->getGenres(genres, rolled));
+            ASSERT_EQ(expectedGenres.size(), genres.size());
+            for (auto e = expectedGenres.begin(), a = genres.begin(); e != expectedGenres.end(); e++, a++) {
+                EXPECT_EQ(*e, *a);
+                EXPECT_EQ(e->count, a->count);
+                EXPECT_EQ(e->votes, a->votes);
+            }
+        }
+    };
+
+    verify(db);
+
+    // Votes in other open sessions count straight away.
+    int64_t room_id = 0;
+    ASSERT_EQ(Status::OK(), db->createSession(room_id));
+
+    WriteOptions room;
+    room.session_id = room_id;
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("r" + to_string(i), data.songs[NUM_SONGS - 1], 10, room));
+    }
+
+    verify(db);
+
+    // And are still counted once the session is closed.
+    EXPECT_EQ(Status::OK(), db->closeSession(room_id));
+    verify(db);
+
+    // Restoring an old session takes it back out of the history.
+    db.reset();
+
+    Options restore;
+    restore.session_id = 2;
+
+    raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", restore));
+    db.reset(raw);
+    verify(db);
+
+    // Another handle on the file leaves the session open here out
+    // of the rollups, and puts its own back once it closes.
+    Options other;
+    other.session_id = 1;
+
+    raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", other));
+    delete raw;
+    verify(db);
+}
+
+TEST(Sqlite3DatabaseTests, Subscriptions) {
+    Options options = Options::TestOptions();
+    options.notification_interval = 50;
+
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 10, 3, 3));
+
+    PopulatorData data = get_populator_data(10, 3, 3);
+
+    mutex lock;
+    condition_variable notified;
+    vector<RankingDelta<Song>> rankings;
+    vector<QueueDelta> queues;
+
+    auto waitFor = [&](function<bool()> done) {
+        unique_lock<mutex> l(lock);
+        return notified.wait_for(l, chrono::seconds(5), done);
+    };
+
+    ReadOptions top;
+    top.sort = SortType::Votes;
+    top.result_limit = 3;
+    top.inactivity_threshold = 0;
+
+    int rankingId = 0;
+    int queueId   = 0;
+    EXPECT_EQ(Status::OK(), db->subscribeSongs(top, [&](const RankingDelta<Song>& delta) {
+        lock_guard<mutex> l(lock);
+        rankings.push_back(delta);
+        notified.notify_all();
+    }, rankingId));
+    EXPECT_EQ(Status::OK(), db->subscribeQueue(ReadOptions(), [&](const QueueDelta& delta) {
+        lock_guard<mutex> l(lock);
+        queues.push_back(delta);
+        notified.notify_all();
+    }, queueId));
+
+    // The first notifications hold everything.
+    ASSERT_TRUE(waitFor([&]() { return rankings.size() == 1 && queues.size() == 1; }));
+    EXPECT_EQ(3, rankings[0].size);
+    EXPECT_EQ(3, rankings[0].changed.size());
+    EXPECT_TRUE(queues[0].queue_changed);
+    EXPECT_TRUE(queues[0].queue.empty());
+
+    // A burst of votes is delivered as one delta.
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("u" + to_string(i), data.songs[7], 1));
+    }
+
+    ASSERT_TRUE(waitFor([&]() { return rankings.size() == 2; }));
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    {
+        lock_guard<mutex> l(lock);
+        ASSERT_EQ(2, rankings.size());
+        EXPECT_EQ(1, rankings[1].removed.size());
+        ASSERT_LE(1, rankings[1].changed.size());
+        EXPECT_EQ(0, rankings[1].changed[0].first);
+        EXPECT_EQ(data.songs[7], rankings[1].changed[0].second);
+        EXPECT_EQ(5, rankings[1].changed[0].second.votes);
+
+        // Votes do not touch the queue.
+        EXPECT_EQ(1, queues.size());
+    }
+
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[1].id));
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[2].id));
+
+    ASSERT_TRUE(waitFor([&]() { return queues.size() == 2; }));
+    EXPECT_TRUE(queues[1].queue_changed);
+    EXPECT_FALSE(queues[1].buffer_changed);
+    EXPECT_EQ(vector<int>({ data.songs[1].id, data.songs[2].id }), queues[1].queue);
+
+    // Marking a ranked song unplayable drops it from every ranking,
+    // including those of rooms.
+    int64_t roomId = 0;
+    ASSERT_EQ(Status::OK(), db->createSession(roomId));
+
+    WriteOptions room;
+    room.session_id = roomId;
+    EXPECT_EQ(Status::OK(), db->voteSong("r", data.songs[7], 1, room));
+
+    ReadOptions roomTop = top;
+    roomTop.session_id = roomId;
+
+    vector<RankingDelta<Song>> roomRankings;
+    int roomRankingId = 0;
+    EXPECT_EQ(Status::OK(), db->subscribeSongs(roomTop, [&](const RankingDelta<Song>& delta) {
+        lock_guard<mutex> l(lock);
+        roomRankings.push_back(delta);
+        notified.notify_all();
+    }, roomRankingId));
+    ASSERT_TRUE(waitFor([&]() { return roomRankings.size() == 1; }));
+
+    EXPECT_EQ(Status::OK(), db->markUnplayable(data.songs[7].id));
+
+    ASSERT_TRUE(waitFor([&]() { return rankings.size() == 3 && roomRankings.size() == 2; }));
+    {
+        lock_guard<mutex> l(lock);
+        for (auto& change : rankings[2].changed) {
+            EXPECT_NE(data.songs[7].id, change.second.id);
+        }
+        EXPECT_EQ(vector<int>({ data.songs[7].id }), roomRankings[1].removed);
+    }
+    EXPECT_EQ(Status::OK(), db->unsubscribe(roomRankingId));
+
+    // Nothing more once unsubscribed.
+    EXPECT_EQ(Status::OK(), db->unsubscribe(rankingId));
+    EXPECT_EQ(Status::OK(), db->voteSong("u0", data.songs[8], 10));
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    lock_guard<mutex> l(lock);
+    EXPECT_EQ(3, rankings.size());
+}
+
+TEST(Sqlite3DatabaseTests, DeltaReads) {
+    Options options = Options::TestOptions();
+    options.change_log_size = 64;
+
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_full(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES, 1));
+
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+
+    ReadOptions full;
+    full.inactivity_threshold = 0;
+
+    ReadOptions top = full;
+    top.result_limit = 3;
+    top.sort = SortType::Votes;
+
+    ReadOptions fullDelta = full;
+    fullDelta.delta = true;
+
+    ReadOptions topDelta = top;
+    topDelta.delta = true;
+
+    ResultSet<Song>   songs, topSongs;
+    ResultSet<Artist> artists;
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, fullDelta));
+    ASSERT_EQ(Status::OK(), db->getSongs(topSongs, topDelta));
+    ASSERT_EQ(Status::OK(), db->getArtists(artists, fullDelta));
+
+    int marked = 0;
+
+    auto verify = [&]() {
+        ResultSet<Song> expectedSongs, expectedTop;
+        EXPECT_EQ(Status::OK(), db->getSongs(expectedSongs, full));
+        EXPECT_EQ(Status::OK(), db->getSongs(expectedTop, top));
+
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, fullDelta));
+        EXPECT_EQ(Status::OK(), db->getSongs(topSongs, topDelta));
+
+        for (auto pair : { make_pair(&expectedSongs, &songs), make_pair(&expectedTop, &topSongs) }) {
+            ASSERT_EQ(pair.first->size(), pair.second->size());
+            for (auto e = pair.first->begin(), a = pair.second->begin(); e != pair.first->end(); e++, a++) {
+                EXPECT_EQ(e->id, a->id);
+                if (a->id != marked) {
+                    EXPECT_EQ(e->name, a->name);
+                }
+                EXPECT_EQ(e->count, a->count);
+                EXPECT_EQ(e->votes, a->votes);
+                EXPECT_EQ(e->last_played, a->last_played);
+            }
+        }
+
+        ResultSet<Artist> expectedArtists;
+        EXPECT_EQ(Status::OK(), db->getArtists(expectedArtists, full));
+        EXPECT_EQ(Status::OK(), db->getArtists(artists, fullDelta));
+        ASSERT_EQ(expectedArtists.size(), artists.size());
+        for (auto e = expectedArtists.begin(), a = artists.begin(); e != expectedArtists.end(); e++, a++) {
+            EXPECT_EQ(e->id, a->id);
+            EXPECT_EQ(e->count, a->count);
+            EXPECT_EQ(e->votes, a->votes);
+        }
+    };
+
+    // Rows that did not change are left alone, so a row edited
+    // behind the store's back stays edited.
+    ResultSetMutator::getVector(songs).back().name = "marked";
+    marked = ResultSetMutator::getVector(songs).back().id;
+
+    auto isMarked = [&]() {
+        for (auto& s : songs) {
+            if (s.id == marked) {
+                return s.name == "marked";
+            }
+        }
+        return false;
+    };
+
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, fullDelta));
+    EXPECT_TRUE(isMarked());
+
+    // Votes, including ones that reorder the top rows.
+    for (int i = 0; i < 5; i++) {
+        Song song = data.songs[(i * 3) % NUM_SONGS];
+        if (song.id == marked) {
+            continue;
+        }
+
+        EXPECT_EQ(Status::OK(), db->voteSong("delta" + to_string(i), song, i % 2 ? 1 : -1));
+        Artist artist = data.artists[i % NUM_ARTISTS];
+        EXPECT_EQ(Status::OK(), db->voteArtist("delta" + to_string(i), artist, 1));
+        verify();
+    }
+
+    EXPECT_TRUE(isMarked());
+
+    // Buffering hides songs, and finishing them shows them again
+    // with their last play.
+    Song queued = data.songs[0].id == marked ? data.songs[1] : data.songs[0];
+    EXPECT_EQ(Status::OK(), db->queueSong(queued.id));
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    verify();
+    EXPECT_EQ(Status::OK(), db->songFinished());
+    verify();
+
+    // New songs appear.
+    Song added;
+    added.name   = "Delta";
+    added.artist = data.artists[0];
+    added.genre  = data.genres[0];
+    EXPECT_EQ(Status::OK(), db->addSong(added));
+    verify();
+    EXPECT_TRUE(isMarked());
+
+    // Once the log no longer reaches back far enough, the whole
+    // set is read again.
+    for (int i = 0; i < 2 * options.change_log_size; i++) {
+        EXPECT_EQ(Status::OK(), db->voteArtist("log" + to_string(i), data.artists[i % NUM_ARTISTS], 1));
+    }
+
+    verify();
+    EXPECT_FALSE(isMarked());
+}
+
+TEST(Sqlite3DatabaseTests, ScoredSorts) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_full(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES, 1));
+
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+
+    int64_t room_id = 0;
+    ASSERT_EQ(Status::OK(), db->createSession(room_id));
+
+    WriteOptions room;
+    room.session_id = room_id;
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("scored" + to_string(i), data.songs[4], 1, room));
+    }
+    EXPECT_EQ(Status::OK(), db->voteSong("scored", data.songs[7], 1, room));
+    EXPECT_EQ(Status::OK(), db->voteArtist("scored", data.artists[2], 1, room));
+
+    ReadOptions options;
+    options.session_id = room_id;
+    options.inactivity_threshold = 0;
+
+    for (auto sort : { SortType::Decayed, SortType::Trending }) {
+        options.sort = sort;
+
+        ResultSet<Song> songs;
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, options));
+        ASSERT_EQ(NUM_SONGS, songs.size());
+
+        auto it = songs.begin();
+        EXPECT_EQ(data.songs[4].id, it->id);
+        EXPECT_GT(it->score, 2.9);
+        it++;
+        EXPECT_EQ(data.songs[7].id, it->id);
+        EXPECT_GT(it->score, 0.9);
+
+        ResultSet<Artist> artists;
+        EXPECT_EQ(Status::OK(), db->getArtists(artists, options));
+        ASSERT_FALSE(artists.empty());
+        EXPECT_EQ(data.artists[2].id, artists.begin()->id);
+    }
+
+    // Only open sessions keep scores.
+    options.session_id = -1;
+    ResultSet<Song> songs;
+    EXPECT_NE(Status::OK(), db->getSongs(songs, options));
+
+    options.session_id = room_id;
+    options.inactivity_threshold = 1000;
+    EXPECT_NE(Status::OK(), db->getSongs(songs, options));
+}
+
+TEST(Sqlite3DatabaseTests, CompositeSort) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_full(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES, 1));
+
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(Status::OK(), db->voteArtist("composite" + to_string(i), data.artists[i % NUM_ARTISTS], 1));
+        EXPECT_EQ(Status::OK(), db->voteGenre("composite" + to_string(i), data.genres[(i + 1) % NUM_GENRES], -1));
+    }
+
+    ReadOptions options;
+    options.inactivity_threshold = 0;
+    options.artist_weight = 2;
+    options.genre_weight  = 0.5;
+
+    // The same ranking, joined from separate reads.
+    ReadOptions votes = options;
+    votes.sort = SortType::Votes;
+    votes.filter_buffered = false;
+
+    ResultSet<Song>   songs;
+    ResultSet<Artist> artists;
+    ResultSet<Genre>  genres;
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, votes));
+    ASSERT_EQ(Status::OK(), db->getArtists(artists, votes));
+    ASSERT_EQ(Status::OK(), db->getGenres(genres, votes));
+
+    map<int, int> artistVotes, genreVotes;
+    for (auto& a : artists) {
+        artistVotes[a.id] = a.votes;
+    }
+    for (auto& g : genres) {
+        genreVotes[g.id] = g.votes;
+    }
+
+    vector<pair<double, int>> expected;
+    for (auto& s : songs) {
+        double score = s.votes + 2 * artistVotes[s.artist.id] + 0.5 * genreVotes[s.genre.id];
+        expected.push_back(make_pair(-score, s.id));
+    }
+    sort(expected.begin(), expected.end());
+
+    options.sort = SortType::Composite;
+    options.filter_buffered = false;
+
+    for (int limit : { 0, 3 }) {
+        options.result_limit = limit;
+
+        ResultSet<Song> composite;
+        ASSERT_EQ(Status::OK(), db->getSongs(composite, options));
+        ASSERT_EQ(limit ? limit : NUM_SONGS, composite.size());
+
+        auto e = expected.begin();
+        for (auto& s : composite) {
+            EXPECT_EQ(e->second, s.id);
+            EXPECT_DOUBLE_EQ(-e->first, s.score);
+            EXPECT_FALSE(s.name.empty());
+            e++;
+        }
+    }
+
+    // Artists are ranked by their own votes.
+    ResultSet<Artist> compositeArtists;
+    ASSERT_EQ(Status::OK(), db->getArtists(compositeArtists, options));
+    EXPECT_EQ(artists.begin()->votes, compositeArtists.begin()->votes);
+}
+
+TEST(Sqlite3DatabaseTests, Autofill) {
+    Options options = Options::TestOptions();
+    options.autofill = true;
+    options.autofill_artist_gap = 1;
+
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES));
+
+    int64_t session_id = 0;
+    ASSERT_EQ(Status::OK(), StoreMutator::getStore(raw)->getSession(session_id));
+
+    // Songs 0 and 5 share an artist.
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("autofill" + to_string(i), data.songs[0], 1));
+    }
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("autofill" + to_string(i), data.songs[5], 1));
+    }
+    EXPECT_EQ(Status::OK(), db->voteSong("autofill", data.songs[3], 1));
+    EXPECT_EQ(Status::OK(), db->markUnplayable(data.songs[3].id));
+
+    auto buffered = [](shared_ptr<DB> db) {
+        ResultSet<Song> buffer;
+        EXPECT_EQ(Status::OK(), db->getBuffer(buffer));
+
+        vector<int> ids;
+        for (auto& s : buffer) {
+            ids.push_back(s.id);
+        }
+        return ids;
+    };
+
+    // The best ranked song, and then the best whose artist did not
+    // just play, skipping the unplayable one.
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[0].id, data.songs[1].id }), buffered(db));
+
+    // The queue still comes first.
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[9].id));
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(Status::OK(), db->songFinished());
+    EXPECT_EQ(Status::OK(), db->songFinished());
+    EXPECT_EQ(vector<int>({ data.songs[9].id }), buffered(db));
+
+    // Song 0 was played, so 5 goes next.
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[9].id, data.songs[5].id }), buffered(db));
+
+    // Plays and recent artists survive a restart.
+    db.reset();
+
+    options.session_id = session_id;
+    options.recreate = false;
+
+    raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    db.reset(raw);
+
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[9].id, data.songs[5].id, data.songs[2].id }), buffered(db));
+
+    // A song taken out of the buffer is ranked again.
+    EXPECT_EQ(Status::OK(), db->removeFromBuffer(data.songs[5].id));
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[9].id, data.songs[2].id, data.songs[5].id }), buffered(db));
+
+    // With a replay interval, played songs are ranked again once it
+    // passes, whether that is before or after a restart.
+    db.reset();
+
+    options.autofill_replay_interval = 200;
+    this_thread::sleep_for(chrono::milliseconds(250));
+
+    raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    db.reset(raw);
+
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(Status::OK(), db->songFinished());
+    }
+
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[1].id }), buffered(db));
+    EXPECT_EQ(Status::OK(), db->songFinished());
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[0].id }), buffered(db));
+
+    // Songs played within the interval are left out.
+    EXPECT_EQ(Status::OK(), db->songFinished());
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[4].id }), buffered(db));
+
+    this_thread::sleep_for(chrono::milliseconds(250));
+
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(vector<int>({ data.songs[4].id, data.songs[0].id }), buffered(db));
+}
+
+TEST(Sqlite3DatabaseTests, Filters) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES));
+
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+    for (int i = 0; i < NUM_SONGS; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("filters", data.songs[i], 1));
+    }
+
+    EXPECT_EQ(Status::OK(), db->markUnplayable(data.songs[2].id));
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[4].id));
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+    EXPECT_EQ(Status::OK(), db->songFinished());
+    EXPECT_EQ(Status::OK(), db->queueSong(data.songs[6].id));
+    EXPECT_EQ(Status::OK(), db->bufferNext());
+
+    auto ids = [](shared_ptr<DB> db, ReadOptions options) {
+        ResultSet<Song> songs;
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, options));
+
+        vector<int> ids;
+        for (auto& s : songs) {
+            ids.push_back(s.id);
+        }
+        sort(ids.begin(), ids.end());
+        return ids;
+    };
+
+    auto without = [&data](vector<int> indexes) {
+        vector<int> ids;
+        for (int i = 0; i < NUM_SONGS; i++) {
+            if (find(indexes.begin(), indexes.end(), i) == indexes.end()) {
+                ids.push_back(data.songs[i].id);
+            }
+        }
+        return ids;
+    };
+
+    // Unplayable and buffered songs are filtered by default, from
+    // both the database and the tallies.
+    ReadOptions sql;
+    ReadOptions tallied;
+    tallied.inactivity_threshold = 0;
+    ReadOptions composite = tallied;
+    composite.sort = SortType::Composite;
+
+    for (auto options : { sql, tallied, composite }) {
+        EXPECT_EQ(without({ 2, 6 }), ids(db, options));
+
+        options.filter_played = true;
+        EXPECT_EQ(without({ 2, 4, 6 }), ids(db, options));
+
+        options.filter_unplayable = false;
+        options.filter_buffered   = false;
+        EXPECT_EQ(without({ 4 }), ids(db, options));
+    }
+
+    // A top K read still returns K songs when one of them is filtered.
+    for (int i : { 2, 3, 5, 7 }) {
+        EXPECT_EQ(Status::OK(), db->voteSong("filters-top", data.songs[i], 1));
+    }
+    EXPECT_EQ(Status::OK(), db->voteSong("filters-unplayable", data.songs[2], 1));
+
+    for (auto options : { sql, tallied }) {
+        options.sort = SortType::Votes;
+        options.result_limit = 3;
+        EXPECT_EQ(vector<int>({ data.songs[3].id, data.songs[5].id, data.songs[7].id }), ids(db, options));
+    }
+}
+
+TEST(Sqlite3DatabaseTests, Predicates) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES));
+
+    // Song i has i votes.
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+    for (int i = 0; i < NUM_SONGS; i++) {
+        for (int j = 0; j < i; j++) {
+            EXPECT_EQ(Status::OK(), db->voteSong("predicates" + to_string(j), data.songs[i], 1));
+        }
+    }
+
+    auto ids = [](shared_ptr<DB> db, ReadOptions options) {
+        ResultSet<Song> songs;
+        EXPECT_EQ(Status::OK(), db->getSongs(songs, options));
+
+        vector<int> ids;
+        for (auto& s : songs) {
+            ids.push_back(s.id);
+        }
+        return ids;
+    };
+
+    ReadOptions sql;
+    sql.sort = SortType::Votes;
+    ReadOptions tallied = sql;
+    tallied.inactivity_threshold = 0;
+    ReadOptions composite = tallied;
+    composite.sort = SortType::Composite;
+
+    for (auto options : { sql, tallied, composite }) {
+        // Songs 0 and 6 are in genre 0, and 1 and 6 by artist 1.
+        options.genre_ids = { data.genres[0].id };
+        EXPECT_EQ(vector<int>({ data.songs[6].id, data.songs[0].id }), ids(db, options));
+
+        options.artist_ids = { data.artists[1].id };
+        EXPECT_EQ(vector<int>({ data.songs[6].id }), ids(db, options));
+
+        options.artist_ids.clear();
+        options.genre_ids = { data.genres[0].id, data.genres[1].id };
+        options.result_limit = 2;
+        EXPECT_EQ(vector<int>({ data.songs[7].id, data.songs[6].id }), ids(db, options));
+
+        options.genre_ids.clear();
+        options.result_limit = 0;
+        options.min_votes = 7;
+        EXPECT_EQ(vector<int>({ data.songs[9].id, data.songs[8].id, data.songs[7].id }), ids(db, options));
+
+        options.min_votes = INT_MIN;
+        options.min_count = 9;
+        EXPECT_EQ(vector<int>({ data.songs[9].id }), ids(db, options));
+
+        options.min_count = 0;
+        options.name_prefix = "s3";
+        EXPECT_EQ(vector<int>({ data.songs[3].id }), ids(db, options));
+    }
+
+    // Artist reads are limited by their own ids and names.
+    for (auto options : { sql, tallied }) {
+        options.artist_ids = { data.artists[2].id, data.artists[4].id };
+        options.genre_ids  = { data.genres[0].id };
+
+        ResultSet<Artist> artists;
+        EXPECT_EQ(Status::OK(), db->getArtists(artists, options));
+        EXPECT_EQ(2, artists.size());
+
+        options.name_prefix = "a4";
+        EXPECT_EQ(Status::OK(), db->getArtists(artists, options));
+        ASSERT_EQ(1, artists.size());
+        EXPECT_EQ(data.artists[4].id, artists.begin()->id);
+    }
+}
+
+TEST(Sqlite3DatabaseTests, Fields) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_full(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES, 1));
+
+    ReadOptions sql;
+    sql.sort = SortType::Votes;
+    ReadOptions tallied = sql;
+    tallied.inactivity_threshold = 0;
+    ReadOptions composite = tallied;
+    composite.sort = SortType::Composite;
+
+    for (auto options : { sql, tallied, composite }) {
+        ResultSet<Song> full;
+        ASSERT_EQ(Status::OK(), db->getSongs(full, options));
+
+        // The same rows, with only the fields asked for.
+        options.fields = FieldCounts | FieldArtist;
+
+        ResultSet<Song> trimmed;
+        ASSERT_EQ(Status::OK(), db->getSongs(trimmed, options));
+        ASSERT_EQ(full.size(), trimmed.size());
+
+        auto f = full.begin();
+        for (auto& s : trimmed) {
+            EXPECT_EQ(f->id, s.id);
+            EXPECT_EQ(f->votes, s.votes);
+            EXPECT_EQ(f->artist.id, s.artist.id);
+            EXPECT_EQ(f->artist.name, s.artist.name);
+            EXPECT_TRUE(s.name.empty());
+            EXPECT_EQ(0, s.genre.id);
+            EXPECT_TRUE(s.genre.name.empty());
+            f++;
+        }
+    }
+
+    // Unsorted reads of ids alone skip the votes entirely.
+    ReadOptions ids;
+    ids.sort   = SortType::None;
+    ids.fields = FieldIds;
+
+    ResultSet<Song> songs;
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, ids));
+    EXPECT_EQ(NUM_SONGS, songs.size());
+    for (auto& s : songs) {
+        EXPECT_GT(s.id, 0);
+        EXPECT_EQ(0, s.votes);
+        EXPECT_TRUE(s.name.empty());
+    }
+
+    ResultSet<Artist> artists;
+    ASSERT_EQ(Status::OK(), db->getArtists(artists, ids));
+    EXPECT_EQ(NUM_ARTISTS, artists.size());
+    EXPECT_TRUE(artists.begin()->name.empty());
+}
+
+TEST(Sqlite3DatabaseTests, Search) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    shared_ptr<DB> db(raw);
+    ASSERT_EQ(Status::OK(), populate_empty(raw, NUM_SONGS, NUM_ARTISTS, NUM_GENRES));
+
+    PopulatorData data = get_populator_data(NUM_SONGS, NUM_ARTISTS, NUM_GENRES);
+
+    Song song;
+    song.name   = "The Quick Brown Fox";
+    song.artist = data.artists[0];
+    song.genre  = data.genres[0];
+    ASSERT_EQ(Status::OK(), db->addSong(song));
+
+    auto ids = [](shared_ptr<DB> db, string query, ReadOptions options) {
+        ResultSet<Song> songs;
+        EXPECT_EQ(Status::OK(), db->searchSongs(query, songs, options));
+
+        vector<int> ids;
+        for (auto& s : songs) {
+            ids.push_back(s.id);
+        }
+        return ids;
+    };
+
+    ReadOptions options;
+    options.sort = SortType::Votes;
+
+    EXPECT_EQ(vector<int>({ song.id }), ids(db, "brown f", options));
+    EXPECT_EQ(vector<int>({ data.songs[3].id }), ids(db, "S3", options));
+    EXPECT_TRUE(ids(db, "own", options).empty());
+
+    // Songs by a matching artist match too, ranked by their votes.
+    EXPECT_EQ(vector<int>({ data.songs[1].id, data.songs[6].id }), ids(db, "a1", options));
+
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(Status::OK(), db->voteSong("search" + to_string(i), data.songs[6], 1));
+    }
+    EXPECT_EQ(vector<int>({ data.songs[6].id, data.songs[1].id }), ids(db, "a1", options));
+
+    options.result_limit = 1;
+    EXPECT_EQ(vector<int>({ data.songs[6].id }), ids(db, "a1", options));
+
+    // Rows come back with their names and tallies.
+    ResultSet<Song> songs;
+    ASSERT_EQ(Status::OK(), db->searchSongs("a1", songs, options));
+    EXPECT_EQ(data.songs[6].name, songs.begin()->name);
+    EXPECT_EQ(data.artists[1].name, songs.begin()->artist.name);
+    EXPECT_EQ(3, songs.begin()->votes);
+
+    // Unplayable songs are filtered, as they are from reads.
+    options.result_limit = 0;
+    EXPECT_EQ(Status::OK(), db->markUnplayable(data.songs[6].id));
+    EXPECT_EQ(vector<int>({ data.songs[1].id }), ids(db, "a1", options));
+
+    // Broad searches walk the ranking instead, and agree with it.
+    EXPECT_EQ(Status::OK(), db->voteSong("search0", data.songs[0], -1));
+    options.result_limit = 2;
+    EXPECT_EQ(vector<int>({ data.songs[1].id, data.songs[2].id }), ids(db, "s", options));
+    options.result_limit = 0;
+
+    ResultSet<Artist> artists;
+    ASSERT_EQ(Status::OK(), db->searchArtists("a", artists, options));
+    EXPECT_EQ(NUM_ARTISTS, artists.size());
+
+    ASSERT_EQ(Status::OK(), db->searchArtists("a4", artists, options));
+    ASSERT_EQ(1, artists.size());
+    EXPECT_EQ(data.artists[4].id, artists.begin()->id);
+    EXPECT_EQ(data.artists[4].name, artists.begin()->name);
+
+    // Found names are the interned ones that reads share.
+    ResultSet<Artist> all;
+    ASSERT_EQ(Status::OK(), db->getArtists(all));
+    for (auto& a : all) {
+        if (a.id == data.artists[4].id) {
+            EXPECT_TRUE(a.name.shares(artists.begin()->name));
+        }
+    }
+}
+
+TEST(Sqlite3DatabaseTests, Migration) {
+    // A database as written before users had keys.
+    remove("migrate.db");
+
+    sqlite3* sqlite = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open("migrate.db", &sqlite));
+
+    const vector<string> queries = {
+        "CREATE TABLE Artists (ArtistID INTEGER PRIMARY KEY AUTOINCREMENT, Name VARCHAR(255) NOT NULL)",
+        "CREATE TABLE Genres (GenreID INTEGER PRIMARY KEY AUTOINCREMENT, Name VARCHAR(255) NOT NULL)",
+        "CREATE TABLE Songs (SongID INTEGER PRIMARY KEY AUTOINCREMENT, ArtistID INT, GenreID INT, Name VARCHAR(255) NOT NULL)",
+        "CREATE TABLE SessionHistory (SessionID INTEGER PRIMARY KEY AUTOINCREMENT, Date DATETIME NOT NULL)",
+        "CREATE TABLE UserActivity (UserID VARCHAR(255) NOT NULL, SessionID INT NOT NULL, LastActive DATETIME NOT NULL, PRIMARY KEY(UserID, SessionID))",
+        "CREATE TABLE ArtistVotes (ArtistID INT NOT NULL, SessionID INT NOT NULL, UserID VARCHAR(255) NOT NULL, Vote INT NOT NULL DEFAULT 0, PRIMARY KEY(ArtistID, SessionID, UserID))",
+        "CREATE TABLE GenreVotes (GenreID INT NOT NULL, SessionID INT NOT NULL, UserID VARCHAR(255) NOT NULL, Vote INT NOT NULL DEFAULT 0, PRIMARY KEY(GenreID, SessionID, UserID))",
+        "CREATE TABLE SongVotes (SongID INT NOT NULL, SessionID INT NOT NULL, UserID VARCHAR(255) NOT NULL, Vote INT NOT NULL DEFAULT 0, PRIMARY KEY(SongID, SessionID, UserID))",
+        "CREATE TABLE Normalized (Normalized VARCHAR(255) NOT NULL, SongID INT, ArtistID INT, GenreID INT, PRIMARY KEY(Normalized))",
+
+        "INSERT INTO Artists (Name) VALUES ('artist')",
+        "INSERT INTO Genres (Name) VALUES ('genre')",
+        "INSERT INTO Songs (ArtistID, GenreID, Name) VALUES (1, 1, 'song')",
+        "INSERT INTO SessionHistory (Date) VALUES (1)",
+        "INSERT INTO UserActivity VALUES ('device-a', 1, 1), ('device-b', 1, 1)",
+        "INSERT INTO SongVotes VALUES (1, 1, 'device-a', 1), (1, 1, 'device-b', 1)",
+        "INSERT INTO ArtistVotes VALUES (1, 1, 'device-b', -1)",
+        "INSERT INTO Normalized VALUES ('Sartistsong', 1, 1, 1), ('Aartist', 0, 1, 0)",
+        "PRAGMA user_version = 1"
+    };
+
+    for (auto& query : queries) {
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(sqlite, query.c_str(), 0, 0, 0)) << query;
+    }
+    sqlite3_close(sqlite);
+
+    Options options;
+    options.session_id = 1;
+
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "migrate.db", options));
+    shared_ptr<DB> db(raw);
+
+    ReadOptions read;
+    read.sort = SortType::Votes;
+    read.inactivity_threshold = 0;
+
+    ResultSet<Song> songs;
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, read));
+    ASSERT_EQ(1, songs.size());
+    EXPECT_EQ(2, songs.begin()->count);
+    EXPECT_EQ(2, songs.begin()->votes);
+
+    ResultSet<Artist> artists;
+    ASSERT_EQ(Status::OK(), db->getArtists(artists, read));
+    EXPECT_EQ(-1, artists.begin()->votes);
+
+    // Normalized keys are found by their hash.
+    Store* store = StoreMutator::getStore(raw);
+
+    Song song;
+    ASSERT_EQ(Status::OK(), store->getNormalized(song, fnv1a("Sartistsong"), "Sartistsong"));
+    EXPECT_EQ(1, song.id);
+    EXPECT_EQ(1, song.genre.id);
+
+    // A migrated user's votes replace their old ones.
+    EXPECT_EQ(Status::OK(), db->voteSong("device-a", song, -1));
+    EXPECT_EQ(Status::OK(), db->voteSong("device-c", song, 1));
+
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, read));
+    EXPECT_EQ(3, songs.begin()->count);
+    EXPECT_EQ(1, songs.begin()->votes);
+
+    // The recreated tables keep the constraints of a fresh schema.
+    ASSERT_EQ(SQLITE_OK, sqlite3_open("migrate.db", &sqlite));
+    for (string table : { "UserActivity", "ArtistVotes", "GenreVotes", "SongVotes", "Normalized" }) {
+        string query = "SELECT COUNT(*) FROM pragma_foreign_key_list('" + table + "')";
+        sqlite3_stmt* statement = 0;
+        ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(sqlite, query.c_str(), -1, &statement, 0));
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(statement));
+        EXPECT_LT(0, sqlite3_column_int(statement, 0)) << table;
+        sqlite3_finalize(statement);
+    }
+    sqlite3_close(sqlite);
+}
+
+TEST(Sqlite3DatabaseTests, InternedNames) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 100, 10, 5));
+    shared_ptr<DB> db(raw);
+
+    ResultSet<Song> first;
+    ResultSet<Song> second;
+    ASSERT_EQ(Status::OK(), db->getSongs(first));
+    ASSERT_EQ(Status::OK(), db->getSongs(second));
+    ASSERT_EQ(100, first.size());
+    ASSERT_EQ(100, second.size());
+
+    // Songs of the same artist or genre share its name, within a
+    // result set and across them.
+    map<int, Name> artists;
+    map<int, Name> genres;
+    for (auto& s : first) {
+        ASSERT_FALSE(s.artist.name.empty());
+        ASSERT_FALSE(s.genre.name.empty());
+
+        auto a = artists.insert(make_pair(s.artist.id, s.artist.name)).first;
+        auto g = genres.insert(make_pair(s.genre.id, s.genre.name)).first;
+        EXPECT_TRUE(a->second.shares(s.artist.name));
+        EXPECT_TRUE(g->second.shares(s.genre.name));
+    }
+
+    for (auto& s : second) {
+        EXPECT_TRUE(artists[s.artist.id].shares(s.artist.name));
+        EXPECT_TRUE(genres[s.genre.id].shares(s.genre.name));
+    }
+
+    ResultSet<Artist> read;
+    ASSERT_EQ(Status::OK(), db->getArtists(read));
+    for (auto& a : read) {
+        EXPECT_TRUE(artists[a.id].shares(a.name));
+        EXPECT_EQ("a" + to_string(a.id - 1), a.name);
+    }
+}
+
+TEST(Sqlite3DatabaseTests, ColumnarReads) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 100, 10, 5));
+    shared_ptr<DB> db(raw);
+
+    Song song;
+    song.id = 7;
+    ASSERT_EQ(Status::OK(), db->voteSong("a", song, 1));
+    ASSERT_EQ(Status::OK(), db->voteSong("b", song, 1));
+    song.id = 9;
+    ASSERT_EQ(Status::OK(), db->voteSong("a", song, -1));
+
+    ReadOptions options;
+    options.sort = SortType::Votes;
+
+    // Columns hold the same rows, in the same order.
+    ResultSet<Song> rows;
+    ColumnarResultSet<Song> columns;
+    ASSERT_EQ(Status::OK(), db->getSongs(rows, options));
+    ASSERT_EQ(Status::OK(), db->getSongs(columns, options));
+    ASSERT_EQ((size_t) rows.size(), columns.size());
+
+    size_t i = 0;
+    for (auto& s : rows) {
+        EXPECT_EQ(s.id, columns.ids()[i]);
+        EXPECT_EQ(s.votes, columns.votes()[i]);
+        EXPECT_EQ(s.count, columns.counts()[i]);
+        EXPECT_EQ(s.artist.id, columns.artistIds()[i]);
+        EXPECT_EQ(s.name, columns.name(i));
+        i++;
+    }
+
+    EXPECT_EQ(7, columns.ids()[0]);
+    EXPECT_EQ(1, ColumnarResultSet<Song>::sum(columns.votes()));
+    EXPECT_EQ(3, ColumnarResultSet<Song>::sum(columns.counts()));
+
+    // Reading into the set again replaces its columns.
+    options.result_limit = 5;
+    ASSERT_EQ(Status::OK(), db->getSongs(columns, options));
+    ASSERT_EQ(5u, columns.size());
+    EXPECT_EQ(7, columns.ids()[0]);
+    EXPECT_EQ(6u, columns.nameOffsets().size());
+
+    ColumnarResultSet<Artist> artists;
+    ASSERT_EQ(Status::OK(), db->getArtists(artists, ReadOptions()));
+    EXPECT_EQ(10u, artists.size());
+    EXPECT_TRUE(artists.artistIds().empty());
+
+    ColumnarResultSet<Genre> genres;
+    ASSERT_EQ(Status::OK(), db->getGenres(genres, ReadOptions()));
+    EXPECT_EQ(5u, genres.size());
+    EXPECT_EQ("g0", genres.name(0));
+}
+
+TEST(Sqlite3DatabaseTests, AsyncCalls) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 100, 10, 5));
+    shared_ptr<DB> db(raw);
+
+    // Writes land in the order they were made.
+    vector<Song> songs(100);
+    vector<future<Status>> votes;
+    for (int i = 0; i < 100; i++) {
+        songs[i].id = i + 1;
+        votes.push_back(db->voteSongAsync("user", songs[i], 1, WriteOptions()));
+    }
+
+    for (int i = 1; i <= 10; i++) {
+        votes.push_back(db->queueSongAsync(i, WriteOptions()));
+    }
+    for (auto& v : votes) {
+        EXPECT_EQ(Status::OK(), v.get());
+    }
+
+    ResultSet<Song> queue;
+    ASSERT_EQ(Status::OK(), db->getQueueAsync(queue, ReadOptions()).get());
+    ASSERT_EQ(10, queue.size());
+
+    int id = 1;
+    for (auto& s : queue) {
+        EXPECT_EQ(id++, s.id);
+    }
+
+    // Reads run in parallel, calling back once done.
+    mutex lock;
+    condition_variable done;
+    int remaining = 8;
+
+    vector<ResultSet<Song>> sets(remaining);
+    for (auto& set : sets) {
+        db->getSongsAsync(set, ReadOptions(), [&](Status s) {
+            EXPECT_EQ(Status::OK(), s);
+
+            lock_guard<mutex> guard(lock);
+            remaining--;
+            done.notify_one();
+        });
+    }
+
+    {
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [&]() { return remaining == 0; });
+    }
+
+    for (auto& set : sets) {
+        ASSERT_EQ(100, set.size());
+        for (auto& s : set) {
+            EXPECT_EQ(1, s.votes);
+        }
+    }
+
+    // Calls made before the DB is destroyed still finish.
+    Song last;
+    last.id = 1;
+    future<Status> vote = db->voteSongAsync("other", last, 1, WriteOptions());
+    db.reset();
+    EXPECT_EQ(Status::OK(), vote.get());
+}
+
+TEST(Sqlite3DatabaseTests, BatchedWrites) {
+    Options options = Options::TestOptions();
+    options.batch_writes     = true;
+    options.write_batch_size = 16;
+
+    Options partitioned = options;
+    partitioned.partition_sessions = true;
+
+    DB* raw = 0;
+    EXPECT_TRUE(open(raw, "test.db", partitioned).error());
+
+    Options restore;
+    restore.batch_writes = true;
+
+    {
+        raw = 0;
+        ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+        ASSERT_EQ(Status::OK(), populate_empty(raw, 100, 10, 5));
+        shared_ptr<DB> db(raw);
+
+        // Every thread votes every song up once.
+        vector<thread> threads;
+        for (int t = 0; t < 8; t++) {
+            threads.emplace_back([&db, t]() {
+                string user = "user" + to_string(t);
+                for (int i = 1; i <= 100; i++) {
+                    Song song;
+                    song.id = i;
+                    EXPECT_EQ(Status::OK(), db->voteSong(user, song, 1));
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        // Fire and forget, then wait on a later write; writes apply
+        // in order.
+        Song song;
+        song.id = 1;
+        db->voteSongAsync("user0", song, -1, WriteOptions(), DB::Completion());
+        EXPECT_EQ(Status::OK(), db->queueSongAsync(2, WriteOptions()).get());
+
+        ResultSet<Song> songs;
+        ReadOptions readOptions;
+        readOptions.inactivity_threshold = 0;
+        ASSERT_EQ(Status::OK(), db->getSongs(songs, readOptions));
+        ASSERT_EQ(100, songs.size());
+        for (auto& s : songs) {
+            EXPECT_EQ(8, s.count);
+            EXPECT_EQ(s.id == 1 ? 6 : 8, s.votes);
+        }
+
+        int64_t session_id = 0;
+        StoreMutator::getStore(raw)->getSession(session_id);
+        restore.session_id = session_id;
+    }
+
+    // Every batch was committed.
+    raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", restore));
+    shared_ptr<DB> db(raw);
+
+    ResultSet<Song> songs;
+    ReadOptions readOptions;
+    readOptions.sort = SortType::Votes;
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, readOptions));
+    ASSERT_EQ(100, songs.size());
+    for (auto& s : songs) {
+        EXPECT_EQ(s.id == 1 ? 6 : 8, s.votes);
+    }
+
+    ResultSet<Song> queue;
+    ASSERT_EQ(Status::OK(), db->getQueue(queue));
+    ASSERT_EQ(1, queue.size());
+    EXPECT_EQ(2, queue.begin()->id);
+}
+
+TEST(Sqlite3DatabaseTests, FailedBatch) {
+    Options options = Options::TestOptions();
+    options.batch_writes = true;
+
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", options));
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 10, 3, 3));
+    shared_ptr<DB> db(raw);
+
+    Song song;
+    song.id = 1;
+    ASSERT_EQ(Status::OK(), db->voteSong("a", song, 1));
+
+    // Another connection's read keeps the next batch from committing.
+    sqlite3* reader = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open("test.db", &reader));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(reader, "BEGIN; SELECT COUNT(*) FROM Songs", 0, 0, 0));
+
+    EXPECT_TRUE(db->voteSong("b", song, 1).error());
+
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(reader, "COMMIT", 0, 0, 0));
+    sqlite3_close(reader);
+
+    // The vote was rolled back on disk, but not in memory, so the
+    // store refuses every later read and write.
+    ResultSet<Song> songs;
+    EXPECT_TRUE(db->voteSong("c", song, 1).error());
+    EXPECT_TRUE(db->getSongs(songs).error());
+    EXPECT_TRUE(db->getQueue(songs).error());
+
+    // The batch's transaction is closed, so the file is not held.
+    sqlite3* writer = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open("test.db", &writer));
+    EXPECT_EQ(SQLITE_OK, sqlite3_exec(writer, "INSERT INTO Genres (Name) VALUES ('after')", 0, 0, 0));
+    sqlite3_close(writer);
+}
+
+TEST(Sqlite3DatabaseTests, Deadlines) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+    ASSERT_EQ(Status::OK(), populate_empty(raw, 10, 5, 5));
+    shared_ptr<DB> db(raw);
+
+    Song song;
+    song.id = 1;
+
+    // Reads and writes whose deadline has passed are never started.
+    WriteOptions late;
+    late.deadline = 1;
+    EXPECT_TRUE(db->voteSong("a", song, 1, late).deadlineExceeded());
+    EXPECT_TRUE(db->queueSongAsync(1, late).get().deadlineExceeded());
+
+    ReadOptions readLate;
+    readLate.deadline = 1;
+
+    ResultSet<Song> songs;
+    EXPECT_TRUE(db->getSongs(songs, readLate).deadlineExceeded());
+    EXPECT_TRUE(db->getSongsAsync(songs, readLate).get().deadlineExceeded());
+    EXPECT_EQ(0, songs.size());
+
+    // Nor are cancelled ones.
+    ReadOptions cancelled;
+    cancelled.cancel = CancelToken::Create();
+    cancelled.cancel.cancel();
+    EXPECT_TRUE(db->getQueue(songs, cancelled).cancelled());
+
+    Stats stats;
+    ASSERT_EQ(Status::OK(), db->getStats(stats));
+    EXPECT_EQ(4u, stats.deadlines_exceeded);
+    EXPECT_EQ(1u, stats.cancelled);
+
+    // Reads and writes within their deadline are unaffected.
+    WriteOptions early;
+    early.deadline = timestamp() + 60000;
+    early.cancel   = CancelToken::Create();
+    EXPECT_EQ(Status::OK(), db->voteSong("a", song, 1, early));
+
+    ReadOptions readEarly;
+    readEarly.deadline = timestamp() + 60000;
+    ASSERT_EQ(Status::OK(), db->getSongs(songs, readEarly));
+    ASSERT_EQ(10, songs.size());
+    EXPECT_EQ(1, songs.begin()->votes);
+
+    ASSERT_EQ(Status::OK(), db->getStats(stats));
+    EXPECT_EQ(4u, stats.deadlines_exceeded);
+    EXPECT_EQ(1u, stats.cancelled);
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+
+#include "sqlite3/sqlite3.h"
+#include "store/deadline.hpp"
+#include "util/time.hpp"
+
+using namespace std;
+using namespace skrillex;
+using namespace skrillex::internal;
+
+namespace {
+    // Counts forever, until interrupted.
+    int countForever(sqlite3* db) {
+        sqlite3_stmt* statement = 0;
+        sqlite3_prepare_v2(db, "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) SELECT COUNT(*) FROM c", -1, &statement, 0);
+
+        int r = sqlite3_step(statement);
+        sqlite3_finalize(statement);
+
+        return r;
+    }
+}
+
+TEST(DeadlineTests, Check) {
+    CancelToken none;
+    EXPECT_FALSE(Deadline(0, none).bounded());
+    EXPECT_TRUE(Deadline(0, none).check().ok());
+    EXPECT_TRUE(Deadline(timestamp() + 60000, none).check().ok());
+    EXPECT_TRUE(Deadline(timestamp() - 1, none).check().deadlineExceeded());
+
+    CancelToken token = CancelToken::Create();
+    CancelToken copy  = token;
+    EXPECT_TRUE(Deadline(0, token).bounded());
+    EXPECT_TRUE(Deadline(0, token).check().ok());
+
+    copy.cancel();
+    EXPECT_TRUE(token.cancelled());
+    EXPECT_TRUE(Deadline(0, token).check().cancelled());
+
+    // Cancelling a token that was never made does nothing.
+    none.cancel();
+    EXPECT_FALSE(none.cancelled());
+}
+
+TEST(DeadlineTests, Interrupt) {
+    sqlite3* db = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(":memory:", &db));
+    sqlite3_progress_handler(db, 1000, &Deadline::progress, nullptr);
+
+    CancelToken token = CancelToken::Create();
+
+    {
+        Deadline deadline(timestamp() + 20, token);
+        Deadline::Scope scope(deadline);
+
+        EXPECT_EQ(SQLITE_INTERRUPT, countForever(db));
+        EXPECT_TRUE(scope.interrupted());
+        EXPECT_TRUE(deadline.check().deadlineExceeded());
+    }
+
+    {
+        Deadline deadline(0, token);
+        Deadline::Scope scope(deadline);
+
+        token.cancel();
+        EXPECT_EQ(SQLITE_INTERRUPT, countForever(db));
+        EXPECT_TRUE(scope.interrupted());
+        EXPECT_TRUE(deadline.check().cancelled());
+    }
+
+    // Queries outside of any scope are left alone.
+    sqlite3_stmt* statement = 0;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c LIMIT 100000) SELECT COUNT(*) FROM c", -1, &statement, 0));
+    EXPECT_EQ(SQLITE_ROW, sqlite3_step(statement));
+    EXPECT_EQ(100000, sqlite3_column_int(statement, 0));
+    sqlite3_finalize(statement);
+
+    sqlite3_close(db);
+}
@@ -4,16 +4,22 @@
 
 #include "skrillex/mapper.hpp"
 #include "mapper/transforms.hpp"
+#include "util/hash.hpp"
 
 using namespace std;
 using namespace skrillex;
 using namespace skrillex::internal;
 
 TEST(MapperTests, Transforms) {
-    EXPECT_EQ("Gsupercoolg3nre", normalize(FieldType::GenreField, "SuPer-cOol    g3nre"));
-    EXPECT_EQ("Asupercoolarteest3", normalize(FieldType::ArtistField, "SuPer-cOol    arteest3"));
-    EXPECT_EQ("supercools0ng", normalize(FieldType::None, "SuPer-cOol    s0ng"));
-    EXPECT_EQ("Sk4ynegayfish", combine("gayFISH", "K4yne"));
+    EXPECT_EQ("Gsupercoolg3nre", normalize(FieldType::GenreField, "SuPer-cOol    g3nre").text);
+    EXPECT_EQ("Asupercoolarteest3", normalize(FieldType::ArtistField, "SuPer-cOol    arteest3").text);
+    EXPECT_EQ("supercools0ng", normalize(FieldType::None, "SuPer-cOol    s0ng").text);
+    EXPECT_EQ("Sk4ynegayfish", combine("gayFISH", "K4yne").text);
+
+    // Keys are hashed as they are normalized.
+    EXPECT_EQ(fnv1a("Gsupercoolg3nre"), normalize(FieldType::GenreField, "SuPer-cOol    g3nre").hash);
+    EXPECT_EQ(fnv1a("Sk4ynegayfish"), combine("gayFISH", "K4yne").hash);
+    EXPECT_EQ(combine("Gay Fish", "Kanye").hash, combine("Kanye - Gay Fish", "").hash);
 }
 
 TEST(MapperTests, Mapper) {
@@ -104,3 +110,23 @@ TEST(MapperTests, Mapper) {
     EXPECT_TRUE(mapper.lookup(song, "", "Kanye").error());
     EXPECT_TRUE(mapper.lookup(song, "Romeo", "Taylor Fish").notFound());
 }
+
+TEST(MapperTests, Async) {
+    DB* raw = 0;
+    ASSERT_EQ(Status::OK(), open(raw, "test.db", Options::TestOptions()));
+
+    shared_ptr<DB> db(raw);
+    Mapper mapper(db);
+
+    Song mapped;
+    EXPECT_EQ(Status::OK(), mapper.mapAsync(mapped, "Song", "Artist", "Genre").get());
+    EXPECT_EQ(1, mapped.id);
+
+    Song found;
+    EXPECT_EQ(Status::OK(), mapper.lookupAsync(found, "  song", "ARTIST").get());
+    EXPECT_EQ(mapped.id, found.id);
+    EXPECT_EQ("Artist", found.artist.name);
+
+    Song missing;
+    EXPECT_TRUE(mapper.lookupAsync(missing, "Other", "Artist").get().notFound());
+}
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "store/name_index.hpp"
+
+using namespace std;
+using namespace skrillex::internal;
+
+vector<int> matches(NameIndex& index, const string& query) {
+    vector<int> ids;
+    index.match(NameIndex::normalize(query), [&ids](int id) {
+        ids.push_back(id);
+    });
+
+    sort(ids.begin(), ids.end());
+    return ids;
+}
+
+TEST(NameIndexTest, Words) {
+    NameIndex index;
+    index.add(1, "The Quick Brown Fox");
+    index.add(2, "Brownian Motion");
+    index.add(3, "Fox-Trot (Live)");
+
+    EXPECT_EQ(vector<int>({ 1 }), matches(index, "the"));
+    EXPECT_EQ(vector<int>({ 1 }), matches(index, "QUICK br"));
+    EXPECT_EQ(vector<int>({ 1, 2 }), matches(index, "Brown"));
+    EXPECT_EQ(vector<int>({ 1, 3 }), matches(index, "fox"));
+    EXPECT_EQ(vector<int>({ 3 }), matches(index, "foxtrot live"));
+    EXPECT_EQ(vector<int>({ 3 }), matches(index, "live"));
+
+    // Only word starts match.
+    EXPECT_TRUE(matches(index, "rown").empty());
+    EXPECT_TRUE(matches(index, "foxes").empty());
+    EXPECT_TRUE(matches(index, "!!").empty());
+
+    EXPECT_EQ(2, index.count("brown"));
+    EXPECT_EQ(2, index.count("f"));
+    EXPECT_EQ(0, index.count("rown"));
+
+    EXPECT_TRUE(index.matches(1, "brown"));
+    EXPECT_TRUE(index.matches(3, "trotl"));
+    EXPECT_FALSE(index.matches(2, "fox"));
+    EXPECT_FALSE(index.matches(4, "fox"));
+}
+
+TEST(NameIndexTest, Appends) {
+    NameIndex index;
+    index.add(1, "b");
+    EXPECT_EQ(vector<int>({ 1 }), matches(index, "b"));
+
+    // Entries added after a lookup are merged by the next.
+    index.add(2, "a b");
+    index.add(3, "c");
+    EXPECT_EQ(vector<int>({ 1, 2 }), matches(index, "b"));
+    EXPECT_EQ(vector<int>({ 2 }), matches(index, "a"));
+    EXPECT_EQ(vector<int>({ 3 }), matches(index, "c"));
+    EXPECT_EQ(4, index.size());
+
+    index.clear();
+    EXPECT_TRUE(matches(index, "b").empty());
+}
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+
+#include "skrillex/name.hpp"
+
+using namespace std;
+using namespace skrillex;
+
+TEST(NameTests, Basic) {
+    Name empty;
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ("", empty);
+    EXPECT_EQ(Name(""), empty);
+
+    Name name = string("The Artist Formerly Known As");
+    EXPECT_EQ(28u, name.size());
+    EXPECT_EQ("The Artist Formerly Known As", name);
+    EXPECT_EQ(string("The Artist Formerly Known As"), name);
+    EXPECT_NE("The Artist", name);
+    EXPECT_EQ("The Artist Formerly Known As!", name + "!");
+
+    // Copies share their text, equal names need not.
+    Name copy = name;
+    EXPECT_TRUE(copy.shares(name));
+    EXPECT_EQ(name.c_str(), copy.c_str());
+
+    Name other("The Artist Formerly Known As");
+    EXPECT_FALSE(other.shares(name));
+    EXPECT_EQ(other, name);
+
+    const string& text = name;
+    EXPECT_EQ("The Artist Formerly Known As", text);
+
+    stringstream ss;
+    ss << name;
+    EXPECT_EQ("The Artist Formerly Known As", ss.str());
+
+    copy.clear();
+    EXPECT_TRUE(copy.empty());
+    EXPECT_FALSE(name.empty());
+}
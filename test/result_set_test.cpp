@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include "skrillex/columnar_result_set.hpp"
 #include "skrillex/result_set.hpp"
 #include "mutator.hpp"
 
@@ -31,3 +32,40 @@ TEST(ResultSetTests, Basic) {
     }
 }
 
+
+TEST(ResultSetTests, Columnar) {
+    ColumnarResultSet<Song> songs;
+    EXPECT_TRUE(songs.empty());
+    EXPECT_EQ(0u, songs.size());
+
+    std::vector<Song> rows(5);
+    for (int i = 0; i < 5; i++) {
+        rows[i].id        = i + 1;
+        rows[i].name      = std::string(i, 'a' + i);
+        rows[i].count     = i;
+        rows[i].votes     = (i % 2 ? 1 : -1) * i;
+        rows[i].artist.id = i % 2 + 1;
+    }
+
+    ResultSetMutator::assign(songs, rows);
+    ASSERT_EQ(5u, songs.size());
+    EXPECT_EQ(std::vector<int>({ 1, 2, 3, 4, 5 }), songs.ids());
+    EXPECT_EQ(std::vector<int>({ 1, 2, 1, 2, 1 }), songs.artistIds());
+    EXPECT_EQ(std::vector<uint32_t>({ 0, 0, 1, 3, 6, 10 }), songs.nameOffsets());
+    EXPECT_EQ("", songs.name(0));
+    EXPECT_EQ("ddd", songs.name(3));
+    EXPECT_EQ("eeee", songs.name(4));
+
+    // Votes are 0, 1, -2, 3, -4.
+    EXPECT_EQ(10, ColumnarResultSet<Song>::sum(songs.counts()));
+    EXPECT_EQ(-2, ColumnarResultSet<Song>::sum(songs.votes()));
+    EXPECT_EQ(std::vector<size_t>({ 3, 1 }), ColumnarResultSet<Song>::top(songs.votes(), 2));
+    EXPECT_EQ(std::vector<size_t>({ 3, 1, 0, 2, 4 }), ColumnarResultSet<Song>::top(songs.votes(), 10));
+    EXPECT_EQ(std::vector<size_t>({ 3, 1, 1 }), ColumnarResultSet<Song>::histogram(songs.votes(), -1, 2, 3));
+
+    // Reassigning replaces the columns.
+    rows.resize(1);
+    ResultSetMutator::assign(songs, rows);
+    EXPECT_EQ(1u, songs.size());
+    EXPECT_EQ(std::vector<uint32_t>({ 0, 0 }), songs.nameOffsets());
+}
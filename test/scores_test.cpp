@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include "store/scores.hpp"
+
+using namespace skrillex::internal;
+
+TEST(ScoresTest, Decayed) {
+    const int64_t start = 1500000000000;
+
+    Scores scores(1000, 16000);
+    scores.apply(EntityKind::Song, 1, 8, start);
+    scores.apply(EntityKind::Song, 2, 8, start + 2000);
+    scores.apply(EntityKind::Song, 2, -4, start + 2000);
+
+    EXPECT_DOUBLE_EQ(8, scores.decayed(EntityKind::Song, 1, start));
+    EXPECT_DOUBLE_EQ(4, scores.decayed(EntityKind::Song, 1, start + 1000));
+    EXPECT_DOUBLE_EQ(1, scores.decayed(EntityKind::Song, 1, start + 3000));
+    EXPECT_DOUBLE_EQ(2, scores.decayed(EntityKind::Song, 2, start + 3000));
+    EXPECT_DOUBLE_EQ(0, scores.decayed(EntityKind::Artist, 1, start + 3000));
+
+    // Long after the landmark, the weights are rebased.
+    const int64_t later = start + 1000 * 1000;
+    scores.apply(EntityKind::Song, 1, 1, later);
+    EXPECT_DOUBLE_EQ(1, scores.decayed(EntityKind::Song, 1, later));
+    EXPECT_DOUBLE_EQ(0.5, scores.decayed(EntityKind::Song, 1, later + 1000));
+}
+
+TEST(ScoresTest, Trending) {
+    const int64_t start = 1500000000000;
+
+    // 16 buckets of one second each.
+    Scores scores(1000, 16000);
+    scores.apply(EntityKind::Song, 1, 1, start);
+    scores.apply(EntityKind::Song, 1, 1, start + 5000);
+    scores.apply(EntityKind::Song, 1, -1, start + 5000);
+    scores.apply(EntityKind::Genre, 1, 1, start + 5000);
+
+    scores.advance(start + 5000);
+    EXPECT_EQ(2, scores.trending(EntityKind::Song, 1));
+    EXPECT_EQ(1, scores.trending(EntityKind::Genre, 1));
+    EXPECT_EQ(0, scores.trending(EntityKind::Artist, 1));
+
+    // Upvotes fall out of the window, bucket by bucket.
+    scores.advance(start + 17000);
+    EXPECT_EQ(1, scores.trending(EntityKind::Song, 1));
+
+    scores.advance(start + 60000);
+    EXPECT_EQ(0, scores.trending(EntityKind::Song, 1));
+    EXPECT_EQ(0, scores.trending(EntityKind::Genre, 1));
+}
+
+TEST(ScoresTest, TrendingNeverUnderestimates) {
+    const int64_t start = 1500000000000;
+
+    // Many more songs than counters.
+    Scores scores(1000, 16000);
+    for (int id = 1; id <= 10 * Scores::Width; id++) {
+        scores.apply(EntityKind::Song, id, id % 7, start);
+    }
+
+    scores.advance(start);
+
+    for (int id = 1; id <= 10 * Scores::Width; id++) {
+        EXPECT_GE(scores.trending(EntityKind::Song, id), id % 7);
+    }
+}
@@ -43,3 +43,27 @@ TEST(StatusTest, Error) {
     EXPECT_EQ("def", error.message());
     EXPECT_EQ("Status: Error - def", error.string());
 }
+
+TEST(StatusTest, Copies) {
+    EXPECT_EQ(sizeof(void*), sizeof(Status));
+
+    Status error = Status::Error("def");
+    Status copy = error;
+    Status moved = std::move(copy);
+
+    EXPECT_TRUE(copy.ok());
+    EXPECT_TRUE(moved.error());
+    EXPECT_EQ("def", moved.message());
+    EXPECT_EQ(error, moved);
+    EXPECT_NE(Status::OK(), moved);
+    EXPECT_NE(Status::NotFound("def"), moved);
+    EXPECT_EQ(Status::Error("def"), moved);
+
+    moved = Status::OK();
+    EXPECT_TRUE(moved.ok());
+    EXPECT_EQ(Status::OK(), moved);
+    EXPECT_EQ("def", error.message());
+
+    error = error;
+    EXPECT_EQ("def", error.message());
+}